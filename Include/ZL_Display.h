@@ -334,6 +334,18 @@ struct ZL_Display
 	//Initialize rendering on a window
 	static bool Init(const char* title, int width = 640, int height = 480, int displayflags = ZL_DISPLAY_DEFAULT);
 
+	//Store linked shader programs in a file to skip compiling them on the next launch (needs to be called before Init, only used if the driver supports program binaries)
+	static void SetShaderCacheFile(const char* CacheFilePath);
+
+	//Read back the screen after the current frame without stalling, the signal gets called once in a later frame with RGBA pixels (bottom row first)
+	static ZL_Signal_v3<const unsigned char*, int, int>& ReadPixelsAsync();
+
+	//Save the screen after the current frame has been drawn as an uncompressed TGA image file (written in the background)
+	static void SaveScreenshot(const char* OutTGAFile);
+
+	//Save every Nth frame as numbered TGA image files starting with PathPrefix (i.e. "capture/frame" for capture/frame00000.tga), NULL to stop
+	static void SetFrameCapture(const char* PathPrefix, unsigned int EveryNthFrame = 1);
+
 	//Clear the entire screen
 	static void ClearFill(ZL_Color col = ZL_Color::Black);
 
@@ -380,6 +392,9 @@ struct ZL_Display
 	static ZL_Vector ScreenToWorld(scalar x, scalar y);
 	inline static void ConvertScreenToWorld(ZL_Vector& pos) { pos = ScreenToWorld(pos.x, pos.y); }
 
+	//Get the area of the world that is visible on screen with the current matrix (bounding rectangle if rotated)
+	static ZL_Rectf GetVisibleWorldRect();
+
 	//2D geometry drawing functions
 	inline static void DrawLine(const ZL_Vector& p1, const ZL_Vector& p2, const ZL_Color &color) { DrawLine(p1.x, p1.y, p2.x, p2.y, color); }
 	static void DrawLine(scalar x1, scalar y1, scalar x2, scalar y2, const ZL_Color &color);
@@ -321,6 +321,11 @@ struct ZL_RenderList
 	ZL_Matrix GetMeshMatrix(size_t MeshIndex);
 	void SetMeshMatrix(size_t MeshIndex, const ZL_Matrix& Matrix);
 
+	//Statistics of view frustum culling and instancing summed over all color and shadow map passes that drew this list
+	unsigned int CountDrawnParts(bool reset = false); //mesh parts inside the camera or light frustum
+	unsigned int CountCulledParts(bool reset = false); //mesh parts skipped because their bounds were outside of the frustum
+	unsigned int CountInstancedParts(bool reset = false); //drawn mesh parts that were batched with others of the same mesh and material
+
 	#if defined(ZILLALOG) && !defined(ZL_VIDEO_OPENGL_ES2)
 	//Debug functionality is only available on desktop debug builds
 	void DebugDump();
@@ -329,12 +334,50 @@ struct ZL_RenderList
 	private: struct ZL_RenderList_Impl* impl;
 };
 
+//Bounding volume hierarchy over many mostly static meshes for hierarchical view frustum culling and spatial queries
+//Skinned meshes and particle emitters have no fixed bounds, they are always added to render lists and skipped by queries
+struct ZL_SceneBVH
+{
+	ZL_SceneBVH();
+	~ZL_SceneBVH();
+	ZL_SceneBVH(const ZL_SceneBVH &source);
+	ZL_SceneBVH &operator=(const ZL_SceneBVH &source);
+	operator bool () const { return (impl!=NULL); }
+	bool operator==(const ZL_SceneBVH &b) const { return (impl==b.impl); }
+	bool operator!=(const ZL_SceneBVH &b) const { return (impl!=b.impl); }
+
+	void Clear();
+	size_t Add(const ZL_Mesh& Mesh, const ZL_Matrix& Matrix); //returns the object index, the tree gets rebuilt on the next query
+	size_t GetCount() const;
+	ZL_Mesh GetMesh(size_t ObjectIndex) const;
+	ZL_Matrix GetMatrix(size_t ObjectIndex) const;
+	void SetMatrix(size_t ObjectIndex, const ZL_Matrix& Matrix); //moving objects only refits the tree bounds on the next query
+	void Rebuild(); //rebuild the tree from scratch (call after objects moved far from where they were when the tree was built or after changing their materials)
+
+	//Add all objects overlapping the view frustum to a render list, returns the number of added objects
+	size_t FillRenderList(ZL_RenderList& List, const ZL_Camera& Camera);
+	size_t FillRenderList(ZL_RenderList& List, const ZL_Matrix& ViewProjection);
+
+	//Find the closest object whose bounding box is hit by the line segment, returns false if nothing was hit
+	bool RayCast(const ZL_Vector3& RayStart, const ZL_Vector3& RayEnd, size_t* ResultObjectIndex = NULL, ZL_Vector3* ResultHitPoint = NULL);
+
+	//Count the objects whose world space bounds overlap the box and optionally collect their indices
+	size_t QueryAABB(const ZL_Vector3& Min, const ZL_Vector3& Max, std::vector<size_t>* ResultObjectIndices = NULL);
+
+	private: struct ZL_SceneBVH_Impl* impl;
+};
+
 struct ZL_Display3D
 {
 	//Initialize 3D rendering features
 	static bool Init(size_t MaxLights = 1);
 	static bool InitShadowMapping();
 
+	//Record the material variations used in this session into a manifest file and precompile the ones recorded by earlier sessions over the next frames (call after Init and InitShadowMapping)
+	static void WarmUpMaterials(const char* ManifestFilePath, ticks_t MaxTicksPerFrame = 10);
+	static bool IsWarmingUpMaterials();
+	static ZL_Signal_v2<size_t, size_t> sigMaterialWarmUpProgress; //number of precompiled variations, total number
+
 	//Draw rendering lists
 	static inline void DrawList(const ZL_RenderList& RenderList, const ZL_Camera& Camera) { const ZL_RenderList* r = &RenderList; DrawLists(&r, 1, Camera); }
 	static void DrawLists(const ZL_RenderList*const* RenderLists, size_t NumLists, const ZL_Camera& Camera);
@@ -52,6 +52,21 @@ struct ZL_TextBuffer
 	ZL_TextBuffer& SetFont(const struct ZL_Font& font, scalar multiline_x_align, const char* reset_text);
 	ZL_TextBuffer& SetFont(const struct ZL_Font& font, scalar multiline_x_align, const char* reset_text, scalar max_width, bool word_wrap_newline = false);
 
+	//Edit the text, only the lines of the modified paragraphs get laid out again (positions are byte offsets in the UTF-8 text)
+	ZL_TextBuffer& Append(const char* text);
+	ZL_TextBuffer& Insert(size_t pos, const char* text);
+	ZL_TextBuffer& Erase(size_t pos, size_t count);
+
+	//Only draw the characters in a byte range of the text (i.e. for a typewriter effect or scrolling), defaults to everything
+	ZL_TextBuffer& SetVisibleRange(size_t first = 0, size_t count = (size_t)-1);
+
+	//While batch rendering is active, drawing text buffers only collects the transformed glyphs (with their position, color and scale)
+	//Ending the batch draws everything with one draw call per font texture, so overlapping text is not drawn in order between pages
+	static void BatchRenderBegin();
+	static void BatchRenderEnd(bool DrawAndClear = true);
+	static bool BatchRenderActive();
+	static void BatchRenderDraw(); //draw collected text again (i.e. after BatchRenderEnd(false) for static labels), the text buffers stay referenced until the next BatchRenderBegin
+
 	//Set text buffer settings
 	ZL_TextBuffer& SetColor(const ZL_Color &color); //defaults to fonts color
 	ZL_TextBuffer& SetDrawOrigin(ZL_Origin::Type draw_origin); //defaults to fonts origin
@@ -119,6 +134,7 @@ struct ZL_Font
 	ZL_Font(const ZL_FileLink& BitmapFontFile);
 	ZL_Font(const ZL_FileLink& TruetypeFontFile, scalar height, bool pixel_exact = true, unsigned char outline_width = 0); //supports utf8
 	ZL_Font(const ZL_FileLink& TruetypeFontFile, scalar height, bool pixel_exact, unsigned char outline_left, unsigned char outline_right, unsigned char outline_top, unsigned char outline_bottom); //supports utf8
+	static ZL_Font LoadSDF(const ZL_FileLink& TruetypeFontFile, scalar height); //distance field true type font that stays sharp at any scale (regular glyphs on platforms without shaders)
 	~ZL_Font();
 	ZL_Font(const ZL_Font &source);
 	ZL_Font &operator=(const ZL_Font &source);
@@ -137,6 +153,10 @@ struct ZL_Font
 	ZL_Font& SetScale(scalar scalew, scalar scaleh);
 	ZL_Font& AddScale(scalar scalew, scalar scaleh);
 
+	//Shader effects of distance field fonts (ignored by other fonts), width and offset are in pixels at scale 1 and limited to a few pixels
+	ZL_Font& SetOutline(scalar width, const ZL_Color& color = ZL_Color::Black);
+	ZL_Font& SetShadow(const ZL_Vector& offset, const ZL_Color& color, scalar softness = 0);
+
 	//Get font settings
 	ZL_Color& GetColor() const;
 	scalar GetCharSpacing() const;
@@ -193,6 +213,9 @@ struct ZL_Font
 	void Draw(const ZL_Vector &p, const char *text, scalar scalew, scalar scaleh, ZL_Origin::Type draw_at_origin) const;
 	void Draw(const ZL_Vector &p, const char *text, scalar scalew, scalar scaleh, const ZL_Color &color, ZL_Origin::Type draw_at_origin) const;
 
+	//Rasterize all characters of a utf8 string into the glyph atlas ahead of drawing them, spread over the worker threads (only for true type fonts)
+	void Preload(const char* utf8_charset) const;
+
 	// Create a text buffer using this font
 	inline ZL_TextBuffer CreateBuffer(const char *text = NULL) { return ZL_TextBuffer(*this, text); }
 	inline ZL_TextBuffer CreateBuffer(const char *text, scalar max_width, bool word_wrap_newline = false) { return ZL_TextBuffer(*this, text, max_width, word_wrap_newline); }
@@ -202,6 +225,9 @@ struct ZL_Font
 	// Requests a limit of the number of bytes processed for the next call to GetWidth/GetHeight/GetDimensions/Draw/CreateBuffer
 	void RequestCharLimit(int limitCount);
 
+	// Glyphs of all true type fonts share 1024x1024 texture pages, when MaxPages are full the least recently drawn glyphs get replaced (defaults to 4)
+	static void SetGlyphAtlasMaxPages(unsigned int MaxPages);
+
 	private: struct ZL_Font_Impl* impl;
 };
 
@@ -39,13 +39,28 @@ struct ZL_ParticleEffect
 
 	void Spawn(int numOfParticles, scalar x, scalar y, int lifetimeStartOffsetTicks = 0, scalar xSpread = 0, scalar ySpread = 0);
 	void Spawn(int numOfParticles, const ZL_Vector& pos, int lifetimeStartOffsetTicks = 0, scalar xSpread = 0, scalar ySpread = 0);
-	void Draw();
+	void Draw(); //draws the state of the last Update, calls Update first if it wasn't called since the last tick or spawn
+
+	//Simulate the particles and build their vertex data, many effects can be updated in parallel on worker threads
+	//Spawning stays on the calling thread so spawned particles (and their random seeds) don't depend on the update order
+	void Update();
+	static void Update(ZL_ParticleEffect* effects, size_t count);
 
 	void SetLifetimeDuration(scalar lifetimeDuration);
 	void SetLifetimeDurationSpread(scalar lifetimeDurationSpread);
 	void SetSpawnProbability(scalar spawnProbability);
+
+	//Continuous emitter mode, spawns particles per second at the emitter position on Draw/Update (rate 0 to stop)
+	void SetSpawnRate(scalar particlesPerSecond);
+	void SetEmitterPosition(scalar x, scalar y, scalar xSpread = 0, scalar ySpread = 0);
+	void SetEmitterPosition(const ZL_Vector& pos, scalar xSpread = 0, scalar ySpread = 0);
+
 	int CountParticleImage();
 	int CountParticles();
+	unsigned int CountDroppedParticles(bool reset = false); //spawns that failed because an image reached its particle limit
+	unsigned int CountExpiredParticles(bool reset = false); //particles removed at the end of their lifetime
+
+	//The particle storage of an image grows as needed, maxNumOfParticles is a hard limit for it (0 for no limit)
 	void AddParticleImage(const ZL_Surface &surface, unsigned int maxNumOfParticles, scalar weight = 1);
 	void AddBehavior(struct ZL_ParticleBehavior *particleBehavior, bool deleteBehavior = true);
 	inline void AddBehavior(struct ZL_ParticleBehavior& particleBehavior) { AddBehavior(&particleBehavior, false); }
@@ -62,9 +77,15 @@ protected:
 	virtual bool ProvidesSpawnSeed() { return false; }
 	virtual unsigned int GetSpawnSeed(struct ZL_ParticleEffect_CalcData& /*data*/) { return 0; }
 
+	//Built-in behaviors made with their static Create function are evaluated together in one fused kernel over all particles instead of
+	//calling Calculate per particle (with their movement and color parameters applied on spawn). Only Create sets the tag so behaviors
+	//constructed directly and subclasses of built-in behaviors always use Calculate
+	enum eKernel { KERNEL_NONE, KERNEL_LINEARMOVE, KERNEL_LINEARIMAGEPROPERTIES, KERNEL_LINEARCOLOR, KERNEL_GRAVITY };
+	eKernel Kernel;
+
 	bool UsesSeed, SpawnSeed, ChangesRotation, ChangesAspectRatio, DeleteAfterUse;
 	ZL_ParticleBehavior(bool UsesSeed, bool ChangesRotation, bool ChangesAspectRatio)
-							 : UsesSeed(UsesSeed), ChangesRotation(ChangesRotation), ChangesAspectRatio(ChangesAspectRatio) { }
+							 : Kernel(KERNEL_NONE), UsesSeed(UsesSeed), ChangesRotation(ChangesRotation), ChangesAspectRatio(ChangesAspectRatio) { }
 	virtual ~ZL_ParticleBehavior() { }
 };
 
@@ -74,6 +95,7 @@ struct ZL_ParticleBehavior_LinearMove : ZL_ParticleBehavior
 	scalar spawningAngle, spawningAngleSpread, spawningSpeed, spawningSpeedSpread;
 
 	ZL_ParticleBehavior_LinearMove(scalar Speed = 10, scalar SpeedSpread = 3, scalar AngleRad = 0, scalar AngleRadSpread = 2*PI, bool rotateImageToMoveAngle = false);
+	static ZL_ParticleBehavior_LinearMove* Create(scalar Speed = 10, scalar SpeedSpread = 3, scalar AngleRad = 0, scalar AngleRadSpread = 2*PI, bool rotateImageToMoveAngle = false);
 	void SetSpawnAngle(scalar AngleRad = 0, scalar AngleRadSpread = 2*PI);
 	void SetSpawnSpeed(scalar Speed = 10, scalar SpeedSpread = 3);
 
@@ -86,6 +108,7 @@ struct ZL_ParticleBehavior_LinearMove : ZL_ParticleBehavior
 struct ZL_ParticleBehavior_LinearImageProperties : ZL_ParticleBehavior
 {
 	ZL_ParticleBehavior_LinearImageProperties(scalar alphaStart = 1, scalar alphaEnd = 0, scalar scaleStart = 1, scalar scaleEnd = 0);
+	static ZL_ParticleBehavior_LinearImageProperties* Create(scalar alphaStart = 1, scalar alphaEnd = 0, scalar scaleStart = 1, scalar scaleEnd = 0);
 	scalar behaviorAlphaStart, behaviorAlphaEnd, behaviorScaleStart, behaviorScaleEnd;
 	protected: void Calculate(struct ZL_ParticleEffect_CalcData& data);
 };
@@ -100,6 +123,7 @@ struct ZL_ParticleBehavior_LinearColor : public ZL_ParticleBehavior
 	std::vector<WeightedColor>	colorStarts, colorEnds;
 
 	ZL_ParticleBehavior_LinearColor();
+	static ZL_ParticleBehavior_LinearColor* Create();
 
 	ZL_ParticleBehavior_LinearColor* AddColorStart(const ZL_Color &color, scalar weight = 1);
 	ZL_ParticleBehavior_LinearColor* AddColorEnd(const ZL_Color &color, scalar weight = 1);
@@ -113,6 +137,7 @@ struct ZL_ParticleBehavior_LinearColor : public ZL_ParticleBehavior
 struct ZL_ParticleBehavior_Gravity : ZL_ParticleBehavior
 {
 	ZL_ParticleBehavior_Gravity(scalar Angle = -PI/2, scalar Strength = 100);
+	static ZL_ParticleBehavior_Gravity* Create(scalar Angle = -PI/2, scalar Strength = 100);
 	scalar behaviorAngle, behaviorStrength, behaviorStrengthSpread;
 	protected: void Calculate(struct ZL_ParticleEffect_CalcData& data);
 };
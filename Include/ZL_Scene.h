@@ -23,6 +23,7 @@
 #define __ZL_SCENE__
 
 #include "ZL_Math.h"
+#include "ZL_Display.h"
 
 typedef short ZL_SceneType;
 #define SCN_NOSCENE ((ZL_SceneType)0)
@@ -65,4 +66,63 @@ public:
 	static bool GoToScene(ZL_SceneType SceneType, void* data = NULL, bool SwitchImmediately = false);
 };
 
+//Optional retained 2D scene graph of sprite, text, shape and group nodes
+//World transforms and bounds are only recalculated for changed nodes and nodes outside of the current view are skipped when drawing.
+//Nodes on the same layer are drawn in tree order, consecutive sprites sharing a texture get batched into a single draw call.
+struct ZL_SceneNode
+{
+	ZL_SceneNode();
+	~ZL_SceneNode();
+	ZL_SceneNode(const ZL_SceneNode &source);
+	ZL_SceneNode &operator=(const ZL_SceneNode &source);
+	operator bool () const { return (impl!=NULL); }
+	bool operator==(const ZL_SceneNode &b) const { return (impl==b.impl); }
+	bool operator!=(const ZL_SceneNode &b) const { return (impl!=b.impl); }
+
+	//Create nodes, sprites and texts use the origin, rotation, clipping and color of the surface or text buffer
+	static ZL_SceneNode Group();
+	static ZL_SceneNode Sprite(const struct ZL_Surface& surface);
+	static ZL_SceneNode Text(const struct ZL_TextBuffer& text_buffer);
+	static ZL_SceneNode Rect(scalar width, scalar height, const ZL_Color &color_border, const ZL_Color &color_fill = ZL_Color::Transparent);
+	static ZL_SceneNode Ellipse(scalar radius_x, scalar radius_y, const ZL_Color &color_border, const ZL_Color &color_fill = ZL_Color::Transparent);
+
+	//Node hierarchy (a node can only have one parent, adding it to another node removes it from the previous parent)
+	ZL_SceneNode& AddChild(const ZL_SceneNode& child);
+	ZL_SceneNode& RemoveChild(const ZL_SceneNode& child);
+	ZL_SceneNode& RemoveAllChildren();
+	void RemoveFromParent();
+	ZL_SceneNode GetParent() const;
+	size_t GetChildCount() const;
+	ZL_SceneNode GetChild(size_t index) const;
+
+	//Local transform and settings (color and visibility are inherited by child nodes)
+	ZL_SceneNode& SetPosition(const ZL_Vector& pos);
+	ZL_SceneNode& SetPosition(scalar x, scalar y);
+	ZL_SceneNode& SetRotate(scalar rotate_rad);
+	ZL_SceneNode& SetRotateDeg(scalar rotate_deg);
+	ZL_SceneNode& SetScale(scalar scale);
+	ZL_SceneNode& SetScale(scalar scalew, scalar scaleh);
+	ZL_SceneNode& SetColor(const ZL_Color &color);
+	ZL_SceneNode& SetVisible(bool visible);
+	ZL_SceneNode& SetLayer(int layer); //lower layers are drawn first, defaults to 0
+	ZL_Vector GetPosition() const;
+	scalar GetRotate() const;
+	ZL_Vector GetScale() const;
+	ZL_Color GetColor() const;
+	bool IsVisible() const;
+	int GetLayer() const;
+
+	//Needs to be called after the size, origin, rotation or clipping of the surface or text buffer of a node was changed
+	ZL_SceneNode& Invalidate();
+
+	//Get the world position and the bounding box of this node including all its children
+	ZL_Vector GetWorldPosition() const;
+	ZL_Rectf GetWorldBounds() const;
+
+	//Draw this node and all its children
+	void Draw() const;
+
+	private: struct ZL_SceneNode_Impl* impl;
+};
+
 #endif //__ZL_SCENE__
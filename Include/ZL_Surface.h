@@ -43,6 +43,25 @@ struct ZL_Surface
 	bool operator!=(const ZL_Surface &b) const { return (impl!=b.impl); }
 	ZL_Surface Clone() const;
 
+	//Load an image in the background, the returned surface has the final size but draws transparent until the texture is decoded and uploaded
+	static ZL_Surface LoadAsync(const ZL_FileLink& file);
+	bool IsLoading() const;
+	bool HasLoadFailed() const; //true if the image could not be decoded and the surface keeps drawing transparent
+	ZL_Signal_v1<const ZL_Surface&>& sigLoaded(); //called once when a surface from LoadAsync got its texture or failed loading (check HasLoadFailed)
+
+	//Limit the time and texture data spent on uploading asynchronously loaded surfaces per frame (at least one texture gets uploaded per frame)
+	static void SetAsyncUploadBudget(ticks_t MaxTicksPerFrame, size_t MaxBytesPerFrame);
+
+	//Limit the video memory used by textures, when above the budget the least recently drawn images that were unused for MinUnusedFrames get evicted (0 bytes for no limit)
+	//Evicted images are reloaded from their file when drawn again, either right away or with AsyncReload in the background while drawing transparent for a few frames
+	//Images modified with SetPixels and render target surfaces are never evicted but count towards the resident bytes
+	static void SetTextureMemoryBudget(size_t MaxBytes, unsigned int MinUnusedFrames = 60, bool AsyncReload = false);
+	struct TextureMemoryStats { size_t ResidentBytes, BudgetBytes; unsigned int EvictedTextures, Evictions, Reloads; };
+	static TextureMemoryStats GetTextureMemoryStats();
+
+	//Read back the pixels of the surface texture without stalling, the signal gets called once in a later frame with RGBA pixels (bottom row first)
+	ZL_Signal_v3<const unsigned char*, int, int>& ReadPixelsAsync() const;
+
 	int GetWidth() const;
 	int GetHeight() const;
 	ZL_Vector GetSize() const;
@@ -137,7 +156,97 @@ struct ZL_Surface
 	//Returns bitmap data which needs to be free()'d after use
 	static unsigned char* GetPixelsFromFile(const ZL_FileLink& ImgFile, int* pOutWidth = NULL, int* pOutHeight = NULL, int* pOutBytesPerPixel = NULL, int RequestBytesPerPixel = 0);
 
+	//Besides PNG/JPG/GIF/BMP, images can be KTX/KTX2 files with ETC1/ETC2/BC1/BC2/BC3/ASTC compressed data which is uploaded directly if the GPU supports it (otherwise decoded to RGBA, except ASTC)
+	//From a list of alternative files of the same image (i.e. "a.astc.ktx2", "a.etc2.ktx", "a.bc3.ktx", "a.png") this returns the first one the GPU supports directly, or the first one that can be loaded at all
+	static const char* SelectSupportedFile(const char*const* Files, int Count);
+
+	//Generate mipmaps on the CPU for images loaded after this call (on the loader thread with LoadAsync) which are then used by linear filtering when drawn scaled down
+	//Filtering is alpha weighted and optionally done in linear color space, mipmaps are only created for textures without padding and with power of two sizes on GLES
+	enum MipmapFilter { MIPMAP_NONE, MIPMAP_BOX, MIPMAP_KAISER };
+	static void SetMipmapGeneration(MipmapFilter Filter, bool GammaCorrect = false);
+
+	//Write an image with its mipmap chain as an uncompressed KTX file, meant to be called from a build step to put the result into the asset pack instead of the source image
+	static bool SaveMipmappedKTX(const ZL_FileLink& ImgFile, const char* OutKTXFile, MipmapFilter Filter = MIPMAP_KAISER, bool GammaCorrect = false);
+
 	private: struct ZL_Surface_Impl* impl;
 };
 
+//Renders tile based maps with static geometry, tiles are grouped in chunks of which only the visible ones are drawn
+struct ZL_TileMap
+{
+	ZL_TileMap();
+	ZL_TileMap(const ZL_Surface& Tileset, int ImageNumTileCols, int ImageNumTileRows, int MapWidth, int MapHeight, int NumLayers = 1, int ChunkSize = 16);
+	~ZL_TileMap();
+	ZL_TileMap(const ZL_TileMap &source);
+	ZL_TileMap &operator =(const ZL_TileMap &source);
+	operator bool () const { return (impl!=NULL); }
+	bool operator==(const ZL_TileMap &b) const { return (impl==b.impl); }
+	bool operator!=(const ZL_TileMap &b) const { return (impl!=b.impl); }
+
+	int GetMapWidth() const;
+	int GetMapHeight() const;
+	int GetNumLayers() const;
+	ZL_Vector GetTileSize() const;
+	ZL_Vector GetSize() const;
+
+	//Set the size of a single tile when drawing (defaults to the pixel size of a tile in the tileset image)
+	ZL_TileMap& SetTileSize(scalar TileWidth, scalar TileHeight);
+
+	//Tile indices count left to right, top to bottom in the tileset image, negative values are empty tiles
+	//Map coordinates start with 0,0 at the bottom left of the map, editing a tile only rebuilds the chunk containing it
+	int GetTile(int x, int y, int Layer = 0) const;
+	ZL_TileMap& SetTile(int x, int y, int TileIndex, int Layer = 0);
+	ZL_TileMap& SetTiles(const int* TileIndices, int Layer = 0); //MapWidth*MapHeight indices ordered row by row starting with the top row
+	ZL_TileMap& Fill(int TileIndex, int Layer = 0);
+
+	//Animated tiles, all tiles with TileIndex cycle through the list of frame tile indices
+	ZL_TileMap& SetTileAnimation(int TileIndex, const int* FrameTileIndices, int NumFrames, ticks_t FrameDuration);
+	ZL_TileMap& ClearTileAnimation(int TileIndex);
+
+	//Draw all layers (or a single layer) with the bottom left of the map at position x/y, chunks outside of the current view are skipped
+	void Draw(scalar x, scalar y, const ZL_Color &color = ZL_Color::White) const;
+	void Draw(const ZL_Vector &pos, const ZL_Color &color = ZL_Color::White) const { Draw(pos.x, pos.y, color); }
+	void DrawLayer(int Layer, scalar x, scalar y, const ZL_Color &color = ZL_Color::White) const;
+	void DrawLayer(int Layer, const ZL_Vector &pos, const ZL_Color &color = ZL_Color::White) const { DrawLayer(Layer, pos.x, pos.y, color); }
+
+	private: struct ZL_TileMap_Impl* impl;
+};
+
+//A layer for mostly static content which gets rendered into an offscreen surface only when invalidated and otherwise is drawn as a single quad
+struct ZL_CachedLayer
+{
+	ZL_CachedLayer();
+	ZL_CachedLayer(const ZL_Rectf& area, bool use_alpha = true, scalar resolution_scale = 1); //resolution_scale 0 matches the current screen resolution
+	~ZL_CachedLayer();
+	ZL_CachedLayer(const ZL_CachedLayer &source);
+	ZL_CachedLayer &operator =(const ZL_CachedLayer &source);
+	operator bool () const { return (impl!=NULL); }
+	bool operator==(const ZL_CachedLayer &b) const { return (impl==b.impl); }
+	bool operator!=(const ZL_CachedLayer &b) const { return (impl!=b.impl); }
+
+	//Called to render the contents of the layer in world coordinates, the parameter is the area that needs to be redrawn
+	ZL_Signal_v1<const ZL_Rectf&>& sigRedraw();
+
+	//Change the covered area in world coordinates (if the size changes the whole layer will be redrawn)
+	ZL_CachedLayer& SetArea(const ZL_Rectf& area);
+	ZL_Rectf GetArea() const;
+
+	//Request a redraw of the whole layer or just a part of it on the next draw
+	ZL_CachedLayer& Invalidate();
+	ZL_CachedLayer& Invalidate(const ZL_Rectf& dirty_area);
+	bool IsInvalidated() const;
+
+	//Invalidate automatically when the memory at data changed since the last draw (memory needs to stay valid until untracked)
+	ZL_CachedLayer& TrackDependency(const void* data, size_t size);
+	ZL_CachedLayer& UntrackDependency(const void* data);
+
+	//Redraw invalidated parts and then draw the cached layer
+	void Draw() const;
+	void Draw(const ZL_Color &color) const;
+
+	ZL_Surface GetSurface() const;
+
+	private: struct ZL_CachedLayer_Impl* impl;
+};
+
 #endif //__ZL_SURFACE__
@@ -34,6 +34,7 @@ unsigned int ZL_LastFPSTicks = 0, ZL_MainApplicationFlags = 0;
 int ZL_DoneReturn;
 void (*funcSceneManagerCalculate)() = NULL;
 void (*funcSceneManagerDraw)() = NULL;
+void (*funcFrameCapture)() = NULL;
 
 ZL_Signal_v0 ZL_Application::sigKeepAlive;
 static int FPS_Frame_Count = 0;
@@ -140,6 +141,7 @@ void ZL_Application::Frame()
 		if (native_aspectcorrection) { glClearColor(0.0f, 0.0f, 0.0f, 1.0f); glClear(GL_COLOR_BUFFER_BIT); }
 	}
 	AfterFrame();
+	if (funcFrameCapture) funcFrameCapture();
 }
 
 void ZL_Application::Quit(int Return)
@@ -281,6 +283,7 @@ void ZL_ApplicationConstantTicks::Frame()
 	if (!calledBeforeFrame) BeforeFrame();
 	funcSceneManagerDraw();
 	AfterFrame();
+	if (funcFrameCapture) funcFrameCapture();
 	Ticks = now;
 }
 
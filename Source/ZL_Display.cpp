@@ -21,6 +21,7 @@
 
 #include "ZL_Display.h"
 #include "ZL_Display_Impl.h"
+#include "ZL_Texture_Impl.h"
 
 #undef KMOD_META
 
@@ -152,6 +153,30 @@ void ZL_Display::AllSigDisconnect(void *callback_class_inst)
 	sigJoyDeviceChange.disconnect_class(callback_class_inst);
 }
 
+void ZL_Display::SetShaderCacheFile(const char* CacheFilePath)
+{
+	#if defined(ZL_VIDEO_GL_PROGRAM_BINARY)
+	ZLGLSL::ProgramCacheOpen(CacheFilePath);
+	#else
+	(void)CacheFilePath;
+	#endif
+}
+
+ZL_Signal_v3<const unsigned char*, int, int>& ZL_Display::ReadPixelsAsync()
+{
+	return ZL_Texture_Impl::ReadScreenPixelsAsync();
+}
+
+void ZL_Display::SaveScreenshot(const char* OutTGAFile)
+{
+	ZL_Texture_Impl::SaveScreenshot(OutTGAFile);
+}
+
+void ZL_Display::SetFrameCapture(const char* PathPrefix, unsigned int EveryNthFrame)
+{
+	ZL_Texture_Impl::SetFrameCapture(PathPrefix, EveryNthFrame);
+}
+
 bool ZL_Display::Init(const char* title, int width, int height, int displayflags)
 {
 	if (width == height) displayflags |= ZL_DISPLAY_ALLOWANYORIENTATION;
@@ -484,6 +509,16 @@ ZL_Vector ZL_Display::ScreenToWorld(scalar x, scalar y)
 	#endif
 }
 
+ZL_Rectf ZL_Display::GetVisibleWorldRect()
+{
+	ZL_Rectf r = ZL_Rectf::ByCorners(ScreenToWorld(0, 0), ScreenToWorld(Width, Height));
+	if (r.left > r.right) { scalar tmp = r.left; r.left = r.right; r.right = tmp; }
+	if (r.low > r.high) { scalar tmp = r.low; r.low = r.high; r.high = tmp; }
+	r.Expand(ScreenToWorld(0, Height));
+	r.Expand(ScreenToWorld(Width, 0));
+	return r;
+}
+
 void ZL_Display::DrawLine(scalar x1, scalar y1, scalar x2, scalar y2, const ZL_Color &color)
 {
 	GLscalar vertices[4] = { x1 , y1 , x2 , y2 };
@@ -1117,7 +1152,7 @@ struct ZL_Polygon_Impl : ZL_Impl
 		if (!pSurfaceImpl || !fill || TessVertices.empty()) return;
 		GLushort i;
 		ZLGL_ENABLE_TEXTURE();
-		glBindTexture(GL_TEXTURE_2D, pSurfaceImpl->tex->gltexid);
+		glBindTexture(GL_TEXTURE_2D, pSurfaceImpl->tex->Use());
 		ZLGL_COLORA(pSurfaceImpl->color, pSurfaceImpl->fOpacity);
 		ZLGL_TEXCOORDPOINTER(2, GL_SCALAR, 0, TessVerticesTexCoords);
 		ZLGL_VERTEXTPOINTER(2, GL_SCALAR, 0, &TessVertices[0]);
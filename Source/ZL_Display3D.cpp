@@ -34,11 +34,13 @@ struct ZL_ShaderIDs { GLuint Program; GLubyte UsedAttributeMask; GLint UniformMa
 static struct { ZL_ShaderIDs Shader; GLuint BoundTextureChksum, BoundTextures[4], IndexBuffer, VertexBuffer; GLubyte AttributeMask; GLenum Texture; } g_Active3D;
 static std::vector<struct ZL_MaterialProgram*>* g_LoadedShaderVariations;
 static GLubyte g_MaxLights;
+static enum { INSTANCING_NONE, INSTANCING_HARDWARE, INSTANCING_BATCHES } g_InstancingMode;
+static GLsizei g_MaxInstances; //instances per draw call that fit into the vertex uniform vectors of the platform (up to Z3MAX_INSTANCES)
 static struct ZL_MaterialProgram* g_DebugColorMat;
 
 static void (*g_SetupShadowMapProgram)(struct ZL_MaterialProgram* ShaderProgram, unsigned int MM, const char* CustomVertexCode);
 static GLuint g_ShadowMap_FBO, g_ShadowMap_TEX;
-static ZL_MaterialProgram *g_ShadowMapPrograms[4];
+static ZL_MaterialProgram *g_ShadowMapPrograms[8];
 #define SHADOWMAP_SIZE         2048
 #define SHADOWMAP_SIZE_STRING "2048"
 
@@ -63,13 +65,20 @@ namespace ZL_Display3D_Shaders
 	#define Z3L_LIGHTDISTANCE    ZL_SHADERVARNAME("LD", "l_lightdistance")
 	#define Z3L_LIGHTDIM         ZL_SHADERVARNAME("LI", "l_lightdim")
 	#define Z3L_DIRECTION2LIGHT  ZL_SHADERVARNAME("DL", "l_direction2light")
+	#define Z3L_INSTANCE         ZL_SHADERVARNAME("IN", "l_instance")
+	#define Z3L_MAXINSTANCES     ZL_SHADERVARNAME("MI", "l_maxinstances")
+	#define Z3A_INSTANCE         ZL_SHADERVARNAME("ai", "a_instance")        //instance index of replicated vertices for uniform array batching (float)
+	#define Z3U_INSTANCEMODELS   ZL_SHADERVARNAME("uim", "u_instancemodels")  //model matrices of instanced draw calls (mat4 array)
+	#define Z3U_INSTANCENORMALS  ZL_SHADERVARNAME("uin", "u_instancenormals") //normal matrices of instanced draw calls (mat4 array)
 	#define Z3D_SHADOWMAP "SM"
 	#define Z3MAX_BONES 60
 	#define Z3MAX_BONES_STRING "60"
+	#define Z3MAX_INSTANCES 16
+	#define Z3INSTANCES_RESERVED_UNIFORMS 64 //vertex uniform vectors kept free for the view, light and material uniforms of instanced programs
 
 	static const char S_VoidMain[] = "void main(){";
 
-	static const char *S_AttributeList[] = { Z3A_POSITION, Z3A_NORMAL, Z3A_TEXCOORD, Z3A_TANGENT, Z3A_COLOR, Z3A_JOINTS, Z3A_WEIGHTS };
+	static const char *S_AttributeList[] = { Z3A_POSITION, Z3A_NORMAL, Z3A_TEXCOORD, Z3A_TANGENT, Z3A_COLOR, Z3A_JOINTS, Z3A_WEIGHTS, Z3A_INSTANCE };
 
 	using namespace ZL_MaterialModes;
 	enum
@@ -82,6 +91,7 @@ namespace ZL_Display3D_Shaders
 		MMDEF_REQUESTS          = MR_WPOSITION|MR_TEXCOORD|MR_NORMAL|MR_CAMERATANGENT|MR_TIME,
 		MMDEF_NOSHADERCODE      = MO_TRANSPARENCY|MO_ADDITIVE|MO_MODULATE|MO_CASTNOSHADOW|MO_IGNOREDEPTH,
 		MMDEF_NODEPTHWRITE      = MO_TRANSPARENCY|MO_ADDITIVE|MO_MODULATE,
+		MMDEF_INSTANCED         = 1<<21, //internal mode of program variations reading the model and normal matrix from per instance uniform arrays
 
 		MMUSE_VERTEXCOLOR   = MM_VERTEXCOLOR|MM_VERTEXCOLORFUNC,
 		MMUSE_SPECULAR      = MM_SPECULARSTATIC|MM_SPECULARMAP|MM_SPECULARFUNC,
@@ -94,11 +104,12 @@ namespace ZL_Display3D_Shaders
 		MMUSE_LATECOLORCALC = MM_PARALLAXMAP|MM_DIFFUSEFUNC,
 	};
 
-	enum { EXTERN_Varying_ShadowMap, EXTERN_VS_ShadowMap_Defs, EXTERN_FS_ShadowMap_Defs, EXTERN_VS_ShadowMap_Calc, EXTERN_FS_ShadowMap_Calc, _EXTERN_NUM };
+	enum { EXTERN_Varying_ShadowMap, EXTERN_VS_ShadowMap_Defs, EXTERN_FS_ShadowMap_Defs, EXTERN_VS_ShadowMap_Calc, EXTERN_FS_ShadowMap_Calc, EXTERN_VS_Instancing_Prefix, EXTERN_VS_Instancing_Defs, _EXTERN_NUM };
 	static const char* ExternalSource[_EXTERN_NUM];
 	static const char* SharedVSHeader[1] = { ZLGLSL_LIST_HIGH_PRECISION_HEADER ZLGLSL_LIST_VS_HEADER ZLGLSL_LIST_NULL_HEADER };
 	static const char* SharedFSHeader[1] = { ZLGLSL_LIST_HIGH_PRECISION_HEADER ZLGLSL_LIST_FS_HEADER ZLGLSL_LIST_NULL_HEADER };
 	static char Const_NumLights[] = "const int " Z3S_NUMLIGHTS "=   ", *Const_NumLightsNumberPtr = Const_NumLights+COUNT_OF(Const_NumLights)-4;
+	static char Instancing_Defs[128];
 
 	static const struct SourceRule { int MMUseIf, MMLimit; const char *Source; }
 		SharedRules[] = {
@@ -112,10 +123,13 @@ namespace ZL_Display3D_Shaders
 			{ 0,            MO_RECEIVENOSHADOW|MO_UNLIT, (const char *)&ExternalSource[EXTERN_Varying_ShadowMap] },
 		},
 		VSGlobalRules[] = {
-			{ 0,                                      0, "uniform mat4 " Z3U_VIEW "," Z3U_MODEL ";attribute vec3 " Z3A_POSITION ";" },
+			{ 0,                        MMDEF_INSTANCED, "uniform mat4 " Z3U_VIEW "," Z3U_MODEL ";attribute vec3 " Z3A_POSITION ";" },
+			{ MMDEF_INSTANCED,                        0, (const char *)&ExternalSource[EXTERN_VS_Instancing_Defs] },
+			{ MMDEF_INSTANCED,                        0, "uniform mat4 " Z3U_VIEW "," Z3U_INSTANCEMODELS "[" Z3L_MAXINSTANCES "];attribute vec3 " Z3A_POSITION ";\n#define " Z3U_MODEL " " Z3U_INSTANCEMODELS "[" Z3L_INSTANCE "]\n" },
 			{ MMUSE_TEXCOORD,                         0, "attribute vec2 " Z3A_TEXCOORD ";" },
 			{ MM_VERTEXCOLOR,                         0, "attribute vec4 " Z3A_COLOR ";" },
-			{ MMUSE_NORMAL,                           0, "attribute vec3 " Z3A_NORMAL ";uniform mat4 " Z3U_NORMAL ";" },
+			{ MMUSE_NORMAL,             MMDEF_INSTANCED, "attribute vec3 " Z3A_NORMAL ";uniform mat4 " Z3U_NORMAL ";" },
+			{ MMUSE_NORMAL,            -MMDEF_INSTANCED, "attribute vec3 " Z3A_NORMAL ";uniform mat4 " Z3U_INSTANCENORMALS "[" Z3L_MAXINSTANCES "];\n#define " Z3U_NORMAL " " Z3U_INSTANCENORMALS "[" Z3L_INSTANCE "]\n" },
 			{ MMUSE_TANGENT,        MO_PRECISIONTANGENT, "attribute vec3 " Z3A_TANGENT ";uniform vec3 " Z3U_VIEWPOS ";" },
 			{ MMUSE_TANGENT,       -MO_PRECISIONTANGENT, "attribute vec3 " Z3A_TANGENT ";" },
 			{ MO_SKELETALMESH,                        0, "attribute vec4 " Z3A_JOINTS ", " Z3A_WEIGHTS ";uniform mat4 " Z3U_BONES "[" Z3MAX_BONES_STRING "];" },
@@ -383,6 +397,9 @@ struct ZL_MaterialProgram : ZL_Material_Impl
 	GLuint UploadedCamera, UploadedLight, UploadedLightDataChkSum, UniformUploadedValueChksum, UniformNum;
 	UniformEntry* UniformEntries;
 	ZL_MaterialProgram* ShadowMapProgram;
+	ZL_MaterialProgram* InstancedProgram; //variation drawing multiple instances per draw call, compiled on first use
+	ZL_String InstancedFragmentCode, InstancedVertexCode;
+	bool InstancedUnavailable;
 
 	#ifdef ZL_VIDEO_WEAKCONTEXT
 	ZL_String WeakVertexShaderSrc, WeakFragmentShaderSrc;
@@ -407,6 +424,7 @@ struct ZL_MaterialProgram : ZL_Material_Impl
 		if (VariationID) g_LoadedShaderVariations->erase(FindVariation(VariationID));
 		if (VariationID && g_LoadedShaderVariations->empty()) { delete g_LoadedShaderVariations; g_LoadedShaderVariations = NULL; }
 		if (ShadowMapProgram) ShadowMapProgram->DelRef();
+		if (InstancedProgram) InstancedProgram->DelRef();
 		for (int i = 0; i < (int)COUNT_OF(g_ShadowMapPrograms); i++)
 			if (this == g_ShadowMapPrograms[i]) g_ShadowMapPrograms[i] = NULL;
 		if (UniformEntries) free(UniformEntries);
@@ -416,7 +434,7 @@ struct ZL_MaterialProgram : ZL_Material_Impl
 		#endif
 	}
 
-	ZL_MaterialProgram(GLsizei vertex_shader_srcs_count, const char **vertex_shader_srcs, GLsizei fragment_shader_srcs_count, const char **fragment_shader_srcs, unsigned int MaterialModes = 0) : ZL_Material_Impl(NULL, MaterialModes), VariationID(0), UploadedCamera(0), UploadedLight(0), UploadedLightDataChkSum(0), UniformUploadedValueChksum(0), UniformEntries(NULL), ShadowMapProgram(NULL)
+	ZL_MaterialProgram(GLsizei vertex_shader_srcs_count, const char **vertex_shader_srcs, GLsizei fragment_shader_srcs_count, const char **fragment_shader_srcs, unsigned int MaterialModes = 0) : ZL_Material_Impl(NULL, MaterialModes), VariationID(0), UploadedCamera(0), UploadedLight(0), UploadedLightDataChkSum(0), UniformUploadedValueChksum(0), UniformEntries(NULL), ShadowMapProgram(NULL), InstancedProgram(NULL), InstancedUnavailable(false)
 	{
 		ZL_ASSERTMSG(funcInitGL3D, "3D rendering was not initialized with ZL_Display3D::Init");
 		ShaderProgram = this;
@@ -424,6 +442,8 @@ struct ZL_MaterialProgram : ZL_Material_Impl
 		UniformMatrixView               = glGetUniformLocation(ShaderIDs.Program, Z3U_VIEW);
 		ShaderIDs.UniformMatrixModel    = glGetUniformLocation(ShaderIDs.Program, Z3U_MODEL);
 		ShaderIDs.UniformMatrixNormal   = glGetUniformLocation(ShaderIDs.Program, Z3U_NORMAL);
+		if (ShaderIDs.UniformMatrixModel  == -1) ShaderIDs.UniformMatrixModel  = glGetUniformLocation(ShaderIDs.Program, Z3U_INSTANCEMODELS);
+		if (ShaderIDs.UniformMatrixNormal == -1) ShaderIDs.UniformMatrixNormal = glGetUniformLocation(ShaderIDs.Program, Z3U_INSTANCENORMALS);
 		UniformMatrixLight              = glGetUniformLocation(ShaderIDs.Program, Z3U_LIGHT);
 		UniformVectorViewPos            = glGetUniformLocation(ShaderIDs.Program, Z3U_VIEWPOS);
 		UniformVectorLightData          = glGetUniformLocation(ShaderIDs.Program, Z3U_LIGHTDATA);
@@ -551,6 +571,8 @@ struct ZL_MaterialProgram : ZL_Material_Impl
 			}
 			UniformUploadedValueChksum = Override.ValueChksum;
 		}
+		for (ZL_Texture_Impl*const* t = Override.TextureReferences, *const* tEnd = t + COUNT_OF(Override.TextureReferences); t != tEnd; t++)
+			if (*t && (*t)->Touch()) g_Active3D.BoundTextureChksum = ~Override.TextureChksum; //rebind if reloaded after being evicted by the texture memory budget
 		if (g_Active3D.BoundTextureChksum != Override.TextureChksum)
 		{
 			if (Override.TextureReferences[0] && Override.TextureReferences[0]->gltexid != g_Active3D.BoundTextures[0]) { if (g_Active3D.Texture != GL_TEXTURE0) glActiveTexture(g_Active3D.Texture = GL_TEXTURE0); glBindTexture(GL_TEXTURE_2D, Override.TextureReferences[0]->gltexid); }
@@ -561,6 +583,10 @@ struct ZL_MaterialProgram : ZL_Material_Impl
 		}
 	}
 
+	static ZL_MaterialProgram* CompileVariation(unsigned int MM, const char* CustomFragmentCode, const char* CustomVertexCode);
+
+	ZL_MaterialProgram* GetInstancedProgram();
+
 	inline GLint GetUniformOffset(ZL_NameID Name, UniformEntry::eType Type, bool IsArray = false) const
 	{
 		UniformEntry* e = std::lower_bound(UniformEntries, UniformEntries+UniformNum, Name);
@@ -609,6 +635,58 @@ struct ZL_MaterialInstance : ZL_Material_Impl
 	~ZL_MaterialInstance() { ShaderProgram->DelRef(); }
 };
 
+struct ZL_MaterialManifest
+{
+	struct Entry { unsigned int MM; ZL_String CustomFragmentCode, CustomVertexCode; bool Instanced; };
+	ZL_String FilePath;
+	std::map<u64, Entry> Recorded;
+	std::vector<Entry> Pending;
+	std::vector<ZL_Material_Impl*> WarmedUp;
+	size_t PendingDone;
+	ticks_t MaxTicksPerFrame;
+	bool Dirty;
+
+	void Record(u64 VariationID, unsigned int MM, const char* CustomFragmentCode, const char* CustomVertexCode)
+	{
+		std::map<u64, Entry>::iterator it = Recorded.find(VariationID);
+		if (it != Recorded.end()) return;
+		Entry& e = Recorded[VariationID];
+		e.MM = MM;
+		e.Instanced = false;
+		if (CustomFragmentCode) e.CustomFragmentCode = CustomFragmentCode;
+		if (CustomVertexCode) e.CustomVertexCode = CustomVertexCode;
+		Dirty = true;
+	}
+
+	void RecordInstanced(u64 VariationID)
+	{
+		std::map<u64, Entry>::iterator it = Recorded.find(VariationID);
+		if (it == Recorded.end() || it->second.Instanced) return;
+		it->second.Instanced = true;
+		Dirty = true;
+	}
+
+	static void KeepAlive();
+};
+static ZL_MaterialManifest* g_MaterialManifest;
+
+ZL_MaterialProgram* ZL_MaterialProgram::GetInstancedProgram()
+{
+	if (InstancedProgram || InstancedUnavailable) return InstancedProgram;
+	using namespace ZL_Display3D_Shaders;
+	if (g_MaterialManifest && VariationID) g_MaterialManifest->RecordInstanced(VariationID);
+	const char *CustomFragmentCode = (InstancedFragmentCode.empty() ? NULL : InstancedFragmentCode.c_str()), *CustomVertexCode = (InstancedVertexCode.empty() ? NULL : InstancedVertexCode.c_str());
+	InstancedProgram = CompileVariation(MaterialModes | MMDEF_INSTANCED, CustomFragmentCode, CustomVertexCode);
+	if (InstancedProgram && InstancedProgram->UniformSet.ValueNum != UniformSet.ValueNum) { delete InstancedProgram; InstancedProgram = NULL; } //material uniform sets need to match
+	if (InstancedProgram && ShadowMapProgram)
+	{
+		g_SetupShadowMapProgram(InstancedProgram, MaterialModes | MMDEF_INSTANCED, CustomVertexCode);
+		if (!InstancedProgram->ShadowMapProgram) { delete InstancedProgram; InstancedProgram = NULL; }
+	}
+	InstancedUnavailable = (InstancedProgram == NULL);
+	return InstancedProgram;
+}
+
 ZL_Material_Impl* ZL_Material_Impl::GetMaterialReference(unsigned int MM, const char* CustomFragmentCode, const char* CustomVertexCode)
 {
 	using namespace ZL_Display3D_Shaders;
@@ -630,6 +708,7 @@ ZL_Material_Impl* ZL_Material_Impl::GetMaterialReference(unsigned int MM, const
 	if ((MM & MR_CAMERATANGENT) && (MM & (MMUSE_CAMERATANGENT^MR_CAMERATANGENT))) VariationID ^= MR_CAMERATANGENT;
 	if (CustomFragmentCode) VariationID ^= (((u64)(ZL_NameID(CustomFragmentCode).IDValue)) << 32);
 	if (CustomVertexCode  ) VariationID ^= (((u64)(ZL_NameID(CustomVertexCode  ).IDValue)) << 32);
+	if (g_MaterialManifest) g_MaterialManifest->Record(VariationID, MM, CustomFragmentCode, CustomVertexCode);
 
 	ZL_Material_Impl* res;
 	std::vector<ZL_MaterialProgram*>::iterator it;
@@ -640,23 +719,10 @@ ZL_Material_Impl* ZL_Material_Impl::GetMaterialReference(unsigned int MM, const
 	}
 	else
 	{
-		char FS_FragColorCalc[FRAGCOLOR_CALC_MAXLEN+1], *FS_FragColorCalcPtr = FS_FragColorCalc;
-		for (size_t i = 0; i < COUNT_OF(FragColorRules); i++)
-			if (MM & FragColorRules[i].MMUseIf)
-				FS_FragColorCalcPtr += sprintf(FS_FragColorCalcPtr, "%s%s", (FS_FragColorCalcPtr != FS_FragColorCalc ? "*" : ""), FragColorRules[i].Source);
-		FS_FragColorCalcPtr[0] = ';'; FS_FragColorCalcPtr[1] = '\0';
-
-		const unsigned int MMRules = (MM & MO_UNLIT ? MM : MM | MR_WPOSITION | MR_NORMAL);
-		const char* FSNullReplacements[] = { CustomFragmentCode, FS_FragColorCalc };
-		const char *VS[COUNT_OF(SharedRules)+COUNT_OF(VSGlobalRules)+COUNT_OF(VSRules)], *FS[COUNT_OF(SharedRules)+COUNT_OF(FSRules)];
-		GLsizei VSCount  = BuildList(SharedRules,   COUNT_OF(SharedRules),   MMRules, &VS[      0], SharedVSHeader);
-		        VSCount += BuildList(VSGlobalRules, COUNT_OF(VSGlobalRules), MMRules, &VS[VSCount]);
-		        VSCount += BuildList(VSRules,       COUNT_OF(VSRules),       MMRules, &VS[VSCount], &CustomVertexCode);
-		GLsizei FSCount  = BuildList(SharedRules,   COUNT_OF(SharedRules),   MMRules, &FS[      0], SharedFSHeader);
-		        FSCount += BuildList(FSRules,       COUNT_OF(FSRules),       MMRules, &FS[FSCount], FSNullReplacements);
-		res = new ZL_MaterialProgram(VSCount, VS, FSCount, FS, MM);
-		if (!res->ShaderProgram->ShaderIDs.Program) { res->ShaderProgram->MaterialModes = 0; delete res; return NULL; }
+		if (!(res = ZL_MaterialProgram::CompileVariation(MM, CustomFragmentCode, CustomVertexCode))) return NULL;
 		((ZL_MaterialProgram*)res)->VariationID = VariationID;
+		if (CustomFragmentCode) ((ZL_MaterialProgram*)res)->InstancedFragmentCode = CustomFragmentCode;
+		if (CustomVertexCode) ((ZL_MaterialProgram*)res)->InstancedVertexCode = CustomVertexCode;
 
 		g_LoadedShaderVariations->insert(it, res->ShaderProgram);
 	}
@@ -667,9 +733,67 @@ ZL_Material_Impl* ZL_Material_Impl::GetMaterialReference(unsigned int MM, const
 	return res;
 }
 
+ZL_MaterialProgram* ZL_MaterialProgram::CompileVariation(unsigned int MM, const char* CustomFragmentCode, const char* CustomVertexCode)
+{
+	using namespace ZL_Display3D_Shaders;
+	char FS_FragColorCalc[FRAGCOLOR_CALC_MAXLEN+1], *FS_FragColorCalcPtr = FS_FragColorCalc;
+	for (size_t i = 0; i < COUNT_OF(FragColorRules); i++)
+		if (MM & FragColorRules[i].MMUseIf)
+			FS_FragColorCalcPtr += sprintf(FS_FragColorCalcPtr, "%s%s", (FS_FragColorCalcPtr != FS_FragColorCalc ? "*" : ""), FragColorRules[i].Source);
+	FS_FragColorCalcPtr[0] = ';'; FS_FragColorCalcPtr[1] = '\0';
+
+	const unsigned int MMRules = (MM & MO_UNLIT ? MM : MM | MR_WPOSITION | MR_NORMAL);
+	const char* FSNullReplacements[] = { CustomFragmentCode, FS_FragColorCalc };
+	const char *VS[1+COUNT_OF(SharedRules)+COUNT_OF(VSGlobalRules)+COUNT_OF(VSRules)], *FS[COUNT_OF(SharedRules)+COUNT_OF(FSRules)];
+	GLsizei VSCount = 0;
+	if ((MM & MMDEF_INSTANCED) && ExternalSource[EXTERN_VS_Instancing_Prefix]) VS[VSCount++] = ExternalSource[EXTERN_VS_Instancing_Prefix];
+	        VSCount += BuildList(SharedRules,   COUNT_OF(SharedRules),   MMRules, &VS[VSCount], SharedVSHeader);
+	        VSCount += BuildList(VSGlobalRules, COUNT_OF(VSGlobalRules), MMRules, &VS[VSCount]);
+	        VSCount += BuildList(VSRules,       COUNT_OF(VSRules),       MMRules, &VS[VSCount], &CustomVertexCode);
+	GLsizei FSCount  = BuildList(SharedRules,   COUNT_OF(SharedRules),   MMRules, &FS[      0], SharedFSHeader);
+	        FSCount += BuildList(FSRules,       COUNT_OF(FSRules),       MMRules, &FS[FSCount], FSNullReplacements);
+	ZL_MaterialProgram* res = new ZL_MaterialProgram(VSCount, VS, FSCount, FS, MM);
+	if (!res->ShaderIDs.Program) { res->MaterialModes = 0; delete res; return NULL; }
+	return res;
+}
+
+void ZL_MaterialManifest::KeepAlive()
+{
+	ZL_MaterialManifest* m = g_MaterialManifest;
+	if (m->PendingDone < m->Pending.size())
+	{
+		//Precompile the variations (including their shadow map programs) and keep them referenced so they stay loaded
+		for (ticks_t Start = ZL_GetTicks(); m->PendingDone < m->Pending.size() && ZL_GetTicks() - Start < m->MaxTicksPerFrame;)
+		{
+			const Entry& e = m->Pending[m->PendingDone++];
+			ZL_Material_Impl* Material = ZL_Material_Impl::GetMaterialReference(e.MM, (e.CustomFragmentCode.empty() ? NULL : e.CustomFragmentCode.c_str()), (e.CustomVertexCode.empty() ? NULL : e.CustomVertexCode.c_str()));
+			if (!Material) continue;
+			m->WarmedUp.push_back(Material);
+			if (e.Instanced && g_InstancingMode != INSTANCING_NONE) Material->ShaderProgram->GetInstancedProgram();
+		}
+		ZL_Display3D::sigMaterialWarmUpProgress.call(m->PendingDone, m->Pending.size());
+	}
+	if (m->Dirty && m->PendingDone == m->Pending.size()) //don't write the manifest before all previously recorded variations were recorded again
+	{
+		m->Dirty = false;
+		ZL_Json Manifest;
+		for (std::map<u64, Entry>::iterator it = m->Recorded.begin(); it != m->Recorded.end(); ++it)
+		{
+			ZL_Json Variation = Manifest.Add();
+			char MMHex[9];
+			sprintf(MMHex, "%08X", it->second.MM);
+			Variation["mm"].SetString(MMHex);
+			if (!it->second.CustomFragmentCode.empty()) Variation["fs"].SetString(it->second.CustomFragmentCode.c_str());
+			if (!it->second.CustomVertexCode.empty()) Variation["vs"].SetString(it->second.CustomVertexCode.c_str());
+			if (it->second.Instanced) Variation["instanced"].SetBool(true);
+		}
+		ZL_File(m->FilePath, "w").SetContents(Manifest.ToString(false));
+	}
+}
+
 struct ZL_Mesh_Impl : ZL_Impl
 {
-	enum { VA_POS = 0, VA_NORMAL = 1, VAMASK_NORMAL = 2, VA_TEXCOORD = 2, VAMASK_TEXCOORD = 4, VA_TANGENT = 3, VAMASK_TANGENT = 8, VA_COLOR = 4, VAMASK_COLOR = 16, VA_JOINTS = 5, VAMASK_JOINTS = 32, VA_WEIGHTS = 6, VAMASK_WEIGHTS = 64 };
+	enum { VA_POS = 0, VA_NORMAL = 1, VAMASK_NORMAL = 2, VA_TEXCOORD = 2, VAMASK_TEXCOORD = 4, VA_TANGENT = 3, VAMASK_TANGENT = 8, VA_COLOR = 4, VAMASK_COLOR = 16, VA_JOINTS = 5, VAMASK_JOINTS = 32, VA_WEIGHTS = 6, VAMASK_WEIGHTS = 64, VA_INSTANCE = 7, VAMASK_INSTANCE = 128 };
 
 	GLuint IndexBufferObject, VertexBufferObject, LastRenderFrame;
 	GLubyte ProvideAttributeMask;
@@ -679,11 +803,16 @@ struct ZL_Mesh_Impl : ZL_Impl
 	struct MeshPart
 	{
 		ZL_NameID Name; GLsizei IndexCount; GLushort* IndexOffsetPtr; ZL_Material_Impl* Material;
-		MeshPart() {}
-		MeshPart(ZL_NameID Name, GLsizei IndexCount, GLushort* IndexOffsetPtr,  ZL_Material_Impl* Material, bool AddMatRef) : Name(Name), IndexCount(IndexCount), IndexOffsetPtr(IndexOffsetPtr), Material(Material) { if (Material && AddMatRef) Material->AddRef(); }
+		GLsizei InstanceCount; //number of hardware instances drawn of the part (used by particle emitters), 0 for a regular draw call
+		MeshPart() : InstanceCount(0) {}
+		MeshPart(ZL_NameID Name, GLsizei IndexCount, GLushort* IndexOffsetPtr,  ZL_Material_Impl* Material, bool AddMatRef) : Name(Name), IndexCount(IndexCount), IndexOffsetPtr(IndexOffsetPtr), Material(Material), InstanceCount(0) { if (Material && AddMatRef) Material->AddRef(); }
 		bool operator==(ZL_NameID n) { return Name == n; }
 	};
 	MeshPart *Parts, *PartsEnd;
+	ZL_Vector3 BoundsMin, BoundsMax, BoundsCenter; scalar BoundsRadius; //object space bounds of all vertex positions
+	bool NeverCull; //set for meshes whose vertices get moved by the shader (skinning, particles)
+	GLuint BatchBufferObjects[2]; //vertex and index buffer holding g_MaxInstances copies of the mesh for uniform array batching
+	GLvoid *BatchInstanceOffsetPtr, *BatchSourceVertices; GLushort* BatchSourceIndices; GLsizeiptr BatchSourceVerticesSize, BatchSourceIndicesSize;
 
 	#ifdef ZL_VIDEO_WEAKCONTEXT
 	bool WeakIsAnimatedMesh;
@@ -696,11 +825,13 @@ struct ZL_Mesh_Impl : ZL_Impl
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, WeakIndicesSize, WeakIndices, GL_STATIC_DRAW);
 		glBindBuffer(GL_ARRAY_BUFFER, VertexBufferObject);
 		glBufferData(GL_ARRAY_BUFFER, WeakVertDataSize, WeakVertData, GL_STATIC_DRAW);
+		BatchBufferObjects[0] = BatchBufferObjects[1] = 0; //rebuilt on demand from the kept data
 	}
 	#endif
 
-	ZL_Mesh_Impl(GLubyte AttributeMask) : IndexBufferObject(0), VertexBufferObject(0), LastRenderFrame((GLuint)-1), ProvideAttributeMask(AttributeMask)
+	ZL_Mesh_Impl(GLubyte AttributeMask) : IndexBufferObject(0), VertexBufferObject(0), LastRenderFrame((GLuint)-1), ProvideAttributeMask(AttributeMask), BoundsRadius(0), NeverCull(false), BatchSourceVertices(NULL), BatchSourceIndices(NULL)
 	{
+		BatchBufferObjects[0] = BatchBufferObjects[1] = 0;
 		Stride = 3 * sizeof(GLscalar);
 		if (AttributeMask & VAMASK_NORMAL)   { NormalOffsetPtr   = (GLvoid*)(size_t)Stride; Stride += 3 * sizeof(GLscalar); }
 		if (AttributeMask & VAMASK_TEXCOORD) { TexCoordOffsetPtr = (GLvoid*)(size_t)Stride; Stride += 2 * sizeof(GLscalar); }
@@ -729,8 +860,10 @@ struct ZL_Mesh_Impl : ZL_Impl
 	~ZL_Mesh_Impl()
 	{
 		if (IndexBufferObject) glDeleteBuffers(2, &IndexBufferObject);
+		if (BatchBufferObjects[0]) glDeleteBuffers(2, BatchBufferObjects);
 		for (MeshPart* it = Parts; it != PartsEnd; ++it) it->Material->DelRef();
 		free(Parts);
+		ReleaseBatchSource();
 
 		#ifdef ZL_VIDEO_WEAKCONTEXT
 		if (IndexBufferObject) { free(WeakIndices); free(WeakVertData); g_LoadedMeshes->erase(std::find(g_LoadedMeshes->begin(), g_LoadedMeshes->end(), this)); }
@@ -773,6 +906,7 @@ struct ZL_Mesh_Impl : ZL_Impl
 		glBindBuffer(GL_ARRAY_BUFFER, VertexBufferObject);
 		glBufferData(GL_ARRAY_BUFFER, VerticesBufSize, Vertices, GL_STATIC_DRAW);
 		glBindBuffer(GL_ARRAY_BUFFER, g_Active3D.VertexBuffer);
+		CalculateBounds(Vertices, (size_t)(VerticesBufSize / Stride), true);
 
 		#if defined(ZILLALOG) && (0||ZL_DISPLAY3D_ASSERT_NORMALS_AND_TANGENTS)
 		ZL_ASSERTMSG(!(IndicesCount%3), "Indices do not make triangles");
@@ -805,6 +939,101 @@ struct ZL_Mesh_Impl : ZL_Impl
 		if (!g_LoadedMeshes) g_LoadedMeshes = new std::vector<struct ZL_Mesh_Impl*>();
 		g_LoadedMeshes->push_back(this);
 		#endif
+
+		//Without instanced draw calls, small meshes keep their data to build replicated batches on demand
+		if (g_InstancingMode == INSTANCING_BATCHES && !NeverCull && IndicesType == GL_UNSIGNED_SHORT && VerticesBufSize / Stride * g_MaxInstances <= 65536)
+		{
+			#ifdef ZL_VIDEO_WEAKCONTEXT
+			BatchSourceVertices = WeakVertData;
+			BatchSourceIndices = WeakIndices;
+			#else
+			BatchSourceVertices = malloc(VerticesBufSize); memcpy(BatchSourceVertices, Vertices, VerticesBufSize);
+			BatchSourceIndices = (GLushort*)malloc(IndicesBufSize); memcpy(BatchSourceIndices, Indices, IndicesBufSize);
+			#endif
+			BatchSourceVerticesSize = VerticesBufSize;
+			BatchSourceIndicesSize = IndicesBufSize;
+		}
+	}
+
+	void ReleaseBatchSource()
+	{
+		#ifndef ZL_VIDEO_WEAKCONTEXT
+		free(BatchSourceVertices);
+		free(BatchSourceIndices);
+		#endif
+		BatchSourceVertices = NULL;
+		BatchSourceIndices = NULL;
+	}
+
+	bool SupportsInstancing() const
+	{
+		return (!NeverCull && (g_InstancingMode == INSTANCING_HARDWARE || BatchBufferObjects[0] || BatchSourceVertices));
+	}
+
+	//Vertices of skinned meshes and of parts with a custom vertex or position shader function don't match the object space bounds
+	static bool MaterialMovesVertices(const ZL_Material_Impl* Material) { return (Material && (Material->MaterialModes & (ZL_MaterialModes::MM_VERTEXFUNC|ZL_MaterialModes::MM_POSITIONFUNC))); }
+	bool HasReliableBounds(const ZL_Material_Impl* OverrideMaterial = NULL) const
+	{
+		if (NeverCull) return false;
+		if (OverrideMaterial) return !MaterialMovesVertices(OverrideMaterial);
+		for (const MeshPart *p = Parts; p != PartsEnd; p++)
+			if (p->IndexCount && MaterialMovesVertices(p->Material)) return false;
+		return true;
+	}
+
+	//Upload g_MaxInstances copies of the vertices tagged with their copy index, and the indices of each part repeated for every copy
+	void BuildBatchBuffers()
+	{
+		size_t VertCount = (size_t)(BatchSourceVerticesSize / Stride), IndexCount = (size_t)BatchSourceIndicesSize / sizeof(GLushort);
+		size_t CopiesSize = (size_t)BatchSourceVerticesSize * g_MaxInstances, VerticesSize = CopiesSize + VertCount * g_MaxInstances * sizeof(GLscalar);
+		char* BatchVertices = (char*)malloc(VerticesSize);
+		GLscalar* InstanceIndices = (GLscalar*)(BatchVertices + CopiesSize);
+		GLushort* BatchIndices = (GLushort*)calloc(IndexCount * g_MaxInstances, sizeof(GLushort));
+		for (size_t k = 0; k != (size_t)g_MaxInstances; k++)
+		{
+			memcpy(BatchVertices + BatchSourceVerticesSize * k, BatchSourceVertices, BatchSourceVerticesSize);
+			for (size_t v = 0; v != VertCount; v++) InstanceIndices[k * VertCount + v] = (GLscalar)k;
+		}
+		for (MeshPart *p = Parts; p != PartsEnd; p++)
+		{
+			size_t First = (size_t)p->IndexOffsetPtr / sizeof(GLushort);
+			GLushort* Out = BatchIndices + First * g_MaxInstances;
+			for (size_t k = 0; k != (size_t)g_MaxInstances; k++)
+				for (GLsizei i = 0; i != p->IndexCount; i++)
+					*(Out++) = (GLushort)(BatchSourceIndices[First + i] + k * VertCount);
+		}
+		glGenBuffers(2, BatchBufferObjects);
+		glBindBuffer(GL_ARRAY_BUFFER, BatchBufferObjects[0]);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)VerticesSize, BatchVertices, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, g_Active3D.VertexBuffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, BatchBufferObjects[1]);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)(IndexCount * g_MaxInstances * sizeof(GLushort)), BatchIndices, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_Active3D.IndexBuffer);
+		BatchInstanceOffsetPtr = (GLvoid*)CopiesSize;
+		free(BatchVertices);
+		free(BatchIndices);
+		#ifndef ZL_VIDEO_WEAKCONTEXT
+		ReleaseBatchSource();
+		#endif
+	}
+
+	//Get (or with Reset false extend) the bounding box and the enclosing sphere from the positions at the start of each vertex
+	void CalculateBounds(const GLvoid* Vertices, size_t VertCount, bool Reset)
+	{
+		if (Reset) { BoundsMin = ZL_Vector3(S_MAX, S_MAX, S_MAX); BoundsMax = ZL_Vector3(-S_MAX, -S_MAX, -S_MAX); }
+		for (const char *v = (const char*)Vertices, *vEnd = v + Stride * VertCount; v != vEnd; v += Stride)
+		{
+			const GLscalar* p = (const GLscalar*)v;
+			if (p[0] < BoundsMin.x) BoundsMin.x = p[0];
+			if (p[1] < BoundsMin.y) BoundsMin.y = p[1];
+			if (p[2] < BoundsMin.z) BoundsMin.z = p[2];
+			if (p[0] > BoundsMax.x) BoundsMax.x = p[0];
+			if (p[1] > BoundsMax.y) BoundsMax.y = p[1];
+			if (p[2] > BoundsMax.z) BoundsMax.z = p[2];
+		}
+		if (BoundsMin.x > BoundsMax.x) { BoundsMin = BoundsMax = BoundsCenter = ZL_Vector3::Zero; BoundsRadius = 0; return; }
+		BoundsCenter = (BoundsMin + BoundsMax) * s(.5);
+		BoundsRadius = (BoundsMax - BoundsCenter).GetLength();
 	}
 
 	static unsigned char* ReadMeshFile(const ZL_FileLink& file)
@@ -1233,7 +1462,35 @@ struct ZL_Mesh_Impl : ZL_Impl
 	{
 		if (g_Active3D.Shader.UniformMatrixModel  != -1) glUniformMatrix4v(g_Active3D.Shader.UniformMatrixModel, 1, GL_FALSE, ModelMatrix.m);
 		if (g_Active3D.Shader.UniformMatrixNormal != -1) glUniformMatrix4v(g_Active3D.Shader.UniformMatrixNormal, 1, GL_FALSE, NormalMatrix.m);
-		GLuint RenderAttributeMask = (g_Active3D.Shader.UsedAttributeMask & ProvideAttributeMask), ChangeMask = (RenderAttributeMask ^ g_Active3D.AttributeMask);
+		BindBuffers(VertexBufferObject, IndexBufferObject, ProvideAttributeMask);
+		#ifdef ZL_VIDEO_GL_INSTANCING
+		if (p->InstanceCount) { glDrawElementsInstanced(GL_TRIANGLES, p->IndexCount, IndexBufferType, p->IndexOffsetPtr, p->InstanceCount); return; }
+		#endif
+		glDrawElements(GL_TRIANGLES, p->IndexCount, IndexBufferType, p->IndexOffsetPtr);
+	}
+
+	//Draw a part Count times (up to g_MaxInstances) with an instanced program active, taking the matrices of each instance from the arrays
+	void DrawPartInstanced(MeshPart* p, const ZL_Matrix* ModelMatrices, const ZL_Matrix* NormalMatrices, GLsizei Count)
+	{
+		ZL_STATIC_ASSERTMSG(sizeof(ZL_Matrix) == sizeof(scalar) * 16, BAD_MATRIX_SIZE);
+		if (g_Active3D.Shader.UniformMatrixModel  != -1) glUniformMatrix4v(g_Active3D.Shader.UniformMatrixModel, Count, GL_FALSE, ModelMatrices->m);
+		if (g_Active3D.Shader.UniformMatrixNormal != -1) glUniformMatrix4v(g_Active3D.Shader.UniformMatrixNormal, Count, GL_FALSE, NormalMatrices->m);
+		#ifdef ZL_VIDEO_GL_INSTANCING
+		if (g_InstancingMode == INSTANCING_HARDWARE)
+		{
+			BindBuffers(VertexBufferObject, IndexBufferObject, ProvideAttributeMask);
+			glDrawElementsInstanced(GL_TRIANGLES, p->IndexCount, IndexBufferType, p->IndexOffsetPtr, Count);
+			return;
+		}
+		#endif
+		if (!BatchBufferObjects[0]) BuildBatchBuffers();
+		BindBuffers(BatchBufferObjects[0], BatchBufferObjects[1], ProvideAttributeMask | VAMASK_INSTANCE);
+		glDrawElements(GL_TRIANGLES, p->IndexCount * Count, GL_UNSIGNED_SHORT, (GLvoid*)((size_t)p->IndexOffsetPtr * g_MaxInstances));
+	}
+
+	void BindBuffers(GLuint VertexBuffer, GLuint IndexBuffer, GLuint ProvideMask) const
+	{
+		GLuint RenderAttributeMask = (g_Active3D.Shader.UsedAttributeMask & ProvideMask), ChangeMask = (RenderAttributeMask ^ g_Active3D.AttributeMask);
 		if (ChangeMask)
 		{
 			if (ChangeMask & VAMASK_NORMAL  ) { if (RenderAttributeMask & VAMASK_NORMAL  ) glEnableVertexAttribArray(VA_NORMAL  ); else glDisableVertexAttribArray(VA_NORMAL  ); }
@@ -1242,13 +1499,14 @@ struct ZL_Mesh_Impl : ZL_Impl
 			if (ChangeMask & VAMASK_COLOR   ) { if (RenderAttributeMask & VAMASK_COLOR   ) glEnableVertexAttribArray(VA_COLOR   ); else glDisableVertexAttribArray(VA_COLOR   ); }
 			if (ChangeMask & VAMASK_JOINTS  ) { if (RenderAttributeMask & VAMASK_JOINTS  ) glEnableVertexAttribArray(VA_JOINTS  ); else glDisableVertexAttribArray(VA_JOINTS  ); }
 			if (ChangeMask & VAMASK_WEIGHTS ) { if (RenderAttributeMask & VAMASK_WEIGHTS ) glEnableVertexAttribArray(VA_WEIGHTS ); else glDisableVertexAttribArray(VA_WEIGHTS ); }
+			if (ChangeMask & VAMASK_INSTANCE) { if (RenderAttributeMask & VAMASK_INSTANCE) glEnableVertexAttribArray(VA_INSTANCE); else glDisableVertexAttribArray(VA_INSTANCE); }
 			g_Active3D.AttributeMask = RenderAttributeMask;
 			goto UpdateVertexBuffer;
 		}
-		if (g_Active3D.VertexBuffer != VertexBufferObject)
+		if (g_Active3D.VertexBuffer != VertexBuffer)
 		{
 			UpdateVertexBuffer:
-			glBindBuffer(GL_ARRAY_BUFFER, (g_Active3D.VertexBuffer = VertexBufferObject));
+			glBindBuffer(GL_ARRAY_BUFFER, (g_Active3D.VertexBuffer = VertexBuffer));
 			                                           glVertexAttribPointer(VA_POS,      3, GL_SCALAR,         GL_FALSE, Stride, NULL);
 			if (RenderAttributeMask & VAMASK_NORMAL  ) glVertexAttribPointer(VA_NORMAL,   3, GL_SCALAR,         GL_FALSE, Stride, NormalOffsetPtr);
 			if (RenderAttributeMask & VAMASK_TEXCOORD) glVertexAttribPointer(VA_TEXCOORD, 2, GL_SCALAR,         GL_FALSE, Stride, TexCoordOffsetPtr);
@@ -1256,12 +1514,12 @@ struct ZL_Mesh_Impl : ZL_Impl
 			if (RenderAttributeMask & VAMASK_COLOR   ) glVertexAttribPointer(VA_COLOR,    4, GL_UNSIGNED_BYTE,  GL_TRUE,  Stride, ColorOffsetPtr);
 			if (RenderAttributeMask & VAMASK_JOINTS  ) glVertexAttribPointer(VA_JOINTS,   4, GL_UNSIGNED_SHORT, GL_FALSE, Stride, JointsOffsetPtr);
 			if (RenderAttributeMask & VAMASK_WEIGHTS ) glVertexAttribPointer(VA_WEIGHTS,  4, GL_SCALAR,         GL_FALSE, Stride, WeightsOffsetPtr);
+			if (RenderAttributeMask & VAMASK_INSTANCE) glVertexAttribPointer(VA_INSTANCE, 1, GL_SCALAR,         GL_FALSE, 0,      BatchInstanceOffsetPtr);
 		}
-		if (g_Active3D.IndexBuffer != IndexBufferObject)
+		if (g_Active3D.IndexBuffer != IndexBuffer)
 		{
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (g_Active3D.IndexBuffer = IndexBufferObject));
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (g_Active3D.IndexBuffer = IndexBuffer));
 		}
-		glDrawElements(GL_TRIANGLES, p->IndexCount, IndexBufferType, p->IndexOffsetPtr);
 	}
 };
 
@@ -1276,7 +1534,7 @@ struct ZL_SkeletalMesh_Impl : public ZL_Mesh_Impl
 	ZL_Matrix* MeshBoneMatrices;
 	ZL_Matrix* InverseBoneMatrices;
 
-	ZL_SkeletalMesh_Impl(GLubyte AttributeMask) : ZL_Mesh_Impl(AttributeMask), BoneMemory(NULL) {}
+	ZL_SkeletalMesh_Impl(GLubyte AttributeMask) : ZL_Mesh_Impl(AttributeMask), BoneMemory(NULL) { NeverCull = true; }
 
 	~ZL_SkeletalMesh_Impl() { if (BoneMemory) free(BoneMemory); }
 
@@ -1492,6 +1750,8 @@ struct ZL_MeshAnimated_Impl : public ZL_Mesh_Impl
 		glBufferData(GL_ARRAY_BUFFER, Stride * VertCount, VertData, GL_STATIC_DRAW);
 		glBindBuffer(GL_ARRAY_BUFFER, g_Active3D.VertexBuffer);
 		FrameVertexBufferObjects.push_back(FrameVertexBufferObject);
+		CalculateBounds(VertData, (size_t)VertCount, false); //bounds enclose all frames
+		ReleaseBatchSource(); //replicated batches can't follow the frame switching
 
 		#ifdef ZL_VIDEO_WEAKCONTEXT
 		ZL_ASSERT(g_LoadedMeshes);ZL_ASSERT(IndexBufferObject);ZL_ASSERT(WeakVertDataSize == Stride * VertCount);
@@ -1577,20 +1837,59 @@ struct ZL_MeshAnimated_Impl : public ZL_Mesh_Impl
 	}
 };
 
+#if !defined(ZL_DOUBLE_PRECISCION) && (defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#include <xmmintrin.h>
+#define ZL_DISPLAY3D_SSE
+#elif !defined(ZL_DOUBLE_PRECISCION) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define ZL_DISPLAY3D_NEON
+#endif
+
+//Integrate one axis of the particle velocities and positions (v += g*dt, p += v*dt)
+static void ZL_ParticleEmitterIntegrate(scalar* Pos, scalar* Vel, size_t Count, scalar Gravity, scalar TimeElapsed)
+{
+	size_t i = 0;
+	#if defined(ZL_DISPLAY3D_SSE)
+	__m128 dv = _mm_set1_ps(Gravity * TimeElapsed), dt = _mm_set1_ps(TimeElapsed);
+	for (; i + 4 <= Count; i += 4)
+	{
+		__m128 v = _mm_add_ps(_mm_loadu_ps(Vel + i), dv);
+		_mm_storeu_ps(Vel + i, v);
+		_mm_storeu_ps(Pos + i, _mm_add_ps(_mm_loadu_ps(Pos + i), _mm_mul_ps(v, dt)));
+	}
+	#elif defined(ZL_DISPLAY3D_NEON)
+	float32x4_t dv = vdupq_n_f32(Gravity * TimeElapsed), dt = vdupq_n_f32(TimeElapsed);
+	for (; i + 4 <= Count; i += 4)
+	{
+		float32x4_t v = vaddq_f32(vld1q_f32(Vel + i), dv);
+		vst1q_f32(Vel + i, v);
+		vst1q_f32(Pos + i, vmlaq_f32(vld1q_f32(Pos + i), v, dt));
+	}
+	#endif
+	for (scalar dv1 = Gravity * TimeElapsed; i != Count; i++) { Vel[i] += dv1; Pos[i] += Vel[i] * TimeElapsed; }
+}
+
 struct ZL_ParticleEmitter_Impl : public ZL_Mesh_Impl
 {
-	struct sParticleMeta { scalar SpawnTime; ZL_Vector3 Velocity; sParticleMeta() : SpawnTime(s(-1)) {} };
 	struct sEmitter { scalar LifeTime, Chance; ZL_Vector3 Gravity, VelocityMins, VelocityMaxs; ZL_Vector3 ColorMin, ColorMax; scalar AlphaMin, AlphaMax, SizeMin, SizeMax; int TileCount, TileCols, TileMin, TileMax; bool TileOverTime, ColorOverTime, AlphaOverTime, SizeOverTime; };
 
-	std::vector<sParticleMeta> ParticleMeta;
+	//Active particles are stored packed in structure of arrays, the shader records get written in draw order on update
+	std::vector<scalar> SpawnTimes, PosX, PosY, PosZ, VelX, VelY, VelZ;
+	std::vector<ZL_Vector3> Colors, Props; //spawn color and (alpha, tile, size)
+	std::vector<scalar> SortDepths;
+	std::vector<GLushort> SortKeys;
+	std::vector<unsigned int> SortOrder, SortTemp;
 	std::vector<ZL_Vector3> ShaderData;
 	sEmitter Emitter;
-	size_t ActiveCount, MaxCount;
+	size_t ActiveCount, MaxCount, Capacity;
+	bool SortByDepth, HardwareInstancing;
 
 	enum { S_COUNT = 70, SD_HEADER = 3, SD_BODY = 3, SD_COUNT = SD_HEADER + S_COUNT * SD_BODY, P_INDEXES = 6 };
-	#define SD_COUNT_STR "213" //needs to be updated when changing above
+	#define SD_COUNT_STR "213" //these need to be updated when changing above
+	#define SD_HEADER_STR "3"
+	#define SD_BODY_STR "3"
 
-	ZL_ParticleEmitter_Impl(scalar LifeTime, size_t MaxParticles, ZL_MaterialModes::Blending BlendMode) : ZL_Mesh_Impl(0), ActiveCount(0), MaxCount(MaxParticles)
+	ZL_ParticleEmitter_Impl(scalar LifeTime, size_t MaxParticles, ZL_MaterialModes::Blending BlendMode) : ZL_Mesh_Impl(0), ActiveCount(0), MaxCount(MaxParticles), Capacity(0), SortByDepth(BlendMode == ZL_MaterialModes::OP_TRANSPARENT), HardwareInstancing(false)
 	{
 		memset((void*)&Emitter, 0, sizeof(Emitter)); // cast to void* to avoid GCC warning
 		Emitter.LifeTime = LifeTime;
@@ -1598,9 +1897,16 @@ struct ZL_ParticleEmitter_Impl : public ZL_Mesh_Impl
 		Emitter.ColorMin = Emitter.ColorMax = ZL_Vector3::One;
 		Emitter.SizeMin = Emitter.SizeMax = Emitter.AlphaMin = Emitter.AlphaMax = s(1);
 		Emitter.TileCount = Emitter.TileCols = 1;
+
+		//With hardware instancing a single quad gets drawn once per particle and finds its record by the instance id,
+		//otherwise the vertex buffer holds S_COUNT quads which have their record index stored in the z coordinate
+		#ifdef ZL_VIDEO_GL_INSTANCING
+		HardwareInstancing = (g_InstancingMode == INSTANCING_HARDWARE);
+		#endif
+		GLushort NumQuads = (HardwareInstancing ? 1 : S_COUNT);
 		GLscalar Verts[S_COUNT*4*3];
 		GLushort Indices[S_COUNT*P_INDEXES];
-		for (GLushort i = 0; i < S_COUNT; i++)
+		for (GLushort i = 0; i < NumQuads; i++)
 		{
 			Verts[i*4*3 + 3*0 + 0] = -HALF; Verts[i*4*3 + 3*0 + 1] =  HALF; Verts[i*4*3 + 3*0 + 2] = 3+i*3+HALF;
 			Verts[i*4*3 + 3*1 + 0] = -HALF; Verts[i*4*3 + 3*1 + 1] = -HALF; Verts[i*4*3 + 3*1 + 2] = 3+i*3+HALF;
@@ -1618,11 +1924,15 @@ struct ZL_ParticleEmitter_Impl : public ZL_Mesh_Impl
 		#endif
 
 		using namespace ZL_MaterialModes;
-		ZL_Material_Impl* Program = ZL_Material_Impl::GetMaterialReference(MM_VERTEXCOLOR | MM_DIFFUSEMAP | MM_VERTEXFUNC | MO_UNLIT | MO_CASTNOSHADOW | BlendMode, NULL, 
+		ZL_Material_Impl* Program = ZL_Material_Impl::GetMaterialReference(MM_VERTEXCOLOR | MM_DIFFUSEMAP | MM_VERTEXFUNC | MO_UNLIT | MO_CASTNOSHADOW | BlendMode | (HardwareInstancing ? ZL_Display3D_Shaders::MMDEF_INSTANCED : 0), NULL, 
 			"uniform vec3 sd[" SD_COUNT_STR "];"
 			"void Vertex()"
 			"{"
+				"\n#ifdef " Z3L_INSTANCE "\n"
+				"int i = " SD_HEADER_STR "+" Z3L_INSTANCE "*" SD_BODY_STR ";"
+				"\n#else\n"
 				"int i = int(" Z3A_POSITION ".z);"
+				"\n#endif\n"
 				"float sz = sd[i+2].z;"
 				Z3O_POSITION " = vec4(sd[i] + sd[0] * (" Z3A_POSITION ".x*sz) + sd[1] * (" Z3A_POSITION ".y*sz), 1);"
 				//"\n#ifndef " Z3D_SHADOWMAP "\n" //if used without MO_CASTNOSHADOW
@@ -1633,7 +1943,8 @@ struct ZL_ParticleEmitter_Impl : public ZL_Mesh_Impl
 			"}"
 		);
 
-		CreateAndFillBufferData(Indices, GL_UNSIGNED_SHORT, sizeof(Indices), Verts, sizeof(Verts));
+		NeverCull = true;
+		CreateAndFillBufferData(Indices, GL_UNSIGNED_SHORT, NumQuads * P_INDEXES * sizeof(GLushort), Verts, NumQuads * 4 * 3 * sizeof(GLscalar));
 		Parts = (MeshPart*)malloc(sizeof(MeshPart));
 		Parts[0] = MeshPart(ZL_NameID(), 0, NULL, Program, false);
 		PartsEnd = Parts+1;
@@ -1650,54 +1961,110 @@ struct ZL_ParticleEmitter_Impl : public ZL_Mesh_Impl
 		Emitter.TileOverTime = Animate;
 	}
 
+	inline ZL_Vector3* Record(size_t Slot) { return &ShaderData[SD_HEADER + ((Slot / S_COUNT) * SD_COUNT) + ((Slot % S_COUNT) * SD_BODY)]; }
+
+	//Add another mesh part with its own material instance and shader data for S_COUNT more particles
+	void AddPart()
+	{
+		size_t NewPartIdx = Capacity / S_COUNT, NewPartCount = NewPartIdx + 1;
+		if (NewPartIdx > 0)
+		{
+			Parts = (MeshPart*)realloc(Parts, sizeof(MeshPart) * NewPartCount);
+			Parts[NewPartIdx] = Parts[0];
+			Parts[NewPartIdx].Material = new ZL_MaterialInstance(Parts[0].Material, Parts[0].Material->MaterialModes, false);
+			PartsEnd = Parts + NewPartCount;
+		}
+
+		Capacity = NewPartCount * S_COUNT;
+		SpawnTimes.resize(Capacity); PosX.resize(Capacity); PosY.resize(Capacity); PosZ.resize(Capacity);
+		VelX.resize(Capacity); VelY.resize(Capacity); VelZ.resize(Capacity); Colors.resize(Capacity); Props.resize(Capacity);
+		ShaderData.resize(NewPartCount * SD_COUNT);
+		GLint Off = Parts[0].Material->ShaderProgram->GetUniformOffset("sd[0]", ZL_MaterialProgram::UniformEntry::TYPE_VEC3, true);
+		for (size_t Part = 0; Part < NewPartCount; Part++)
+		{
+			ZL_Material_Impl::UniformArrayValue* UniformSDArray = reinterpret_cast<ZL_Material_Impl::UniformArrayValue*>(Parts[Part].Material->UniformSet.Values+Off);
+			UniformSDArray->Count = SD_COUNT;
+			UniformSDArray->Ptr = (scalar*)&ShaderData[SD_COUNT * Part];
+			Parts[Part].Material->UniformSet.ValueChksum = (GLuint)(size_t)UniformSDArray->Ptr;
+		}
+	}
+
+	//Only draw the quads of slots holding particles, parts without any get skipped by the render list
+	void SetDrawCount(size_t Count)
+	{
+		for (MeshPart* it = Parts; it != PartsEnd; ++it, Count = (Count > S_COUNT ? Count - S_COUNT : 0))
+		{
+			GLsizei PartCount = (GLsizei)(Count > S_COUNT ? S_COUNT : Count);
+			if (HardwareInstancing) { it->IndexCount = (PartCount ? P_INDEXES : 0); it->InstanceCount = PartCount; }
+			else it->IndexCount = PartCount * P_INDEXES;
+		}
+	}
+
+	void WriteRecord(size_t Slot, size_t i)
+	{
+		ZL_Vector3* p = Record(Slot);
+		p[0] = ZLV3(PosX[i], PosY[i], PosZ[i]);
+		p[1] = Colors[i];
+		p[2] = Props[i];
+	}
+
 	void Spawn(const ZL_Vector3& Pos)
 	{
 		ZL_ASSERTMSG(LastRenderFrame != ZL_Application::FrameCount, "Can't spawn particles after already adding it to a render list");
 		if (ActiveCount == MaxCount || (Emitter.Chance < 1 && RAND_FACTOR > Emitter.Chance)) return;
-
-		sParticleMeta* m;
-		if (ActiveCount == ParticleMeta.size())
+		if (ActiveCount == Capacity) AddPart();
+
+		size_t i = ActiveCount++;
+		SpawnTimes[i] = ZLSECONDS;
+		PosX[i] = Pos.x; PosY[i] = Pos.y; PosZ[i] = Pos.z;
+		VelX[i] = RAND_RANGE(Emitter.VelocityMins.x,Emitter.VelocityMaxs.x);
+		VelY[i] = RAND_RANGE(Emitter.VelocityMins.y,Emitter.VelocityMaxs.y);
+		VelZ[i] = RAND_RANGE(Emitter.VelocityMins.z,Emitter.VelocityMaxs.z);
+		Colors[i] = (Emitter.ColorOverTime ? Emitter.ColorMin : ZL_Vector3::Lerp(Emitter.ColorMin, Emitter.ColorMax, RAND_FACTOR));
+		Props[i].x = (Emitter.AlphaOverTime ? Emitter.AlphaMin : ZL_Math::Lerp(Emitter.AlphaMin, Emitter.AlphaMax, RAND_FACTOR));
+		Props[i].y = s(Emitter.TileOverTime ? Emitter.TileMin : RAND_INT_RANGE(Emitter.TileMin, Emitter.TileMax));
+		Props[i].z = (Emitter.SizeOverTime ? Emitter.SizeMin : ZL_Math::Lerp(Emitter.SizeMin, Emitter.SizeMax, RAND_FACTOR));
+
+		//visible right away in the free slot after the particles written by the last update
+		WriteRecord(i, i);
+		SetDrawCount(ActiveCount);
+	}
+
+	void Remove(size_t i)
+	{
+		if (i == --ActiveCount) return;
+		SpawnTimes[i] = SpawnTimes[ActiveCount];
+		PosX[i] = PosX[ActiveCount]; PosY[i] = PosY[ActiveCount]; PosZ[i] = PosZ[ActiveCount];
+		VelX[i] = VelX[ActiveCount]; VelY[i] = VelY[ActiveCount]; VelZ[i] = VelZ[ActiveCount];
+		Colors[i] = Colors[ActiveCount];
+		Props[i] = Props[ActiveCount];
+	}
+
+	//Order the particles back to front with a two pass radix sort on their view depth quantized to 16 bit
+	void SortBackToFront(const ZL_Camera& Camera)
+	{
+		ZL_Vector3 CamPos = Camera.GetPosition(), CamDir = Camera.GetDirection();
+		SortDepths.resize(ActiveCount);
+		SortKeys.resize(ActiveCount);
+		SortTemp.resize(ActiveCount);
+		scalar DepthMin = S_MAX, DepthMax = -S_MAX;
+		for (size_t i = 0; i != ActiveCount; i++)
 		{
-			size_t NewPartIdx = ActiveCount / S_COUNT, NewPartCount = NewPartIdx + 1;
-			if (NewPartIdx > 0)
-			{
-				Parts = (MeshPart*)realloc(Parts, sizeof(MeshPart) * NewPartCount);
-				Parts[NewPartIdx] = Parts[0];
-				Parts[NewPartIdx].Material = new ZL_MaterialInstance(Parts[0].Material, Parts[0].Material->MaterialModes, false);
-				PartsEnd = Parts + NewPartCount;
-			}
-			else Parts[0].IndexCount = S_COUNT*P_INDEXES;
-
-			ParticleMeta.resize(NewPartCount * S_COUNT);
-			ShaderData.resize(NewPartCount * SD_COUNT);
-			GLint Off = Parts[0].Material->ShaderProgram->GetUniformOffset("sd[0]", ZL_MaterialProgram::UniformEntry::TYPE_VEC3, true);
-			for (size_t Part = 0; Part < NewPartCount; Part++)
-			{
-				ZL_Material_Impl::UniformArrayValue* UniformSDArray = reinterpret_cast<ZL_Material_Impl::UniformArrayValue*>(Parts[Part].Material->UniformSet.Values+Off);
-				UniformSDArray->Count = SD_COUNT;
-				UniformSDArray->Ptr = (scalar*)&ShaderData[SD_COUNT * Part];
-				Parts[Part].Material->UniformSet.ValueChksum = (GLuint)(size_t)UniformSDArray->Ptr;
-			}
-			m = &ParticleMeta[ActiveCount];
+			scalar Depth = SortDepths[i] = (PosX[i] - CamPos.x) * CamDir.x + (PosY[i] - CamPos.y) * CamDir.y + (PosZ[i] - CamPos.z) * CamDir.z;
+			if (Depth < DepthMin) DepthMin = Depth;
+			if (Depth > DepthMax) DepthMax = Depth;
 		}
-		else
+		scalar Quantize = (DepthMax > DepthMin ? s(65535) / (DepthMax - DepthMin) : 0);
+		for (size_t i = 0; i != ActiveCount; i++)
+			SortKeys[i] = (GLushort)((DepthMax - SortDepths[i]) * Quantize); //farthest particle gets key 0
+		for (int Shift = 0; Shift != 16; Shift += 8)
 		{
-			m = &ParticleMeta[0];
-			for (sParticleMeta* mEnd = m + ParticleMeta.size(); m != mEnd; m++)
-				if (m->SpawnTime < 0)
-					break;
+			size_t Offsets[256] = { 0 };
+			for (size_t i = 0; i != ActiveCount; i++) Offsets[(SortKeys[SortOrder[i]] >> Shift) & 0xFF]++;
+			for (size_t b = 0, Sum = 0; b != 256; b++) { size_t Count = Offsets[b]; Offsets[b] = Sum; Sum += Count; }
+			for (size_t i = 0; i != ActiveCount; i++) SortTemp[Offsets[(SortKeys[SortOrder[i]] >> Shift) & 0xFF]++] = SortOrder[i];
+			SortOrder.swap(SortTemp);
 		}
-
-		size_t i = (m - &ParticleMeta[0]);
-		ZL_Vector3* p = &ShaderData[SD_HEADER + ((i / S_COUNT) * SD_COUNT) + ((i % S_COUNT) * SD_BODY)];
-		m->SpawnTime = ZLSECONDS;
-		m->Velocity = ZLV3(RAND_RANGE(Emitter.VelocityMins.x,Emitter.VelocityMaxs.x), RAND_RANGE(Emitter.VelocityMins.y,Emitter.VelocityMaxs.y), RAND_RANGE(Emitter.VelocityMins.z,Emitter.VelocityMaxs.z));
-		p[0] = Pos;
-		if (!Emitter.ColorOverTime) p[1] = ZL_Vector3::Lerp(Emitter.ColorMin, Emitter.ColorMax, RAND_FACTOR);
-		if (!Emitter.AlphaOverTime) p[2].x = ZL_Math::Lerp(Emitter.AlphaMin, Emitter.AlphaMax, RAND_FACTOR);
-		if (!Emitter.TileOverTime)  p[2].y = s(RAND_INT_RANGE(Emitter.TileMin, Emitter.TileMax));
-		if (!Emitter.SizeOverTime)  p[2].z = ZL_Math::Lerp(Emitter.SizeMin, Emitter.SizeMax, RAND_FACTOR);
-		ActiveCount++;
 	}
 
 	void Update(const ZL_Camera& Camera)
@@ -1706,49 +2073,117 @@ struct ZL_ParticleEmitter_Impl : public ZL_Mesh_Impl
 
 		scalar TimeNow = ZLSECONDS, TimeElapsed = ZLELAPSED;
 		//static scalar s_TimeSum = 0; TimeNow = (s_TimeSum += (TimeElapsed = MIN(TimeElapsed, s(.1))));
+		for (size_t i = 0; i < ActiveCount; i++)
+			if ((TimeNow - SpawnTimes[i]) / Emitter.LifeTime > 1)
+				Remove(i--);
+
+		ZL_ParticleEmitterIntegrate(&PosX[0], &VelX[0], ActiveCount, Emitter.Gravity.x, TimeElapsed);
+		ZL_ParticleEmitterIntegrate(&PosY[0], &VelY[0], ActiveCount, Emitter.Gravity.y, TimeElapsed);
+		ZL_ParticleEmitterIntegrate(&PosZ[0], &VelZ[0], ActiveCount, Emitter.Gravity.z, TimeElapsed);
+
+		if (Emitter.ColorOverTime || Emitter.AlphaOverTime || Emitter.TileOverTime || Emitter.SizeOverTime)
+		{
+			for (size_t i = 0; i != ActiveCount; i++)
+			{
+				scalar t = (TimeNow - SpawnTimes[i]) / Emitter.LifeTime;
+				if (Emitter.ColorOverTime) Colors[i] = ZL_Vector3::Lerp(Emitter.ColorMin, Emitter.ColorMax, t);
+				if (Emitter.AlphaOverTime) Props[i].x = ZL_Math::Lerp(Emitter.AlphaMin, Emitter.AlphaMax, t);
+				if (Emitter.TileOverTime)  Props[i].y = s((int)(Emitter.TileMin + (Emitter.TileMax-Emitter.TileMin+s(.999)) * t));
+				if (Emitter.SizeOverTime)  Props[i].z = ZL_Math::Lerp(Emitter.SizeMin, Emitter.SizeMax, t);
+			}
+		}
+
+		SortOrder.resize(ActiveCount);
+		for (size_t i = 0; i != ActiveCount; i++) SortOrder[i] = (unsigned int)i;
+		if (SortByDepth && ActiveCount > 1) SortBackToFront(Camera);
+
 		ZL_Vector3 CamRight = Camera.GetRightDirection();
 		ZL_Vector3 CamUp = Camera.GetUpDirection();
 		ZL_Vector3 SpriteSize = ZLV3(s(1)/Emitter.TileCols, s(1)/(Emitter.TileCount/Emitter.TileCols), Emitter.TileCols);
-		ZL_Vector3* p = &ShaderData[0];
-		sParticleMeta* m = &ParticleMeta[0];
-		for (size_t i = 0; i < ParticleMeta.size(); i++, m++, p+=3)
+		for (size_t Part = 0; Part * S_COUNT < ActiveCount; Part++)
 		{
-			if (!(i % S_COUNT))
-			{
-				*(p++) = CamRight;
-				*(p++) = CamUp;
-				*(p++) = SpriteSize;
-				Parts[i / S_COUNT].Material->UniformSet.ValueChksum ^= 1;
-			}
-			if (m->SpawnTime < 0) continue;
+			ZL_Vector3* p = &ShaderData[Part * SD_COUNT];
+			p[0] = CamRight;
+			p[1] = CamUp;
+			p[2] = SpriteSize;
+			Parts[Part].Material->UniformSet.ValueChksum ^= 1;
+		}
+		for (size_t Slot = 0; Slot != ActiveCount; Slot++) WriteRecord(Slot, SortOrder[Slot]);
+		SetDrawCount(ActiveCount);
+	}
+};
 
-			scalar t = (TimeNow - m->SpawnTime) / Emitter.LifeTime;
-			if (t > 1)
-			{
-				ActiveCount--;
-				m->SpawnTime = s(-1);
-				p[0].x = S_MAX;
-				p[2].z = 0;
-				continue;
-			}
+//Frustum planes extracted from a view projection matrix, stored as structure of arrays to test a sphere against all planes at once
+struct ZL_FrustumPlanes
+{
+	scalar X[8], Y[8], Z[8], D[8]; //6 planes pointing inwards, padded with 2 planes that never reject
 
-			m->Velocity += Emitter.Gravity * TimeElapsed;
-			p[0] += m->Velocity * TimeElapsed;
-			if (Emitter.ColorOverTime) p[1] = ZL_Vector3::Lerp(Emitter.ColorMin, Emitter.ColorMax, t);
-			if (Emitter.AlphaOverTime) p[2].x = ZL_Math::Lerp(Emitter.AlphaMin, Emitter.AlphaMax, t);
-			if (Emitter.TileOverTime)  p[2].y = s((int)(Emitter.TileMin + (Emitter.TileMax-Emitter.TileMin+s(.999)) * t));
-			if (Emitter.SizeOverTime)  p[2].z = ZL_Math::Lerp(Emitter.SizeMin, Emitter.SizeMax, t);
+	ZL_FrustumPlanes(const ZL_Matrix& VP)
+	{
+		const scalar* m = VP.m;
+		for (int i = 0; i != 6; i++)
+		{
+			int Row = (i >> 1); scalar Sign = ((i & 1) ? s(-1) : s(1));
+			scalar a = m[3] + m[Row] * Sign, b = m[7] + m[4+Row] * Sign, c = m[11] + m[8+Row] * Sign, d = m[15] + m[12+Row] * Sign;
+			scalar Len = ssqrt(a*a + b*b + c*c), InvLen = (Len > 0 ? s(1) / Len : s(0));
+			X[i] = a * InvLen; Y[i] = b * InvLen; Z[i] = c * InvLen; D[i] = d * InvLen;
 		}
+		X[6] = X[7] = Y[6] = Y[7] = Z[6] = Z[7] = 0;
+		D[6] = D[7] = S_MAX;
+	}
+
+	bool IsSphereOutside(const ZL_Vector3& Center, scalar Radius) const
+	{
+		#if defined(ZL_DISPLAY3D_SSE)
+		__m128 cx = _mm_set1_ps(Center.x), cy = _mm_set1_ps(Center.y), cz = _mm_set1_ps(Center.z), nr = _mm_set1_ps(-Radius);
+		__m128 d0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(X  ), cx), _mm_mul_ps(_mm_loadu_ps(Y  ), cy)), _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(Z  ), cz), _mm_loadu_ps(D  )));
+		__m128 d1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(X+4), cx), _mm_mul_ps(_mm_loadu_ps(Y+4), cy)), _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(Z+4), cz), _mm_loadu_ps(D+4)));
+		return (_mm_movemask_ps(_mm_or_ps(_mm_cmplt_ps(d0, nr), _mm_cmplt_ps(d1, nr))) != 0);
+		#elif defined(ZL_DISPLAY3D_NEON)
+		float32x4_t cx = vdupq_n_f32(Center.x), cy = vdupq_n_f32(Center.y), cz = vdupq_n_f32(Center.z), nr = vdupq_n_f32(-Radius);
+		float32x4_t d0 = vmlaq_f32(vmlaq_f32(vmlaq_f32(vld1q_f32(D  ), vld1q_f32(X  ), cx), vld1q_f32(Y  ), cy), vld1q_f32(Z  ), cz);
+		float32x4_t d1 = vmlaq_f32(vmlaq_f32(vmlaq_f32(vld1q_f32(D+4), vld1q_f32(X+4), cx), vld1q_f32(Y+4), cy), vld1q_f32(Z+4), cz);
+		uint32x4_t Out = vorrq_u32(vcltq_f32(d0, nr), vcltq_f32(d1, nr));
+		uint32x2_t Out2 = vorr_u32(vget_low_u32(Out), vget_high_u32(Out));
+		return ((vget_lane_u32(Out2, 0) | vget_lane_u32(Out2, 1)) != 0);
+		#else
+		for (int i = 0; i != 6; i++)
+			if (X[i] * Center.x + Y[i] * Center.y + Z[i] * Center.z + D[i] < -Radius) return true;
+		return false;
+		#endif
+	}
+
+	//Returns -1 if the box is completely outside, 1 if it is completely inside and 0 if it intersects the frustum
+	int ClassifyBox(const ZL_Vector3& Min, const ZL_Vector3& Max) const
+	{
+		ZL_Vector3 Center = (Min + Max) * s(.5), Extent = (Max - Min) * s(.5);
+		int Res = 1;
+		for (int i = 0; i != 6; i++)
+		{
+			scalar Dist = X[i] * Center.x + Y[i] * Center.y + Z[i] * Center.z + D[i], Radius = sabs(X[i]) * Extent.x + sabs(Y[i]) * Extent.y + sabs(Z[i]) * Extent.z;
+			if (Dist < -Radius) return -1;
+			if (Dist < Radius) Res = 0;
+		}
+		return Res;
 	}
 };
 
 struct ZL_RenderList_Impl : public ZL_Impl
 {
-	struct MeshEntry { ZL_Mesh_Impl* Mesh; ZL_Matrix ModelMatrix, NormalMatrix; MeshEntry(ZL_Mesh_Impl* Mesh, const ZL_Matrix& ModelMatrix, bool UseNormalMatrix) : Mesh(Mesh), ModelMatrix(ModelMatrix) { if (UseNormalMatrix) NormalMatrix = ModelMatrix.GetInverseTransposed(); else NormalMatrix.m[0] = FLT_MAX; } };
-	struct PartEntry { ZL_Mesh_Impl::MeshPart* Part; ZL_Material_Impl* Material; GLushort MeshIndex; GLuint Checksum; PartEntry(ZL_Mesh_Impl::MeshPart* Part, ZL_Material_Impl* Material, GLushort MeshIndex, GLuint Checksum) : Part(Part), Material(Material), MeshIndex(MeshIndex), Checksum(Checksum) {} };
+	struct MeshEntry
+	{
+		ZL_Mesh_Impl* Mesh; ZL_Matrix ModelMatrix, NormalMatrix; ZL_Vector3 CullCenter; scalar CullRadius; bool NeverCull;
+		MeshEntry(ZL_Mesh_Impl* Mesh, const ZL_Matrix& ModelMatrix, bool UseNormalMatrix, bool NeverCull) : Mesh(Mesh), ModelMatrix(ModelMatrix), NeverCull(NeverCull) { if (UseNormalMatrix) NormalMatrix = ModelMatrix.GetInverseTransposed(); else NormalMatrix.m[0] = FLT_MAX; UpdateCullSphere(); }
+		void UpdateCullSphere() { ZL_Vector3 Scale = ModelMatrix.GetScale(); CullCenter = ModelMatrix.TransformPosition(Mesh->BoundsCenter); CullRadius = (NeverCull ? s(-1) : Mesh->BoundsRadius * MAX(Scale.x, MAX(Scale.y, Scale.z))); }
+	};
+	struct PartEntry { ZL_Mesh_Impl::MeshPart* Part; ZL_Material_Impl* Material; GLushort MeshIndex; GLuint Checksum; bool Instanced; PartEntry(ZL_Mesh_Impl::MeshPart* Part, ZL_Material_Impl* Material, GLushort MeshIndex, GLuint Checksum, bool Instanced) : Part(Part), Material(Material), MeshIndex(MeshIndex), Checksum(Checksum), Instanced(Instanced) {} };
 	std::vector<ZL_Mesh_Impl*> ReferencedMeshes;
 	std::vector<MeshEntry> Meshes;
 	std::vector<PartEntry> Parts;
+	std::vector<GLubyte> MeshVisible;
+	ZL_Matrix InstanceModels[Z3MAX_INSTANCES], InstanceNormals[Z3MAX_INSTANCES];
+	unsigned int statDrawn, statCulled, statInstanced;
+	ZL_RenderList_Impl() : statDrawn(0), statCulled(0), statInstanced(0) { }
 	~ZL_RenderList_Impl() { Reset(); }
 
 	void Reset()
@@ -1762,16 +2197,16 @@ struct ZL_RenderList_Impl : public ZL_Impl
 	void Add(ZL_Mesh_Impl* mesh, const ZL_Matrix& matrix, ZL_Material_Impl* OverrideMaterial)
 	{
 		GLushort MeshIndex = (GLushort)Meshes.size();
-		bool UseNormalMatrix = false;
+		bool UseNormalMatrix = false, Instanced = mesh->SupportsInstancing();
 		for (ZL_Mesh_Impl::MeshPart *p = mesh->Parts; p != mesh->PartsEnd; p++)
 		{
 			if (!p->IndexCount) continue;
 			ZL_Material_Impl* m = (OverrideMaterial ? OverrideMaterial : p->Material);
 			if (m->ShaderProgram->ShaderIDs.UniformMatrixNormal != -1) UseNormalMatrix = true;
-			Parts.push_back(PartEntry(p, m, MeshIndex, (m->ShaderProgram->ShaderIDs.Program ^ m->UniformSet.ValueChksum ^ m->UniformSet.TextureChksum)));
+			Parts.push_back(PartEntry(p, m, MeshIndex, (m->ShaderProgram->ShaderIDs.Program ^ m->UniformSet.ValueChksum ^ m->UniformSet.TextureChksum), Instanced));
 		}
 		mesh->LastRenderFrame = ZL_Application::FrameCount;
-		Meshes.push_back(MeshEntry(mesh, matrix, UseNormalMatrix));
+		Meshes.push_back(MeshEntry(mesh, matrix, UseNormalMatrix, !mesh->HasReliableBounds(OverrideMaterial)));
 	}
 
 	void AddReferenced(ZL_Mesh_Impl* mesh, const ZL_Matrix& matrix)
@@ -1788,17 +2223,61 @@ struct ZL_RenderList_Impl : public ZL_Impl
 			const ZL_Material_Impl *am = a.Material, *bm = b.Material;
 			if ((am->MaterialModes & ZL_Display3D_Shaders::MMDEF_NODEPTHWRITE) != (bm->MaterialModes & ZL_Display3D_Shaders::MMDEF_NODEPTHWRITE)) return !(am->MaterialModes & ZL_Display3D_Shaders::MMDEF_NODEPTHWRITE);
 			const ZL_MaterialProgram *ap = am->ShaderProgram, *bp = bm->ShaderProgram;
-			return (ap->ShadowMapProgram == bp->ShadowMapProgram ? ap < bp : ap->ShadowMapProgram < bp->ShadowMapProgram);
+			if (ap->ShadowMapProgram != bp->ShadowMapProgram) return ap->ShadowMapProgram < bp->ShadowMapProgram;
+			if (ap != bp) return ap < bp;
+			return (am == bm ? a.Part < b.Part : am < bm); //keep repeated parts next to each other for instanced drawing
 		}};
 		std::sort(Parts.begin(), Parts.end(), Func::SortByMaterial);
 	}
 
+	//Test the bounding sphere of every mesh against the frustum of the active camera (which is the light in shadow map passes)
+	void CullMeshes(const ZL_RenderSceneSetup& Scene)
+	{
+		MeshVisible.resize(Meshes.size());
+		if (Meshes.empty()) return;
+		if (!Scene.Camera->Size) { memset(&MeshVisible[0], 1, Meshes.size()); return; } //light without projection has no frustum
+		ZL_FrustumPlanes Frustum(Scene.Camera->VP);
+		for (size_t i = 0; i != Meshes.size(); i++)
+			MeshVisible[i] = (Meshes[i].CullRadius < 0 || !Frustum.IsSphereOutside(Meshes[i].CullCenter, Meshes[i].CullRadius));
+	}
+
+	//Draw the run of entries starting at e that share the same part and material with instanced draw calls of up to g_MaxInstances visible meshes each
+	bool DrawInstanced(PartEntry*& e, PartEntry* eEnd, const ZL_RenderSceneSetup& Scene, bool ShadowMap)
+	{
+		ZL_MaterialProgram* Program = e->Material->ShaderProgram->GetInstancedProgram();
+		if (Program && ShadowMap) Program = Program->ShadowMapProgram;
+		if (!Program) return false;
+		Program->Activate(e->Material->UniformSet, Scene);
+		for (PartEntry *eRun = e; e != eEnd && e->Part == eRun->Part && e->Material == eRun->Material;)
+		{
+			GLsizei Count = 0;
+			for (; e != eEnd && e->Part == eRun->Part && e->Material == eRun->Material && Count != g_MaxInstances; e++)
+			{
+				if (!MeshVisible[e->MeshIndex]) { statCulled++; continue; }
+				MeshEntry& me = Meshes[e->MeshIndex];
+				InstanceModels[Count] = me.ModelMatrix;
+				InstanceNormals[Count] = me.NormalMatrix;
+				Count++;
+			}
+			if (!Count) continue;
+			Meshes[eRun->MeshIndex].Mesh->DrawPartInstanced(eRun->Part, InstanceModels, InstanceNormals, Count);
+			statDrawn += Count;
+			statInstanced += Count;
+		}
+		e--; //point to the last entry of the run for the loop increment
+		return true;
+	}
+
 	void RenderShadowMap(const ZL_RenderSceneSetup& Scene)
 	{
 		GLuint ActiveChecksum = 0;
+		CullMeshes(Scene);
 		for (ZL_RenderList_Impl::PartEntry *e = (Parts.empty() ? NULL : &Parts[0]), *eEnd = e + Parts.size(); e != eEnd; e++)
 		{
 			if (e->Material->MaterialModes & ZL_MaterialModes::MO_CASTNOSHADOW) continue;
+			if (e->Instanced && e + 1 != eEnd && e[1].Part == e->Part && e[1].Material == e->Material && DrawInstanced(e, eEnd, Scene, true)) { ActiveChecksum = 0; continue; }
+			if (!MeshVisible[e->MeshIndex]) { statCulled++; continue; }
+			statDrawn++;
 			if (ActiveChecksum != e->Checksum)
 			{
 				ActiveChecksum = e->Checksum;
@@ -1813,8 +2292,11 @@ struct ZL_RenderList_Impl : public ZL_Impl
 	{
 		using namespace ZL_Display3D_Shaders; using namespace ZL_MaterialModes;
 		GLuint ActiveChecksum = 0, MaterialOptions = 0;
+		CullMeshes(Scene);
 		for (ZL_RenderList_Impl::PartEntry *e = (Parts.empty() ? NULL : &Parts[0]), *eEnd = e + Parts.size(); e != eEnd; e++)
 		{
+			bool Run = (e->Instanced && e + 1 != eEnd && e[1].Part == e->Part && e[1].Material == e->Material);
+			if (!Run && !MeshVisible[e->MeshIndex]) { statCulled++; continue; }
 			enum { MMDEF_WATCHOPTIONS = MMDEF_NODEPTHWRITE|MO_IGNOREDEPTH|MO_ADDITIVE|MO_MODULATE };
 			if (MaterialOptions != (e->Material->MaterialModes & MMDEF_WATCHOPTIONS))
 			{
@@ -1829,6 +2311,9 @@ struct ZL_RenderList_Impl : public ZL_Impl
 				if (!(NewOptions & MO_MODULATE) && (MaterialOptions & MO_MODULATE)) glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 				MaterialOptions = NewOptions;
 			}
+			if (Run && DrawInstanced(e, eEnd, Scene, false)) { ActiveChecksum = 0; continue; }
+			if (!MeshVisible[e->MeshIndex]) { statCulled++; continue; }
+			statDrawn++;
 			if (ActiveChecksum != e->Checksum)
 			{
 				ActiveChecksum = e->Checksum;
@@ -1843,6 +2328,322 @@ struct ZL_RenderList_Impl : public ZL_Impl
 	}
 };
 
+struct ZL_SceneBVH_Impl : public ZL_Impl
+{
+	enum { LEAF_SIZE = 4, MAX_LEAF_SIZE = 16, SAH_BINS = 12, MAX_DEPTH = 48 };
+	struct Object { ZL_Mesh_Impl* Mesh; ZL_Matrix Matrix; ZL_Vector3 Min, Max; };
+	struct Node { ZL_Vector3 Min, Max; unsigned int First, Count; }; //inner nodes have a count of 0 and their two children at First and First+1
+	std::vector<Object> Objects;
+	std::vector<Node> Nodes;
+	std::vector<unsigned int> Indices, Unbounded; //object indices referenced by the leaf nodes and objects that are not part of the tree
+	bool NeedBuild, NeedRefit;
+	ZL_SceneBVH_Impl() : NeedBuild(false), NeedRefit(false) { }
+	~ZL_SceneBVH_Impl() { Clear(); }
+
+	void Clear()
+	{
+		for (std::vector<Object>::iterator it = Objects.begin(); it != Objects.end(); ++it) it->Mesh->DelRef();
+		Objects.clear();
+		Nodes.clear();
+		Indices.clear();
+		Unbounded.clear();
+		NeedBuild = NeedRefit = false;
+	}
+
+	size_t Add(ZL_Mesh_Impl* Mesh, const ZL_Matrix& Matrix)
+	{
+		Mesh->AddRef();
+		Objects.push_back(Object());
+		Object& o = Objects.back();
+		o.Mesh = Mesh;
+		o.Matrix = Matrix;
+		UpdateObjectBounds(o);
+		NeedBuild = true;
+		return Objects.size() - 1;
+	}
+
+	void SetMatrix(size_t ObjectIndex, const ZL_Matrix& Matrix)
+	{
+		Object& o = Objects[ObjectIndex];
+		o.Matrix = Matrix;
+		UpdateObjectBounds(o);
+		NeedRefit = true;
+	}
+
+	//World space box around the transformed local bounding box of the mesh
+	static void UpdateObjectBounds(Object& o)
+	{
+		const scalar* m = o.Matrix.m;
+		ZL_Vector3 Half = (o.Mesh->BoundsMax - o.Mesh->BoundsMin) * s(.5), Center = o.Matrix.TransformPosition((o.Mesh->BoundsMin + o.Mesh->BoundsMax) * s(.5));
+		ZL_Vector3 Extent(sabs(m[0]) * Half.x + sabs(m[4]) * Half.y + sabs(m[8]) * Half.z, sabs(m[1]) * Half.x + sabs(m[5]) * Half.y + sabs(m[9]) * Half.z, sabs(m[2]) * Half.x + sabs(m[6]) * Half.y + sabs(m[10]) * Half.z);
+		o.Min = Center - Extent;
+		o.Max = Center + Extent;
+	}
+
+	static inline void GrowBox(ZL_Vector3& Min, ZL_Vector3& Max, const ZL_Vector3& AddMin, const ZL_Vector3& AddMax)
+	{
+		Min.x = MIN(Min.x, AddMin.x); Max.x = MAX(Max.x, AddMax.x);
+		Min.y = MIN(Min.y, AddMin.y); Max.y = MAX(Max.y, AddMax.y);
+		Min.z = MIN(Min.z, AddMin.z); Max.z = MAX(Max.z, AddMax.z);
+	}
+
+	static inline scalar HalfArea(const ZL_Vector3& Min, const ZL_Vector3& Max)
+	{
+		ZL_Vector3 e = Max - Min;
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+
+	static inline bool BoxesOverlap(const ZL_Vector3& AMin, const ZL_Vector3& AMax, const ZL_Vector3& BMin, const ZL_Vector3& BMax)
+	{
+		return (AMin.x <= BMax.x && AMax.x >= BMin.x && AMin.y <= BMax.y && AMax.y >= BMin.y && AMin.z <= BMax.z && AMax.z >= BMin.z);
+	}
+
+	//Distance along the ray to where it enters the box (0 if it starts inside) or S_MAX if it misses the box before MaxT
+	static inline scalar RayBoxT(const ZL_Vector3& Start, const ZL_Vector3& InvDir, const ZL_Vector3& Min, const ZL_Vector3& Max, scalar MaxT)
+	{
+		scalar tx1 = (Min.x - Start.x) * InvDir.x, tx2 = (Max.x - Start.x) * InvDir.x, tMin = MIN(tx1, tx2), tMax = MAX(tx1, tx2);
+		scalar ty1 = (Min.y - Start.y) * InvDir.y, ty2 = (Max.y - Start.y) * InvDir.y; tMin = MAX(tMin, MIN(ty1, ty2)); tMax = MIN(tMax, MAX(ty1, ty2));
+		scalar tz1 = (Min.z - Start.z) * InvDir.z, tz2 = (Max.z - Start.z) * InvDir.z; tMin = MAX(tMin, MIN(tz1, tz2)); tMax = MIN(tMax, MAX(tz1, tz2));
+		if (tMin < 0) tMin = 0;
+		return (tMin <= tMax && tMin <= MaxT ? tMin : S_MAX);
+	}
+
+	static inline ZL_Vector3 InverseDirection(const ZL_Vector3& Dir)
+	{
+		return ZL_Vector3((Dir.x ? s(1) / Dir.x : S_MAX), (Dir.y ? s(1) / Dir.y : S_MAX), (Dir.z ? s(1) / Dir.z : S_MAX));
+	}
+
+	void Update()
+	{
+		if (NeedBuild) Build();
+		else if (NeedRefit) Refit();
+	}
+
+	void Build()
+	{
+		NeedBuild = NeedRefit = false;
+		Nodes.clear();
+		Indices.clear();
+		Unbounded.clear();
+		for (unsigned int i = 0; i != (unsigned int)Objects.size(); i++)
+			(Objects[i].Mesh->HasReliableBounds() ? Indices : Unbounded).push_back(i); //meshes deformed by the shader are not part of the tree
+		if (Indices.empty()) return;
+		Nodes.reserve(Indices.size() * 2);
+		Nodes.resize(1);
+		Subdivide(0, 0, (unsigned int)Indices.size(), 0);
+	}
+
+	struct CentroidLess
+	{
+		const Object* Objs; int Axis;
+		CentroidLess(const Object* Objs, int Axis) : Objs(Objs), Axis(Axis) { }
+		bool operator()(unsigned int a, unsigned int b) const { return (&Objs[a].Min.x)[Axis] + (&Objs[a].Max.x)[Axis] < (&Objs[b].Min.x)[Axis] + (&Objs[b].Max.x)[Axis]; }
+	};
+
+	//Split a node with the binned surface area heuristic, falling back to a median split for large nodes that the heuristic would keep as leaf
+	void Subdivide(unsigned int NodeIndex, unsigned int First, unsigned int Count, int Depth)
+	{
+		ZL_Vector3 Min(S_MAX, S_MAX, S_MAX), Max(-S_MAX, -S_MAX, -S_MAX), CMin = Min, CMax = Max;
+		for (unsigned int i = First; i != First + Count; i++)
+		{
+			const Object& o = Objects[Indices[i]];
+			ZL_Vector3 Centroid = (o.Min + o.Max) * s(.5);
+			GrowBox(Min, Max, o.Min, o.Max);
+			GrowBox(CMin, CMax, Centroid, Centroid);
+		}
+		Node& n = Nodes[NodeIndex];
+		n.Min = Min; n.Max = Max; n.First = First; n.Count = Count;
+		if (Count <= LEAF_SIZE) return;
+
+		int BestAxis = -1, BestBin = 0;
+		scalar BestCost = HalfArea(Min, Max) * Count;
+		struct Bin { ZL_Vector3 Min, Max; unsigned int Count; };
+		for (int Axis = 0; Axis != 3 && Depth < MAX_DEPTH; Axis++)
+		{
+			scalar CentroidMin = (&CMin.x)[Axis], CentroidExtent = (&CMax.x)[Axis] - CentroidMin;
+			if (CentroidExtent <= 0) continue;
+			Bin Bins[SAH_BINS];
+			for (int b = 0; b != SAH_BINS; b++) { Bins[b].Min = ZL_Vector3(S_MAX, S_MAX, S_MAX); Bins[b].Max = ZL_Vector3(-S_MAX, -S_MAX, -S_MAX); Bins[b].Count = 0; }
+			scalar BinScale = SAH_BINS / CentroidExtent;
+			for (unsigned int i = First; i != First + Count; i++)
+			{
+				const Object& o = Objects[Indices[i]];
+				int b = MIN(SAH_BINS - 1, (int)(((&o.Min.x)[Axis] + (&o.Max.x)[Axis] - CentroidMin * 2) * s(.5) * BinScale));
+				GrowBox(Bins[b].Min, Bins[b].Max, o.Min, o.Max);
+				Bins[b].Count++;
+			}
+			scalar LeftArea[SAH_BINS - 1]; unsigned int LeftCount[SAH_BINS - 1];
+			ZL_Vector3 SweepMin(S_MAX, S_MAX, S_MAX), SweepMax(-S_MAX, -S_MAX, -S_MAX); unsigned int SweepCount = 0;
+			for (int b = 0; b != SAH_BINS - 1; b++)
+			{
+				if (Bins[b].Count) { GrowBox(SweepMin, SweepMax, Bins[b].Min, Bins[b].Max); SweepCount += Bins[b].Count; }
+				LeftArea[b] = (SweepCount ? HalfArea(SweepMin, SweepMax) : 0);
+				LeftCount[b] = SweepCount;
+			}
+			SweepMin = ZL_Vector3(S_MAX, S_MAX, S_MAX); SweepMax = ZL_Vector3(-S_MAX, -S_MAX, -S_MAX); SweepCount = 0;
+			for (int b = SAH_BINS - 1; b != 0; b--)
+			{
+				if (Bins[b].Count) { GrowBox(SweepMin, SweepMax, Bins[b].Min, Bins[b].Max); SweepCount += Bins[b].Count; }
+				if (!SweepCount || !LeftCount[b - 1]) continue;
+				scalar Cost = LeftArea[b - 1] * LeftCount[b - 1] + HalfArea(SweepMin, SweepMax) * SweepCount;
+				if (Cost < BestCost) { BestCost = Cost; BestAxis = Axis; BestBin = b; }
+			}
+		}
+
+		unsigned int Mid;
+		if (BestAxis >= 0)
+		{
+			scalar CentroidMin = (&CMin.x)[BestAxis], BinScale = SAH_BINS / ((&CMax.x)[BestAxis] - CentroidMin);
+			unsigned int Left = First, Right = First + Count;
+			while (Left != Right)
+			{
+				const Object& o = Objects[Indices[Left]];
+				int b = MIN(SAH_BINS - 1, (int)(((&o.Min.x)[BestAxis] + (&o.Max.x)[BestAxis] - CentroidMin * 2) * s(.5) * BinScale));
+				if (b < BestBin) Left++;
+				else std::swap(Indices[Left], Indices[--Right]);
+			}
+			Mid = Left;
+		}
+		else if (Count > MAX_LEAF_SIZE || Depth >= MAX_DEPTH)
+		{
+			ZL_Vector3 CentroidExtent = CMax - CMin;
+			int Axis = (CentroidExtent.x > CentroidExtent.y ? (CentroidExtent.x > CentroidExtent.z ? 0 : 2) : (CentroidExtent.y > CentroidExtent.z ? 1 : 2));
+			Mid = First + Count / 2;
+			std::nth_element(Indices.begin() + First, Indices.begin() + Mid, Indices.begin() + First + Count, CentroidLess(&Objects[0], Axis));
+		}
+		else return;
+		if (Mid == First || Mid == First + Count) return;
+		if (Depth >= MAX_DEPTH && Count <= MAX_LEAF_SIZE) return;
+
+		unsigned int Child = (unsigned int)Nodes.size();
+		Nodes.resize(Child + 2);
+		Nodes[NodeIndex].First = Child;
+		Nodes[NodeIndex].Count = 0;
+		Subdivide(Child, First, Mid - First, Depth + 1);
+		Subdivide(Child + 1, Mid, First + Count - Mid, Depth + 1);
+	}
+
+	//Update the node bounds after objects moved while keeping the tree structure (children are always stored after their parent)
+	void Refit()
+	{
+		NeedRefit = false;
+		for (size_t i = Nodes.size(); i--;)
+		{
+			Node& n = Nodes[i];
+			n.Min = ZL_Vector3(S_MAX, S_MAX, S_MAX); n.Max = ZL_Vector3(-S_MAX, -S_MAX, -S_MAX);
+			if (n.Count) { for (unsigned int j = n.First; j != n.First + n.Count; j++) GrowBox(n.Min, n.Max, Objects[Indices[j]].Min, Objects[Indices[j]].Max); }
+			else { GrowBox(n.Min, n.Max, Nodes[n.First].Min, Nodes[n.First].Max); GrowBox(n.Min, n.Max, Nodes[n.First + 1].Min, Nodes[n.First + 1].Max); }
+		}
+	}
+
+	size_t FillRenderList(ZL_RenderList_Impl* List, const ZL_Matrix& ViewProjection)
+	{
+		Update();
+		size_t Added = Unbounded.size();
+		for (std::vector<unsigned int>::iterator it = Unbounded.begin(); it != Unbounded.end(); ++it) List->Add(Objects[*it].Mesh, Objects[*it].Matrix, NULL);
+		if (Nodes.empty()) return Added;
+		ZL_FrustumPlanes Frustum(ViewProjection);
+		unsigned int Stack[MAX_DEPTH + 32], StackSize = 0, Entry = 0; //entries are node indices shifted left with the lowest bit set for nodes known to be fully inside
+		for (;;)
+		{
+			const Node& n = Nodes[Entry >> 1];
+			int Class = ((Entry & 1) ? 1 : Frustum.ClassifyBox(n.Min, n.Max));
+			if (Class >= 0 && !n.Count)
+			{
+				Stack[StackSize++] = ((n.First + 1) << 1) | (Class > 0);
+				Entry = (n.First << 1) | (Class > 0);
+				continue;
+			}
+			if (Class >= 0)
+			{
+				for (unsigned int j = n.First; j != n.First + n.Count; j++)
+				{
+					const Object& o = Objects[Indices[j]];
+					if (!Class && Frustum.ClassifyBox(o.Min, o.Max) < 0) continue;
+					List->Add(o.Mesh, o.Matrix, NULL);
+					Added++;
+				}
+			}
+			if (!StackSize) break;
+			Entry = Stack[--StackSize];
+		}
+		return Added;
+	}
+
+	//Find the closest object whose local bounding box is hit by the segment from Start to End
+	bool RayCast(const ZL_Vector3& Start, const ZL_Vector3& End, size_t* ResultObjectIndex, ZL_Vector3* ResultHitPoint)
+	{
+		Update();
+		if (Nodes.empty()) return false;
+		ZL_Vector3 InvDir = InverseDirection(End - Start);
+		scalar BestT = S_MAX;
+		unsigned int BestIndex = (unsigned int)-1, Stack[MAX_DEPTH + 32], StackSize = 0, NodeIndex = 0;
+		if (RayBoxT(Start, InvDir, Nodes[0].Min, Nodes[0].Max, s(1)) == S_MAX) return false;
+		for (;;)
+		{
+			const Node& n = Nodes[NodeIndex];
+			if (!n.Count)
+			{
+				scalar tLeft = RayBoxT(Start, InvDir, Nodes[n.First].Min, Nodes[n.First].Max, MIN(BestT, s(1)));
+				scalar tRight = RayBoxT(Start, InvDir, Nodes[n.First + 1].Min, Nodes[n.First + 1].Max, MIN(BestT, s(1)));
+				unsigned int Near = n.First, Far = n.First + 1;
+				if (tRight < tLeft) { std::swap(tLeft, tRight); std::swap(Near, Far); }
+				if (tLeft != S_MAX)
+				{
+					if (tRight != S_MAX) Stack[StackSize++] = Far;
+					NodeIndex = Near;
+					continue;
+				}
+			}
+			else for (unsigned int j = n.First; j != n.First + n.Count; j++)
+			{
+				const Object& o = Objects[Indices[j]];
+				if (RayBoxT(Start, InvDir, o.Min, o.Max, MIN(BestT, s(1))) == S_MAX) continue;
+				ZL_Matrix Inv = o.Matrix.GetInverted();
+				ZL_Vector3 LocalStart = Inv.TransformPosition(Start), LocalEnd = Inv.TransformPosition(End);
+				scalar t = RayBoxT(LocalStart, InverseDirection(LocalEnd - LocalStart), o.Mesh->BoundsMin, o.Mesh->BoundsMax, MIN(BestT, s(1)));
+				if (t < BestT) { BestT = t; BestIndex = Indices[j]; }
+			}
+			if (!StackSize) break;
+			NodeIndex = Stack[--StackSize];
+		}
+		if (BestIndex == (unsigned int)-1) return false;
+		if (ResultObjectIndex) *ResultObjectIndex = BestIndex;
+		if (ResultHitPoint) *ResultHitPoint = Start + (End - Start) * BestT;
+		return true;
+	}
+
+	size_t QueryAABB(const ZL_Vector3& Min, const ZL_Vector3& Max, std::vector<size_t>* ResultObjectIndices)
+	{
+		Update();
+		if (Nodes.empty()) return 0;
+		size_t Found = 0;
+		unsigned int Stack[MAX_DEPTH + 32], StackSize = 0, NodeIndex = 0;
+		for (;;)
+		{
+			const Node& n = Nodes[NodeIndex];
+			if (BoxesOverlap(Min, Max, n.Min, n.Max))
+			{
+				if (!n.Count)
+				{
+					Stack[StackSize++] = n.First + 1;
+					NodeIndex = n.First;
+					continue;
+				}
+				for (unsigned int j = n.First; j != n.First + n.Count; j++)
+				{
+					if (!BoxesOverlap(Min, Max, Objects[Indices[j]].Min, Objects[Indices[j]].Max)) continue;
+					if (ResultObjectIndices) ResultObjectIndices->push_back(Indices[j]);
+					Found++;
+				}
+			}
+			if (!StackSize) break;
+			NodeIndex = Stack[--StackSize];
+		}
+		return Found;
+	}
+};
+
 ZL_IMPL_OWNER_DEFAULT_IMPLEMENTATIONS(ZL_Material)
 ZL_Material::ZL_Material(unsigned int MaterialModes) : impl(ZL_Material_Impl::GetMaterialReference(MaterialModes)) { }
 ZL_Material::ZL_Material(unsigned int MaterialModes, const char* CustomFragmentCode, const char* CustomVertexCode) : impl(ZL_Material_Impl::GetMaterialReference(MaterialModes, CustomFragmentCode, CustomVertexCode)) { }
@@ -2325,7 +3126,42 @@ void ZL_RenderList::Add(const ZL_Mesh& Mesh, const ZL_Matrix& Matrix) { impl->Ad
 void ZL_RenderList::Add(const ZL_Mesh& Mesh, const ZL_Matrix& Matrix, const ZL_Material& OverrideMaterial) { impl->Add(ZL_ImplFromOwner<ZL_Mesh_Impl>(Mesh), Matrix, ZL_ImplFromOwner<ZL_Material_Impl>(OverrideMaterial)); }
 void ZL_RenderList::AddReferenced(const ZL_Mesh& Mesh, const ZL_Matrix& Matrix) { impl->AddReferenced(ZL_ImplFromOwner<ZL_Mesh_Impl>(Mesh), Matrix); }
 ZL_Matrix ZL_RenderList::GetMeshMatrix(size_t MeshIndex) { return (MeshIndex < impl->Meshes.size() ? impl->Meshes[MeshIndex].ModelMatrix : ZL_Matrix::Identity); }
-void ZL_RenderList::SetMeshMatrix(size_t MeshIndex, const ZL_Matrix& Matrix) { if (MeshIndex < impl->Meshes.size()) { ZL_RenderList_Impl::MeshEntry& m = impl->Meshes[MeshIndex]; m.ModelMatrix = Matrix; if (m.NormalMatrix.m[0] != FLT_MAX) m.NormalMatrix = Matrix.GetInverseTransposed(); } }
+void ZL_RenderList::SetMeshMatrix(size_t MeshIndex, const ZL_Matrix& Matrix) { if (MeshIndex < impl->Meshes.size()) { ZL_RenderList_Impl::MeshEntry& m = impl->Meshes[MeshIndex]; m.ModelMatrix = Matrix; if (m.NormalMatrix.m[0] != FLT_MAX) m.NormalMatrix = Matrix.GetInverseTransposed(); m.UpdateCullSphere(); } }
+
+unsigned int ZL_RenderList::CountDrawnParts(bool reset)
+{
+	unsigned int res = impl->statDrawn;
+	if (reset) impl->statDrawn = 0;
+	return res;
+}
+
+unsigned int ZL_RenderList::CountCulledParts(bool reset)
+{
+	unsigned int res = impl->statCulled;
+	if (reset) impl->statCulled = 0;
+	return res;
+}
+
+unsigned int ZL_RenderList::CountInstancedParts(bool reset)
+{
+	unsigned int res = impl->statInstanced;
+	if (reset) impl->statInstanced = 0;
+	return res;
+}
+
+ZL_IMPL_OWNER_NONULLCON_IMPLEMENTATIONS(ZL_SceneBVH)
+ZL_SceneBVH::ZL_SceneBVH() : impl(new ZL_SceneBVH_Impl) { }
+void ZL_SceneBVH::Clear() { impl->Clear(); }
+size_t ZL_SceneBVH::Add(const ZL_Mesh& Mesh, const ZL_Matrix& Matrix) { ZL_Mesh_Impl* m = ZL_ImplFromOwner<ZL_Mesh_Impl>(Mesh); return (m ? impl->Add(m, Matrix) : (size_t)-1); }
+size_t ZL_SceneBVH::GetCount() const { return impl->Objects.size(); }
+ZL_Mesh ZL_SceneBVH::GetMesh(size_t ObjectIndex) const { return (ObjectIndex < impl->Objects.size() ? ZL_ImplMakeOwner<ZL_Mesh>(impl->Objects[ObjectIndex].Mesh, true) : ZL_Mesh()); }
+ZL_Matrix ZL_SceneBVH::GetMatrix(size_t ObjectIndex) const { return (ObjectIndex < impl->Objects.size() ? impl->Objects[ObjectIndex].Matrix : ZL_Matrix::Identity); }
+void ZL_SceneBVH::SetMatrix(size_t ObjectIndex, const ZL_Matrix& Matrix) { if (ObjectIndex < impl->Objects.size()) impl->SetMatrix(ObjectIndex, Matrix); }
+void ZL_SceneBVH::Rebuild() { impl->Build(); }
+size_t ZL_SceneBVH::FillRenderList(ZL_RenderList& List, const ZL_Camera& Camera) { return impl->FillRenderList(ZL_ImplFromOwner<ZL_RenderList_Impl>(List), ZL_ImplFromOwner<ZL_Camera_Impl>(Camera)->VP); }
+size_t ZL_SceneBVH::FillRenderList(ZL_RenderList& List, const ZL_Matrix& ViewProjection) { return impl->FillRenderList(ZL_ImplFromOwner<ZL_RenderList_Impl>(List), ViewProjection); }
+bool ZL_SceneBVH::RayCast(const ZL_Vector3& RayStart, const ZL_Vector3& RayEnd, size_t* ResultObjectIndex, ZL_Vector3* ResultHitPoint) { return impl->RayCast(RayStart, RayEnd, ResultObjectIndex, ResultHitPoint); }
+size_t ZL_SceneBVH::QueryAABB(const ZL_Vector3& Min, const ZL_Vector3& Max, std::vector<size_t>* ResultObjectIndices) { return impl->QueryAABB(Min, Max, ResultObjectIndices); }
 
 #if defined(ZILLALOG) && !defined(ZL_VIDEO_OPENGL_ES2)
 void ZL_RenderList::DebugDump()
@@ -2393,9 +3229,68 @@ bool ZL_Display3D::Init(size_t MaxLights)
 	ZL_ASSERTMSG2(MaxLights < 100 && MaxLights < ZL_RenderSceneSetup::MAX_LIGHTS, "Requested %d lights, no more than %d supported", MaxLights, ZL_RenderSceneSetup::MAX_LIGHTS);
 	g_MaxLights = (GLubyte)MIN(MaxLights, ZL_RenderSceneSetup::MAX_LIGHTS);
 	sprintf(ZL_Display3D_Shaders::Const_NumLightsNumberPtr, "%d;", (int)MaxLights);
+
+	using namespace ZL_Display3D_Shaders;
+	//Each instance takes 8 vertex uniform vectors for its model and normal matrix, size the arrays to what the platform offers
+	GLint MAX_VERTEX_UNIFORM_VECTORS = 0;
+	glGetIntegerv(GL_MAX_VERTEX_UNIFORM_VECTORS, &MAX_VERTEX_UNIFORM_VECTORS);
+	g_MaxInstances = (MAX_VERTEX_UNIFORM_VECTORS <= 1 ? Z3MAX_INSTANCES : MIN(Z3MAX_INSTANCES, (MAX_VERTEX_UNIFORM_VECTORS - Z3INSTANCES_RESERVED_UNIFORMS) / 8));
+	if (g_MaxInstances < 2) { g_InstancingMode = INSTANCING_NONE; return true; }
+	ExternalSource[EXTERN_VS_Instancing_Defs] = Instancing_Defs;
+	#ifdef ZL_VIDEO_GL_INSTANCING
+	if (glDrawElementsInstanced)
+	{
+		//Instanced draw calls index the per instance matrix arrays with the built-in instance id
+		g_InstancingMode = INSTANCING_HARDWARE;
+		#ifdef ZL_VIDEO_OPENGL_CORE
+		sprintf(Instancing_Defs, "\n#define " Z3L_INSTANCE " gl_InstanceID\n#define " Z3L_MAXINSTANCES " %d\n", (int)g_MaxInstances);
+		#else
+		ExternalSource[EXTERN_VS_Instancing_Prefix] = "#extension GL_ARB_draw_instanced : enable\n";
+		sprintf(Instancing_Defs, "\n#define " Z3L_INSTANCE " gl_InstanceIDARB\n#define " Z3L_MAXINSTANCES " %d\n", (int)g_MaxInstances);
+		#endif
+		return true;
+	}
+	#endif
+	//Without instancing support, meshes are replicated into batches with each copy tagged by an instance index attribute
+	g_InstancingMode = INSTANCING_BATCHES;
+	sprintf(Instancing_Defs, "\nattribute float " Z3A_INSTANCE ";\n#define " Z3L_INSTANCE " int(" Z3A_INSTANCE ")\n#define " Z3L_MAXINSTANCES " %d\n", (int)g_MaxInstances);
 	return true;
 }
 
+ZL_Signal_v2<size_t, size_t> ZL_Display3D::sigMaterialWarmUpProgress;
+
+void ZL_Display3D::WarmUpMaterials(const char* ManifestFilePath, ticks_t MaxTicksPerFrame)
+{
+	ZL_ASSERTMSG(!g_MaterialManifest, "WarmUpMaterials can only be called once");
+	if (g_MaterialManifest) return;
+	g_MaterialManifest = new ZL_MaterialManifest();
+	g_MaterialManifest->FilePath = ManifestFilePath;
+	g_MaterialManifest->PendingDone = 0;
+	g_MaterialManifest->MaxTicksPerFrame = MaxTicksPerFrame;
+	g_MaterialManifest->Dirty = false;
+	if (ZL_File::Exists(ManifestFilePath))
+	{
+		ZL_Json Manifest = ZL_Json(ZL_File(ManifestFilePath));
+		for (ZL_Json::Iterator it = Manifest.GetIterator(); it; ++it)
+		{
+			const char *MMHex = it->GetStringOf("mm"), *CustomFragmentCode = it->GetStringOf("fs"), *CustomVertexCode = it->GetStringOf("vs");
+			if (!MMHex) continue;
+			g_MaterialManifest->Pending.push_back(ZL_MaterialManifest::Entry());
+			ZL_MaterialManifest::Entry& e = g_MaterialManifest->Pending.back();
+			e.MM = (unsigned int)strtoul(MMHex, NULL, 16);
+			if (CustomFragmentCode) e.CustomFragmentCode = CustomFragmentCode;
+			if (CustomVertexCode) e.CustomVertexCode = CustomVertexCode;
+			e.Instanced = it->GetBoolOf("instanced");
+		}
+	}
+	ZL_Application::sigKeepAlive.connect(&ZL_MaterialManifest::KeepAlive);
+}
+
+bool ZL_Display3D::IsWarmingUpMaterials()
+{
+	return (g_MaterialManifest && g_MaterialManifest->PendingDone < g_MaterialManifest->Pending.size());
+}
+
 bool ZL_Display3D::InitShadowMapping()
 {
 	if (g_ShadowMap_FBO) return false;
@@ -2441,17 +3336,18 @@ bool ZL_Display3D::InitShadowMapping()
 		static void SetupShadowMapProgram(ZL_MaterialProgram* ShaderProgram, unsigned int MM, const char* CustomVertexCode = NULL)
 		{
 			using namespace ZL_Display3D_Shaders;
-			bool UseMasked = (MM&MM_DIFFUSEMAP) && (MM&(MO_MASKED|MO_TRANSPARENCY)), UseSkeletal = !!(MM&MO_SKELETALMESH), UseCustomPosition = !!(MM&(MM_VERTEXFUNC|MM_POSITIONFUNC)), UseCustomMask = (UseMasked && (MM&(MM_UVFUNC)));
-			ZL_MaterialProgram*& UseShadowMapProgram = (UseCustomPosition || UseCustomMask ? ShaderProgram->ShadowMapProgram : g_ShadowMapPrograms[(UseMasked<<0) | (UseSkeletal<<1)]);
+			bool UseMasked = (MM&MM_DIFFUSEMAP) && (MM&(MO_MASKED|MO_TRANSPARENCY)), UseSkeletal = !!(MM&MO_SKELETALMESH), UseInstanced = !!(MM&MMDEF_INSTANCED), UseCustomPosition = !!(MM&(MM_VERTEXFUNC|MM_POSITIONFUNC)), UseCustomMask = (UseMasked && (MM&(MM_UVFUNC)));
+			ZL_MaterialProgram*& UseShadowMapProgram = (UseCustomPosition || UseCustomMask ? ShaderProgram->ShadowMapProgram : g_ShadowMapPrograms[(UseMasked<<0) | (UseSkeletal<<1) | (UseInstanced<<2)]);
 			if (UseShadowMapProgram) UseShadowMapProgram->AddRef();
 			else
 			{
-				unsigned int MMSMRules = MO_UNLIT | (MM&MO_SKELETALMESH);
+				unsigned int MMSMRules = MO_UNLIT | (MM&(MO_SKELETALMESH|MMDEF_INSTANCED));
 				if (UseMasked)         MMSMRules |= MO_MASKED | (UseCustomMask ? (MM&(MM_UVFUNC|MM_DIFFUSEMAP|MM_DIFFUSEFUNC)) : MM_DIFFUSEMAP);
 				if (UseCustomPosition) MMSMRules |= (MM&(MM_VERTEXFUNC|MM_POSITIONFUNC));
 				unsigned int MMSMGlobal = MMSMRules | ((UseCustomPosition|UseCustomMask) ? (MM & MMDEF_REQUESTS) : 0);
-				const char *VS[1+COUNT_OF(SharedRules)+COUNT_OF(VSGlobalRules)+COUNT_OF(VSRules)], *FS[COUNT_OF(SharedRules)+COUNT_OF(FSRules)];
+				const char *VS[2+COUNT_OF(SharedRules)+COUNT_OF(VSGlobalRules)+COUNT_OF(VSRules)], *FS[COUNT_OF(SharedRules)+COUNT_OF(FSRules)];
 				GLsizei VSCount = 0;
+				if (UseInstanced && ExternalSource[EXTERN_VS_Instancing_Prefix]) VS[VSCount++] = ExternalSource[EXTERN_VS_Instancing_Prefix];
 				if (MMSMRules & MM_VERTEXFUNC) VS[VSCount++] = "#define " Z3D_SHADOWMAP "\n";
 				        VSCount += BuildList(SharedRules,      COUNT_OF(SharedRules),      MMSMRules,  &VS[VSCount], SharedVSHeader);
 				        VSCount += BuildList(VSGlobalRules,    COUNT_OF(VSGlobalRules),    MMSMGlobal, &VS[VSCount]);
@@ -2535,6 +3431,7 @@ void ZL_Display3D::FinishRendering()
 	ZLGLSL::_TEXTURE_PROGRAM_ACTIVATE();
 	glVertexAttrib4(ZLGLSL::ATTR_COLOR, 3, 3, 3, 1);
 	glUniformMatrix4v(ZLGLSL::UNI_MVP, 1, GL_FALSE, matrix);
+	ZLGLSL::MatrixDirty = false; //draw with the custom matrix
 	glEnableVertexAttribArrayUnbuffered(ZLGLSL::ATTR_TEXCOORD);
 	glVertexAttribPointerUnbuffered(ZLGLSL::ATTR_POSITION, 2, GL_SCALAR, GL_FALSE, 0, halfscreen);
 	glVertexAttribPointerUnbuffered(ZLGLSL::ATTR_TEXCOORD, 2, GL_SCALAR, GL_FALSE, 0, fullbox);
@@ -108,6 +108,7 @@
 	#define GLPOPMATRIX() ZLGLSL::MatrixPop()
 	#define GLORTHO(r,l,b,t) ZLGLSL::MatrixOrtho(r,l,b,t)
 	#define GLLOADIDENTITY() ZLGLSL::MatrixIdentity()
+	#define ZLGL_FLUSH_MATRIX() ZLGLSL::MatrixFlush() //matrix changes are uploaded to the GPU lazily right before drawing
 #else
 	#define ZLGL_DISABLE_PROGRAM()
 	#define ZLGL_DISABLE_TEXTURE() glDisable(GL_TEXTURE_2D)
@@ -123,6 +124,7 @@
 	#define GLPOPMATRIX() glPopMatrix()
 	#define GLORTHO(r,l,b,t) glOrtho(r,l,b,t, -1.0f, 1.0f)
 	#define GLLOADIDENTITY() glLoadIdentity()
+	#define ZLGL_FLUSH_MATRIX()
 #endif
 
 #ifdef ZL_VIDEO_OPENGL_ES1
@@ -141,8 +143,8 @@
 	#define glEnableVertexAttribArrayUnbuffered glEnableVertexAttribArray
 	#define glDisableVertexAttribArrayUnbuffered glDisableVertexAttribArray
 	#define glVertexAttribPointerUnbuffered glVertexAttribPointer
-	#define glDrawArraysUnbuffered glDrawArrays
-	#define glDrawElementsUnbuffered glDrawElements
+	inline void glDrawArraysUnbuffered(GLenum mode, GLint first, GLsizei count) { ZLGL_FLUSH_MATRIX(); glDrawArrays(mode, first, count); }
+	inline void glDrawElementsUnbuffered(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices) { ZLGL_FLUSH_MATRIX(); glDrawElements(mode, count, type, indices); }
 #else
 	#define ZL_VIDEO_GL_USE_VBO
 	namespace ZLGLSL { extern bool EnabledVertexAttrib[]; };
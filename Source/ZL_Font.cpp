@@ -24,8 +24,17 @@
 #include "ZL_Platform.h"
 #include "ZL_Data.h"
 #include <vector>
+#include <algorithm>
 #include "stb/stb_truetype.h"
 
+#if !defined(ZL_DOUBLE_PRECISCION) && (defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#include <xmmintrin.h>
+#define ZLFONT_SSE
+#elif !defined(ZL_DOUBLE_PRECISCION) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define ZLFONT_NEON
+#endif
+
 struct ZL_Font_Impl_Settings
 {
 	ZL_Vector scale;
@@ -33,19 +42,123 @@ struct ZL_Font_Impl_Settings
 	ZL_Font_Impl_Settings() : scale(ZL_Vector::One), color(ZL_Color::White), draw_at_origin(ZL_Origin::BottomLeft) { }
 };
 
+//Glyph atlas page ranges of a text buffer rendered with a true type font
+struct ZL_FontTTFBuffer
+{
+	std::vector<int> TexLastIndex;
+	struct ShelfRef { unsigned short shelf; unsigned int gen; };
+	std::vector<ShelfRef> Shelves; //atlas shelves holding the glyphs with their generation, marked as used when the buffer is drawn
+
+	void AddShelf(unsigned short shelf, unsigned int gen)
+	{
+		for (std::vector<ShelfRef>::iterator it = Shelves.begin(); it != Shelves.end(); ++it)
+			if (it->shelf == shelf && it->gen == gen) return;
+		ShelfRef r = { shelf, gen };
+		Shelves.push_back(r);
+	}
+
+	inline bool IsValid() const; //the buffer needs to be rendered again if any of its shelves got evicted since
+	inline void TouchShelves() const;
+};
+
+//Glyph run and dimensions of a string drawn with ZL_Font::Draw, kept in a small hashed cache so redrawing the same text is a lookup
+struct ZL_FontLayout
+{
+	ZL_String text;
+	unsigned int hash, LastUsedFrame;
+	std::vector<GLscalar> vertices, texcoords;
+	ZL_FontTTFBuffer* ttfbuf;
+	GLsizei len;
+	scalar width, height;
+	ZL_FontLayout() : hash(0), LastUsedFrame(0), ttfbuf(NULL), len(0), width(0), height(0) { }
+	~ZL_FontLayout() { if (ttfbuf) delete ttfbuf; }
+};
+#define ZLFONT_LAYOUT_CACHE_SIZE 64
+
+//Glyphs of a text buffer in text order with 12 vertices and texture coordinates (two triangles) per glyph
+struct ZL_TextGlyphs
+{
+	struct Glyph { unsigned int pos; signed short tex; unsigned short shelf; }; //pos is the byte offset in the text
+	struct Run { GLsizei end; signed short tex; }; //consecutive glyphs on the same texture
+	std::vector<GLscalar> vertices, texcoords;
+	std::vector<Glyph> glyphs;
+	std::vector<Run> runs;
+
+	void Add(unsigned int pos, signed short tex, unsigned short shelf, GLscalar left, GLscalar bottom, GLscalar right, GLscalar top, const GLscalar* tc)
+	{
+		Glyph g = { pos, tex, shelf };
+		GLscalar v[12] = { left, bottom, right, bottom, left, top, right, bottom, left, top, right, top };
+		glyphs.push_back(g);
+		vertices.insert(vertices.end(), v, v + 12);
+		texcoords.insert(texcoords.end(), tc, tc + 6);
+		texcoords.insert(texcoords.end(), tc + 2, tc + 8);
+	}
+
+	void Replace(GLsizei from, GLsizei to, const ZL_TextGlyphs& src)
+	{
+		glyphs.erase(glyphs.begin() + from, glyphs.begin() + to);
+		glyphs.insert(glyphs.begin() + from, src.glyphs.begin(), src.glyphs.end());
+		vertices.erase(vertices.begin() + from*12, vertices.begin() + to*12);
+		vertices.insert(vertices.begin() + from*12, src.vertices.begin(), src.vertices.end());
+		texcoords.erase(texcoords.begin() + from*12, texcoords.begin() + to*12);
+		texcoords.insert(texcoords.begin() + from*12, src.texcoords.begin(), src.texcoords.end());
+	}
+
+	void Clear()
+	{
+		glyphs.clear();
+		vertices.clear();
+		texcoords.clear();
+		runs.clear();
+	}
+
+	void UpdateRuns()
+	{
+		runs.clear();
+		for (GLsizei i = 0, n = (GLsizei)glyphs.size(); i != n; i++)
+		{
+			if (runs.size() && runs.back().tex == glyphs[i].tex) { runs.back().end = i + 1; continue; }
+			Run r = { i + 1, glyphs[i].tex };
+			runs.push_back(r);
+		}
+	}
+};
+
+static unsigned int ZL_FontLayoutHash(const char *text)
+{
+	unsigned int hash = 2166136261u;
+	for (const unsigned char *p = (const unsigned char*)text; *p; p++) hash = (hash ^ *p) * 16777619u;
+	return hash;
+}
+
+//Outline and shadow drawn by the shader of a distance field font
+struct ZL_FontSDFEffects
+{
+	scalar outline, shadow_softness;
+	ZL_Color outline_color, shadow_color;
+	ZL_Vector shadow_offset;
+	ZL_FontSDFEffects() : outline(0), shadow_softness(0), outline_color(ZL_Color::Black), shadow_color(ZL_Color::Transparent) { }
+};
+
 struct ZL_Font_Impl : ZL_Impl, ZL_Font_Impl_Settings
 {
 	scalar fCharSpacing, fLineSpacing, fLineHeight, fSpaceWidth;
 	int limitCount;
 	bool draw_at_baseline;
-	ZL_Font_Impl(bool draw_at_baseline) : fCharSpacing(0), fLineSpacing(0), fLineHeight(0), fSpaceWidth(0), limitCount(0), draw_at_baseline(draw_at_baseline) { }
-	virtual ~ZL_Font_Impl() {}
+	ZL_FontLayout* layouts; //allocated on the first draw
+	ZL_Font_Impl(bool draw_at_baseline) : fCharSpacing(0), fLineSpacing(0), fLineHeight(0), fSpaceWidth(0), limitCount(0), draw_at_baseline(draw_at_baseline), layouts(NULL) { }
+	virtual ~ZL_Font_Impl() { if (layouts) delete[] layouts; }
 
 	virtual void DoDraw(scalar x, scalar y, const char *text, scalar scalew, scalar scaleh, const ZL_Color &color) = 0;
-	virtual GLsizei CountBuffer(const char *text, std::vector<int>* &vecTTFTexLastIndex) = 0;
-	virtual void RenderBuffer(const char *text, GLscalar* vertices, GLscalar* texcoords, std::vector<int>* vecTTFTexLastIndex, GLsizei &len, scalar &width, scalar &height) = 0;
-	virtual void DoDrawBuffer(std::vector<int>* vecTTFTexLastIndex, GLsizei len) = 0;
+	virtual GLsizei CountBuffer(const char *text, ZL_FontTTFBuffer* &ttfbuf) = 0;
+	virtual void RenderBuffer(const char *text, GLscalar* vertices, GLscalar* texcoords, ZL_FontTTFBuffer* ttfbuf, GLsizei &len, scalar &width, scalar &height) = 0;
+	virtual void DoDrawBuffer(ZL_FontTTFBuffer* ttfbuf, GLsizei len) = 0;
+	virtual scalar RenderLine(const char *text, size_t len, unsigned int pos, GLscalar y, ZL_TextGlyphs& out, ZL_FontTTFBuffer* &ttfbuf) = 0; //returns the line width
+	virtual void DoDrawRuns(ZL_FontTTFBuffer* ttfbuf, const ZL_TextGlyphs& glyphs, GLsizei from, GLsizei to) = 0;
+	virtual GLuint GetRunTexture(ZL_FontTTFBuffer* ttfbuf, signed short tex) = 0; //texture of a glyph run, marks the glyphs as used
 	virtual void GetDimensions(const char *text, scalar* width, scalar* height = NULL, bool resetLimitCount = true) = 0;
+	virtual ZL_FontSDFEffects* GetSDFEffects() { return NULL; }
+	virtual void Preload(const char *charset) { }
 
 	ZL_Vector GetDrawOffset(const scalar& width, const scalar& height, ZL_Origin::Type draw_at_origin)
 	{
@@ -66,8 +179,43 @@ struct ZL_Font_Impl : ZL_Impl, ZL_Font_Impl_Settings
 		}
 	}
 
+	//Get the cached layout of a string to draw (built or rendered again if needed), returns NULL if the text can't be cached
+	ZL_FontLayout* GetLayout(const char *text);
+
+	inline ZL_FontLayout* FindLayout(const char *text)
+	{
+		if (!layouts || !*text) return NULL;
+		unsigned int hash = ZL_FontLayoutHash(text);
+		ZL_FontLayout& l = layouts[hash % ZLFONT_LAYOUT_CACHE_SIZE];
+		return (l.hash == hash && l.text == text ? &l : NULL);
+	}
+
+	//Needs to be called when a setting that affects the layout changes
+	void ClearLayouts()
+	{
+		if (layouts) for (int i = 0; i != ZLFONT_LAYOUT_CACHE_SIZE; i++) layouts[i].text.clear();
+	}
+
+	void Measure(const char *text, scalar* width, scalar* height)
+	{
+		ZL_FontLayout* l = (limitCount ? NULL : FindLayout(text));
+		if (!l) { GetDimensions(text, width, height); return; }
+		if (width) *width = l->width;
+		if (height) *height = l->height;
+	}
+
 	void Draw(scalar x, scalar y, const char *text, scalar scalew, scalar scaleh, const ZL_Color &color, ZL_Origin::Type draw_at_origin)
 	{
+		#ifdef ZL_VIDEO_USE_GLSL
+		ZL_FontLayout* l = (limitCount || ZLGLSL::ActiveProgram == ZLGLSL::CUSTOM ? NULL : GetLayout(text)); //drawing a buffer would end an active custom shader
+		#else
+		ZL_FontLayout* l = (limitCount ? NULL : GetLayout(text));
+		#endif
+		if (l)
+		{
+			if (l->len) DrawBuffer(x, y, scalew, scaleh, color, draw_at_origin, &l->vertices[0], &l->texcoords[0], l->ttfbuf, l->len, l->width, l->height);
+			return;
+		}
 		scalar width, height;
 		GetDimensions(text,
 			(draw_at_origin < ZL_Origin::_CUSTOM_START && (draw_at_origin & ZL_Origin::_MASK_LEFT) ? NULL : &width), //width only needed in some cases
@@ -78,7 +226,15 @@ struct ZL_Font_Impl : ZL_Impl, ZL_Font_Impl_Settings
 		limitCount = 0;
 	}
 
-	void DrawBuffer(const scalar &x, const scalar &y, const scalar &scalew, const scalar &scaleh, const ZL_Color &color, ZL_Origin::Type draw_at_origin, GLscalar* vertices, GLscalar* texcoords, std::vector<int>* vecTTFTexLastIndex, GLsizei len, const scalar &width, const scalar &height)
+	void DrawBuffer(const scalar &x, const scalar &y, const scalar &scalew, const scalar &scaleh, const ZL_Color &color, ZL_Origin::Type draw_at_origin, GLscalar* vertices, GLscalar* texcoords, ZL_FontTTFBuffer* ttfbuf, GLsizei len, const scalar &width, const scalar &height)
+	{
+		BeginDrawBuffer(x, y, scalew, scaleh, color, draw_at_origin, vertices, texcoords, width, height);
+		DoDrawBuffer(ttfbuf, len);
+		GLPOPMATRIX();
+	}
+
+	//Set up the matrix and vertex pointers to draw a buffer, needs to be followed by GLPOPMATRIX
+	void BeginDrawBuffer(const scalar &x, const scalar &y, const scalar &scalew, const scalar &scaleh, const ZL_Color &color, ZL_Origin::Type draw_at_origin, GLscalar* vertices, GLscalar* texcoords, const scalar &width, const scalar &height)
 	{
 		ZL_Vector align_offset = GetDrawOffset(width, height, draw_at_origin);
 		GLPUSHMATRIX();
@@ -89,8 +245,6 @@ struct ZL_Font_Impl : ZL_Impl, ZL_Font_Impl_Settings
 		ZLGL_COLOR(color);
 		ZLGL_VERTEXTPOINTER(2, GL_SCALAR, 0, vertices);
 		ZLGL_TEXCOORDPOINTER(2, GL_SCALAR, 0, texcoords);
-		DoDrawBuffer(vecTTFTexLastIndex, len);
-		GLPOPMATRIX();
 	}
 };
 
@@ -163,7 +317,7 @@ struct ZL_FontBitmap_Impl : ZL_Font_Impl
 
 	void DoDraw(scalar x, scalar y, const char *text, scalar scalew, scalar scaleh, const ZL_Color &color)
 	{
-		glBindTexture(GL_TEXTURE_2D, tex->gltexid);
+		glBindTexture(GL_TEXTURE_2D, tex->Use());
 		ZLGL_ENABLE_TEXTURE();
 		ZLGL_COLOR(color);
 		#define VBSIZE 64
@@ -196,16 +350,16 @@ struct ZL_FontBitmap_Impl : ZL_Font_Impl
 		if (v) glDrawArraysUnbuffered(GL_TRIANGLES, 0, 6*v);
 	}
 
-	GLsizei CountBuffer(const char *text, std::vector<int>* &vecTTFTexLastIndex)
+	GLsizei CountBuffer(const char *text, ZL_FontTTFBuffer* &ttfbuf)
 	{
-		if (vecTTFTexLastIndex) { delete vecTTFTexLastIndex; vecTTFTexLastIndex = NULL; }
+		if (ttfbuf) { delete ttfbuf; ttfbuf = NULL; }
 		GLsizei cnt = 0;
 		for (const unsigned char *p = (const unsigned char*)text, *pEnd = (limitCount ? p + limitCount : (unsigned char*)-1); *p && p < pEnd; p++)
 			if (*p > ' ' && (*p-(unsigned char)' '-1) < (unsigned char)(sizeof(CharWidths)/sizeof(CharWidths[0])) && CharWidths[*p-' '-1]) cnt++;
 		return cnt;
 	}
 
-	void RenderBuffer(const char *text, GLscalar* vertices, GLscalar* texcoords, std::vector<int>* vecTTFTexLastIndex, GLsizei &len, scalar &width, scalar &height)
+	void RenderBuffer(const char *text, GLscalar* vertices, GLscalar* texcoords, ZL_FontTTFBuffer* ttfbuf, GLsizei &len, scalar &width, scalar &height)
 	{
 		GLscalar vbox[8];
 		vbox[7] = vbox[5] =  fLineHeight*s(0.8); //top
@@ -232,12 +386,39 @@ struct ZL_FontBitmap_Impl : ZL_Font_Impl
 		height = 0 - (vbox[1] - fLineHeight*s(0.8));
 	}
 
-	void DoDrawBuffer(std::vector<int>* vecTTFTexLastIndex, GLsizei len)
+	void DoDrawBuffer(ZL_FontTTFBuffer* ttfbuf, GLsizei len)
 	{
-		glBindTexture(GL_TEXTURE_2D, tex->gltexid);
+		glBindTexture(GL_TEXTURE_2D, tex->Use());
 		glDrawArraysUnbuffered(GL_TRIANGLES, 0, len * 6);
 	}
 
+	scalar RenderLine(const char *text, size_t len, unsigned int pos, GLscalar y, ZL_TextGlyphs& out, ZL_FontTTFBuffer* &ttfbuf)
+	{
+		GLscalar x = 0, right = 0, top = y + fLineHeight*s(0.8), bottom = y - fLineHeight*s(0.2);
+		for (const unsigned char *p = (const unsigned char*)text, *pEnd = p + len; p != pEnd; p++)
+		{
+			if (*p == '\r') continue;
+			if (*p <= ' ') { x += fSpaceWidth + fCharSpacing; continue; }
+			unsigned char charidx = *p-' '-1;
+			if (charidx >= (sizeof(CharWidths)/sizeof(CharWidths[0])) || !CharWidths[charidx]) continue;
+			right = x + CharWidths[charidx];
+			out.Add(pos + (unsigned int)(p - (const unsigned char*)text), 0, 0, x, bottom, right, top, TextureCoordinates[charidx]);
+			x = right + fCharSpacing;
+		}
+		return right;
+	}
+
+	void DoDrawRuns(ZL_FontTTFBuffer* ttfbuf, const ZL_TextGlyphs& glyphs, GLsizei from, GLsizei to)
+	{
+		glBindTexture(GL_TEXTURE_2D, tex->Use());
+		glDrawArraysUnbuffered(GL_TRIANGLES, from * 6, (to - from) * 6);
+	}
+
+	GLuint GetRunTexture(ZL_FontTTFBuffer* ttfbuf, signed short runtex)
+	{
+		return tex->Use();
+	}
+
 	void GetDimensions(const char *text, scalar* width, scalar* height, bool resetLimitCount)
 	{
 		GLscalar cs = 0, linewidth;
@@ -265,121 +446,384 @@ struct ZL_FontBitmap_Impl : ZL_Font_Impl
 	}
 };
 
-#ifdef ZL_VIDEO_WEAKCONTEXT
-//#include <algorithm>
-static std::vector<struct ZL_FontTTF_Impl*> *pLoadedTTFFonts = NULL;
-static std::vector<struct ZL_TextBuffer_Impl*> *pActiveTTFTextBuffers = NULL;
+#if !defined(ZL_VIDEO_OPENGL_CORE) && !defined(ZL_VIDEO_DIRECT3D)
+#define ZLFONTVIDEO_FORMAT GL_LUMINANCE_ALPHA
+#define ZLFONTVIDEO_BPP 2
+#else //D3D and GLCORE must be RGBA
+#define ZLFONTVIDEO_FORMAT GL_RGBA
+#define ZLFONTVIDEO_BPP 4
+#endif
+#define ZLFONTATLAS_SIZE 1024
+
+//Distance field glyphs are rendered once at the reference pixel height and then scaled to any size when drawn
+#define ZLFONT_SDF_SIZE 40
+#define ZLFONT_SDF_SPREAD 6 //distance in reference pixels that maps to the full alpha range on each side of the glyph edge
+#define ZLFONT_SDF_OVERSAMPLE 4 //the distance transform runs on a glyph coverage bitmap rendered at this many times the reference size
+#if defined(ZL_VIDEO_USE_GLSL) && !defined(ZL_VIDEO_DIRECT3D)
+#define ZLFONT_SDF //without shaders distance field fonts fall back to regular bitmap glyphs
 #endif
 
-struct ZL_FontTTF_Impl : ZL_Font_Impl
+//Texture pages shared by all true type fonts. Glyphs are packed left to right into shelves (rows with a fixed height) and
+//when all pages are full the shelf that was least recently drawn gets cleared as a whole to make space for new glyphs
+struct ZL_FontGlyphAtlas
+{
+	struct Shelf { unsigned short page, y, h, x; unsigned int gen, LastUsedFrame; };
+	std::vector<GLuint> gltexids;
+	std::vector<int> PageUsedHeight;
+	std::vector<Shelf> shelves;
+	unsigned int NextGen, MaxPages;
+
+	ZL_FontGlyphAtlas() : NextGen(1), MaxPages(4) { }
+
+	//Glyphs remember the generation of their shelf and are only valid as long as it matches (it changes on eviction)
+	inline bool Touch(unsigned short shelf, unsigned int gen)
+	{
+		if (shelf >= shelves.size() || shelves[shelf].gen != gen) return false;
+		shelves[shelf].LastUsedFrame = ZL_Application::FrameCount;
+		return true;
+	}
+
+	int AddShelf(int h, bool NewPage)
+	{
+		size_t page = 0;
+		if (NewPage)
+		{
+			GLuint gltexid;
+			glGenTextures(1, &gltexid);
+			glBindTexture(GL_TEXTURE_2D, gltexid);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			GLubyte *data = (GLubyte*)calloc(ZLFONTATLAS_SIZE*ZLFONTATLAS_SIZE, ZLFONTVIDEO_BPP);
+			glTexImage2D(GL_TEXTURE_2D, 0, ZLFONTVIDEO_FORMAT, ZLFONTATLAS_SIZE, ZLFONTATLAS_SIZE, 0, ZLFONTVIDEO_FORMAT, GL_UNSIGNED_BYTE, data);
+			free(data);
+			gltexids.push_back(gltexid);
+			PageUsedHeight.push_back(0);
+			page = gltexids.size() - 1;
+			if (gltexids.size() > MaxPages) { ZL_LOG1("FONT", "Glyph atlas grows to %d pages because all glyphs were drawn in this frame", (int)gltexids.size()); }
+		}
+		else for (; page != gltexids.size() && PageUsedHeight[page] + h > ZLFONTATLAS_SIZE; page++) {}
+		if (page == gltexids.size() || shelves.size() == 0xFFFF) return -1;
+		Shelf sh = { (unsigned short)page, (unsigned short)PageUsedHeight[page], (unsigned short)h, 0, NextGen++, ZL_Application::FrameCount };
+		PageUsedHeight[page] += h + 1;
+		shelves.push_back(sh);
+		return (int)shelves.size() - 1;
+	}
+
+	void Evict(int shelf)
+	{
+		Shelf& sh = shelves[shelf];
+		sh.x = 0;
+		sh.gen = NextGen++;
+		GLubyte *data = (GLubyte*)calloc(ZLFONTATLAS_SIZE*sh.h, ZLFONTVIDEO_BPP);
+		glBindTexture(GL_TEXTURE_2D, gltexids[sh.page]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, sh.y, ZLFONTATLAS_SIZE, sh.h, ZLFONTVIDEO_FORMAT, GL_UNSIGNED_BYTE, data);
+		free(data);
+	}
+
+	//Returns the shelf with space for a glyph (at its current x) or -1 if the glyph is larger than a page
+	int Allocate(int w, int h)
+	{
+		if (w > ZLFONTATLAS_SIZE || h > ZLFONTATLAS_SIZE) return -1;
+		int best = -1, lru = -1;
+		for (int i = 0, n = (int)shelves.size(); i != n; i++)
+		{
+			const Shelf& sh = shelves[i];
+			if (sh.h < h || sh.h > h + h/4 + 2) continue; //only shelves of similar height to keep unused space low
+			if (sh.x + w <= ZLFONTATLAS_SIZE) { if (best < 0 || sh.h < shelves[best].h) best = i; }
+			else if (sh.LastUsedFrame != ZL_Application::FrameCount && (lru < 0 || sh.LastUsedFrame < shelves[lru].LastUsedFrame)) lru = i;
+		}
+		if (best >= 0 || (best = AddShelf(h, false)) >= 0) return best;
+		if (gltexids.size() < MaxPages) return AddShelf(h, true);
+		if (lru < 0)
+			for (int i = 0, n = (int)shelves.size(); i != n; i++)
+				if (shelves[i].h >= h && shelves[i].LastUsedFrame != ZL_Application::FrameCount && (lru < 0 || shelves[i].LastUsedFrame < shelves[lru].LastUsedFrame)) lru = i;
+		if (lru < 0) return AddShelf(h, true); //everything was drawn in this frame, grow above the limit
+		Evict(lru);
+		return lru;
+	}
+
+	void Reset() //after the context got lost with all textures
+	{
+		gltexids.clear();
+		PageUsedHeight.clear();
+		shelves.clear();
+	}
+};
+static ZL_FontGlyphAtlas* pGlyphAtlas = NULL;
+
+inline bool ZL_FontTTFBuffer::IsValid() const
 {
+	for (std::vector<ShelfRef>::const_iterator it = Shelves.begin(); it != Shelves.end(); ++it)
+		if (it->shelf >= pGlyphAtlas->shelves.size() || pGlyphAtlas->shelves[it->shelf].gen != it->gen) return false;
+	return true;
+}
+
+inline void ZL_FontTTFBuffer::TouchShelves() const
+{
+	for (std::vector<ShelfRef>::const_iterator it = Shelves.begin(); it != Shelves.end(); ++it)
+		pGlyphAtlas->Touch(it->shelf, it->gen);
+}
+
+struct ZL_FontTTFChar { signed short tex; unsigned short shelf; unsigned int gen; GLscalar offx, offy, advance, width, TextureCoordinates[8]; };
+
+//A glyph on its way into the atlas with the pixels of its whole slot (tex_w x slot_h)
+struct ZL_FontTTFRaster { unsigned short cd; int glyph, x0, y0; GLuint tex_w, tex_h, slot_h, x; unsigned char* pixels; ZL_FontTTFChar c; };
+
+//Font data and glyphs shared by all true type font instances loaded with the same file, size and outline
+struct ZL_FontTTFFace
+{
+	ZL_String key;
+	int RefCount;
 	unsigned char *ttf_buffer;
 	stbtt_fontinfo font;
+	ZL_TMap<unsigned short, ZL_FontTTFChar> chars;
+};
+static std::vector<ZL_FontTTFFace*> *pTTFFaces = NULL;
+
+struct ZL_SDFPoint { short dx, dy; inline int Dist2() const { return dx*dx + dy*dy; } };
+
+static inline void SDFCompare(ZL_SDFPoint* g, int w, int x, int y, int ox, int oy)
+{
+	ZL_SDFPoint o = g[(y+oy)*w + x+ox];
+	o.dx = (short)(o.dx + ox); o.dy = (short)(o.dy + oy);
+	if (o.Dist2() < g[y*w + x].Dist2()) g[y*w + x] = o;
+}
+
+//8-point sequential euclidean distance transform, afterwards each point holds the offset to the nearest seed point
+static void SDFTransform(ZL_SDFPoint* g, int w, int h)
+{
+	for (int y = 0; y < h; y++)
+	{
+		for (int x = 0; x < w; x++)
+		{
+			if (x > 0) SDFCompare(g, w, x, y, -1, 0);
+			if (y > 0) { SDFCompare(g, w, x, y, 0, -1); if (x > 0) SDFCompare(g, w, x, y, -1, -1); if (x < w-1) SDFCompare(g, w, x, y, 1, -1); }
+		}
+		for (int x = w-2; x >= 0; x--) SDFCompare(g, w, x, y, 1, 0);
+	}
+	for (int y = h-1; y >= 0; y--)
+	{
+		for (int x = w-1; x >= 0; x--)
+		{
+			if (x < w-1) SDFCompare(g, w, x, y, 1, 0);
+			if (y < h-1) { SDFCompare(g, w, x, y, 0, 1); if (x > 0) SDFCompare(g, w, x, y, -1, 1); if (x < w-1) SDFCompare(g, w, x, y, 1, 1); }
+		}
+		for (int x = 1; x < w; x++) SDFCompare(g, w, x, y, -1, 0);
+	}
+}
+
+//Fill the alpha values of a glyph cell with a signed distance field (128 on the edge, 0 and 255 at spread pixels outside and inside)
+//The coverage bitmap is rendered at os times the size of the cell and placed at bx, by in the oversampled grid of the cell
+static void MakeGlyphDistanceField(const unsigned char* bmp, int bw, int bh, int bx, int by, int os, int spread, unsigned char* out, int ow, int oh, int ostep)
+{
+	int gw = ow*os, gh = oh*os;
+	const ZL_SDFPoint Far = { 9999, 9999 }, Seed = { 0, 0 };
+	ZL_SDFPoint *inner = (ZL_SDFPoint*)malloc(gw*gh*sizeof(ZL_SDFPoint)*2), *outer = inner + gw*gh;
+	for (int y = 0; y < gh; y++)
+		for (int x = 0; x < gw; x++)
+		{
+			bool in = (x >= bx && y >= by && x < bx + bw && y < by + bh && bmp[(y-by)*bw + (x-bx)] >= 128);
+			inner[y*gw + x] = (in ? Far : Seed); //distance to the nearest outside point
+			outer[y*gw + x] = (in ? Seed : Far); //distance to the nearest inside point
+		}
+	SDFTransform(inner, gw, gh);
+	SDFTransform(outer, gw, gh);
+	for (int y = 0; y < oh; y++)
+		for (int x = 0; x < ow; x++)
+		{
+			int i = (y*os + os/2)*gw + (x*os + os/2);
+			float d = (inner[i].Dist2() ? sqrtf((float)inner[i].Dist2()) - .5f : .5f - sqrtf((float)outer[i].Dist2())) / os;
+			float v = 127.5f + d * 127.5f / spread;
+			out[(y*ow + x)*ostep] = (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v + .5f));
+		}
+	free(inner);
+}
+
+#ifdef ZLFONT_SDF
+static struct ZL_FontSDFProgram { GLuint PROGRAM, UNI_MVP, UNI_SMOOTH, UNI_OUTLINE, UNI_OUTLINE_COLOR, UNI_SHADOW, UNI_SHADOW_COLOR; } FontSDFProgram;
+
+static const char* font_sdf_vertex_shader_src =
+	"uniform mat4 u_mvpMatrix;"
+	"attribute vec4 a_position;"
+	"attribute vec4 a_color;"
+	"attribute vec2 a_texcoord;"
+	"varying vec4 v_color;"
+	"varying vec2 v_texcoord;"
+	"void main()"
+	"{"
+		"v_color = a_color;"
+		"v_texcoord = a_texcoord;"
+		"gl_Position = u_mvpMatrix * a_position;"
+	"}";
+
+//u_smooth is half a screen pixel in distance units, u_shadow holds the texture coordinate offset in xy and the softness in z
+static const char* font_sdf_fragment_shader_src =
+	"uniform sampler2D u_texture;"
+	"uniform float u_smooth, u_outline;"
+	"uniform vec4 u_outline_color, u_shadow, u_shadow_color;"
+	"varying vec4 v_color;"
+	"varying vec2 v_texcoord;"
+	"void main()"
+	"{"
+		"float d = texture2D(u_texture, v_texcoord).a, edge = .5 - u_outline;"
+		"vec4 oc = (u_outline > 0. ? vec4(u_outline_color.rgb, u_outline_color.a * v_color.a) : v_color);"
+		"vec4 fg = mix(oc, v_color, smoothstep(.5 - u_smooth, .5 + u_smooth, d));"
+		"fg.a *= smoothstep(edge - u_smooth, edge + u_smooth, d);"
+		"float sd = texture2D(u_texture, v_texcoord - u_shadow.xy).a;"
+		"float sa = u_shadow_color.a * v_color.a * smoothstep(edge - u_smooth - u_shadow.z, edge + u_smooth, sd) * (1. - fg.a);"
+		"gl_FragColor = vec4(mix(u_shadow_color.rgb, fg.rgb, fg.a / max(fg.a + sa, .0001)), fg.a + sa);"
+	"}";
+
+static bool CreateFontSDFProgram()
+{
+	const char *srcs_vertex[]   = { ZLGLSL_LIST_HIGH_PRECISION_HEADER ZLGLSL_LIST_VS_HEADER font_sdf_vertex_shader_src };
+	const char *srcs_fragment[] = { ZLGLSL_LIST_HIGH_PRECISION_HEADER ZLGLSL_LIST_FS_HEADER font_sdf_fragment_shader_src };
+	const char *attr[] = { "a_position", "a_color", "a_texcoord" };
+	ZL_FontSDFProgram& p = FontSDFProgram;
+	if (!(p.PROGRAM = ZLGLSL::CreateProgramFromVertexAndFragmentShaders(COUNT_OF(srcs_vertex), srcs_vertex, COUNT_OF(srcs_fragment), srcs_fragment, COUNT_OF(attr), attr))) return false;
+	p.UNI_MVP           = (GLuint)glGetUniformLocation(p.PROGRAM, "u_mvpMatrix");
+	p.UNI_SMOOTH        = (GLuint)glGetUniformLocation(p.PROGRAM, "u_smooth");
+	p.UNI_OUTLINE       = (GLuint)glGetUniformLocation(p.PROGRAM, "u_outline");
+	p.UNI_OUTLINE_COLOR = (GLuint)glGetUniformLocation(p.PROGRAM, "u_outline_color");
+	p.UNI_SHADOW        = (GLuint)glGetUniformLocation(p.PROGRAM, "u_shadow");
+	p.UNI_SHADOW_COLOR  = (GLuint)glGetUniformLocation(p.PROGRAM, "u_shadow_color");
+	return true;
+}
+#endif
+
+struct ZL_FontTTF_Impl : ZL_Font_Impl
+{
+	typedef ZL_FontTTFChar Char;
+	ZL_FontTTFFace* face;
+	ZL_FontSDFEffects* sdf; //only set for distance field fonts
 	float stbtt_scale;
-	std::vector<GLuint> gltexids;
-	struct Char { signed char tex; GLscalar offx, offy, advance, width, TextureCoordinates[8]; };
-	ZL_TMap<unsigned short, Char> chars;
-	GLscalar last_char_coord1, last_char_coord2, last_char_coord5;
-	bool last_char;
+	GLscalar sdf_scale, cell_h; //glyph metrics are in pixels of the rasterized glyphs and get multiplied by sdf_scale, cell_h is the height of a glyph quad in those pixels
 	bool pixel_exact;
 	unsigned char oll, olr, olt, olb;
 
-	ZL_FontTTF_Impl(const ZL_FileLink& file, scalar height, bool pixel_exact, unsigned char oll, unsigned char olr, unsigned char olt, unsigned char olb)
-		: ZL_Font_Impl(true), ttf_buffer(NULL), last_char(false), pixel_exact(pixel_exact), oll(oll), olr(olr), olt(olt), olb(olb)
+	ZL_FontTTF_Impl(const ZL_FileLink& file, scalar height, bool pixel_exact, unsigned char oll, unsigned char olr, unsigned char olt, unsigned char olb, bool sdf_mode = false)
+		: ZL_Font_Impl(true), face(NULL), sdf(sdf_mode ? new ZL_FontSDFEffects() : NULL), sdf_scale(1), pixel_exact(pixel_exact && !sdf_mode), oll(oll), olr(olr), olt(olt), olb(olb)
 	{
-		ZL_File f = file.Open();
-		ZL_File_Impl* fileimpl = ZL_ImplFromOwner<ZL_File_Impl>(f);
-		if (!fileimpl || !fileimpl->src) return;
-		ptrdiff_t cur = fileimpl->src->seektell(0, RW_SEEK_CUR);
-		char magic[2]; fileimpl->src->read(magic, 1, 2);
-		fileimpl->src->seektell(cur, RW_SEEK_SET);
-		if (magic[0] == 'P' && magic[1] == 'K')
-		{
-			ttf_buffer = ZL_RWopsZIP::ReadSingle(fileimpl->src);
-			if (!ttf_buffer) return;
-		}
-		else
+		ZL_String name = file.Name(), key;
+		if (sdf) this->oll = this->olr = this->olt = this->olb = ZLFONT_SDF_SPREAD; //the spread is kept free around each glyph
+		if (name.length() && sdf) key = ZL_String::format("%s|sdf", name.c_str()); //distance field glyphs are shared by all sizes
+		else if (name.length()) key = ZL_String::format("%s|%g|%d|%d|%d|%d|%d", name.c_str(), (double)height, (int)pixel_exact, oll, olr, olt, olb);
+		if (pTTFFaces && key.length())
+			for (std::vector<ZL_FontTTFFace*>::iterator it = pTTFFaces->begin(); it != pTTFFaces->end(); ++it)
+				if ((*it)->key == key) { face = *it; face->RefCount++; break; }
+		if (!face)
 		{
-			size_t ttf_size = fileimpl->src->size();
-			if (!ttf_size) return;
-			ttf_buffer = (unsigned char*)malloc(ttf_size);
-			fileimpl->src->read(ttf_buffer, 1, ttf_size);
+			unsigned char *ttf_buffer = NULL;
+			ZL_File f = file.Open();
+			ZL_File_Impl* fileimpl = ZL_ImplFromOwner<ZL_File_Impl>(f);
+			if (!fileimpl || !fileimpl->src) return;
+			ptrdiff_t cur = fileimpl->src->seektell(0, RW_SEEK_CUR);
+			char magic[2]; fileimpl->src->read(magic, 1, 2);
+			fileimpl->src->seektell(cur, RW_SEEK_SET);
+			if (magic[0] == 'P' && magic[1] == 'K')
+			{
+				ttf_buffer = ZL_RWopsZIP::ReadSingle(fileimpl->src);
+				if (!ttf_buffer) return;
+			}
+			else
+			{
+				size_t ttf_size = fileimpl->src->size();
+				if (!ttf_size) return;
+				ttf_buffer = (unsigned char*)malloc(ttf_size);
+				fileimpl->src->read(ttf_buffer, 1, ttf_size);
+			}
+			face = new ZL_FontTTFFace();
+			face->key = key;
+			face->RefCount = 1;
+			face->ttf_buffer = ttf_buffer;
+			if (!pTTFFaces) pTTFFaces = new std::vector<ZL_FontTTFFace*>();
+			pTTFFaces->push_back(face);
+			//if (!stbtt_InitFont(&face->font, ttf_buffer, stbtt_GetFontOffsetForIndex(ttf_buffer,0))) return; //offset for ttc
+			if (!stbtt_InitFont(&face->font, ttf_buffer, 0)) return;
 		}
-		//if (!stbtt_InitFont(&font, ttf_buffer, stbtt_GetFontOffsetForIndex(ttf_buffer,0))) return; //offset for ttc
-		if (!stbtt_InitFont(&font, ttf_buffer, 0)) return;
-		stbtt_scale = stbtt_ScaleForPixelHeight(&font, (float)height);
+		if (!pGlyphAtlas) pGlyphAtlas = new ZL_FontGlyphAtlas();
+		stbtt_scale = stbtt_ScaleForPixelHeight(&face->font, (float)(sdf ? ZLFONT_SDF_SIZE : height));
+		if (sdf) sdf_scale = (GLscalar)(height / ZLFONT_SDF_SIZE);
+		cell_h = (sdf ? (GLscalar)ZLFONT_SDF_SIZE : (GLscalar)height) + (this->olt + this->olb);
 		fLineHeight = height;
 		fLineSpacing = s((int)(fLineHeight / 7));
 		int iSpaceWidth = 10;
-		stbtt_GetCodepointHMetrics(&font, ' ', &iSpaceWidth, NULL);
-		fSpaceWidth = s(stbtt_scale * s(iSpaceWidth));
+		stbtt_GetCodepointHMetrics(&face->font, ' ', &iSpaceWidth, NULL);
+		fSpaceWidth = s(stbtt_scale * s(iSpaceWidth)) * sdf_scale;
 		if (pixel_exact) fSpaceWidth = (GLscalar)(int)(fSpaceWidth + .5f);
-		#ifdef ZL_VIDEO_WEAKCONTEXT
-		if (!pLoadedTTFFonts) pLoadedTTFFonts = new std::vector<ZL_FontTTF_Impl*>();
-		pLoadedTTFFonts->push_back(this);
-		#endif
 	}
 
 	~ZL_FontTTF_Impl()
 	{
-		if (ttf_buffer) free(ttf_buffer);
-		if (gltexids.size()) glDeleteTextures((GLsizei)gltexids.size(), &gltexids[0]);
-		#ifdef ZL_VIDEO_WEAKCONTEXT
-		std::vector<ZL_FontTTF_Impl*>::iterator itClear = std::find(pLoadedTTFFonts->begin(), pLoadedTTFFonts->end(), this);
-		if (itClear != pLoadedTTFFonts->end()) pLoadedTTFFonts->erase(itClear);
-		#endif
+		if (sdf) delete sdf;
+		if (!face || --face->RefCount) return;
+		if (face->ttf_buffer) free(face->ttf_buffer);
+		pTTFFaces->erase(std::find(pTTFFaces->begin(), pTTFFaces->end(), face));
+		delete face; //glyphs stay in the atlas until their shelf gets evicted
 	}
 
-	const Char& MakeChar(unsigned short cd)
+	//Calculate the metrics of a glyph to rasterize, returns false for glyphs without any pixels
+	bool PrepareChar(unsigned short cd, ZL_FontTTFRaster& r)
 	{
-		int bmp_w, bmp_h, off_x, off_y;
-		int glyph = stbtt_FindGlyphIndex(&font, cd), advanceWidth, leftSideBearing;
-		unsigned char *bitmap = stbtt_GetGlyphBitmap(&font, stbtt_scale, stbtt_scale, glyph, &bmp_w, &bmp_h, &off_x, &off_y);
-
-		if (!bitmap || !bmp_w)
+		int x1, y1, advanceWidth, leftSideBearing;
+		r.cd = cd;
+		r.glyph = stbtt_FindGlyphIndex(&face->font, cd);
+		r.x = 0;
+		r.pixels = NULL;
+		stbtt_GetGlyphBitmapBox(&face->font, r.glyph, stbtt_scale, stbtt_scale, &r.x0, &r.y0, &x1, &y1);
+
+		Char& c = r.c;
+		if (x1 <= r.x0 || y1 <= r.y0)
 		{
-			Char c;
 			memset(&c, 0, sizeof(Char));
 			c.tex = -1;
-			return chars.Put(cd, c);
+			return false;
 		}
 
-		#if !defined(ZL_VIDEO_OPENGL_CORE) && !defined(ZL_VIDEO_DIRECT3D)
-		#define ZLFONTVIDEO_FORMAT GL_LUMINANCE_ALPHA
-		#define ZLFONTVIDEO_BPP 2
-		#else //D3D and GLCORE must be RGBA
-		#define ZLFONTVIDEO_FORMAT GL_RGBA
-		#define ZLFONTVIDEO_BPP 4
-		#endif
-
-		GLuint gltexid, x, y, tex_w = bmp_w + oll + olr, tex_h = bmp_h + olt + olb;
-		bool textnextline;
-		if (!last_char || ((textnextline = ((last_char_coord2 + s(tex_w)/s(512)) >= 1)) && (last_char_coord1 + s(tex_h)/s(512)) >= 1))
-		{
-			glGenTextures(1, &gltexid);
-			glBindTexture(GL_TEXTURE_2D, gltexid);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			GLubyte *data = (GLubyte*)malloc(512*512*ZLFONTVIDEO_BPP);
-			memset(data, 0, (512*512*ZLFONTVIDEO_BPP));
-			glTexImage2D(GL_TEXTURE_2D, 0, ZLFONTVIDEO_FORMAT, 512, 512, 0, ZLFONTVIDEO_FORMAT, GL_UNSIGNED_BYTE, data);
-			free(data);
-			gltexids.push_back(gltexid);
-			x = y = 0;
-		}
-		else
+		GLuint lh = (GLuint)(cell_h + .999f);
+		r.tex_w = (x1 - r.x0) + oll + olr;
+		r.tex_h = (y1 - r.y0) + olt + olb;
+		r.slot_h = (r.tex_h > lh ? r.tex_h : lh);
+		stbtt_GetGlyphHMetrics(&face->font, r.glyph, &advanceWidth, &leftSideBearing);
+		c.tex = 0;
+		c.shelf = 0;
+		c.gen = 0; //not rasterized yet
+		c.width = (GLscalar)r.tex_w;
+		c.advance = (GLscalar)(stbtt_scale * (GLscalar)advanceWidth);
+		c.offx = (GLscalar)(stbtt_scale * (GLscalar)leftSideBearing)-oll;
+		c.offy = (GLscalar)r.y0-olt;
+		if (pixel_exact)
 		{
-			gltexid = gltexids.back();
-			glBindTexture(GL_TEXTURE_2D, gltexid);
-			x = (GLuint)(textnextline ? 0 : last_char_coord2 * 512.0f + 1);
-			y = (GLuint)(textnextline ? last_char_coord1 * 512.0f + 1 : last_char_coord5 * 512.0f);
+			c.advance = (GLscalar)(int)(c.advance + .5f);
+			c.offx = (GLscalar)(int)(c.offx + .5f);
 		}
+		memset(c.TextureCoordinates, 0, sizeof(c.TextureCoordinates));
+		return true;
+	}
 
-		glPixelStorei(GL_UNPACK_ALIGNMENT, (!(tex_w&7) ? 8 : (!(tex_w&3) ? 4 : (!(tex_w&1) ? 2 : 1))));
-		unsigned char *tex = (unsigned char*)malloc(tex_w*tex_h*ZLFONTVIDEO_BPP), *texalpha = tex+(ZLFONTVIDEO_BPP-1);
-		memset(tex, 0xFF, tex_w*tex_h*ZLFONTVIDEO_BPP); //clear alpha and lum to fully lit
+	//Render the pixels of a whole atlas slot of a glyph, only reads the font data so it can run on worker threads
+	void RasterizeChar(ZL_FontTTFRaster& r) const
+	{
+		int bmp_w, bmp_h, off_x, off_y;
+		float bmp_scale = (sdf ? stbtt_scale * ZLFONT_SDF_OVERSAMPLE : stbtt_scale);
+		unsigned char *bitmap = stbtt_GetGlyphBitmap(&face->font, bmp_scale, bmp_scale, r.glyph, &bmp_w, &bmp_h, &off_x, &off_y);
+		if (!bitmap) { r.pixels = NULL; return; }
+
+		//the whole slot gets uploaded to also clear the space below the glyph
+		GLuint tex_w = r.tex_w, tex_h = r.tex_h, slot_h = r.slot_h;
+		unsigned char *tex = (unsigned char*)malloc(tex_w*slot_h*ZLFONTVIDEO_BPP), *texalpha = tex+(ZLFONTVIDEO_BPP-1);
+		memset(tex, 0xFF, tex_w*slot_h*ZLFONTVIDEO_BPP); //clear alpha and lum to fully lit
+		int texstride = tex_w*ZLFONTVIDEO_BPP;
+		for (unsigned char *ptex = texalpha + tex_h*texstride, *ptexend = texalpha + slot_h*texstride; ptex != ptexend; ptex+=ZLFONTVIDEO_BPP) *ptex = 0;
 		unsigned char *bitmapend = bitmap+(bmp_w*bmp_h);
-		if (tex_w == (GLuint)bmp_w && tex_h == (GLuint)bmp_h)
+		if (sdf)
+		{
+			//the oversampled bitmap is placed relative to the top left corner of the cell including the spread
+			const int os = ZLFONT_SDF_OVERSAMPLE;
+			MakeGlyphDistanceField(bitmap, bmp_w, bmp_h, off_x - (r.x0 - oll)*os, off_y - (r.y0 - olt)*os, os, ZLFONT_SDF_SPREAD, texalpha, tex_w, tex_h, ZLFONTVIDEO_BPP);
+		}
+		else if (tex_w == (GLuint)bmp_w && tex_h == (GLuint)bmp_h)
 		{
 			//just set alpha to the value of input if tex and bmp sizes match
 			for (unsigned char *ptex = texalpha, *pin = bitmap; pin != bitmapend; ptex+=ZLFONTVIDEO_BPP)
@@ -388,10 +832,9 @@ struct ZL_FontTTF_Impl : ZL_Font_Impl
 		else
 		{
 			//clear alpha to 0, set alpha to bmp for all outline directions, clear alpha in center to keep only outline
-			int texstride = tex_w*ZLFONTVIDEO_BPP;
 			for (unsigned char *ptex = texalpha, *ptexend = ptex+tex_h*texstride; ptex != ptexend; ptex+=ZLFONTVIDEO_BPP) *ptex = 0;
-			for (int r = 0, rw = oll+1+olr, rh = olt+1+olb, rwh = rw*rh; r < rwh; ++r)
-				for (unsigned char *pin = bitmap, *ptexline = texalpha+ZLFONTVIDEO_BPP*((tex_w*(r/rw))+(r%rw)); pin != bitmapend; ptexline+=texstride)
+			for (int o = 0, rw = oll+1+olr, rh = olt+1+olb, rwh = rw*rh; o < rwh; ++o)
+				for (unsigned char *pin = bitmap, *ptexline = texalpha+ZLFONTVIDEO_BPP*((tex_w*(o/rw))+(o%rw)); pin != bitmapend; ptexline+=texstride)
 					for (unsigned char *ptex = ptexline, *pinlineend = pin + bmp_w; pin != pinlineend; ptex+=ZLFONTVIDEO_BPP, ++pin)
 						if (*pin > *ptex) *ptex = *pin;
 			for (unsigned char *pin = bitmap, *ptexline = texalpha+ZLFONTVIDEO_BPP*((tex_w*olt)+(oll)); pin != bitmapend; ptexline+=texstride)
@@ -399,120 +842,235 @@ struct ZL_FontTTF_Impl : ZL_Font_Impl
 					*ptex -= *pin;
 		}
 		stbtt_FreeBitmap(bitmap, NULL);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, tex_w, tex_h, ZLFONTVIDEO_FORMAT, GL_UNSIGNED_BYTE, tex);
-		free(tex);
-
-		//ZL_Application::Log("FONT", "Char %c at off %d, %d with size %d, %d (glyoff: %d, %d)", (char)cd, x, y, bmp_w, bmp_h, off_x, off_y);
+		r.pixels = tex;
+	}
 
-		stbtt_GetGlyphHMetrics(&font, glyph, &advanceWidth, &leftSideBearing);
+	//Reserve the space for a rasterized glyph in the atlas, returns false if it is too large for the atlas
+	bool PlaceChar(ZL_FontTTFRaster& r)
+	{
+		int shelf = (r.pixels ? pGlyphAtlas->Allocate(r.tex_w, r.slot_h) : -1);
+		if (shelf < 0) { r.c.tex = -1; return false; }
+		ZL_FontGlyphAtlas::Shelf& sh = pGlyphAtlas->shelves[shelf];
+		r.x = sh.x;
+		sh.x += r.tex_w + 1;
+		sh.LastUsedFrame = ZL_Application::FrameCount;
+
+		Char& c = r.c;
+		c.tex = (signed short)sh.page;
+		c.shelf = (unsigned short)shelf;
+		c.gen = sh.gen;
+		GLscalar *pTexCoord = c.TextureCoordinates;
+		pTexCoord[0] = pTexCoord[4] = (GLscalar)r.x / s(ZLFONTATLAS_SIZE);
+		pTexCoord[5] = pTexCoord[7] = (GLscalar)sh.y / s(ZLFONTATLAS_SIZE);
+		pTexCoord[2] = pTexCoord[6] = (GLscalar)(r.x + r.tex_w) / s(ZLFONTATLAS_SIZE);
+		pTexCoord[1] = pTexCoord[3] = (GLscalar)(sh.y + cell_h) / s(ZLFONTATLAS_SIZE);
+		return true;
+	}
 
-		Char c;
-		c.tex = (signed char)(gltexids.size()-1);
-		c.width = (GLscalar)tex_w;
-		c.advance = (GLscalar)(stbtt_scale * (GLscalar)advanceWidth);
-		c.offx = (GLscalar)(stbtt_scale * (GLscalar)leftSideBearing)-oll;
-		c.offy = (GLscalar)off_y-olt;
-		if (pixel_exact)
+	//Calculate the glyph metrics and if Rasterize is set also render it into the shared atlas (otherwise it gets rendered the first time it is drawn)
+	const Char& MakeChar(unsigned short cd, bool Rasterize)
+	{
+		ZL_FontTTFRaster r;
+		if (!PrepareChar(cd, r) || !Rasterize) return face->chars.Put(cd, r.c);
+		RasterizeChar(r);
+		if (PlaceChar(r))
 		{
-			c.advance = (GLscalar)(int)(c.advance + .5f);
-			c.offx = (GLscalar)(int)(c.offx + .5f);
+			ZL_FontGlyphAtlas::Shelf& sh = pGlyphAtlas->shelves[r.c.shelf];
+			glBindTexture(GL_TEXTURE_2D, pGlyphAtlas->gltexids[sh.page]);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, (!(r.tex_w&7) ? 8 : (!(r.tex_w&3) ? 4 : (!(r.tex_w&1) ? 2 : 1))));
+			glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, sh.y, r.tex_w, r.slot_h, ZLFONTVIDEO_FORMAT, GL_UNSIGNED_BYTE, r.pixels);
 		}
-		GLscalar *pTexCoord = c.TextureCoordinates;
-		pTexCoord[0] = pTexCoord[4] = (GLscalar)x / s(512);
-		last_char_coord5 = pTexCoord[5] = pTexCoord[7] = (GLscalar)y / s(512);
-		last_char_coord2 = pTexCoord[2] = pTexCoord[6] = (GLscalar)(x + tex_w) / s(512);
-		last_char_coord1 = pTexCoord[1] = pTexCoord[3] = (GLscalar)(y + fLineHeight + (olt+olb)) / s(512);
-		last_char = true;
-		return chars.Put(cd, c);
+		if (r.pixels) free(r.pixels);
+		return face->chars.Put(cd, r.c);
+	}
+
+	//Rasterize many glyphs on the worker threads, then place them all and upload each filled atlas shelf at once
+	void Preload(const char *charset);
+
+	//Get a glyph ready for drawing, returns NULL if it needs to be rasterized first
+	inline const Char* GetDrawChar(unsigned short cd)
+	{
+		const Char& c = face->chars.Get(cd);
+		if (&c == &face->chars.NotFoundValue || (c.tex >= 0 && !pGlyphAtlas->Touch(c.shelf, c.gen))) return NULL;
+		return &c;
 	}
 
 	#define UCS(txt, sz, cd) (txt[0] < 0xc2 ? sz=1,cd=txt[0] : \
 	        (txt[0] > 0xdf && txt[0] < 0xf0 ? sz=(txt[1] && txt[2] ? 3 : 1),cd=((txt[0]&0x1f)<<12) + ((txt[1]&0x7f)<<6) + (txt[2]&0x7f) : \
 	        (txt[0] > 0xc1 && txt[0] < 0xe0 ? sz=(txt[1] ? 2 : 1),cd=((txt[0]&0x3f)<<6) + (txt[1]&0x7f) : sz=4,cd=0)))
 
-	GLsizei CountBuffer(const char *text, std::vector<int>* &vecTTFTexLastIndex)
+	GLsizei CountBuffer(const char *text, ZL_FontTTFBuffer* &ttfbuf)
 	{
 		GLsizei cnt = 0;
 		unsigned char sz;
 		unsigned short cd;
-		int *texoffsetbegin, *texoffsetend;
-		if (!vecTTFTexLastIndex) vecTTFTexLastIndex = new std::vector<int>();
-		else vecTTFTexLastIndex->clear();
-		vecTTFTexLastIndex->resize(gltexids.size());
-		if (gltexids.size()) { texoffsetbegin = &vecTTFTexLastIndex->operator[](0); texoffsetend = &vecTTFTexLastIndex->back(); }
-		else texoffsetbegin = texoffsetend = NULL;
+		if (!ttfbuf) ttfbuf = new ZL_FontTTFBuffer();
+		ttfbuf->TexLastIndex.clear();
+		ttfbuf->Shelves.clear();
+		//glyphs are touched while counting so adding new glyphs to the atlas can't evict the ones counted before
 		for (const unsigned char *p = (const unsigned char*)text, *pEnd = (limitCount ? p + limitCount : (unsigned char*)-1); *p && p < pEnd; p += sz)
 		{
 			if (*p <= ' ') { sz = 1; continue; }
 			UCS(p, sz, cd);
 			if (!cd) continue;
-			signed char tex;
-			const Char& c = chars.Get(cd);
-			if (&c == &chars.NotFoundValue)
-			{
-				tex = MakeChar(cd).tex;
-				if (gltexids.size() != vecTTFTexLastIndex->size())
-					{ vecTTFTexLastIndex->resize(gltexids.size()); texoffsetbegin = &vecTTFTexLastIndex->operator[](0); texoffsetend = &vecTTFTexLastIndex->back(); }
-			}
-			else tex = c.tex;
-			if (tex < 0) continue;
-			for (int *texoffset = texoffsetbegin + tex + 1; texoffset <= texoffsetend; ++texoffset) (*texoffset)++;
+			const Char* c = GetDrawChar(cd);
+			if (!c) c = &MakeChar(cd, true);
+			if (c->tex < 0) continue;
+			ttfbuf->AddShelf(c->shelf, c->gen);
+			if (ttfbuf->TexLastIndex.size() < pGlyphAtlas->gltexids.size()) ttfbuf->TexLastIndex.resize(pGlyphAtlas->gltexids.size(), cnt); //new pages start after all glyphs counted so far
+			for (std::vector<int>::iterator texoffset = ttfbuf->TexLastIndex.begin() + c->tex + 1; texoffset != ttfbuf->TexLastIndex.end(); ++texoffset) (*texoffset)++;
 			cnt++;
 		}
+		ttfbuf->TexLastIndex.resize(pGlyphAtlas->gltexids.size(), cnt);
 		return cnt;
 	}
 
-	void RenderBuffer(const char *text, GLscalar* vertices, GLscalar* texcoords, std::vector<int>* vecTTFTexLastIndex, GLsizei &len, scalar &width, scalar &height)
+	void RenderBuffer(const char *text, GLscalar* vertices, GLscalar* texcoords, ZL_FontTTFBuffer* ttfbuf, GLsizei &len, scalar &width, scalar &height)
 	{
-		scalar x = 0, y = 0, lh = (fLineHeight+(olt+olb));
+		scalar x = 0, y = 0, lh = cell_h*sdf_scale, k = sdf_scale, pad = (sdf ? 0 : olr);
 		unsigned char sz;
 		unsigned short cd;
 		width = 0;
 		for (const unsigned char *p = (const unsigned char*)text, *pEnd = (limitCount ? p + limitCount : (unsigned char*)-1); *p && p < pEnd; p += sz)
 		{
 			if (*p == '\r') { sz = 1; continue; }
-			if (*p == '\n') { sz = 1; if (x - fCharSpacing + olr > width) width = x - fCharSpacing + olr; x = 0; y -= (fLineHeight + fLineSpacing); continue; }
+			if (*p == '\n') { sz = 1; if (x - fCharSpacing + pad > width) width = x - fCharSpacing + pad; x = 0; y -= (fLineHeight + fLineSpacing); continue; }
 			if (*p <= ' ' ) { sz = 1; x += fSpaceWidth + fCharSpacing; continue; }
 			UCS(p, sz, cd);
 			if (!cd) continue;
-			const Char& c = chars.Get(cd);
+			const Char& c = face->chars.Get(cd);
 			if (c.tex < 0) { x += fSpaceWidth + fCharSpacing; continue; }
-			int vv = 12 * (vecTTFTexLastIndex->operator[](c.tex)++);
+			int vv = 12 * (ttfbuf->TexLastIndex[c.tex]++);
 			memcpy(&texcoords[vv+0], c.TextureCoordinates+0, sizeof(texcoords[0])*6);
 			memcpy(&texcoords[vv+6], c.TextureCoordinates+2, sizeof(texcoords[0])*6);
-			vertices[vv+0] = vertices[vv+4] = vertices[vv+ 8] = x + c.offx;             //left
-			vertices[vv+2] = vertices[vv+6] = vertices[vv+10] = vertices[vv] + c.width; //right
-			vertices[vv+5] = vertices[vv+9] = vertices[vv+11] = y - c.offy;             //top
-			vertices[vv+1] = vertices[vv+3] = vertices[vv+ 7] = vertices[vv+5] - lh;    //bottom
-			x += c.advance + fCharSpacing;
+			vertices[vv+0] = vertices[vv+4] = vertices[vv+ 8] = x + c.offx*k;             //left
+			vertices[vv+2] = vertices[vv+6] = vertices[vv+10] = vertices[vv] + c.width*k; //right
+			vertices[vv+5] = vertices[vv+9] = vertices[vv+11] = y - c.offy*k;             //top
+			vertices[vv+1] = vertices[vv+3] = vertices[vv+ 7] = vertices[vv+5] - lh;      //bottom
+			x += c.advance*k + fCharSpacing;
 		}
 		height = 0 - (y - fLineHeight);
-		if (x - fCharSpacing + olr > width) width = x - fCharSpacing + olr;
+		if (x - fCharSpacing + pad > width) width = x - fCharSpacing + pad;
 	}
 
-	void DoDrawBuffer(std::vector<int>* vecTTFTexLastIndex, GLsizei len)
+	void DoDrawBuffer(ZL_FontTTFBuffer* ttfbuf, GLsizei len)
 	{
-		for (int texcount = (int)vecTTFTexLastIndex->size(), offset = 0, tex = 0; tex < texcount; tex++)
+		ttfbuf->TouchShelves();
+		#ifdef ZLFONT_SDF
+		bool sdf_active = (sdf && SDFBegin(sdf_scale)); //the buffer scale is already part of the matrix
+		#endif
+		for (int texcount = (int)ttfbuf->TexLastIndex.size(), offset = 0, tex = 0; tex < texcount; tex++)
 		{
-			int last = vecTTFTexLastIndex->operator[](tex);
+			int last = ttfbuf->TexLastIndex[tex];
 			if (last == offset) continue;
-			glBindTexture(GL_TEXTURE_2D, gltexids[tex]);
+			glBindTexture(GL_TEXTURE_2D, pGlyphAtlas->gltexids[tex]);
 			glDrawArraysUnbuffered(GL_TRIANGLES, offset*6, (last-offset)*6);
 			offset = last;
 		}
+		#ifdef ZLFONT_SDF
+		if (sdf_active) ZLGLSL::DisableProgram();
+		#endif
 	}
 
+	scalar RenderLine(const char *text, size_t len, unsigned int pos, GLscalar y, ZL_TextGlyphs& out, ZL_FontTTFBuffer* &ttfbuf)
+	{
+		GLscalar x = 0, lh = cell_h*sdf_scale, k = sdf_scale, pad = (sdf ? 0 : olr);
+		unsigned char sz;
+		unsigned short cd;
+		if (!ttfbuf) ttfbuf = new ZL_FontTTFBuffer();
+		for (const unsigned char *p = (const unsigned char*)text, *pEnd = p + len; p < pEnd; p += sz)
+		{
+			if (*p == '\r') { sz = 1; continue; }
+			if (*p <= ' ' ) { sz = 1; x += fSpaceWidth + fCharSpacing; continue; }
+			UCS(p, sz, cd);
+			if (!cd) continue;
+			const Char* c = GetDrawChar(cd);
+			if (!c) c = &MakeChar(cd, true);
+			if (c->tex < 0) { x += fSpaceWidth + fCharSpacing; continue; }
+			ttfbuf->AddShelf(c->shelf, c->gen);
+			GLscalar left = x + c->offx*k, top = y - c->offy*k;
+			out.Add(pos + (unsigned int)(p - (const unsigned char*)text), c->tex, c->shelf, left, top - lh, left + c->width*k, top, c->TextureCoordinates);
+			x += c->advance*k + fCharSpacing;
+		}
+		return x - fCharSpacing + pad;
+	}
+
+	GLuint GetRunTexture(ZL_FontTTFBuffer* ttfbuf, signed short tex)
+	{
+		ttfbuf->TouchShelves();
+		return pGlyphAtlas->gltexids[tex];
+	}
+
+	void DoDrawRuns(ZL_FontTTFBuffer* ttfbuf, const ZL_TextGlyphs& glyphs, GLsizei from, GLsizei to)
+	{
+		ttfbuf->TouchShelves();
+		#ifdef ZLFONT_SDF
+		bool sdf_active = (sdf && SDFBegin(sdf_scale));
+		#endif
+		GLsizei start = 0;
+		for (std::vector<ZL_TextGlyphs::Run>::const_iterator it = glyphs.runs.begin(); it != glyphs.runs.end() && start < to; start = (it++)->end)
+		{
+			GLsizei a = (start > from ? start : from), b = (it->end < to ? it->end : to);
+			if (a >= b) continue;
+			glBindTexture(GL_TEXTURE_2D, pGlyphAtlas->gltexids[it->tex]);
+			glDrawArraysUnbuffered(GL_TRIANGLES, a*6, (b-a)*6);
+		}
+		#ifdef ZLFONT_SDF
+		if (sdf_active) ZLGLSL::DisableProgram();
+		#endif
+	}
+
+	#ifdef ZLFONT_SDF
+	//Switch to the distance field shader, RasterToUnits is the size of one reference glyph pixel in the current model view space
+	bool SDFBegin(GLscalar RasterToUnits)
+	{
+		if (ZLGLSL::ActiveProgram == ZLGLSL::CUSTOM) return false; //keep a user shader active, it gets the distance field as alpha
+		if (!FontSDFProgram.PROGRAM && !CreateFontSDFProgram()) return false;
+
+		//screen pixels per reference pixel to keep the anti aliased edge at about one screen pixel at any scale
+		ZLGLSL::GLSLscalar x0 = 0, y0 = 0, x1 = (ZLGLSL::GLSLscalar)RasterToUnits, y1 = 0;
+		ZLGLSL::Project(x0, y0);
+		ZLGLSL::Project(x1, y1);
+		GLscalar px = (x1 - x0) * active_viewport[2] * .5f, py = (y1 - y0) * active_viewport[3] * .5f, screen = (GLscalar)ssqrt(px*px + py*py);
+		GLscalar dist = 1 / (2 * ZLFONT_SDF_SPREAD * sdf_scale); //nominal font pixels to distance field alpha
+		GLscalar outline = (GLscalar)sdf->outline * dist, softness = (GLscalar)sdf->shadow_softness * dist, maxoff = ZLFONT_SDF_SPREAD * sdf_scale;
+		GLscalar shadowx = (GLscalar)sdf->shadow_offset.x, shadowy = (GLscalar)sdf->shadow_offset.y;
+		if (outline > .45f) outline = .45f;
+		if (shadowx > maxoff) shadowx = maxoff; else if (shadowx < -maxoff) shadowx = -maxoff; //the quads only have room for offsets up to the spread
+		if (shadowy > maxoff) shadowy = maxoff; else if (shadowy < -maxoff) shadowy = -maxoff;
+
+		ZLGLSL::ActiveProgram = ZLGLSL::CUSTOM;
+		glUseProgram(FontSDFProgram.PROGRAM);
+		ZLGLSL::UNI_MVP = FontSDFProgram.UNI_MVP;
+		ZLGL_ENABLE_VERTEXARRAYOBJECT();
+		glEnableVertexAttribArrayUnbuffered(ZLGLSL::ATTR_POSITION);
+		glEnableVertexAttribArrayUnbuffered(ZLGLSL::ATTR_TEXCOORD);
+		ZLGLSL::MatrixProgramChanged();
+		glUniform1(FontSDFProgram.UNI_SMOOTH, (GLscalar)(.25f / (ZLFONT_SDF_SPREAD * (screen > .01f ? screen : .01f))));
+		glUniform1(FontSDFProgram.UNI_OUTLINE, outline);
+		glUniform4(FontSDFProgram.UNI_OUTLINE_COLOR, sdf->outline_color.r, sdf->outline_color.g, sdf->outline_color.b, sdf->outline_color.a);
+		glUniform4(FontSDFProgram.UNI_SHADOW, shadowx / sdf_scale / ZLFONTATLAS_SIZE, -shadowy / sdf_scale / ZLFONTATLAS_SIZE, softness, 0);
+		glUniform4(FontSDFProgram.UNI_SHADOW_COLOR, sdf->shadow_color.r, sdf->shadow_color.g, sdf->shadow_color.b, sdf->shadow_color.a);
+		return true;
+	}
+	#endif
+
+	ZL_FontSDFEffects* GetSDFEffects() { return sdf; }
+
 	void DoDraw(scalar x, scalar y, const char *text, scalar scalew, scalar scaleh, const ZL_Color &color)
 	{
 		scalar xleft = x;
 		GLscalar vertices[12*VBSIZE], texcoords[12*VBSIZE];
 		ZLGL_ENABLE_TEXTURE();
 		ZLGL_COLOR(color);
+		#ifdef ZLFONT_SDF
+		bool sdf_active = (sdf && SDFBegin(sdf_scale * (scalew > scaleh ? scalew : scaleh)));
+		#endif
 		ZLGL_TEXCOORDPOINTER(2, GL_SCALAR, 0, texcoords);
 		ZLGL_VERTEXTPOINTER(2, GL_SCALAR, 0, vertices);
-		GLscalar cs = fCharSpacing, lh = (scaleh * (fLineHeight+(olt+olb)));
+		GLscalar cs = fCharSpacing, lh = (scaleh * cell_h * sdf_scale), kw = scalew * sdf_scale, kh = scaleh * sdf_scale;
 		int v = 0;
-		signed char last_tex = -1;
+		signed short last_tex = -1;
 		unsigned char sz;
 		unsigned short cd;
 		for (const unsigned char *p = (const unsigned char*)text, *pEnd = (limitCount ? p + limitCount : (unsigned char*)-1); *p && p < pEnd; p += sz)
@@ -522,26 +1080,35 @@ struct ZL_FontTTF_Impl : ZL_Font_Impl
 			if (*p <= ' ' ) { sz = 1; x += (fSpaceWidth + cs) * scalew; continue; }
 			UCS(p, sz, cd);
 			if (!cd) continue;
-			const Char& it = chars.Get(cd);
-			const Char& c = (&it == &chars.NotFoundValue ? MakeChar(cd) : it);
-			if (c.tex < 0) { x += (fSpaceWidth + cs) * scalew; continue; }
-			if (last_tex != c.tex)
+			const Char* c = GetDrawChar(cd);
+			if (!c)
+			{
+				//rasterizing binds an atlas page, so draw what is queued and bind again afterwards
+				if (v) { glDrawArraysUnbuffered(GL_TRIANGLES, 0, 6*v); v = 0; }
+				c = &MakeChar(cd, true);
+				last_tex = -1;
+			}
+			if (c->tex < 0) { x += (fSpaceWidth + cs) * scalew; continue; }
+			if (last_tex != c->tex)
 			{
 				if (v) { glDrawArraysUnbuffered(GL_TRIANGLES, 0, 6*v); v = 0; }
-				last_tex = c.tex;
-				glBindTexture(GL_TEXTURE_2D, gltexids[last_tex]);
+				last_tex = c->tex;
+				glBindTexture(GL_TEXTURE_2D, pGlyphAtlas->gltexids[last_tex]);
 			}
 			int vv = 12 * v++;
-			memcpy(&texcoords[vv+0], c.TextureCoordinates+0, sizeof(texcoords[0])*6);
-			memcpy(&texcoords[vv+6], c.TextureCoordinates+2, sizeof(texcoords[0])*6);
-			vertices[vv+0] = vertices[vv+4] = vertices[vv+ 8] = x + (c.offx*scalew);               //left
-			vertices[vv+2] = vertices[vv+6] = vertices[vv+10] = vertices[vv+0] + (c.width*scalew); //right
-			vertices[vv+5] = vertices[vv+9] = vertices[vv+11] = y - (c.offy*scaleh);               //top
-			vertices[vv+1] = vertices[vv+3] = vertices[vv+ 7] = vertices[vv+5] - lh;               //bottom
+			memcpy(&texcoords[vv+0], c->TextureCoordinates+0, sizeof(texcoords[0])*6);
+			memcpy(&texcoords[vv+6], c->TextureCoordinates+2, sizeof(texcoords[0])*6);
+			vertices[vv+0] = vertices[vv+4] = vertices[vv+ 8] = x + (c->offx*kw);                //left
+			vertices[vv+2] = vertices[vv+6] = vertices[vv+10] = vertices[vv+0] + (c->width*kw); //right
+			vertices[vv+5] = vertices[vv+9] = vertices[vv+11] = y - (c->offy*kh);                //top
+			vertices[vv+1] = vertices[vv+3] = vertices[vv+ 7] = vertices[vv+5] - lh;            //bottom
 			if (v == VBSIZE) { glDrawArraysUnbuffered(GL_TRIANGLES, 0, 6*VBSIZE); v = 0; }
-			x += (c.advance + cs) * scalew;
+			x += c->advance * kw + cs * scalew;
 		}
 		if (v) glDrawArraysUnbuffered(GL_TRIANGLES, 0, 6*v);
+		#ifdef ZLFONT_SDF
+		if (sdf_active) ZLGLSL::DisableProgram();
+		#endif
 	}
 
 	void GetDimensions(const char *text, scalar* width, scalar* height, bool resetLimitCount)
@@ -573,13 +1140,156 @@ struct ZL_FontTTF_Impl : ZL_Font_Impl
 			if (*p <= ' ') { linewidth += fSpaceWidth + cs; sz = 1; c = NULL; continue; }
 			UCS(p, sz, cd);
 			if (!cd) continue;
-			const Char& it = chars.Get(cd);
-			c = (&it == &chars.NotFoundValue ? &MakeChar(cd) : &it);
-			linewidth += (c->tex < 0 ? fSpaceWidth : c->advance) + cs;
+			const Char& it = face->chars.Get(cd);
+			c = (&it == &face->chars.NotFoundValue ? &MakeChar(cd, false) : &it); //only metrics are needed, rasterizing happens when drawing
+			linewidth += (c->tex < 0 ? fSpaceWidth : c->advance * sdf_scale) + cs;
 		}
 	}
 };
 
+//Glyphs rasterized by the main thread and the job workers while preloading, freed by whoever releases it last
+struct ZL_FontPreloadTask
+{
+	const ZL_FontTTF_Impl* font;
+	std::vector<ZL_FontTTFRaster> glyphs;
+	size_t next, done;
+	int refs;
+	ZL_MutexHandle mutex;
+};
+#define ZLFONT_PRELOAD_CHUNK 8
+#define ZLFONT_PRELOAD_JOBS 3
+
+static void ZL_FontPreloadWork(ZL_FontPreloadTask* task)
+{
+	for (size_t from = 0, to = 0;;)
+	{
+		ZL_MutexLock(task->mutex);
+		task->done += to - from;
+		from = task->next;
+		to = task->next = (from + ZLFONT_PRELOAD_CHUNK < task->glyphs.size() ? from + ZLFONT_PRELOAD_CHUNK : task->glyphs.size());
+		ZL_MutexUnlock(task->mutex);
+		if (from == to) return;
+		for (size_t i = from; i != to; i++) task->font->RasterizeChar(task->glyphs[i]);
+	}
+}
+
+static void ZL_FontPreloadRelease(ZL_FontPreloadTask* task)
+{
+	ZL_MutexLock(task->mutex);
+	bool last = !--task->refs;
+	ZL_MutexUnlock(task->mutex);
+	if (!last) return;
+	ZL_MutexDestroy(task->mutex);
+	delete task;
+}
+
+static void ZL_FontPreloadJob(void* task)
+{
+	ZL_FontPreloadWork((ZL_FontPreloadTask*)task);
+	ZL_FontPreloadRelease((ZL_FontPreloadTask*)task);
+}
+
+static bool SortRasterByHeight(const ZL_FontTTFRaster* a, const ZL_FontTTFRaster* b) { return a->slot_h > b->slot_h; }
+static bool SortRasterByPlace(const ZL_FontTTFRaster* a, const ZL_FontTTFRaster* b) { return ((a->c.tex < 0) != (b->c.tex < 0) ? a->c.tex < 0 : (a->c.shelf != b->c.shelf ? a->c.shelf < b->c.shelf : a->x < b->x)); }
+
+void ZL_FontTTF_Impl::Preload(const char *charset)
+{
+	std::vector<unsigned short> cds;
+	unsigned char sz;
+	unsigned short cd;
+	for (const unsigned char *p = (const unsigned char*)charset; *p; p += sz)
+	{
+		if (*p <= ' ') { sz = 1; continue; }
+		UCS(p, sz, cd);
+		if (cd && !GetDrawChar(cd)) cds.push_back(cd);
+	}
+	std::sort(cds.begin(), cds.end());
+	cds.erase(std::unique(cds.begin(), cds.end()), cds.end());
+
+	ZL_FontPreloadTask* task = new ZL_FontPreloadTask();
+	task->font = this;
+	task->next = task->done = 0;
+	task->refs = 1;
+	for (std::vector<unsigned short>::iterator it = cds.begin(); it != cds.end(); ++it)
+	{
+		ZL_FontTTFRaster r;
+		if (PrepareChar(*it, r)) task->glyphs.push_back(r);
+		else face->chars.Put(*it, r.c);
+	}
+	size_t count = task->glyphs.size(), jobs = (count ? (count - 1) / ZLFONT_PRELOAD_CHUNK : 0);
+	if (!count) { delete task; return; }
+	if (jobs > ZLFONT_PRELOAD_JOBS) jobs = ZLFONT_PRELOAD_JOBS;
+	ZL_MutexInit(task->mutex);
+	task->refs += (int)jobs;
+	for (size_t i = 0; i != jobs; i++) ZL_JobQueue(ZL_FontPreloadJob, task);
+	ZL_FontPreloadWork(task);
+	for (bool finished = false; !finished;)
+	{
+		ZL_MutexLock(task->mutex);
+		finished = (task->done == count);
+		ZL_MutexUnlock(task->mutex);
+		if (!finished) ZL_Delay(1);
+	}
+
+	//place the tallest glyphs first to fill shelves of similar height, then upload all glyphs placed on a shelf at once
+	std::vector<ZL_FontTTFRaster*> order;
+	for (size_t i = 0; i != count; i++) order.push_back(&task->glyphs[i]);
+	std::sort(order.begin(), order.end(), SortRasterByHeight);
+	for (std::vector<ZL_FontTTFRaster*>::iterator it = order.begin(); it != order.end(); ++it) PlaceChar(**it);
+	std::sort(order.begin(), order.end(), SortRasterByPlace);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t i = 0, j; i != count; i = j)
+	{
+		ZL_FontTTFRaster *first = order[i];
+		for (j = i + 1; first->c.tex >= 0 && j != count && order[j]->c.tex >= 0 && order[j]->c.shelf == first->c.shelf; j++) {}
+		if (first->c.tex >= 0)
+		{
+			const ZL_FontGlyphAtlas::Shelf& sh = pGlyphAtlas->shelves[first->c.shelf];
+			GLuint band_w = order[j-1]->x + order[j-1]->tex_w - first->x, stride = band_w*ZLFONTVIDEO_BPP;
+			unsigned char *band = (unsigned char*)malloc(stride*sh.h);
+			memset(band, 0xFF, stride*sh.h);
+			for (unsigned char *pa = band+(ZLFONTVIDEO_BPP-1), *paend = pa+stride*sh.h; pa != paend; pa+=ZLFONTVIDEO_BPP) *pa = 0;
+			for (size_t k = i; k != j; k++)
+				for (GLuint row = 0, rowsize = order[k]->tex_w*ZLFONTVIDEO_BPP; row != order[k]->slot_h; row++)
+					memcpy(band + row*stride + (order[k]->x - first->x)*ZLFONTVIDEO_BPP, order[k]->pixels + row*rowsize, rowsize);
+			glBindTexture(GL_TEXTURE_2D, pGlyphAtlas->gltexids[sh.page]);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, first->x, sh.y, band_w, sh.h, ZLFONTVIDEO_FORMAT, GL_UNSIGNED_BYTE, band);
+			free(band);
+		}
+		for (size_t k = i; k != j; k++)
+		{
+			face->chars.Put(order[k]->cd, order[k]->c);
+			if (order[k]->pixels) free(order[k]->pixels);
+		}
+	}
+	ZL_FontPreloadRelease(task);
+}
+
+ZL_FontLayout* ZL_Font_Impl::GetLayout(const char *text)
+{
+	if (!*text) return NULL;
+	unsigned int hash = ZL_FontLayoutHash(text);
+	if (!layouts) layouts = new ZL_FontLayout[ZLFONT_LAYOUT_CACHE_SIZE];
+	ZL_FontLayout& l = layouts[hash % ZLFONT_LAYOUT_CACHE_SIZE];
+	bool found = (l.hash == hash && l.text == text);
+	if (!found && l.text.length() && l.LastUsedFrame == ZL_Application::FrameCount) return NULL; //the slot is taken by another text drawn in this frame
+	if (!found)
+	{
+		l.text = text;
+		l.hash = hash;
+		GetDimensions(text, &l.width, &l.height);
+	}
+	if (!found || (l.ttfbuf && !l.ttfbuf->IsValid()))
+	{
+		scalar render_width, render_height;
+		l.len = CountBuffer(text, l.ttfbuf);
+		if (l.vertices.size() < (size_t)(12*l.len)) { l.vertices.resize(12*l.len); l.texcoords.resize(12*l.len); }
+		if (l.len) RenderBuffer(text, &l.vertices[0], &l.texcoords[0], l.ttfbuf, l.len, render_width, render_height);
+	}
+	l.LastUsedFrame = ZL_Application::FrameCount;
+	return &l;
+}
+
 ZL_IMPL_OWNER_DEFAULT_IMPLEMENTATIONS(ZL_Font)
 
 ZL_Font::ZL_Font(const ZL_FileLink& BitmapFontFile) : impl(new ZL_FontBitmap_Impl(BitmapFontFile))
@@ -605,13 +1315,13 @@ ZL_Font& ZL_Font::SetColor(const ZL_Color& color)
 
 ZL_Font& ZL_Font::SetCharSpacing(scalar CharSpacing)
 {
-	if (impl) impl->fCharSpacing = CharSpacing;
+	if (impl) { impl->fCharSpacing = CharSpacing; impl->ClearLayouts(); }
 	return *this;
 }
 
 ZL_Font& ZL_Font::SetLineSpacing(scalar LineSpacing)
 {
-	if (impl) impl->fLineSpacing = LineSpacing;
+	if (impl) { impl->fLineSpacing = LineSpacing; impl->ClearLayouts(); }
 	return *this;
 }
 
@@ -662,16 +1372,16 @@ scalar ZL_Font::GetScaleH() const { return (impl ? impl->scale.x : s(1)); }
 scalar ZL_Font::GetLineHeight() const { return (impl ? impl->fLineHeight*impl->scale.y : s(0)); }
 scalar ZL_Font::GetLineHeight(scalar scale) const { return (impl ? impl->fLineHeight*scale : s(0)); }
 
-scalar ZL_Font::GetHeight(const char *text) const { if (!impl) return 0; scalar h; impl->GetDimensions(text, NULL, &h); return h*impl->scale.y; }
-scalar ZL_Font::GetHeight(const char *text, scalar scale) const { if (!impl) return 0; scalar h; impl->GetDimensions(text, NULL, &h); return h*scale; }
-scalar ZL_Font::GetWidth(const char *text) const { if (!impl) return 0; scalar w; impl->GetDimensions(text, &w, NULL); return w*impl->scale.x; }
-scalar ZL_Font::GetWidth(const char *text, scalar scale) const  { if (!impl) return 0; scalar w; impl->GetDimensions(text, &w, NULL); return w*scale; }
-ZL_Vector ZL_Font::GetDimensions(const char *text) const { ZL_Vector s; if (impl) impl->GetDimensions(text, &s.x, &s.y); return s * impl->scale; }
-ZL_Vector ZL_Font::GetDimensions(const char *text, scalar scale) const { ZL_Vector s; if (impl) impl->GetDimensions(text, &s.x, &s.y); return s*scale; }
-ZL_Vector ZL_Font::GetDimensions(const char *text, scalar scalew, scalar scaleh) const { ZL_Vector s; if (impl) impl->GetDimensions(text, &s.x, &s.y); return s * ZL_Vector(scalew, scaleh); }
-void ZL_Font::GetDimensions(const char *text, scalar* w, scalar* h) const { if (impl) { impl->GetDimensions(text, w, h); *w *= impl->scale.x; *h *= impl->scale.y; } else *w = *h = 0; }
-void ZL_Font::GetDimensions(const char *text, scalar* w, scalar* h, scalar scale) const { if (impl) { impl->GetDimensions(text, w, h); *w *= scale; *h *=  scale; } else *w = *h = 0; }
-void ZL_Font::GetDimensions(const char *text, scalar* w, scalar* h, scalar scalew, scalar scaleh) const { if (impl) { impl->GetDimensions(text, w, h); *w *= scalew; *h *= scaleh; } else *w = *h = 0; }
+scalar ZL_Font::GetHeight(const char *text) const { if (!impl) return 0; scalar h; impl->Measure(text, NULL, &h); return h*impl->scale.y; }
+scalar ZL_Font::GetHeight(const char *text, scalar scale) const { if (!impl) return 0; scalar h; impl->Measure(text, NULL, &h); return h*scale; }
+scalar ZL_Font::GetWidth(const char *text) const { if (!impl) return 0; scalar w; impl->Measure(text, &w, NULL); return w*impl->scale.x; }
+scalar ZL_Font::GetWidth(const char *text, scalar scale) const  { if (!impl) return 0; scalar w; impl->Measure(text, &w, NULL); return w*scale; }
+ZL_Vector ZL_Font::GetDimensions(const char *text) const { ZL_Vector s; if (impl) impl->Measure(text, &s.x, &s.y); return s * impl->scale; }
+ZL_Vector ZL_Font::GetDimensions(const char *text, scalar scale) const { ZL_Vector s; if (impl) impl->Measure(text, &s.x, &s.y); return s*scale; }
+ZL_Vector ZL_Font::GetDimensions(const char *text, scalar scalew, scalar scaleh) const { ZL_Vector s; if (impl) impl->Measure(text, &s.x, &s.y); return s * ZL_Vector(scalew, scaleh); }
+void ZL_Font::GetDimensions(const char *text, scalar* w, scalar* h) const { if (impl) { impl->Measure(text, w, h); *w *= impl->scale.x; *h *= impl->scale.y; } else *w = *h = 0; }
+void ZL_Font::GetDimensions(const char *text, scalar* w, scalar* h, scalar scale) const { if (impl) { impl->Measure(text, w, h); *w *= scale; *h *=  scale; } else *w = *h = 0; }
+void ZL_Font::GetDimensions(const char *text, scalar* w, scalar* h, scalar scalew, scalar scaleh) const { if (impl) { impl->Measure(text, w, h); *w *= scalew; *h *= scaleh; } else *w = *h = 0; }
 
 void ZL_Font::Draw(scalar x, scalar y, const char *text) const
 { if (impl) impl->Draw(x, y, text, impl->scale.x, impl->scale.y, impl->color, impl->draw_at_origin); }
@@ -729,6 +1439,43 @@ void ZL_Font::Draw(const ZL_Vector &p, const char *text, scalar scalew, scalar s
 
 void ZL_Font::RequestCharLimit(int limitCount) { impl->limitCount = limitCount; }
 
+void ZL_Font::Preload(const char* utf8_charset) const
+{
+	if (impl && utf8_charset) impl->Preload(utf8_charset);
+}
+
+ZL_Font ZL_Font::LoadSDF(const ZL_FileLink& TruetypeFontFile, scalar height)
+{
+	ZL_Font ret;
+	#ifdef ZLFONT_SDF
+	ret.impl = new ZL_FontTTF_Impl(TruetypeFontFile, height, false, 0, 0, 0, 0, true);
+	#else
+	ret.impl = new ZL_FontTTF_Impl(TruetypeFontFile, height, false, 0, 0, 0, 0);
+	#endif
+	if (!ret.impl->fLineHeight) { delete (ZL_FontTTF_Impl*)ret.impl; ret.impl = NULL; }
+	return ret;
+}
+
+ZL_Font& ZL_Font::SetOutline(scalar width, const ZL_Color& color)
+{
+	ZL_FontSDFEffects* fx = (impl ? impl->GetSDFEffects() : NULL);
+	if (fx) { fx->outline = width; fx->outline_color = color; }
+	return *this;
+}
+
+ZL_Font& ZL_Font::SetShadow(const ZL_Vector& offset, const ZL_Color& color, scalar softness)
+{
+	ZL_FontSDFEffects* fx = (impl ? impl->GetSDFEffects() : NULL);
+	if (fx) { fx->shadow_offset = offset; fx->shadow_color = color; fx->shadow_softness = softness; }
+	return *this;
+}
+
+void ZL_Font::SetGlyphAtlasMaxPages(unsigned int MaxPages)
+{
+	if (!pGlyphAtlas) pGlyphAtlas = new ZL_FontGlyphAtlas();
+	pGlyphAtlas->MaxPages = (MaxPages ? MaxPages : 1);
+}
+
 /* alternative using parameter struct for 2 or more options instead of that many overloaded draw methods
 void Draw(const ZL_Vector &p, const char *text, scalar scale) const;
 void Draw(const ZL_Vector &p, const char *text, const ZL_FontDrawDef &def) const;
@@ -745,19 +1492,152 @@ struct ZL_FontDrawDef
 };
 */
 
+struct ZL_TextBuffer_Impl;
+
+//Text buffers drawn while batch rendering is active are transformed on the CPU and collected into one vertex stream per texture
+//The collected text buffers stay referenced so the batch can be collected again when the shared glyph atlas evicted some of its glyphs
+struct ZL_TextBuffer_BatchRenderContext
+{
+	struct Page { ZL_Font_Impl* fnt; signed short tex; std::vector<GLscalar> vertices, texcoords, colors; }; //fnt is set for bitmap font textures, NULL for atlas pages
+	struct Entry { ZL_TextBuffer_Impl* buf; scalar x, y, scalew, scaleh; ZL_Color color; ZL_Origin::Type draw_at_origin; };
+	std::vector<Page> pages;
+	std::vector<Entry> entries;
+	ZL_FontTTFBuffer atlasrefs; //atlas shelves of all collected glyphs
+	size_t last_page;
+	bool active, collecting_again;
+	ZL_TextBuffer_BatchRenderContext() : last_page(0), active(false), collecting_again(false) { }
+
+	Page& GetPage(ZL_Font_Impl* fnt, signed short tex)
+	{
+		if (last_page < pages.size() && pages[last_page].fnt == fnt && pages[last_page].tex == tex) return pages[last_page];
+		for (last_page = 0; last_page != pages.size(); last_page++)
+			if (pages[last_page].fnt == fnt && pages[last_page].tex == tex) return pages[last_page];
+		if (fnt) fnt->AddRef();
+		pages.push_back(Page());
+		pages.back().fnt = fnt;
+		pages.back().tex = tex;
+		return pages.back();
+	}
+
+	void Record(ZL_TextBuffer_Impl* buf, scalar x, scalar y, scalar scalew, scalar scaleh, const ZL_Color &color, ZL_Origin::Type draw_at_origin);
+	void CollectAgain();
+	void ReleaseEntries();
+
+	static void Transform(GLscalar* dst, const GLscalar* src, size_t count, GLscalar tx, GLscalar ty, GLscalar sx, GLscalar sy)
+	{
+		#if defined(ZLFONT_SSE)
+		__m128 mul = _mm_setr_ps(sx, sy, sx, sy), add = _mm_setr_ps(tx, ty, tx, ty);
+		for (const GLscalar* srcEnd = src + count; src != srcEnd; src += 4, dst += 4)
+			_mm_storeu_ps(dst, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src), mul), add));
+		#elif defined(ZLFONT_NEON)
+		const float32_t muls[4] = { sx, sy, sx, sy }, adds[4] = { tx, ty, tx, ty };
+		float32x4_t mul = vld1q_f32(muls), add = vld1q_f32(adds);
+		for (const GLscalar* srcEnd = src + count; src != srcEnd; src += 4, dst += 4)
+			vst1q_f32(dst, vmlaq_f32(add, vld1q_f32(src), mul));
+		#else
+		for (const GLscalar* srcEnd = src + count; src != srcEnd; src += 2, dst += 2)
+			{ dst[0] = src[0] * sx + tx; dst[1] = src[1] * sy + ty; }
+		#endif
+	}
+
+	static void Fill(GLscalar* dst, size_t vertex_count, const ZL_Color &color)
+	{
+		#if defined(ZLFONT_SSE)
+		__m128 c = _mm_setr_ps(color.r, color.g, color.b, color.a);
+		for (GLscalar* dstEnd = dst + vertex_count * 4; dst != dstEnd; dst += 4) _mm_storeu_ps(dst, c);
+		#elif defined(ZLFONT_NEON)
+		const float32_t cs[4] = { color.r, color.g, color.b, color.a };
+		float32x4_t c = vld1q_f32(cs);
+		for (GLscalar* dstEnd = dst + vertex_count * 4; dst != dstEnd; dst += 4) vst1q_f32(dst, c);
+		#else
+		for (GLscalar* dstEnd = dst + vertex_count * 4; dst != dstEnd; dst += 4)
+			{ dst[0] = color.r; dst[1] = color.g; dst[2] = color.b; dst[3] = color.a; }
+		#endif
+	}
+
+	void Add(ZL_Font_Impl* fnt, ZL_FontTTFBuffer* ttfbuf, const ZL_TextGlyphs& glyphs, GLsizei from, GLsizei to, GLscalar x, GLscalar y, GLscalar scalew, GLscalar scaleh, const ZL_Color &color)
+	{
+		if (ttfbuf)
+		{
+			ttfbuf->TouchShelves();
+			for (std::vector<ZL_FontTTFBuffer::ShelfRef>::const_iterator it = ttfbuf->Shelves.begin(); it != ttfbuf->Shelves.end(); ++it)
+				atlasrefs.AddShelf(it->shelf, it->gen);
+		}
+		GLsizei start = 0;
+		for (std::vector<ZL_TextGlyphs::Run>::const_iterator it = glyphs.runs.begin(); it != glyphs.runs.end() && start < to; start = (it++)->end)
+		{
+			GLsizei a = (start > from ? start : from), b = (it->end < to ? it->end : to);
+			if (a >= b) continue;
+			Page& p = GetPage((ttfbuf ? NULL : fnt), it->tex);
+			size_t vertex_count = (size_t)(b - a) * 6, vpos = p.vertices.size(), cpos = p.colors.size();
+			p.vertices.resize(vpos + vertex_count * 2);
+			p.colors.resize(cpos + vertex_count * 4);
+			p.texcoords.insert(p.texcoords.end(), glyphs.texcoords.begin() + a*12, glyphs.texcoords.begin() + b*12);
+			Transform(&p.vertices[vpos], &glyphs.vertices[a*12], vertex_count * 2, x, y, scalew, scaleh);
+			Fill(&p.colors[cpos], vertex_count, color);
+		}
+	}
+
+	void Draw()
+	{
+		//textures are resolved on every draw so a replayed batch marks its glyphs as used and picks up reloaded bitmap font textures
+		if (!atlasrefs.IsValid()) CollectAgain();
+		atlasrefs.TouchShelves();
+		ZLGL_ENABLE_TEXTURE();
+		ZLGL_COLORARRAY_ENABLE();
+		for (std::vector<Page>::iterator it = pages.begin(); it != pages.end(); ++it)
+		{
+			if (it->vertices.empty()) continue;
+			glBindTexture(GL_TEXTURE_2D, (it->fnt ? it->fnt->GetRunTexture(NULL, it->tex) : pGlyphAtlas->gltexids[it->tex]));
+			ZLGL_VERTEXTPOINTER(2, GL_SCALAR, 0, &it->vertices[0]);
+			ZLGL_COLORARRAY_POINTER(4, GL_SCALAR, 0, &it->colors[0]);
+			ZLGL_TEXCOORDPOINTER(2, GL_SCALAR, 0, &it->texcoords[0]);
+			glDrawArraysUnbuffered(GL_TRIANGLES, 0, (GLsizei)(it->vertices.size() / 2));
+		}
+		ZLGL_COLORARRAY_DISABLE();
+	}
+
+	void Clear()
+	{
+		ReleaseEntries();
+		atlasrefs.Shelves.clear();
+		//keep the allocated page buffers for the next batch, only drop pages that were unused in this one
+		size_t used = 0;
+		for (size_t i = 0; i != pages.size(); i++)
+		{
+			if (pages[i].vertices.empty()) { if (pages[i].fnt) pages[i].fnt->DelRef(); continue; }
+			if (used != i)
+			{
+				std::swap(pages[used].fnt, pages[i].fnt);
+				std::swap(pages[used].tex, pages[i].tex);
+				pages[used].vertices.swap(pages[i].vertices);
+				pages[used].texcoords.swap(pages[i].texcoords);
+				pages[used].colors.swap(pages[i].colors);
+			}
+			pages[used].vertices.clear();
+			pages[used].texcoords.clear();
+			pages[used].colors.clear();
+			used++;
+		}
+		pages.resize(used);
+	}
+};
+static ZL_TextBuffer_BatchRenderContext* pTextBatch = NULL;
+
 struct ZL_TextBuffer_Impl : ZL_Impl
 {
+	struct Line { size_t start, end; GLsizei glyph_start, glyph_count; GLscalar width, xmin, xmax, xoff; };
 	ZL_Font_Impl* fnt;
 	ZL_Font_Impl_Settings* fntSettings;
-	GLscalar *vertices, *texcoords;
-	scalar width, height;
-	std::vector<int>* vecTTFTexLastIndex;
-	GLsizei len, lenmax;
-	#ifdef ZL_VIDEO_WEAKCONTEXT
-	ZL_String TTFBufferString;
-	#endif
-
-	ZL_TextBuffer_Impl(const ZL_Font& font) : fnt(ZL_ImplFromOwner<ZL_Font_Impl>(font)), fntSettings(fnt), vertices(NULL), texcoords(NULL), vecTTFTexLastIndex(NULL), len(0), lenmax(0)
+	ZL_TextGlyphs glyphs;
+	std::vector<Line> lines;
+	ZL_String text; //kept for editing and to render again if glyphs were evicted from the atlas or the context got lost
+	scalar width, height, max_width, align;
+	bool word_wrap_newline;
+	ZL_FontTTFBuffer* ttfbuf;
+	size_t visible_first, visible_count;
+
+	ZL_TextBuffer_Impl(const ZL_Font& font) : fnt(ZL_ImplFromOwner<ZL_Font_Impl>(font)), fntSettings(fnt), width(0), height(0), max_width(0), align(0), word_wrap_newline(false), ttfbuf(NULL), visible_first(0), visible_count((size_t)-1)
 	{
 		if (fnt) fnt->AddRef();
 	}
@@ -769,6 +1649,7 @@ struct ZL_TextBuffer_Impl : ZL_Impl
 		fnt = ZL_ImplFromOwner<ZL_Font_Impl>(font);
 		if (fnt) fnt->AddRef();
 		if (!fntSettings) fntSettings = fnt;
+		if (ttfbuf) { delete ttfbuf; ttfbuf = NULL; }
 	}
 
 	size_t FindMaxWidthIndex(char *t, size_t end, scalar max_width, bool word_wrap_newline)
@@ -791,121 +1672,191 @@ struct ZL_TextBuffer_Impl : ZL_Impl
 		return (test ? test : lineMaxLetterBreakIndex);
 	}
 
-	void RenderMaxWidth(const char *text, scalar max_width, bool word_wrap_newline)
+	void SetText(const char *new_text, scalar new_max_width = 0, bool new_word_wrap_newline = false)
 	{
-		if (!text || !text[0] || !fnt) { Render(text); return; }
-		scalar check_width;
-		fnt->limitCount = 0;
-		fnt->GetDimensions(text, &check_width);
-		if (check_width*fntSettings->scale.x <= max_width) { Render(text); return; }
+		ZL_ASSERTMSG(fnt || !new_text || !new_text[0], "The font needs to be loaded before rendering to a text buffer with it");
+		text = (new_text ? new_text : "");
+		if (fnt && fnt->limitCount) { if ((size_t)fnt->limitCount < text.length()) text.resize(fnt->limitCount); fnt->limitCount = 0; }
+		max_width = new_max_width;
+		word_wrap_newline = new_word_wrap_newline;
+		align = 0;
+		Layout();
+	}
 
-		std::vector<char> textbuf;
-		textbuf.assign(text, text + strlen(text) + 1);
-		for (size_t breakIndex = 0; ;)
+	//Lay out the text from start to end (which needs to be the end of a paragraph) into lines starting at line index first_line
+	//Paragraphs wider than max_width get split into multiple lines (or cut off when not wrapping words)
+	void LayoutRange(size_t start, size_t end, size_t first_line, std::vector<Line>& out_lines, ZL_TextGlyphs& out)
+	{
+		GLscalar line_advance = fnt->fLineHeight + fnt->fLineSpacing;
+		std::vector<char> buf;
+		for (size_t par = start;; par++)
 		{
-			breakIndex += FindMaxWidthIndex(&textbuf[breakIndex], textbuf.size()-breakIndex, max_width, word_wrap_newline);
-			if (!word_wrap_newline) { textbuf[breakIndex] = '\0'; break; }
-
-			if (textbuf[breakIndex] == ' ') textbuf[breakIndex] = '\n';
-			else textbuf.insert(textbuf.begin() + breakIndex, '\n');
-			breakIndex++;
-
-			fnt->GetDimensions(&textbuf[breakIndex], &check_width);
-			if (check_width*fntSettings->scale.x <= max_width) break;
+			size_t par_end = text.find('\n', par);
+			if (par_end == ZL_String::npos || par_end > end) par_end = end;
+			if (max_width) { buf.assign(text.begin() + par, text.begin() + par_end); buf.push_back('\0'); }
+			for (size_t line_start = par, next = par_end;; line_start = next)
+			{
+				size_t line_end = par_end;
+				bool cut = false;
+				if (max_width)
+				{
+					scalar check_width;
+					fnt->GetDimensions(&buf[line_start - par], &check_width);
+					if (check_width*fntSettings->scale.x > max_width)
+					{
+						size_t test = FindMaxWidthIndex(&buf[line_start - par], buf.size() - (line_start - par), max_width, word_wrap_newline);
+						line_end = line_start + test;
+						next = line_end + (buf[line_end - par] == ' ' ? 1 : 0);
+						cut = !word_wrap_newline;
+					}
+				}
+				Line l = { line_start, line_end, (GLsizei)out.glyphs.size(), 0, 0, S_MAX, 0, 0 };
+				l.width = fnt->RenderLine(text.c_str() + line_start, line_end - line_start, (unsigned int)line_start, -(GLscalar)(first_line + out_lines.size()) * line_advance, out, ttfbuf);
+				if (l.width < 0) l.width = 0;
+				l.glyph_count = (GLsizei)out.glyphs.size() - l.glyph_start;
+				for (GLscalar *v = (l.glyph_count ? &out.vertices[l.glyph_start*12] : NULL), *vEnd = v + l.glyph_count*12; v != vEnd; v += 12)
+				{
+					if (l.xmin > v[0]) l.xmin = v[0];
+					if (l.xmax < v[2]) l.xmax = v[2];
+				}
+				out_lines.push_back(l);
+				if (cut) return; //everything after the cut is not shown
+				if (line_end == par_end) break;
+			}
+			if ((par = par_end) >= end) return;
 		}
-		Render(&textbuf[0]);
 	}
 
-	void Render(const char *text)
+	void Layout()
 	{
-		GLsizei newlen = (text && text[0] && fnt ? fnt->CountBuffer(text, vecTTFTexLastIndex) : 0);
-		if (!fnt || newlen > lenmax)
-		{
-			ZL_ASSERTMSG(fnt || !text || !text[0], "The font needs to be loaded before rendering to a text buffer with it");
-			if (vertices) { delete [] vertices; vertices = NULL; }
-			if (texcoords) { delete [] texcoords; texcoords = NULL; }
-		}
-		len = newlen;
-		if (newlen > lenmax) lenmax = newlen;
-		if (!newlen || !fnt)
-		{
-			if (vecTTFTexLastIndex) { delete vecTTFTexLastIndex; vecTTFTexLastIndex = NULL; }
-			width = height = 0;
-		}
-		else
+		glyphs.Clear();
+		lines.clear();
+		if (ttfbuf) ttfbuf->Shelves.clear();
+		size_t old_count = 0;
+		if (fnt && text.length()) LayoutRange(0, text.length(), 0, lines, glyphs);
+		UpdateDimensions(0, lines.size(), -1, old_count);
+	}
+
+	//Replace erase_len bytes at pos with insert and lay out only the lines of the changed paragraphs again
+	void Edit(size_t pos, size_t erase_len, const char* insert)
+	{
+		size_t insert_len = (insert ? strlen(insert) : 0);
+		if (pos > text.length()) pos = text.length();
+		if (erase_len > text.length() - pos) erase_len = text.length() - pos;
+		if (!erase_len && !insert_len) return;
+		bool full = (!fnt || lines.empty() || (max_width && !word_wrap_newline) || (ttfbuf && !ttfbuf->IsValid()));
+		size_t first = 0, last = 0;
+		if (!full)
 		{
-			if (!vertices) vertices = new GLscalar[12*lenmax];
-			if (!texcoords) texcoords = new GLscalar[12*lenmax];
-			fnt->RenderBuffer(text, vertices, texcoords, vecTTFTexLastIndex, len, width, height);
-			//ZL_LOG3("FONT", "Rendered Text Buffer: %s - Len: %d - vec: %d", text, len, (vecTTFTexLastIndex != NULL));
+			//from the start of the paragraph containing pos (earlier lines of it can change when wrapping words) to the end of the paragraph containing the erased text
+			while (first + 1 < lines.size() && lines[first + 1].start <= pos) first++;
+			while (first > 0 && text[lines[first].start - 1] != '\n') first--;
+			for (last = first; last + 1 < lines.size(); last++)
+				if (lines[last].end >= pos + erase_len && (lines[last].end == text.length() || text[lines[last].end] == '\n')) break;
 		}
-		fnt->limitCount = 0;
-		#ifdef ZL_VIDEO_WEAKCONTEXT
-		if (vecTTFTexLastIndex)
+		text.replace(pos, erase_len, (insert ? insert : ""), insert_len);
+		if (full || text.empty()) { Layout(); return; }
+
+		std::vector<Line> new_lines;
+		ZL_TextGlyphs new_glyphs;
+		LayoutRange(lines[first].start, lines[last].end + insert_len - erase_len, first, new_lines, new_glyphs);
+
+		//patch the glyphs and the lines after the changed paragraphs in place
+		GLsizei glyph_from = lines[first].glyph_start, glyph_to = lines[last].glyph_start + lines[last].glyph_count, glyph_new = (GLsizei)new_glyphs.glyphs.size();
+		glyphs.Replace(glyph_from, glyph_to, new_glyphs);
+		ptrdiff_t text_delta = (ptrdiff_t)insert_len - (ptrdiff_t)erase_len, line_delta = (ptrdiff_t)new_lines.size() - (ptrdiff_t)(last - first + 1);
+		GLsizei glyph_delta = glyph_new - (glyph_to - glyph_from);
+		GLscalar y_delta = -(GLscalar)line_delta * (fnt->fLineHeight + fnt->fLineSpacing);
+		for (std::vector<Line>::iterator it = lines.begin() + last + 1; it != lines.end(); ++it)
 		{
-			if (!pActiveTTFTextBuffers) pActiveTTFTextBuffers = new std::vector<ZL_TextBuffer_Impl*>();
-			std::vector<ZL_TextBuffer_Impl*>::iterator itAlready = std::find(pActiveTTFTextBuffers->begin(), pActiveTTFTextBuffers->end(), this);
-			if (itAlready == pActiveTTFTextBuffers->end()) pActiveTTFTextBuffers->push_back(this);
-			TTFBufferString = text;
+			it->start += text_delta;
+			it->end += text_delta;
+			it->glyph_start += glyph_delta;
 		}
-		else
+		for (std::vector<ZL_TextGlyphs::Glyph>::iterator it = glyphs.glyphs.begin() + glyph_from + glyph_new; it != glyphs.glyphs.end(); ++it)
+			it->pos = (unsigned int)(it->pos + text_delta);
+		if (line_delta)
+			for (std::vector<GLscalar>::iterator it = glyphs.vertices.begin() + (glyph_from + glyph_new)*12; it != glyphs.vertices.end(); it += 2)
+				*(it + 1) += y_delta;
+		for (std::vector<Line>::iterator it = new_lines.begin(); it != new_lines.end(); ++it) it->glyph_start += glyph_from;
+		size_t old_count = lines.size();
+		lines.erase(lines.begin() + first, lines.begin() + last + 1);
+		lines.insert(lines.begin() + first, new_lines.begin(), new_lines.end());
+		UpdateDimensions(first, first + new_lines.size(), width, old_count);
+	}
+
+	void UpdateDimensions(size_t changed_from, size_t changed_to, scalar old_width, size_t old_count)
+	{
+		width = height = 0;
+		if (!glyphs.glyphs.empty())
 		{
-			if (pActiveTTFTextBuffers)
-			{
-				std::vector<ZL_TextBuffer_Impl*>::iterator itClear = std::find(pActiveTTFTextBuffers->begin(), pActiveTTFTextBuffers->end(), this);
-				if (itClear != pActiveTTFTextBuffers->end()) pActiveTTFTextBuffers->erase(itClear);
-			}
-			TTFBufferString = ZL_String::EmptyString;
+			for (std::vector<Line>::iterator it = lines.begin(); it != lines.end(); ++it) if (it->width > width) width = it->width;
+			height = fnt->fLineHeight + (lines.size() - 1) * (fnt->fLineHeight + fnt->fLineSpacing);
 		}
-		#endif
+		glyphs.UpdateRuns();
+		if (!align) return;
+		if (width != old_width || (old_count > 1) != (lines.size() > 1)) AlignLines(0, lines.size());
+		else AlignLines(changed_from, changed_to);
 	}
 
-	void SetMultiLineHorizontalAlign(scalar align)
+	void AlignLines(size_t from, size_t to)
 	{
-		if (!len || !fnt || height < fnt->fLineHeight*s(1.5)) return;
-		GLscalar *verticesEnd = &vertices[len*12], *v;
-		for (GLscalar line = (fnt->fLineHeight + fnt->fLineSpacing), halfline = line*s(0.49), y_line = fnt->fLineHeight*s(0.367), y_end = -height + fnt->fLineHeight; y_line > y_end; y_line -= line)
+		bool multiline = (lines.size() > 1);
+		for (std::vector<Line>::iterator it = lines.begin() + from; it != lines.begin() + to; ++it)
 		{
-			GLscalar xmin = S_MAX, xmax = 0;
-			for (v = vertices; v != verticesEnd; v += 12)
+			GLscalar offset = 0;
+			if (multiline && align && it->glyph_count && it->xmax != width)
 			{
-				if (sabs(y_line - v[5]) >= halfline) continue;
-				if (xmin > v[0]) xmin = v[0];
-				if (xmax < v[2]) xmax = v[2];
+				offset = (width - it->xmax + it->xmin) * align - it->xmin;
+				if (sabs(offset) < s(0.005)) offset = 0;
 			}
-			if (xmax == width) continue;
-
-			GLscalar offset = (width - xmax + xmin) * align - xmin;
-			if (sabs(offset) < s(0.005)) continue;
-
-			for (v = vertices; v != verticesEnd; v += 12)
+			if (offset == it->xoff) continue;
+			for (GLscalar *v = &glyphs.vertices[it->glyph_start*12], *vEnd = v + it->glyph_count*12, move = offset - it->xoff; v != vEnd; v += 12)
 			{
-				if (sabs(y_line - v[5]) >= halfline) continue;
-				v[0] = v[4] = v[ 8] += offset; //left
-				v[2] = v[6] = v[10] += offset; //right
+				v[0] = v[4] = v[ 8] += move; //left
+				v[2] = v[6] = v[10] += move; //right
 			}
+			it->xoff = offset;
 		}
 	}
 
+	void SetMultiLineHorizontalAlign(scalar new_align)
+	{
+		align = new_align;
+		AlignLines(0, lines.size());
+	}
+
 	~ZL_TextBuffer_Impl()
 	{
-		#ifdef ZL_VIDEO_WEAKCONTEXT
-		if (vecTTFTexLastIndex)
-		{
-			std::vector<ZL_TextBuffer_Impl*>::iterator itClear = std::find(pActiveTTFTextBuffers->begin(), pActiveTTFTextBuffers->end(), this);
-			if (itClear != pActiveTTFTextBuffers->end()) pActiveTTFTextBuffers->erase(itClear);
-		}
-		#endif
 		if (fntSettings != fnt) delete fntSettings;
 		if (fnt) fnt->DelRef();
-		if (vecTTFTexLastIndex) delete vecTTFTexLastIndex;
-		if (vertices) delete [] vertices;
-		if (texcoords) delete [] texcoords;
+		if (ttfbuf) delete ttfbuf;
 	}
 
+	static bool GlyphBefore(const ZL_TextGlyphs::Glyph& g, size_t pos) { return g.pos < pos; }
+
 	inline void Draw(const scalar &x, const scalar &y, const scalar &scalew, const scalar &scaleh, const ZL_Color &color, ZL_Origin::Type draw_at_origin)
 	{
-		if (fnt && vertices) fnt->DrawBuffer(x, y, scalew, scaleh, color, draw_at_origin, vertices, texcoords, vecTTFTexLastIndex, len, width, height);
+		if (ttfbuf && !ttfbuf->IsValid()) Layout(); //glyphs of this buffer got evicted from the shared atlas, render again
+		if (!fnt || glyphs.glyphs.empty()) return;
+		GLsizei from = 0, to = (GLsizei)glyphs.glyphs.size();
+		if (visible_first || visible_count != (size_t)-1)
+		{
+			size_t visible_end = (visible_count > (size_t)-1 - visible_first ? (size_t)-1 : visible_first + visible_count);
+			from = (GLsizei)(std::lower_bound(glyphs.glyphs.begin(), glyphs.glyphs.end(), visible_first, GlyphBefore) - glyphs.glyphs.begin());
+			to = (GLsizei)(std::lower_bound(glyphs.glyphs.begin() + from, glyphs.glyphs.end(), visible_end, GlyphBefore) - glyphs.glyphs.begin());
+			if (from >= to) return;
+		}
+		if (pTextBatch && pTextBatch->active && !fnt->GetSDFEffects()) //distance field fonts need their own shader and are drawn directly
+		{
+			ZL_Vector align_offset = fnt->GetDrawOffset(width, height, draw_at_origin);
+			if (!pTextBatch->collecting_again) pTextBatch->Record(this, x, y, scalew, scaleh, color, draw_at_origin);
+			pTextBatch->Add(fnt, ttfbuf, glyphs, from, to, x + align_offset.x * scalew, y + align_offset.y * scaleh, scalew, scaleh, color);
+			return;
+		}
+		fnt->BeginDrawBuffer(x, y, scalew, scaleh, color, draw_at_origin, &glyphs.vertices[0], &glyphs.texcoords[0], width, height);
+		fnt->DoDrawRuns(ttfbuf, glyphs, from, to);
+		GLPOPMATRIX();
 	}
 
 	inline void CustomizeSettings()
@@ -914,78 +1865,156 @@ struct ZL_TextBuffer_Impl : ZL_Impl
 	}
 };
 
+void ZL_TextBuffer_BatchRenderContext::Record(ZL_TextBuffer_Impl* buf, scalar x, scalar y, scalar scalew, scalar scaleh, const ZL_Color &color, ZL_Origin::Type draw_at_origin)
+{
+	buf->AddRef();
+	Entry e = { buf, x, y, scalew, scaleh, color, draw_at_origin };
+	entries.push_back(e);
+}
+
+void ZL_TextBuffer_BatchRenderContext::CollectAgain()
+{
+	for (std::vector<Page>::iterator it = pages.begin(); it != pages.end(); ++it)
+		{ it->vertices.clear(); it->texcoords.clear(); it->colors.clear(); }
+	atlasrefs.Shelves.clear();
+	bool was_active = active;
+	active = collecting_again = true;
+	for (std::vector<Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+		it->buf->Draw(it->x, it->y, it->scalew, it->scaleh, it->color, it->draw_at_origin);
+	active = was_active;
+	collecting_again = false;
+}
+
+void ZL_TextBuffer_BatchRenderContext::ReleaseEntries()
+{
+	for (std::vector<Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+		it->buf->DelRef();
+	entries.clear();
+}
+
 ZL_IMPL_OWNER_DEFAULT_IMPLEMENTATIONS(ZL_TextBuffer)
 
 ZL_TextBuffer::ZL_TextBuffer(const ZL_Font& font, const char *text) : impl(new ZL_TextBuffer_Impl(font))
 {
-	impl->Render(text);
+	impl->SetText(text);
 }
 
 ZL_TextBuffer::ZL_TextBuffer(const ZL_Font& font, const char *text, scalar max_width, bool word_wrap_newline) : impl(new ZL_TextBuffer_Impl(font))
 {
-	impl->RenderMaxWidth(text, max_width, word_wrap_newline);
+	impl->SetText(text, max_width, word_wrap_newline);
 }
 
 ZL_TextBuffer::ZL_TextBuffer(const ZL_Font& font, scalar multiline_x_align, const char *text) : impl(new ZL_TextBuffer_Impl(font))
 {
-	impl->Render(text);
+	impl->SetText(text);
 	if (multiline_x_align) impl->SetMultiLineHorizontalAlign(multiline_x_align);
 }
 
 ZL_TextBuffer::ZL_TextBuffer(const ZL_Font& font, scalar multiline_x_align, const char *text, scalar max_width, bool word_wrap_newline) : impl(new ZL_TextBuffer_Impl(font))
 {
-	impl->RenderMaxWidth(text, max_width, word_wrap_newline);
+	impl->SetText(text, max_width, word_wrap_newline);
 	if (multiline_x_align) impl->SetMultiLineHorizontalAlign(multiline_x_align);
 }
 
 ZL_TextBuffer& ZL_TextBuffer::SetText(const char* new_text)
 {
-	if (impl) impl->Render(new_text);
+	if (impl) impl->SetText(new_text);
 	return *this;
 }
 
 ZL_TextBuffer& ZL_TextBuffer::SetText(const char* new_text, scalar max_width, bool word_wrap_newline)
 {
-	if (impl) impl->RenderMaxWidth(new_text, max_width, word_wrap_newline);
+	if (impl) impl->SetText(new_text, max_width, word_wrap_newline);
 	return *this;
 }
 
 ZL_TextBuffer& ZL_TextBuffer::SetText(scalar multiline_x_align, const char* new_text)
 {
-	if (impl) { impl->Render(new_text); if (multiline_x_align) impl->SetMultiLineHorizontalAlign(multiline_x_align); }
+	if (impl) { impl->SetText(new_text); if (multiline_x_align) impl->SetMultiLineHorizontalAlign(multiline_x_align); }
 	return *this;
 }
 
 ZL_TextBuffer& ZL_TextBuffer::SetText(scalar multiline_x_align, const char* new_text, scalar max_width, bool word_wrap_newline)
 {
-	if (impl) { impl->RenderMaxWidth(new_text, max_width, word_wrap_newline); if (multiline_x_align) impl->SetMultiLineHorizontalAlign(multiline_x_align); }
+	if (impl) { impl->SetText(new_text, max_width, word_wrap_newline); if (multiline_x_align) impl->SetMultiLineHorizontalAlign(multiline_x_align); }
 	return *this;
 }
 
 ZL_TextBuffer& ZL_TextBuffer::SetFont(const ZL_Font& font, const char* reset_text)
 {
-	if (impl) { impl->SetFont(font); impl->Render(reset_text); }
+	if (impl) { impl->SetFont(font); impl->SetText(reset_text); }
 	return *this;
 }
 
 ZL_TextBuffer& ZL_TextBuffer::SetFont(const ZL_Font& font, const char* reset_text, scalar max_width, bool word_wrap_newline)
 {
-	if (impl) { impl->SetFont(font); impl->RenderMaxWidth(reset_text, max_width, word_wrap_newline); }
+	if (impl) { impl->SetFont(font); impl->SetText(reset_text, max_width, word_wrap_newline); }
 	return *this;
 }
 
 ZL_TextBuffer& ZL_TextBuffer::SetFont(const ZL_Font& font, scalar multiline_x_align, const char* reset_text)
 {
-	if (impl) { impl->SetFont(font); impl->Render(reset_text); if (multiline_x_align) impl->SetMultiLineHorizontalAlign(multiline_x_align); }
+	if (impl) { impl->SetFont(font); impl->SetText(reset_text); if (multiline_x_align) impl->SetMultiLineHorizontalAlign(multiline_x_align); }
 	return *this;
 }
 
 ZL_TextBuffer& ZL_TextBuffer::SetFont(const ZL_Font& font, scalar multiline_x_align, const char* reset_text, scalar max_width, bool word_wrap_newline)
 {
-	if (impl) { impl->SetFont(font); impl->RenderMaxWidth(reset_text, max_width, word_wrap_newline); if (multiline_x_align) impl->SetMultiLineHorizontalAlign(multiline_x_align); }
+	if (impl) { impl->SetFont(font); impl->SetText(reset_text, max_width, word_wrap_newline); if (multiline_x_align) impl->SetMultiLineHorizontalAlign(multiline_x_align); }
+	return *this;
+}
+
+ZL_TextBuffer& ZL_TextBuffer::Append(const char* text)
+{
+	if (impl) impl->Edit(impl->text.length(), 0, text);
+	return *this;
+}
+
+ZL_TextBuffer& ZL_TextBuffer::Insert(size_t pos, const char* text)
+{
+	if (impl) impl->Edit(pos, 0, text);
 	return *this;
 }
 
+ZL_TextBuffer& ZL_TextBuffer::Erase(size_t pos, size_t count)
+{
+	if (impl) impl->Edit(pos, count, NULL);
+	return *this;
+}
+
+ZL_TextBuffer& ZL_TextBuffer::SetVisibleRange(size_t first, size_t count)
+{
+	if (impl) { impl->visible_first = first; impl->visible_count = count; }
+	return *this;
+}
+
+void ZL_TextBuffer::BatchRenderBegin()
+{
+	if (!pTextBatch) pTextBatch = new ZL_TextBuffer_BatchRenderContext();
+	ZL_ASSERTMSG(!pTextBatch->active, "Text buffer batch rendering is already active");
+	pTextBatch->Clear();
+	pTextBatch->active = true;
+}
+
+void ZL_TextBuffer::BatchRenderEnd(bool DrawAndClear)
+{
+	if (!pTextBatch || !pTextBatch->active) return;
+	pTextBatch->active = false;
+	if (!DrawAndClear) return;
+	pTextBatch->Draw();
+	pTextBatch->Clear();
+}
+
+bool ZL_TextBuffer::BatchRenderActive()
+{
+	return (pTextBatch && pTextBatch->active);
+}
+
+void ZL_TextBuffer::BatchRenderDraw()
+{
+	if (pTextBatch) pTextBatch->Draw();
+}
+
 ZL_TextBuffer& ZL_TextBuffer::SetColor(const ZL_Color &color)
 {
 	if (impl) { impl->CustomizeSettings(); impl->fntSettings->color = color; }
@@ -1090,23 +2119,17 @@ void ZL_TextBuffer::Draw(const ZL_Vector &p, scalar scalew, scalar scaleh, const
 #ifndef ZL_VIDEO_USE_GLSL
 bool CheckFontTexturesIfContextLost()
 {
-	return (pLoadedTTFFonts && pLoadedTTFFonts->size() && (*(pLoadedTTFFonts->begin()))->gltexids.size() && !glIsTexture(*(*(pLoadedTTFFonts->begin()))->gltexids.begin()));
+	return (pGlyphAtlas && pGlyphAtlas->gltexids.size() && !glIsTexture(pGlyphAtlas->gltexids[0]));
 }
 #endif
 void RecreateAllFontTexturesOnContextLost()
 {
-	if (!pLoadedTTFFonts) return;
-	//for (std::vector<ZL_FontTTF_Impl*>::iterator itx = pLoadedTTFFonts->begin(); itx != pLoadedTTFFonts->end(); ++itx) for (std::vector<GLuint>::iterator ittex = (*itx)->gltexids.begin(); ittex != (*itx)->gltexids.end(); ++ittex) glDeleteTextures(1, &*ittex); //DEBUG
-	ZL_LOG1("TEXTURE", "RecreateAllFontTexturesIfContextLost with %d fonts to reload", pLoadedTTFFonts->size());
-	for (std::vector<ZL_FontTTF_Impl*>::iterator itTTFFont = pLoadedTTFFonts->begin(); itTTFFont != pLoadedTTFFonts->end(); ++itTTFFont)
-	{
-		(*itTTFFont)->last_char = false;
-		(*itTTFFont)->chars.Clear();
-		(*itTTFFont)->gltexids.clear();
-	}
-	ZL_LOG1("TEXTURE", "RecreateAllFontTexturesIfContextLost with %d ttf buffers to reload", (pActiveTTFTextBuffers ? pActiveTTFTextBuffers->size() : 0));
-	if (pActiveTTFTextBuffers)
-		for (std::vector<ZL_TextBuffer_Impl*>::iterator itTTFTB = pActiveTTFTextBuffers->begin(); itTTFTB != pActiveTTFTextBuffers->end(); ++itTTFTB)
-			if ((*itTTFTB)->vecTTFTexLastIndex) (*itTTFTB)->Render((*itTTFTB)->TTFBufferString.c_str());
+	if (!pGlyphAtlas) return;
+	ZL_LOG1("TEXTURE", "RecreateAllFontTexturesIfContextLost with %d glyph atlas pages to reset", pGlyphAtlas->gltexids.size());
+	//glyphs get rasterized again when drawn and text buffers notice the reset and render again on their next draw
+	pGlyphAtlas->Reset();
+	#ifdef ZLFONT_SDF
+	FontSDFProgram.PROGRAM = 0; //gets compiled again on the next draw
+	#endif
 }
 #endif
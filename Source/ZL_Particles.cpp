@@ -24,6 +24,46 @@
 #include <assert.h>
 #include "ZL_Texture_Impl.h"
 #include "ZL_Particles.h"
+#include "ZL_Platform.h"
+#include <algorithm>
+
+#if !defined(ZL_DOUBLE_PRECISCION) && (defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#include <xmmintrin.h>
+#define ZLPARTICLES_SSE
+#elif !defined(ZL_DOUBLE_PRECISCION) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define ZLPARTICLES_NEON
+#endif
+
+//Vector operations of the particle kernels, ZLPARTICLES_WIDTH particles are processed per step
+#if defined(ZLPARTICLES_SSE)
+#define ZLPARTICLES_WIDTH 4
+typedef __m128 ZL_ParticleVec;
+static inline ZL_ParticleVec PVLoad(const scalar* p) { return _mm_loadu_ps(p); }
+static inline ZL_ParticleVec PVSet(scalar v) { return _mm_set1_ps(v); }
+static inline void PVStore(scalar* p, ZL_ParticleVec v) { _mm_storeu_ps(p, v); }
+static inline ZL_ParticleVec PVMulAdd(ZL_ParticleVec a, ZL_ParticleVec b, ZL_ParticleVec c) { return _mm_add_ps(a, _mm_mul_ps(b, c)); } //a+b*c
+static inline ZL_ParticleVec PVMul(ZL_ParticleVec a, ZL_ParticleVec b) { return _mm_mul_ps(a, b); }
+static inline ZL_ParticleVec PVMax(ZL_ParticleVec a, ZL_ParticleVec b) { return _mm_max_ps(a, b); }
+#elif defined(ZLPARTICLES_NEON)
+#define ZLPARTICLES_WIDTH 4
+typedef float32x4_t ZL_ParticleVec;
+static inline ZL_ParticleVec PVLoad(const scalar* p) { return vld1q_f32(p); }
+static inline ZL_ParticleVec PVSet(scalar v) { return vdupq_n_f32(v); }
+static inline void PVStore(scalar* p, ZL_ParticleVec v) { vst1q_f32(p, v); }
+static inline ZL_ParticleVec PVMulAdd(ZL_ParticleVec a, ZL_ParticleVec b, ZL_ParticleVec c) { return vmlaq_f32(a, b, c); }
+static inline ZL_ParticleVec PVMul(ZL_ParticleVec a, ZL_ParticleVec b) { return vmulq_f32(a, b); }
+static inline ZL_ParticleVec PVMax(ZL_ParticleVec a, ZL_ParticleVec b) { return vmaxq_f32(a, b); }
+#else
+#define ZLPARTICLES_WIDTH 1
+typedef scalar ZL_ParticleVec;
+static inline ZL_ParticleVec PVLoad(const scalar* p) { return *p; }
+static inline ZL_ParticleVec PVSet(scalar v) { return v; }
+static inline void PVStore(scalar* p, ZL_ParticleVec v) { *p = v; }
+static inline ZL_ParticleVec PVMulAdd(ZL_ParticleVec a, ZL_ParticleVec b, ZL_ParticleVec c) { return a + b * c; }
+static inline ZL_ParticleVec PVMul(ZL_ParticleVec a, ZL_ParticleVec b) { return a * b; }
+static inline ZL_ParticleVec PVMax(ZL_ParticleVec a, ZL_ParticleVec b) { return (a > b ? a : b); }
+#endif
 
 //--------------------------------------------------------------------
 //            Effect Main Class (Calculation and Drawing)
@@ -44,6 +84,20 @@ struct ZL_ParticleEffect_CalcData
 	inline scalar getSeedPercentSecondHalf() { return s(getSeedIntSecondHalf()) / seed_max_half; }
 };
 
+//Built-in behaviors of an effect, if the behavior list only consists of these (in an order that can be fused) particles are evaluated by one SIMD kernel
+struct ZL_ParticleEffect_Kernel
+{
+	bool usable, rotate;
+	ZL_ParticleBehavior_LinearMove* move;
+	ZL_ParticleBehavior_Gravity* gravity;
+	ZL_ParticleBehavior_LinearImageProperties* image;
+	ZL_ParticleBehavior_LinearColor* color;
+	ZL_ParticleEffect_Kernel() : usable(true), rotate(false), move(NULL), gravity(NULL), image(NULL), color(NULL) { }
+};
+
+#define ZLPARTICLES_INITIAL_CAPACITY 64
+#define ZLPARTICLES_MAX_EMIT_TICKS 1000 //limit particles spawned at once by the spawn rate after a long pause
+
 struct ZL_ParticleEffect_Impl : ZL_Impl
 {
 	struct WeightedSurface : ZL_Surface
@@ -51,36 +105,82 @@ struct ZL_ParticleEffect_Impl : ZL_Impl
 		struct Particle
 		{
 			unsigned int lifetimeStart, lifetimeDuration;
-			ZL_Vector startPos;
 			unsigned char cseed[8];
 		};
+		//Per particle values stored as structure of arrays, the first block is set on spawn and the second block is calculated every frame
+		enum { X, Y, VX, VY, ROTC, ROTS, R, G, B, A, DR, DG, DB, DA, _NUM_SPAWN_ARRAYS, T = _NUM_SPAWN_ARRAYS, OX, OY, OSW, OSH, OR, OG, OB, OA, _NUM_ARRAYS };
 		scalar weightIndex; //first entry has 0 and last entry has less than 1
-		unsigned int maxNumOfParticles, usedParticles;
+		unsigned int maxNumOfParticles, usedParticles, capacity, stride; //maxNumOfParticles is the hard cap of the pool (0 for unlimited)
 		Particle *particles;
+		scalar *arrays;
+		//Vertex data written by Update and submitted by Draw
+		std::vector<GLscalar> vertices, colors, texcoords;
+		GLscalar texbox[8];
+		GLsizei drawCount;
+		#ifdef ZL_VIDEO_OPENGL_ES1
+		std::vector<GLscalar> sizes;
+		bool pointSprites;
+		#endif
 		WeightedSurface()
-		 : weightIndex(1), maxNumOfParticles(0), usedParticles(0), particles(NULL) { }
+		 : weightIndex(1), maxNumOfParticles(0), usedParticles(0), capacity(0), stride(0), particles(NULL), arrays(NULL), drawCount(0) { }
 		WeightedSurface(const ZL_Surface &surface, scalar weightIndex, unsigned int maxNumOfParticles)
-		 : ZL_Surface(surface), weightIndex(weightIndex), maxNumOfParticles(maxNumOfParticles), usedParticles(0)
+		 : ZL_Surface(surface), weightIndex(weightIndex), maxNumOfParticles(maxNumOfParticles), usedParticles(0), drawCount(0)
+		{
+			capacity = (maxNumOfParticles && maxNumOfParticles < ZLPARTICLES_INITIAL_CAPACITY ? maxNumOfParticles : ZLPARTICLES_INITIAL_CAPACITY);
+			stride = (capacity + 3) & ~3u; //padded so kernels can always process full SIMD vectors
+			particles = (Particle*)malloc(sizeof(Particle)*capacity);
+			arrays = (scalar*)malloc(sizeof(scalar)*stride*_NUM_ARRAYS);
+		}
+		inline scalar* Array(int i) { return arrays + i * stride; }
+
+		//Make room for one more particle by doubling the pool, fails if the hard cap is reached
+		bool Grow()
+		{
+			if (usedParticles < capacity) return true;
+			if (maxNumOfParticles && capacity >= maxNumOfParticles) return false;
+			unsigned int newCapacity = capacity * 2, newStride;
+			if (maxNumOfParticles && newCapacity > maxNumOfParticles) newCapacity = maxNumOfParticles;
+			newStride = (newCapacity + 3) & ~3u;
+			scalar *newArrays = (scalar*)malloc(sizeof(scalar)*newStride*_NUM_ARRAYS);
+			for (int i = 0; i != _NUM_SPAWN_ARRAYS; i++) memcpy(newArrays + i * newStride, Array(i), sizeof(scalar)*usedParticles);
+			free(arrays);
+			arrays = newArrays;
+			particles = (Particle*)realloc(particles, sizeof(Particle)*newCapacity);
+			capacity = newCapacity;
+			stride = newStride;
+			return true;
+		}
+
+		void Remove(unsigned int i)
 		{
-			particles = (Particle*)malloc(sizeof(Particle)*maxNumOfParticles);
+			if (i != --usedParticles)
+			{
+				particles[i] = particles[usedParticles];
+				for (scalar *a = arrays, *aEnd = arrays + stride*_NUM_SPAWN_ARRAYS; a != aEnd; a += stride) a[i] = a[usedParticles];
+			}
 		}
 	};
 
 	scalar lifetimeDuration, lifetimeDurationSpread, spawnProbability, totalSurfaceWeight;
 	WeightedSurface particleImages[4];
 	ZL_ParticleBehavior* behaviors[10+1]; //+1 = NULL delimiter
-	bool active, allowPointSprites;
+	bool active, allowPointSprites, updated;
+	ticks_t updatedTicks, emitTicks;
+	scalar spawnRate, spawnAccumulator;
+	ZL_Vector emitterPos, emitterSpread;
+	unsigned int statDropped, statExpired;
 	ZL_ParticleEffect_CalcData calcData;
+	ZL_ParticleEffect_Kernel kernel;
 
 	ZL_ParticleEffect_Impl(scalar lifetimeDuration, scalar lifetimeDurationSpread, scalar spawnProbability)
-	 : lifetimeDuration(lifetimeDuration), lifetimeDurationSpread(lifetimeDurationSpread), spawnProbability(spawnProbability), totalSurfaceWeight(0), active(false), allowPointSprites(true)
+	 : lifetimeDuration(lifetimeDuration), lifetimeDurationSpread(lifetimeDurationSpread), spawnProbability(spawnProbability), totalSurfaceWeight(0), active(false), allowPointSprites(true), updated(false), updatedTicks(0), emitTicks(0), spawnRate(0), spawnAccumulator(0), statDropped(0), statExpired(0)
 	{ behaviors[0] = NULL; }
 
 
 	~ZL_ParticleEffect_Impl()
 	{
 		for (WeightedSurface* ws = particleImages; ws->particles && ws != particleImages+(sizeof(particleImages)/sizeof(particleImages[0])); ws++)
-			free(ws->particles);
+			{ free(ws->particles); free(ws->arrays); }
 		for (ZL_ParticleBehavior** b = behaviors; *b; b++)
 			if ((*b)->DeleteAfterUse) delete *b;
 	}
@@ -109,13 +209,14 @@ struct ZL_ParticleEffect_Impl : ZL_Impl
 			}
 
 			//select particle if available
-			if (ws->usedParticles == ws->maxNumOfParticles) continue;
-			WeightedSurface::Particle& newParticle = ws->particles[ws->usedParticles++];
+			if (!ws->Grow()) { statDropped++; continue; }
+			unsigned int newIndex = ws->usedParticles++;
+			WeightedSurface::Particle& newParticle = ws->particles[newIndex];
 
 			//base for new spawned particles
 			newParticle.lifetimeStart = ZL_Application::Ticks + lifetimeStartOffsetTicks;
-			newParticle.startPos.x = (xSpread ? x + RAND_VARIATION(xSpread*HALF) : x);
-			newParticle.startPos.y = (xSpread ? y + RAND_VARIATION(ySpread*HALF) : y);
+			ws->Array(WeightedSurface::X)[newIndex] = (xSpread ? x + RAND_VARIATION(xSpread*HALF) : x);
+			ws->Array(WeightedSurface::Y)[newIndex] = (xSpread ? y + RAND_VARIATION(ySpread*HALF) : y);
 
 			//particle lifetime duration
 			newParticle.lifetimeDuration = (int)(lifetimeDuration + RAND_VARIATION(lifetimeDurationSpread*HALF));
@@ -127,129 +228,284 @@ struct ZL_ParticleEffect_Impl : ZL_Impl
 				if ((*b)->UsesSeed && (*b)->SpawnSeed) *(unsigned int*) (pseed += calcData.seedbytes) = (*b)->GetSpawnSeed(calcData);
 				else if ((*b)->UsesSeed) { pseed += calcData.seedbytes; for (int i = 0; i < calcData.seedbytes; i++) pseed[i] = rand()%0x100; }
 			}
+
+			if (kernel.usable) SetupKernelParticle(ws, newIndex);
 		}
 		active = true;
+		updated = false;
 	}
 
-	void Draw()
+	//Decode the seeds of a particle into the per particle values used by the kernel (velocity, rotation and color range)
+	void SetupKernelParticle(WeightedSurface* ws, unsigned int i)
 	{
-		if (!active) return;
-		#define VBSIZE 32
-		#ifdef ZL_VIDEO_OPENGL_ES1
-		GLscalar sizes[1*VBSIZE];
-		#endif
-		GLscalar vertices[2*6*VBSIZE], colors[4*6*VBSIZE];
-		GLscalar texcoordbox[2*6*VBSIZE];
+		scalar vx = 0, vy = 0, rc = 1, rs = 0;
+		const ZL_Color *colStart = NULL, *colEnd = NULL;
+		unsigned char *pseed = ws->particles[i].cseed - calcData.seedbytes;
+		for (ZL_ParticleBehavior** b = behaviors; *b; b++)
+		{
+			if (!(*b)->UsesSeed) continue;
+			calcData.seed = *(unsigned int*)(pseed += calcData.seedbytes);
+			if (*b == kernel.move)
+			{
+				ZL_ParticleBehavior_LinearMove* m = kernel.move;
+				scalar angle = m->behaviorAngle + ((calcData.getSeedPercentSecondHalf() - s(0.5)) * m->behaviorAngleSpread);
+				scalar speed = m->behaviorSpeed + (calcData.getSeedPercentFirstHalf() - s(0.5)) * m->behaviorSpeedSpread;
+				rc = scos(angle); rs = ssin(angle);
+				vx = rc * speed; vy = rs * speed;
+			}
+			else if (*b == kernel.color && kernel.color->colorStarts.size() && kernel.color->colorEnds.size())
+			{
+				colStart = &kernel.color->colorStarts[calcData.getSeedIntFirstHalf()];
+				colEnd = &kernel.color->colorEnds[calcData.getSeedIntSecondHalf()];
+			}
+		}
+		ws->Array(WeightedSurface::VX)[i] = vx;
+		ws->Array(WeightedSurface::VY)[i] = vy;
+		ws->Array(WeightedSurface::ROTC)[i] = rc;
+		ws->Array(WeightedSurface::ROTS)[i] = rs;
+		if (!colStart) return; //particles without color behavior use the surface color
+		ws->Array(WeightedSurface::R)[i] = colStart->r; ws->Array(WeightedSurface::DR)[i] = colEnd->r - colStart->r;
+		ws->Array(WeightedSurface::G)[i] = colStart->g; ws->Array(WeightedSurface::DG)[i] = colEnd->g - colStart->g;
+		ws->Array(WeightedSurface::B)[i] = colStart->b; ws->Array(WeightedSurface::DB)[i] = colEnd->b - colStart->b;
+		ws->Array(WeightedSurface::A)[i] = colStart->a; ws->Array(WeightedSurface::DA)[i] = colEnd->a - colStart->a;
+	}
+
+	//Remove expired particles and store the percent of life time of the remaining ones (negative if not yet started)
+	void UpdateLifetimes(WeightedSurface* ws)
+	{
+		scalar* t = ws->Array(WeightedSurface::T);
+		for (unsigned int i = 0; i < ws->usedParticles; i++)
+		{
+			WeightedSurface::Particle* p = ws->particles + i;
+			if (p->lifetimeStart > ZL_Application::Ticks) { t[i] = -1; continue; }
+			if (p->lifetimeStart + p->lifetimeDuration < ZL_Application::Ticks) { ws->Remove(i--); statExpired++; continue; }
+			t[i] = (scalar)(ZL_Application::Ticks - p->lifetimeStart)/p->lifetimeDuration;
+		}
+	}
+
+	//Fused kernel of the built-in behaviors: position = start + velocity * t (minus gravity), color and alpha/scale are linear over life time
+	void CalculateKernel(WeightedSurface* ws, const ZL_Color& surfaceColor)
+	{
+		const scalar *x = ws->Array(WeightedSurface::X), *y = ws->Array(WeightedSurface::Y), *vx = ws->Array(WeightedSurface::VX), *vy = ws->Array(WeightedSurface::VY);
+		const scalar *r = ws->Array(WeightedSurface::R), *g = ws->Array(WeightedSurface::G), *b = ws->Array(WeightedSurface::B), *a = ws->Array(WeightedSurface::A);
+		const scalar *dr = ws->Array(WeightedSurface::DR), *dg = ws->Array(WeightedSurface::DG), *db = ws->Array(WeightedSurface::DB), *da = ws->Array(WeightedSurface::DA);
+		const scalar *t = ws->Array(WeightedSurface::T);
+		scalar *ox = ws->Array(WeightedSurface::OX), *oy = ws->Array(WeightedSurface::OY), *osw = ws->Array(WeightedSurface::OSW);
+		scalar *or_ = ws->Array(WeightedSurface::OR), *og = ws->Array(WeightedSurface::OG), *ob = ws->Array(WeightedSurface::OB), *oa = ws->Array(WeightedSurface::OA);
+		ZL_ParticleBehavior_LinearImageProperties* image = kernel.image;
+		ZL_ParticleVec gravity = PVSet(kernel.gravity ? -kernel.gravity->behaviorStrength : 0), zero = PVSet(0);
+		ZL_ParticleVec scaleStart = PVSet(image ? image->behaviorScaleStart : 1), scaleDelta = PVSet(image ? image->behaviorScaleEnd - image->behaviorScaleStart : 0);
+		ZL_ParticleVec alphaStart = PVSet(image ? image->behaviorAlphaStart : 1), alphaDelta = PVSet(image ? image->behaviorAlphaEnd - image->behaviorAlphaStart : 0);
+		ZL_ParticleVec cr = PVSet(surfaceColor.r), cg = PVSet(surfaceColor.g), cb = PVSet(surfaceColor.b), ca = PVSet(surfaceColor.a);
+		bool color = (kernel.color != NULL), clamp = (kernel.gravity != NULL);
+		for (unsigned int i = 0, n = ws->usedParticles; i < n; i += ZLPARTICLES_WIDTH)
+		{
+			ZL_ParticleVec vt = PVLoad(t + i);
+			PVStore(ox + i, PVMulAdd(PVLoad(x + i), PVLoad(vx + i), vt));
+			ZL_ParticleVec py = PVMulAdd(PVMulAdd(PVLoad(y + i), PVLoad(vy + i), vt), gravity, vt);
+			PVStore(oy + i, (clamp ? PVMax(py, zero) : py));
+			PVStore(osw + i, PVMulAdd(scaleStart, scaleDelta, vt));
+			ZL_ParticleVec alpha = PVMulAdd(alphaStart, alphaDelta, vt);
+			if (color)
+			{
+				PVStore(or_ + i, PVMulAdd(PVLoad(r + i), PVLoad(dr + i), vt));
+				PVStore(og + i, PVMulAdd(PVLoad(g + i), PVLoad(dg + i), vt));
+				PVStore(ob + i, PVMulAdd(PVLoad(b + i), PVLoad(db + i), vt));
+				PVStore(oa + i, PVMul(PVMulAdd(PVLoad(a + i), PVLoad(da + i), vt), alpha));
+			}
+			else
+			{
+				PVStore(or_ + i, cr); PVStore(og + i, cg); PVStore(ob + i, cb);
+				PVStore(oa + i, PVMul(ca, alpha));
+			}
+		}
+	}
+
+	//Evaluate custom behaviors one particle at a time through ZL_ParticleBehavior::Calculate
+	void CalculateBehaviors(WeightedSurface* ws, const ZL_Color& surfaceColor)
+	{
+		const scalar *x = ws->Array(WeightedSurface::X), *y = ws->Array(WeightedSurface::Y), *t = ws->Array(WeightedSurface::T);
+		scalar *ox = ws->Array(WeightedSurface::OX), *oy = ws->Array(WeightedSurface::OY), *osw = ws->Array(WeightedSurface::OSW), *osh = ws->Array(WeightedSurface::OSH);
+		scalar *rc = ws->Array(WeightedSurface::ROTC), *rs = ws->Array(WeightedSurface::ROTS);
+		scalar *or_ = ws->Array(WeightedSurface::OR), *og = ws->Array(WeightedSurface::OG), *ob = ws->Array(WeightedSurface::OB), *oa = ws->Array(WeightedSurface::OA);
+		ZL_Vector startPos;
+		for (unsigned int i = 0; i < ws->usedParticles; i++)
+		{
+			if (t[i] < 0) continue;
+
+			//set calc data
+			startPos.x = x[i];
+			startPos.y = y[i];
+			calcData.startPos = &startPos;
+			calcData.percentOfLifeTime = t[i];
+			calcData.rotation = 0;
+			calcData.scalew = calcData.scaleh = calcData.alpha = 1;
+			calcData.col = surfaceColor;
+
+			//call behavior calculations with their seed
+			unsigned char *pseed = ws->particles[i].cseed - calcData.seedbytes;
+			for (ZL_ParticleBehavior** b = behaviors; *b; b++)
+			{
+				calcData.seed = *(unsigned int*) ((*b)->UsesSeed ? (pseed += calcData.seedbytes) : pseed);
+				(*b)->Calculate(calcData);
+			}
+
+			ox[i] = calcData.pos.x;
+			oy[i] = calcData.pos.y;
+			osw[i] = calcData.scalew;
+			osh[i] = calcData.scaleh;
+			rc[i] = scos(calcData.rotation);
+			rs[i] = ssin(calcData.rotation);
+			or_[i] = calcData.col.r;
+			og[i] = calcData.col.g;
+			ob[i] = calcData.col.b;
+			oa[i] = calcData.col.a * calcData.alpha;
+		}
+	}
 
-		ZLGL_ENABLE_TEXTURE();
-		ZLGL_COLORARRAY_ENABLE();
-		ZLGL_VERTEXTPOINTER(2, GL_SCALAR, 0, vertices);
-		ZLGL_COLORARRAY_POINTER(4, GL_SCALAR, 0, colors);
+	//Spawn the particles due by the spawn rate since the last call, needs to run on the main thread
+	void Emit()
+	{
+		if (spawnRate <= 0 || !particleImages[0].particles) return;
+		ticks_t elapsed = ZL_Application::Ticks - emitTicks;
+		emitTicks = ZL_Application::Ticks;
+		spawnAccumulator += spawnRate * (elapsed > ZLPARTICLES_MAX_EMIT_TICKS ? ZLPARTICLES_MAX_EMIT_TICKS : elapsed) / s(1000);
+		int num = (int)spawnAccumulator;
+		if (num <= 0) return;
+		spawnAccumulator -= num;
+		Spawn(num, emitterPos.x, emitterPos.y, 0, emitterSpread.x, emitterSpread.y);
+	}
+
+	void SetSpawnRate(scalar particlesPerSecond)
+	{
+		if (spawnRate <= 0) { emitTicks = ZL_Application::Ticks; spawnAccumulator = 0; }
+		spawnRate = particlesPerSecond;
+	}
 
+	//Simulate all particles and write their vertex data into the buffers of each particle image, safe to run on a worker thread
+	void Update()
+	{
+		updated = true;
+		updatedTicks = ZL_Application::Ticks;
 		for (WeightedSurface* ws = particleImages; ws->particles && ws != particleImages+(sizeof(particleImages)/sizeof(particleImages[0])); ws++)
 		{
+			ws->drawCount = 0;
+			if (!active) continue;
+			UpdateLifetimes(ws);
 			if (!ws->usedParticles) continue;
+			ZL_Surface_Impl *srf = ZL_ImplFromOwner<ZL_Surface_Impl>(*(ZL_Surface*)ws);
+			if (kernel.usable) CalculateKernel(ws, srf->color);
+			else CalculateBehaviors(ws, srf->color);
+			BuildVertices(ws, srf);
+		}
+		active = (CountParticles() != 0);
+	}
 
-			ZL_Surface_Impl *s = ZL_ImplFromOwner<ZL_Surface_Impl>(*(ZL_Surface*)ws);
-			ZL_Texture_Impl *t = s->tex;
-			glBindTexture(GL_TEXTURE_2D, t->gltexid);
+	void BuildVertices(WeightedSurface* ws, ZL_Surface_Impl *srf)
+	{
+		ZL_Texture_Impl *t = srf->tex;
+		const scalar *pt = ws->Array(WeightedSurface::T), *px = ws->Array(WeightedSurface::OX), *py = ws->Array(WeightedSurface::OY);
+		const scalar *psw = ws->Array(WeightedSurface::OSW), *psh = (kernel.usable ? psw : ws->Array(WeightedSurface::OSH));
+		const scalar *prc = ws->Array(WeightedSurface::ROTC), *prs = ws->Array(WeightedSurface::ROTS);
+		const scalar *pr = ws->Array(WeightedSurface::OR), *pg = ws->Array(WeightedSurface::OG), *pb = ws->Array(WeightedSurface::OB), *pa = ws->Array(WeightedSurface::OA);
+		unsigned int n = ws->usedParticles, v = 0;
 
-			#ifdef ZL_VIDEO_OPENGL_ES1
-				bool bDoPointSprite = allowPointSprites && t->w == t->h;
-				if (bDoPointSprite)
-				{
-					glEnable(GL_POINT_SPRITE_OES);
-					glTexEnvi(GL_POINT_SPRITE_OES, GL_COORD_REPLACE_OES, GL_TRUE);
-					glEnableClientState(GL_POINT_SIZE_ARRAY_OES);
-					glPointSizePointerOES(GL_SCALAR, 0, sizes);
-				}
-				else
-			#endif
+		#ifdef ZL_VIDEO_OPENGL_ES1
+		ws->pointSprites = (allowPointSprites && t->w == t->h);
+		if (ws->pointSprites)
+		{
+			if (ws->vertices.size() < n*2) { ws->vertices.resize(n*2); ws->colors.resize(n*4); ws->sizes.resize(n); }
+			GLscalar *vertices = &ws->vertices[0], *colors = &ws->colors[0], *sizes = &ws->sizes[0];
+			for (unsigned int i = 0; i != n; i++)
 			{
-				memcpy(&texcoordbox[0], s->TexCoordBox+0, sizeof(GLscalar)*6);
-				memcpy(&texcoordbox[6], s->TexCoordBox+2, sizeof(GLscalar)*6);
-				for (int v = 1; v < VBSIZE; v++) memcpy(&texcoordbox[12*v], texcoordbox, sizeof(GLscalar)*12);
-				ZLGL_TEXCOORDPOINTER(2, GL_SCALAR, 0, texcoordbox);
+				if (pt[i] < 0) continue;
+				vertices[2*v+0] = px[i];
+				vertices[2*v+1] = py[i];
+				colors[4*v+0] = pr[i]; colors[4*v+1] = pg[i]; colors[4*v+2] = pb[i]; colors[4*v+3] = pa[i];
+				sizes[v++] = psw[i]*t->w*1.1;
 			}
+			ws->drawCount = v;
+			return;
+		}
+		#endif
 
-			int v = 0;
-
-			for (WeightedSurface::Particle* p = ws->particles; p != ws->particles+ws->usedParticles; p++)
-			{
-				//lifetime check
-				if (p->lifetimeStart > ZL_Application::Ticks) continue;
-				if (p->lifetimeStart + p->lifetimeDuration < ZL_Application::Ticks)
-				{
-					ws->usedParticles--;
-					if (p == ws->particles+ws->usedParticles) break;
-					*(p--) = ws->particles[ws->usedParticles];
-					continue;
-				}
+		//texture coordinates are the same for every particle, only refilled when growing or when the surface clipping changed
+		size_t filled = (memcmp(ws->texbox, srf->TexCoordBox, sizeof(ws->texbox)) ? 0 : ws->texcoords.size() / 12);
+		memcpy(ws->texbox, srf->TexCoordBox, sizeof(ws->texbox));
+		if (ws->vertices.size() < n*12) { ws->vertices.resize(n*12); ws->colors.resize(n*24); }
+		if (filled < n)
+		{
+			ws->texcoords.resize(n*12);
+			for (GLscalar *tc = &ws->texcoords[filled*12], *tcEnd = &ws->texcoords[0] + n*12; tc != tcEnd; tc += 12)
+				{ memcpy(tc+0, srf->TexCoordBox+0, sizeof(GLscalar)*6); memcpy(tc+6, srf->TexCoordBox+2, sizeof(GLscalar)*6); }
+		}
 
-				//set calc data
-				calcData.startPos = &p->startPos;
-				calcData.percentOfLifeTime = (scalar)(ZL_Application::Ticks - p->lifetimeStart)/p->lifetimeDuration;
-				calcData.rotation = 0;
-				calcData.scalew = calcData.scaleh = calcData.alpha = 1;
-				calcData.col = s->color;
+		GLscalar *vertices = &ws->vertices[0], *colors = &ws->colors[0];
+		bool rotated = (!kernel.usable || kernel.rotate);
+		GLscalar hw = t->w*HALF, hh = t->h*HALF;
+		for (unsigned int i = 0; i != n; i++)
+		{
+			if (pt[i] < 0) continue;
+			GLscalar rsin = (rotated ? prs[i] : 0), rcos = (rotated ? prc[i] : 1);
+			GLscalar cosW = rcos*hw*psw[i], sinW = rsin*hw*psw[i];
+			GLscalar cosH = rsin*hh*psh[i], sinH = rcos*hh*psh[i];
+			vertices[12*v+ 0] = px[i]-cosW+cosH;
+			vertices[12*v+ 1] = py[i]-sinW-sinH;
+			vertices[12*v+ 2] = px[i]+cosW+cosH;
+			vertices[12*v+ 3] = py[i]+sinW-sinH;
+			vertices[12*v+ 4] = px[i]-cosW-cosH;
+			vertices[12*v+ 5] = py[i]-sinW+sinH;
+			vertices[12*v+10] = px[i]+cosW-cosH;
+			vertices[12*v+11] = py[i]+sinW+sinH;
+			memcpy(&vertices[12*v+ 6], &vertices[12*v+ 2], sizeof(GLscalar)*4);
+			colors[24*v+0] = pr[i]; colors[24*v+1] = pg[i]; colors[24*v+2] = pb[i]; colors[24*v+3] = pa[i];
+			memcpy(&colors[24*v +4], &colors[24*v+0], sizeof(scalar)*4);
+			memcpy(&colors[24*v+ 8], &colors[24*v+0], sizeof(scalar)*4);
+			memcpy(&colors[24*v+12], &colors[24*v+0], sizeof(scalar)*12);
+			v++;
+		}
+		ws->drawCount = v;
+	}
 
-				//call behavior calculations with their seed
-				unsigned char *pseed = p->cseed - calcData.seedbytes;
-				for (ZL_ParticleBehavior** b = behaviors; *b; b++)
-				{
-					calcData.seed = *(unsigned int*) ((*b)->UsesSeed ? (pseed += calcData.seedbytes) : pseed);
-					(*b)->Calculate(calcData);
-				}
+	//Submit the vertex data of the last update, only simulates first if not yet updated since the last tick or spawn
+	void Draw()
+	{
+		Emit();
+		if (active && (!updated || updatedTicks != ZL_Application::Ticks)) Update();
 
-				//draw particle surface
-				calcData.col.a *= calcData.alpha;
-
-				#ifdef ZL_VIDEO_OPENGL_ES1
-					if (bDoPointSprite)
-					{
-						vertices[2*v+0] = calcData.pos.x;
-						vertices[2*v+1] = calcData.pos.y;
-						memcpy(&colors[4*v], &calcData.col.r, sizeof(scalar)*4);
-						sizes[v] = calcData.scalew*t->w*1.1;
-						if (++v==VBSIZE) { glDrawArraysUnbuffered(GL_POINTS, 0, VBSIZE); v = 0; }
-					}
-					else
-				#endif
-				{
-					scalar s = ssin(calcData.rotation), c = scos(calcData.rotation);
-					scalar cosW = c*t->w*calcData.scalew/2, sinW = s*t->w*calcData.scalew/2;
-					scalar cosH = s*t->h*calcData.scaleh/2, sinH = c*t->h*calcData.scaleh/2;
-					vertices[12*v+ 0] = calcData.pos.x-cosW+cosH;
-					vertices[12*v+ 1] = calcData.pos.y-sinW-sinH;
-					vertices[12*v+ 2] = calcData.pos.x+cosW+cosH;
-					vertices[12*v+ 3] = calcData.pos.y+sinW-sinH;
-					vertices[12*v+ 4] = calcData.pos.x-cosW-cosH;
-					vertices[12*v+ 5] = calcData.pos.y-sinW+sinH;
-					vertices[12*v+10] = calcData.pos.x+cosW-cosH;
-					vertices[12*v+11] = calcData.pos.y+sinW+sinH;
-					memcpy(&vertices[12*v+ 6], &vertices[12*v+ 2], sizeof(GLscalar)*4);
-					memcpy(&colors[24*v+ 0], &calcData.col.r, sizeof(scalar)*4);
-					memcpy(&colors[24*v +4], &colors[24*v+0], sizeof(scalar)*4);
-					memcpy(&colors[24*v+ 8], &colors[24*v+0], sizeof(scalar)*4);
-					memcpy(&colors[24*v+12], &colors[24*v+0], sizeof(scalar)*12);
-					if (++v==VBSIZE) { glDrawArraysUnbuffered(GL_TRIANGLES, 0, 6*VBSIZE); v = 0; }
-				}
+		bool first = true;
+		for (WeightedSurface* ws = particleImages; ws->particles && ws != particleImages+(sizeof(particleImages)/sizeof(particleImages[0])); ws++)
+		{
+			if (!ws->drawCount) continue;
+			if (first)
+			{
+				ZLGL_ENABLE_TEXTURE();
+				ZLGL_COLORARRAY_ENABLE();
+				first = false;
 			}
+			ZL_Surface_Impl *srf = ZL_ImplFromOwner<ZL_Surface_Impl>(*(ZL_Surface*)ws);
+			glBindTexture(GL_TEXTURE_2D, srf->tex->Use());
+			ZLGL_VERTEXTPOINTER(2, GL_SCALAR, 0, &ws->vertices[0]);
+			ZLGL_COLORARRAY_POINTER(4, GL_SCALAR, 0, &ws->colors[0]);
+
 			#ifdef ZL_VIDEO_OPENGL_ES1
-				if (bDoPointSprite)
+				if (ws->pointSprites)
 				{
-					if (v) glDrawArraysUnbuffered(GL_POINTS, 0, v);
+					glEnable(GL_POINT_SPRITE_OES);
+					glTexEnvi(GL_POINT_SPRITE_OES, GL_COORD_REPLACE_OES, GL_TRUE);
+					glEnableClientState(GL_POINT_SIZE_ARRAY_OES);
+					glPointSizePointerOES(GL_SCALAR, 0, &ws->sizes[0]);
+					glDrawArraysUnbuffered(GL_POINTS, 0, ws->drawCount);
 					glDisableClientState(GL_POINT_SIZE_ARRAY_OES);
 					glDisable(GL_POINT_SPRITE_OES);
+					continue;
 				}
-				else
 			#endif
-			{
-				if (v) glDrawArraysUnbuffered(GL_TRIANGLES, 0, 6*v);
-			}
+
+			ZLGL_TEXCOORDPOINTER(2, GL_SCALAR, 0, &ws->texcoords[0]);
+			glDrawArraysUnbuffered(GL_TRIANGLES, 0, 6*ws->drawCount);
 		}
-		ZLGL_COLORARRAY_DISABLE();
-		active = ((particleImages[0].usedParticles) || (CountParticles() != 0));
+		if (!first) ZLGL_COLORARRAY_DISABLE();
 	}
 
 	void AddParticleImage(const ZL_Surface &surface, unsigned int maxNumOfParticles, scalar weight)
@@ -278,6 +534,28 @@ struct ZL_ParticleEffect_Impl : ZL_Impl
 		calcData.seed_max_full = (1 << (calcData.seedbits-1));
 		calcData.seed_max_half = (1 << (calcData.seedbits/2));
 		if (particleBehavior->ChangesAspectRatio || particleBehavior->ChangesRotation) allowPointSprites = false;
+		UpdateKernel();
+	}
+
+	void UpdateKernel()
+	{
+		//fused evaluation needs each built-in behavior at most once and gravity after the movement it modifies
+		ZL_ParticleEffect_Kernel k;
+		for (ZL_ParticleBehavior** b = behaviors; *b && k.usable; b++)
+		{
+			switch ((*b)->Kernel)
+			{
+				case ZL_ParticleBehavior::KERNEL_LINEARMOVE: if (k.move) k.usable = false; else { k.move = (ZL_ParticleBehavior_LinearMove*)*b; k.rotate = (*b)->ChangesRotation; } break;
+				case ZL_ParticleBehavior::KERNEL_GRAVITY: if (!k.move || k.gravity) k.usable = false; else k.gravity = (ZL_ParticleBehavior_Gravity*)*b; break;
+				case ZL_ParticleBehavior::KERNEL_LINEARIMAGEPROPERTIES: if (k.image) k.usable = false; else k.image = (ZL_ParticleBehavior_LinearImageProperties*)*b; break;
+				case ZL_ParticleBehavior::KERNEL_LINEARCOLOR: if (k.color) k.usable = false; else k.color = (ZL_ParticleBehavior_LinearColor*)*b; break;
+				default: k.usable = false;
+			}
+		}
+		kernel = k;
+		if (!kernel.usable) return;
+		for (WeightedSurface* ws = particleImages; ws->particles && ws != particleImages+(sizeof(particleImages)/sizeof(particleImages[0])); ws++)
+			for (unsigned int i = 0; i != ws->usedParticles; i++) SetupKernelParticle(ws, i);
 	}
 
 	int CountParticleImage()
@@ -320,6 +598,79 @@ void ZL_ParticleEffect::Draw()
 	impl->Draw();
 }
 
+void ZL_ParticleEffect::Update()
+{
+	impl->Emit();
+	impl->Update();
+}
+
+//Effects updated by the main thread and the job workers, freed by whoever releases it last
+struct ZL_ParticleUpdateTask
+{
+	std::vector<ZL_ParticleEffect_Impl*> effects;
+	size_t next, done;
+	int refs;
+	ZL_MutexHandle mutex;
+};
+#define ZLPARTICLES_UPDATE_JOBS 3
+
+static void ZL_ParticleUpdateWork(ZL_ParticleUpdateTask* task)
+{
+	for (size_t i = (size_t)-1;;)
+	{
+		ZL_MutexLock(task->mutex);
+		if (i != (size_t)-1) task->done++;
+		i = (task->next < task->effects.size() ? task->next++ : (size_t)-1);
+		ZL_MutexUnlock(task->mutex);
+		if (i == (size_t)-1) return;
+		task->effects[i]->Update();
+	}
+}
+
+static void ZL_ParticleUpdateRelease(ZL_ParticleUpdateTask* task)
+{
+	ZL_MutexLock(task->mutex);
+	bool last = !--task->refs;
+	ZL_MutexUnlock(task->mutex);
+	if (!last) return;
+	ZL_MutexDestroy(task->mutex);
+	delete task;
+}
+
+static void ZL_ParticleUpdateJob(void* task)
+{
+	ZL_ParticleUpdateWork((ZL_ParticleUpdateTask*)task);
+	ZL_ParticleUpdateRelease((ZL_ParticleUpdateTask*)task);
+}
+
+void ZL_ParticleEffect::Update(ZL_ParticleEffect* effects, size_t count)
+{
+	ZL_ParticleUpdateTask* task = new ZL_ParticleUpdateTask();
+	for (size_t i = 0; i != count; i++)
+	{
+		ZL_ParticleEffect_Impl* impl = ZL_ImplFromOwner<ZL_ParticleEffect_Impl>(effects[i]);
+		if (impl) impl->Emit();
+		if (impl && impl->active && std::find(task->effects.begin(), task->effects.end(), impl) == task->effects.end()) task->effects.push_back(impl);
+	}
+	size_t n = task->effects.size(), jobs = (n ? n - 1 : 0);
+	if (n < 2) { if (n) task->effects[0]->Update(); delete task; return; }
+	if (jobs > ZLPARTICLES_UPDATE_JOBS) jobs = ZLPARTICLES_UPDATE_JOBS;
+	task->next = task->done = 0;
+	task->refs = 1 + (int)jobs;
+	ZL_MutexInit(task->mutex);
+	for (size_t i = 0; i != jobs; i++) ZL_JobQueue(ZL_ParticleUpdateJob, task);
+	ZL_ParticleUpdateWork(task);
+	//all effects are taken at this point, only spin (yielding the time slice but not sleeping) until the last running jobs are done
+	for (bool finished = false; !finished;)
+	{
+		ZL_MutexLock(task->mutex);
+		finished = (task->done == n);
+		ZL_MutexUnlock(task->mutex);
+		if (!finished) ZL_Delay(0);
+	}
+	ZL_ParticleUpdateRelease(task);
+}
+
 void ZL_ParticleEffect::SetLifetimeDuration(scalar lifetimeDuration)
 {
 	impl->lifetimeDuration = lifetimeDuration;
@@ -345,6 +696,37 @@ int ZL_ParticleEffect::CountParticles()
 	return impl->CountParticles();
 }
 
+void ZL_ParticleEffect::SetSpawnRate(scalar particlesPerSecond)
+{
+	impl->SetSpawnRate(particlesPerSecond);
+}
+
+void ZL_ParticleEffect::SetEmitterPosition(scalar x, scalar y, scalar xSpread, scalar ySpread)
+{
+	impl->emitterPos = ZL_Vector(x, y);
+	impl->emitterSpread = ZL_Vector(xSpread, ySpread);
+}
+
+void ZL_ParticleEffect::SetEmitterPosition(const ZL_Vector& pos, scalar xSpread, scalar ySpread)
+{
+	impl->emitterPos = pos;
+	impl->emitterSpread = ZL_Vector(xSpread, ySpread);
+}
+
+unsigned int ZL_ParticleEffect::CountDroppedParticles(bool reset)
+{
+	unsigned int res = impl->statDropped;
+	if (reset) impl->statDropped = 0;
+	return res;
+}
+
+unsigned int ZL_ParticleEffect::CountExpiredParticles(bool reset)
+{
+	unsigned int res = impl->statExpired;
+	if (reset) impl->statExpired = 0;
+	return res;
+}
+
 void ZL_ParticleEffect::AddParticleImage(const ZL_Surface &surface, unsigned int maxNumOfParticles, scalar weight)
 {
 	impl->AddParticleImage(surface, maxNumOfParticles, weight);
@@ -410,6 +792,13 @@ ZL_ParticleBehavior_LinearMove::ZL_ParticleBehavior_LinearMove(scalar Speed, sca
 	spawningAngleSpread = behaviorAngleSpread = AngleRadSpread;
 }
 
+ZL_ParticleBehavior_LinearMove* ZL_ParticleBehavior_LinearMove::Create(scalar Speed, scalar SpeedSpread, scalar AngleRad, scalar AngleRadSpread, bool rotateImageToMoveAngle)
+{
+	ZL_ParticleBehavior_LinearMove* b = new ZL_ParticleBehavior_LinearMove(Speed, SpeedSpread, AngleRad, AngleRadSpread, rotateImageToMoveAngle);
+	b->Kernel = KERNEL_LINEARMOVE;
+	return b;
+}
+
 void ZL_ParticleBehavior_LinearMove::SetSpawnSpeed(scalar Speed, scalar SpeedSpread)
 { spawningSpeed = Speed; spawningSpeedSpread = SpeedSpread; }
 
@@ -454,6 +843,13 @@ ZL_ParticleBehavior_LinearImageProperties::ZL_ParticleBehavior_LinearImageProper
 	: ZL_ParticleBehavior(false,false,false), behaviorAlphaStart(alphaStart), behaviorAlphaEnd(alphaEnd), behaviorScaleStart(scaleStart), behaviorScaleEnd(scaleEnd)
 { }
 
+ZL_ParticleBehavior_LinearImageProperties* ZL_ParticleBehavior_LinearImageProperties::Create(scalar alphaStart, scalar alphaEnd, scalar scaleStart, scalar scaleEnd)
+{
+	ZL_ParticleBehavior_LinearImageProperties* b = new ZL_ParticleBehavior_LinearImageProperties(alphaStart, alphaEnd, scaleStart, scaleEnd);
+	b->Kernel = KERNEL_LINEARIMAGEPROPERTIES;
+	return b;
+}
+
 void ZL_ParticleBehavior_LinearImageProperties::Calculate(ZL_ParticleEffect_CalcData& d)
 {
 	d.scalew = d.scaleh = behaviorScaleStart + (behaviorScaleEnd - behaviorScaleStart) * d.percentOfLifeTime;
@@ -467,6 +863,13 @@ ZL_ParticleBehavior_LinearColor::ZL_ParticleBehavior_LinearColor()
 	: ZL_ParticleBehavior(true,false,false), totalColorStartWeight(0), totalColorEndWeight(0)
 { }
 
+ZL_ParticleBehavior_LinearColor* ZL_ParticleBehavior_LinearColor::Create()
+{
+	ZL_ParticleBehavior_LinearColor* b = new ZL_ParticleBehavior_LinearColor();
+	b->Kernel = KERNEL_LINEARCOLOR;
+	return b;
+}
+
 ZL_ParticleBehavior_LinearColor* ZL_ParticleBehavior_LinearColor::AddColorStart(const ZL_Color &color, scalar weight)
 {
 	//add weighted entry and update weight indexes
@@ -520,6 +923,13 @@ ZL_ParticleBehavior_Gravity::ZL_ParticleBehavior_Gravity(scalar Angle, scalar St
 	: ZL_ParticleBehavior(false,false,false), behaviorAngle(Angle), behaviorStrength(Strength)
 { }
 
+ZL_ParticleBehavior_Gravity* ZL_ParticleBehavior_Gravity::Create(scalar Angle, scalar Strength)
+{
+	ZL_ParticleBehavior_Gravity* b = new ZL_ParticleBehavior_Gravity(Angle, Strength);
+	b->Kernel = KERNEL_GRAVITY;
+	return b;
+}
+
 void ZL_ParticleBehavior_Gravity::Calculate(ZL_ParticleEffect_CalcData& d)
 {
 	d.pos.y -= behaviorStrength*d.percentOfLifeTime;
@@ -65,6 +65,9 @@ void ZL_GetWindowSize(int *w, int *h);
 //Misc
 void ZL_OpenExternalUrl(const char* url);
 
+//Background jobs run on a small pool of worker threads (on platforms without threads the job is run immediately)
+void ZL_JobQueue(void (*func)(void*), void* data);
+
 //Joystick
 int ZL_NumJoysticks();
 struct ZL_JoystickData;
@@ -111,6 +114,7 @@ extern void (*funcInitGL3D)(bool RecreateContext);
 extern void _ZL_Display_KeepAlive();
 extern void ZL_Display_Process_Event(ZL_Event& event);
 extern void (*funcSceneManagerCalculate)(), (*funcSceneManagerDraw)();
+extern void (*funcFrameCapture)(); //called after a frame was drawn and before it is presented
 extern bool (*funcProcessEventsJoystick)(ZL_Event&);
 extern ZL_Sound_Impl* ZL_Sound_LoadPlatform(void* data);
 extern bool ZL_PlatformAudioMix(short *stream, unsigned int bytes);
@@ -70,6 +70,10 @@ static EGLDisplay RenderDisplay;
 static EGLSurface RenderSurface;
 static EGLContext RenderContext;
 static pthread_t RenderThreadId;
+#ifdef ZL_VIDEO_GL_PROGRAM_BINARY
+PFNGLGETPROGRAMBINARYOESPROC glGetProgramBinary;
+PFNGLPROGRAMBINARYOESPROC glProgramBinary;
+#endif
 enum { ZL_EVENT_ANDROID_SURFACECHANGE = _ZL_EVENT_MAX, ZL_EVENT_ANDROID_ACTIVITYPAUSES, ZL_EVENT_ANDROID_ACTIVITYFINISHES };
 static pthread_mutex_t QueuedEventsMutex;
 static std::vector<ZL_Event> QueuedEvents;
@@ -152,6 +156,11 @@ static bool RendererInitialize()
 	if (!(ZL_ANDROID_WindowFlags & ZL_WINDOW_ALLOWANYORIENTATION) && (ZL_ANDROID_sWantsLandscape != (width > height))) { jint tmp = height; height = width; width = tmp; }
 	ZL_ANDROID_sWindowWidth = width;
 	ZL_ANDROID_sWindowHeight = height;
+	#ifdef ZL_VIDEO_GL_PROGRAM_BINARY
+	glGetProgramBinary = (PFNGLGETPROGRAMBINARYOESPROC)eglGetProcAddress("glGetProgramBinaryOES");
+	glProgramBinary = (PFNGLPROGRAMBINARYOESPROC)eglGetProcAddress("glProgramBinaryOES");
+	if (!glGetProgramBinary || !glProgramBinary) glGetProgramBinary = NULL, glProgramBinary = NULL;
+	#endif
 	return true;
 }
 
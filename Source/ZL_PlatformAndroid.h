@@ -34,6 +34,11 @@
 #ifdef ZL_VIDEO_OPENGL_ES2
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
+#define ZL_VIDEO_GL_PROGRAM_BINARY //these are NULL if GL_OES_get_program_binary is not supported
+extern PFNGLGETPROGRAMBINARYOESPROC glGetProgramBinary;
+extern PFNGLPROGRAMBINARYOESPROC glProgramBinary;
+#define GL_PROGRAM_BINARY_LENGTH GL_PROGRAM_BINARY_LENGTH_OES
+#define GL_NUM_PROGRAM_BINARY_FORMATS GL_NUM_PROGRAM_BINARY_FORMATS_OES
 #endif
 
 #ifdef __cplusplus
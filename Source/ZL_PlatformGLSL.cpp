@@ -26,6 +26,18 @@
 #include "ZL_Math.h"
 #include "ZL_Math3D.h"
 #include <assert.h>
+#ifdef ZL_VIDEO_GL_PROGRAM_BINARY
+#include <ZL_File.h>
+#include <map>
+#endif
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define ZLGLSL_MATRIX_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ZLGLSL_MATRIX_NEON
+#endif
 
 namespace ZLGLSL
 {
@@ -35,7 +47,68 @@ namespace ZLGLSL
 	static GLSLscalar *mvp_matrix_ = mvp_matrix_start;
 	eActiveProgram ActiveProgram = NONE;
 
+	#ifndef ZL_VIDEO_DIRECT3D
+	bool MatrixDirty = false;
+	static inline void MatrixChanged() { MatrixDirty = true; } //matrix gets uploaded on the next draw call (see MatrixFlush)
+	#else
 	void MatrixApply();
+	static inline void MatrixChanged() { MatrixApply(); }
+	#endif
+
+	//All matrix operations only affect the 2D affine part of the matrix (M11,M12,M21,M22 in [0],[1],[4],[5] and M41,M42 in [12],[13])
+	static inline void Affine2DTranslate(GLSLscalar* m, GLSLscalar tx, GLSLscalar ty)
+	{
+		#if defined(ZLGLSL_MATRIX_SSE)
+		__m128 l = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(m+0)), (const __m64*)(m+4));
+		__m128 p = _mm_mul_ps(l, _mm_set_ps(ty, ty, tx, tx));
+		_mm_storel_pi((__m64*)(m+12), _mm_add_ps(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(m+12)), _mm_add_ps(p, _mm_movehl_ps(p, p))));
+		#elif defined(ZLGLSL_MATRIX_NEON)
+		vst1_f32(m+12, vmla_n_f32(vmla_n_f32(vld1_f32(m+12), vld1_f32(m+0), tx), vld1_f32(m+4), ty));
+		#else
+		m[12] += (m[0] * tx) + (m[4] * ty);
+		m[13] += (m[1] * tx) + (m[5] * ty);
+		#endif
+	}
+
+	static inline void Affine2DScale(GLSLscalar* m, GLSLscalar sx, GLSLscalar sy)
+	{
+		#if defined(ZLGLSL_MATRIX_SSE)
+		__m128 l = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(m+0)), (const __m64*)(m+4));
+		l = _mm_mul_ps(l, _mm_set_ps(sy, sy, sx, sx));
+		_mm_storel_pi((__m64*)(m+0), l);
+		_mm_storeh_pi((__m64*)(m+4), l);
+		#elif defined(ZLGLSL_MATRIX_NEON)
+		vst1_f32(m+0, vmul_n_f32(vld1_f32(m+0), sx));
+		vst1_f32(m+4, vmul_n_f32(vld1_f32(m+4), sy));
+		#else
+		m[0] *= sx; m[1] *= sx;
+		m[4] *= sy; m[5] *= sy;
+		#endif
+	}
+
+	//rsin is passed negated for a reversed rotation
+	static inline void Affine2DRotate(GLSLscalar* m, GLSLscalar rcos, GLSLscalar rsin)
+	{
+		#if defined(ZLGLSL_MATRIX_SSE)
+		__m128 l = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(m+0)), (const __m64*)(m+4));
+		l = _mm_add_ps(_mm_mul_ps(l, _mm_set1_ps(rcos)), _mm_mul_ps(_mm_shuffle_ps(l, l, _MM_SHUFFLE(1,0,3,2)), _mm_set_ps(-rsin, -rsin, rsin, rsin)));
+		_mm_storel_pi((__m64*)(m+0), l);
+		_mm_storeh_pi((__m64*)(m+4), l);
+		#elif defined(ZLGLSL_MATRIX_NEON)
+		float32x2_t c0 = vld1_f32(m+0), c1 = vld1_f32(m+4);
+		vst1_f32(m+0, vmla_n_f32(vmul_n_f32(c0, rcos), c1, rsin));
+		vst1_f32(m+4, vmls_n_f32(vmul_n_f32(c1, rcos), c0, rsin));
+		#else
+		for (int i = 0; i < /*4*/ 2; i++)
+		{
+			GLSLscalar tmp = m[i];
+			m[  i] = (m[4+i] * rsin) + (tmp * rcos);
+			m[4+i] = (m[4+i] * rcos) - (tmp * rsin);
+		}
+		#endif
+		m[8] *= rcos;
+		m[9] *= rcos;
+	}
 
 	void MatrixPush()
 	{
@@ -55,93 +128,52 @@ namespace ZLGLSL
 	{
 		if (mvp_matrix_ == mvp_matrix_start) return;
 		mvp_matrix_ -= 16;
-		MatrixApply();
+		MatrixChanged();
 	}
 
 	void MatrixIdentity()
 	{
 		memset(mvp_matrix_, 0, sizeof(GLSLscalar)*16);
 		mvp_matrix_[0] = mvp_matrix_[5] = mvp_matrix_[10] = mvp_matrix_[15] = 1.0f;
-		MatrixApply();
+		MatrixChanged();
 	}
 
 	void MatrixTranslate(GLSLscalar tx, GLSLscalar ty)
 	{
-		mvp_matrix_[12] += (mvp_matrix_[0] * tx) + (mvp_matrix_[4] * ty);
-		mvp_matrix_[13] += (mvp_matrix_[1] * tx) + (mvp_matrix_[5] * ty);
-		//mvp_matrix_[14] += (mvp_matrix_[2] * tx) + (mvp_matrix_[6] * ty);
-		//mvp_matrix_[15] += (mvp_matrix_[3] * tx) + (mvp_matrix_[7] * ty);
-		MatrixApply();
+		Affine2DTranslate(mvp_matrix_, tx, ty);
+		MatrixChanged();
 	}
 
 	void MatrixScale(GLSLscalar sx, GLSLscalar sy)
 	{
-		mvp_matrix_[0] *= sx;
-		mvp_matrix_[1] *= sx;
-		//mvp_matrix_[2] *= sx;
-		//mvp_matrix_[3] *= sx;
-		mvp_matrix_[4] *= sy;
-		mvp_matrix_[5] *= sy;
-		//mvp_matrix_[6] *= sy;
-		//mvp_matrix_[7] *= sy;
-		MatrixApply();
+		Affine2DScale(mvp_matrix_, sx, sy);
+		MatrixChanged();
 	}
 
 	void MatrixRotate(GLSLscalar angle_rad)
 	{
-		GLSLscalar sinAngle = ssin(angle_rad), cosAngle = scos(angle_rad);
-		for (int i = 0; i < /*4*/ 2; i++)
-		{
-			GLSLscalar tmp = mvp_matrix_[i];
-			mvp_matrix_[  i] = (mvp_matrix_[4+i] * sinAngle) + (tmp * cosAngle);
-			mvp_matrix_[4+i] = (mvp_matrix_[4+i] * cosAngle) - (tmp * sinAngle);
-			mvp_matrix_[8+i] *= cosAngle;
-		}
-		MatrixApply();
+		Affine2DRotate(mvp_matrix_, scos(angle_rad), ssin(angle_rad));
+		MatrixChanged();
 	}
 
 	void MatrixRotate(GLSLscalar rcos, GLSLscalar rsin)
 	{
-		for (int i = 0; i < /*4*/ 2; i++)
-		{
-			GLSLscalar tmp = mvp_matrix_[i];
-			mvp_matrix_[  i] = (mvp_matrix_[4+i] * rsin) + (tmp * rcos);
-			mvp_matrix_[4+i] = (mvp_matrix_[4+i] * rcos) - (tmp * rsin);
-			mvp_matrix_[8+i] *= rcos;
-		}
-		MatrixApply();
+		Affine2DRotate(mvp_matrix_, rcos, rsin);
+		MatrixChanged();
 	}
 
 	void MatrixTransform(GLSLscalar tx, GLSLscalar ty, GLSLscalar rcos, GLSLscalar rsin)
 	{
-		mvp_matrix_[12] += (mvp_matrix_[0] * tx) + (mvp_matrix_[4] * ty);
-		mvp_matrix_[13] += (mvp_matrix_[1] * tx) + (mvp_matrix_[5] * ty);
-		//mvp_matrix_[14] += (mvp_matrix_[2] * tx) + (mvp_matrix_[6] * ty);
-		//mvp_matrix_[15] += (mvp_matrix_[3] * tx) + (mvp_matrix_[7] * ty);
-		for (int i = 0; i < /*4*/ 2; i++)
-		{
-			GLSLscalar tmp = mvp_matrix_[i];
-			mvp_matrix_[  i] = (mvp_matrix_[4+i] * rsin) + (tmp * rcos);
-			mvp_matrix_[4+i] = (mvp_matrix_[4+i] * rcos) - (tmp * rsin);
-			mvp_matrix_[8+i] *= rcos;
-		}
-		MatrixApply();
+		Affine2DTranslate(mvp_matrix_, tx, ty);
+		Affine2DRotate(mvp_matrix_, rcos, rsin);
+		MatrixChanged();
 	}
 
 	void MatrixTransformReverse(GLSLscalar tx, GLSLscalar ty, GLSLscalar rcos, GLSLscalar rsin)
 	{
-		for (int i = 0; i < /*4*/ 2; i++)
-		{
-			GLSLscalar tmp = mvp_matrix_[i];
-			mvp_matrix_[  i] = (tmp * rcos) - (mvp_matrix_[4+i] * rsin);
-			mvp_matrix_[4+i] = (tmp * rsin) + (mvp_matrix_[4+i] * rcos);
-			mvp_matrix_[8+i] *= rcos;
-		}
-		mvp_matrix_[12] -= (mvp_matrix_[0] * tx) + (mvp_matrix_[4] * ty);
-		mvp_matrix_[13] -= (mvp_matrix_[1] * tx) + (mvp_matrix_[5] * ty);
-		//mvp_matrix_[14] -= (mvp_matrix_[2] * tx) + (mvp_matrix_[6] * ty);
-		//mvp_matrix_[15] -= (mvp_matrix_[3] * tx) + (mvp_matrix_[7] * ty);
-		MatrixApply();
+		Affine2DRotate(mvp_matrix_, rcos, -rsin);
+		Affine2DTranslate(mvp_matrix_, -tx, -ty);
+		MatrixChanged();
 	}
 
 	void MatrixOrtho(GLSLscalar left, GLSLscalar right, GLSLscalar bottom, GLSLscalar top)
@@ -155,13 +187,13 @@ namespace ZLGLSL
 		mvp_matrix_[13] = -(top + bottom) / deltaY;
 		mvp_matrix_[10] = -1.0f;
 		mvp_matrix_[15] = 1.0f;
-		MatrixApply();
+		MatrixChanged();
 	}
 	
 	void LoadMatrix(const GLSLscalar* mtx)
 	{
 		memcpy(mvp_matrix_, mtx, 16*sizeof(GLSLscalar));
-		MatrixApply();
+		MatrixChanged();
 	}
 
 	void Project(GLSLscalar& x, GLSLscalar& y)
@@ -316,6 +348,92 @@ namespace ZLGLSL
 		return shader;
 	}
 
+	#ifdef ZL_VIDEO_GL_PROGRAM_BINARY
+	//Linked programs are stored by a hash of their sources and attribute bindings, a cache file is only valid for the exact same driver
+	struct ProgramCacheEntry { GLenum Format; std::vector<unsigned char> Binary; };
+	static std::map<u64, ProgramCacheEntry>* pProgramCache;
+	static ZL_String ProgramCacheFilePath;
+	static bool ProgramCacheDirty;
+
+	static u64 ProgramCacheHash(u64 h, GLsizei count, const char*const* strs)
+	{
+		for (GLsizei i = 0; i < count; i++)
+		{
+			if (strs[i]) for (const char* p = strs[i]; *p; p++) h = (h ^ (unsigned char)*p) * 0x100000001B3ULL;
+			h = (h ^ 0xFF) * 0x100000001B3ULL; //separate strings
+		}
+		return h;
+	}
+
+	static ZL_String ProgramCacheDriver()
+	{
+		return ZL_String((const char*)glGetString(GL_VENDOR)) << '|' << (const char*)glGetString(GL_RENDERER) << '|' << (const char*)glGetString(GL_VERSION);
+	}
+
+	static void ProgramCacheSave()
+	{
+		if (!ProgramCacheDirty) return;
+		ProgramCacheDirty = false;
+		ZL_String driver = ProgramCacheDriver();
+		std::vector<unsigned char> out;
+		unsigned int header[2] = { 0x4350535A, (unsigned int)driver.length() }; //'ZSPC'
+		out.insert(out.end(), (unsigned char*)header, (unsigned char*)(header+2));
+		out.insert(out.end(), (const unsigned char*)driver.c_str(), (const unsigned char*)driver.c_str() + driver.length());
+		for (std::map<u64, ProgramCacheEntry>::iterator it = pProgramCache->begin(); it != pProgramCache->end(); ++it)
+		{
+			unsigned int entry[4] = { (unsigned int)(it->first & 0xFFFFFFFF), (unsigned int)(it->first >> 32), (unsigned int)it->second.Format, (unsigned int)it->second.Binary.size() };
+			out.insert(out.end(), (unsigned char*)entry, (unsigned char*)(entry+4));
+			out.insert(out.end(), it->second.Binary.begin(), it->second.Binary.end());
+		}
+		ZL_File(ProgramCacheFilePath, "wb").SetContents(&out[0], out.size());
+		ZL_LOG2("ZLGLSL", "Stored %d programs in program cache %s", (int)pProgramCache->size(), ProgramCacheFilePath.c_str());
+	}
+
+	static void ProgramCacheLoad()
+	{
+		if (ProgramCacheFilePath.empty() || !ZL_File::Exists(ProgramCacheFilePath)) return;
+		std::vector<unsigned char> in;
+		ZL_File(ProgramCacheFilePath).GetContents(in);
+		ZL_String driver = ProgramCacheDriver();
+		const unsigned char *p = (in.empty() ? NULL : &in[0]), *end = p + in.size();
+		unsigned int header[2];
+		if (in.size() < sizeof(header)) return;
+		memcpy(header, p, sizeof(header)); p += sizeof(header);
+		if (header[0] != 0x4350535A || header[1] != driver.length() || (size_t)(end - p) < header[1] || memcmp(p, driver.c_str(), header[1])) { ProgramCacheDirty = true; return; } //rewrite outdated cache file
+		for (p += header[1]; (size_t)(end - p) >= sizeof(unsigned int)*4;)
+		{
+			unsigned int entry[4];
+			memcpy(entry, p, sizeof(entry)); p += sizeof(entry);
+			if ((size_t)(end - p) < entry[3]) break;
+			ProgramCacheEntry& e = (*pProgramCache)[(u64)entry[0] | ((u64)entry[1] << 32)];
+			e.Format = (GLenum)entry[2];
+			e.Binary.assign(p, p + entry[3]);
+			p += entry[3];
+		}
+		ZL_LOG2("ZLGLSL", "Loaded %d programs from program cache %s", (int)pProgramCache->size(), ProgramCacheFilePath.c_str());
+	}
+
+	static bool ProgramCacheEnabled()
+	{
+		if (pProgramCache) return true;
+		#ifndef ZL_VIDEO_WEAKCONTEXT //with a weak context, binaries are kept in memory for recreating programs after a context loss even without a cache file
+		if (ProgramCacheFilePath.empty()) return false;
+		#endif
+		GLint formats = 0;
+		if (!glGetProgramBinary || !glProgramBinary || (glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats), formats <= 0)) return false;
+		pProgramCache = new std::map<u64, ProgramCacheEntry>();
+		ProgramCacheLoad();
+		if (!ProgramCacheFilePath.empty()) ZL_Application::sigKeepAlive.connect(&ProgramCacheSave);
+		return true;
+	}
+
+	void ProgramCacheOpen(const char* CacheFilePath)
+	{
+		ZL_ASSERTMSG(!pProgramCache, "Program cache file needs to be set before the display is initialized");
+		if (!pProgramCache) ProgramCacheFilePath = CacheFilePath;
+	}
+	#endif
+
 	GLuint CreateProgramFromVertexAndFragmentShaders(GLsizei vertex_shader_srcs_count, const char*const* vertex_shader_srcs, GLsizei fragment_shader_srcs_count, const char*const* fragment_shader_srcs, GLsizei bind_attribs_count, const char*const* bind_attribs)
 	{
 		GLuint vertex_shader;
@@ -323,6 +441,25 @@ namespace ZLGLSL
 		GLuint program_object;
 		GLint linked;
 
+		#ifdef ZL_VIDEO_GL_PROGRAM_BINARY
+		u64 cache_key = 0;
+		if (ProgramCacheEnabled())
+		{
+			cache_key = ProgramCacheHash(ProgramCacheHash(ProgramCacheHash(0xCBF29CE484222325ULL, vertex_shader_srcs_count, vertex_shader_srcs), fragment_shader_srcs_count, fragment_shader_srcs), bind_attribs_count, bind_attribs);
+			std::map<u64, ProgramCacheEntry>::iterator it = pProgramCache->find(cache_key);
+			if (it != pProgramCache->end() && (program_object = glCreateProgram()) != 0)
+			{
+				glProgramBinary(program_object, it->second.Format, &it->second.Binary[0], (GLsizei)it->second.Binary.size());
+				glGetProgramiv(program_object, GL_LINK_STATUS, &linked);
+				if (linked) return program_object;
+				ZL_LOG0("ZLGLSL", "Cached program binary was rejected by the driver, compiling from source");
+				glDeleteProgram(program_object);
+				pProgramCache->erase(it);
+				ProgramCacheDirty = true;
+			}
+		}
+		#endif
+
 		// Load the vertex/fragment shaders
 		if (!(vertex_shader = CreateShaderOfType(GL_VERTEX_SHADER, vertex_shader_srcs_count, vertex_shader_srcs))) return 0;
 		if (!(fragment_shader = CreateShaderOfType(GL_FRAGMENT_SHADER, fragment_shader_srcs_count, fragment_shader_srcs))) { glDeleteShader(vertex_shader); return 0; }
@@ -335,6 +472,10 @@ namespace ZLGLSL
 		//attribute bound to index 0 must always be an enabled array attribute - so force position to it
 		for (GLsizei i = 0; i < bind_attribs_count; i++) glBindAttribLocation(program_object, i, bind_attribs[i]);
 
+		#if defined(ZL_VIDEO_GL_PROGRAM_BINARY) && defined(GL_PROGRAM_BINARY_RETRIEVABLE_HINT) && !defined(ZL_VIDEO_OPENGL_ES2)
+		if (cache_key) glProgramParameteri(program_object, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		#endif
+
 		// Link the program
 		glLinkProgram(program_object);
 
@@ -366,6 +507,18 @@ namespace ZLGLSL
 		glDetachShader(program_object, fragment_shader); glDeleteShader(fragment_shader);
 		#endif
 
+		#ifdef ZL_VIDEO_GL_PROGRAM_BINARY
+		GLint binary_length = 0;
+		if (cache_key && (glGetProgramiv(program_object, GL_PROGRAM_BINARY_LENGTH, &binary_length), binary_length > 0))
+		{
+			ProgramCacheEntry& e = (*pProgramCache)[cache_key];
+			e.Binary.resize((size_t)binary_length);
+			glGetProgramBinary(program_object, binary_length, &binary_length, &e.Format, &e.Binary[0]);
+			if (binary_length > 0) { e.Binary.resize((size_t)binary_length); ProgramCacheDirty = true; }
+			else pProgramCache->erase(cache_key);
+		}
+		#endif
+
 		return program_object;
 	}
 
@@ -398,9 +551,22 @@ namespace ZLGLSL
 		return true;
 	}
 
-	void MatrixApply()
+	static GLSLscalar mvp_matrix_uploaded[16];
+	static bool mvp_matrix_forceupload;
+
+	void MatrixProgramChanged()
 	{
-		if (ActiveProgram != NONE) glUniformMatrix4v(UNI_MVP, 1, GL_FALSE, mvp_matrix_);
+		MatrixDirty = mvp_matrix_forceupload = true;
+	}
+
+	void MatrixUpload()
+	{
+		if (ActiveProgram == NONE || ActiveProgram == DISPLAY3D) return; //stays dirty until a 2D program is selected again
+		MatrixDirty = false;
+		if (!mvp_matrix_forceupload && !memcmp(mvp_matrix_uploaded, mvp_matrix_, sizeof(mvp_matrix_uploaded))) return; //unchanged since the last upload (i.e. after push/pop)
+		mvp_matrix_forceupload = false;
+		memcpy(mvp_matrix_uploaded, mvp_matrix_, sizeof(mvp_matrix_uploaded));
+		glUniformMatrix4v(UNI_MVP, 1, GL_FALSE, mvp_matrix_);
 	}
 
 	void _COLOR_PROGRAM_ACTIVATE()
@@ -410,7 +576,7 @@ namespace ZLGLSL
 		glDisableVertexAttribArrayUnbuffered(ATTR_TEXCOORD);
 		glUseProgram(_COLOR_PROGRAM);
 		UNI_MVP = COLOR_UNI_MVP;
-		MatrixApply();
+		MatrixProgramChanged();
 	}
 
 	void _TEXTURE_PROGRAM_ACTIVATE()
@@ -420,7 +586,7 @@ namespace ZLGLSL
 		UNI_MVP = TEXTURE_UNI_MVP;
 		ZLGL_ENABLE_VERTEXARRAYOBJECT();
 		glEnableVertexAttribArrayUnbuffered(ATTR_TEXCOORD); //always required
-		MatrixApply();
+		MatrixProgramChanged();
 	}
 }
 
@@ -489,7 +655,7 @@ void ZL_Shader::Activate()
 	ZLGL_ENABLE_VERTEXARRAYOBJECT();
 	glEnableVertexAttribArrayUnbuffered(ZLGLSL::ATTR_POSITION);
 	glEnableVertexAttribArrayUnbuffered(ZLGLSL::ATTR_TEXCOORD);
-	ZLGLSL::MatrixApply();
+	ZLGLSL::MatrixProgramChanged();
 }
 
 void ZL_Shader::SetUniform(scalar uni1, double uni2, ...)
@@ -576,7 +742,7 @@ void ZL_PostProcess::Apply(scalar uni1, double uni2, ...)
 	ZLGL_ENABLE_VERTEXARRAYOBJECT();
 	glDisableVertexAttribArrayUnbuffered(2);
 	glEnableVertexAttribArrayUnbuffered(1);
-	glBindTexture(GL_TEXTURE_2D, impl->tex->gltexid);
+	glBindTexture(GL_TEXTURE_2D, impl->tex->Use());
 	glVertexAttribPointerUnbuffered(0, 2, GL_SCALAR, GL_FALSE, 0, vec_fullbox);
 	glVertexAttribPointerUnbuffered(1, 2, GL_SCALAR, GL_FALSE, 0, tex_fullbox);
 	va_list ap;
@@ -584,11 +750,11 @@ void ZL_PostProcess::Apply(scalar uni1, double uni2, ...)
 	for (size_t i = 0; i != impl->UNIs.size(); i++)
 		glUniform1(impl->UNIs[i], (GLscalar)(i == 0 ? uni1 : i == 1 ? (scalar)uni2 : (scalar)(va_arg(ap, double))));
 	va_end(ap);
+	ZLGLSL::ActiveProgram = ZLGLSL::NONE; //no matrix upload into the post process program
 	//glDisable(GL_BLEND);
 	glDrawArraysUnbuffered(GL_TRIANGLE_STRIP, 0, 4);
 	//glEnable(GL_BLEND);
 	glDisableVertexAttribArrayUnbuffered(1);
-	ZLGLSL::ActiveProgram = ZLGLSL::NONE;
 }
 
 #ifdef ZL_VIDEO_GL_USE_VBO
@@ -628,6 +794,7 @@ static void glDrawArrayPrepare(GLint first, GLsizei count)
 
 void glDrawArraysUnbuffered(GLenum mode, GLint first, GLsizei count)
 {
+	ZLGLSL::MatrixFlush();
 	ZLGL_ENABLE_VERTEXARRAYOBJECT();
 	glDrawArrayPrepare(first, count);
 	glDrawArrays(mode, 0, count);
@@ -636,6 +803,7 @@ void glDrawArraysUnbuffered(GLenum mode, GLint first, GLsizei count)
 void glDrawElementsUnbuffered(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices)
 {
 	ZL_ASSERT(type == GL_UNSIGNED_SHORT);
+	ZLGLSL::MatrixFlush();
 	ZLGL_ENABLE_VERTEXARRAYOBJECT();
 
 	GLsizei max = 0, countdown = count;
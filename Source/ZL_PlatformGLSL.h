@@ -78,9 +78,22 @@ namespace ZLGLSL
 	void MatrixOrtho(GLSLscalar left, GLSLscalar right, GLSLscalar bottom, GLSLscalar top);
 	void LoadMatrix(const GLSLscalar* mtx);
 
+	#ifndef ZL_VIDEO_DIRECT3D
+	extern bool MatrixDirty;
+	void MatrixUpload();
+	void MatrixProgramChanged();
+	inline void MatrixFlush() { if (MatrixDirty) MatrixUpload(); } //upload the matrix to the active program if it was modified since the last draw call
+	#else
+	inline void MatrixFlush() { }
+	#endif
+
 	void Project(GLSLscalar& x, GLSLscalar& y);
 	void Unproject(GLSLscalar& x, GLSLscalar& y);
 
+	#ifdef ZL_VIDEO_GL_PROGRAM_BINARY
+	void ProgramCacheOpen(const char* CacheFilePath);
+	#endif
+
 	#ifndef ZL_VIDEO_DIRECT3D
 	GLuint CreateProgramFromVertexAndFragmentShaders(GLsizei vertex_shader_srcs_count, const char*const* vertex_shader_srcs, GLsizei fragment_shader_srcs_count, const char*const* fragment_shader_srcs, GLsizei bind_attribs_count, const char*const* bind_attribs);
 	bool CreateShaders();
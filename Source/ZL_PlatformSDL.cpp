@@ -780,6 +780,7 @@ PFNGLBLENDFUNCSEPARATEPROC        glBlendFuncSeparate;
 #ifndef GL_ATI_blend_equation_separate
 PFNGLBLENDCOLORPROC               glBlendColor;
 PFNGLBLENDEQUATIONPROC            glBlendEquation;
+PFNGLCOMPRESSEDTEXIMAGE2DPROC     glCompressedTexImage2D;
 #endif
 #endif
 PFNGLGENFRAMEBUFFERSPROC          glGenFramebuffers;
@@ -796,6 +797,20 @@ PFNGLBUFFERSUBDATAPROC            glBufferSubData;
 PFNGLGENVERTEXARRAYSPROC          glGenVertexArrays;
 PFNGLBINDVERTEXARRAYPROC          glBindVertexArray;
 PFNGLDELETEVERTEXARRAYSPROC       glDeleteVertexArrays;
+#ifdef ZL_VIDEO_GL_PROGRAM_BINARY
+PFNGLGETPROGRAMBINARYPROC         glGetProgramBinary;
+PFNGLPROGRAMBINARYPROC            glProgramBinary;
+PFNGLPROGRAMPARAMETERIPROC        glProgramParameteri;
+#endif
+#ifdef ZL_VIDEO_GL_ASYNC_READBACK
+PFNGLFENCESYNCPROC                glFenceSync;
+PFNGLCLIENTWAITSYNCPROC           glClientWaitSync;
+PFNGLDELETESYNCPROC               glDeleteSync;
+PFNGLGETBUFFERSUBDATAPROC         glGetBufferSubData;
+#endif
+#ifdef ZL_VIDEO_GL_INSTANCING
+PFNGLDRAWELEMENTSINSTANCEDPROC    glDrawElementsInstanced;
+#endif
 static void InitExtensionEntries()
 {
 #ifndef __MACOSX__
@@ -838,6 +853,7 @@ static void InitExtensionEntries()
 #ifndef GL_ATI_blend_equation_separate
 	glBlendColor =               (PFNGLBLENDCOLORPROC              )(size_t)SDL_GL_GetProcAddress("glBlendColor");
 	glBlendEquation =            (PFNGLBLENDEQUATIONPROC           )(size_t)SDL_GL_GetProcAddress("glBlendEquation");
+	glCompressedTexImage2D =     (PFNGLCOMPRESSEDTEXIMAGE2DPROC    )(size_t)SDL_GL_GetProcAddress("glCompressedTexImage2D");
 #endif
 #endif
 	glGenFramebuffers =          (PFNGLGENFRAMEBUFFERSPROC         )(size_t)SDL_GL_GetProcAddress("glGenFramebuffers");
@@ -854,6 +870,26 @@ static void InitExtensionEntries()
 	glGenVertexArrays =          (PFNGLGENVERTEXARRAYSPROC         )(size_t)SDL_GL_GetProcAddress("glGenVertexArrays");
 	glBindVertexArray =          (PFNGLBINDVERTEXARRAYPROC         )(size_t)SDL_GL_GetProcAddress("glBindVertexArray");
 	glDeleteVertexArrays =       (PFNGLDELETEVERTEXARRAYSPROC      )(size_t)SDL_GL_GetProcAddress("glDeleteVertexArrays");
+#ifdef ZL_VIDEO_GL_PROGRAM_BINARY
+	glGetProgramBinary =         (PFNGLGETPROGRAMBINARYPROC        )(size_t)SDL_GL_GetProcAddress("glGetProgramBinary");
+	glProgramBinary =            (PFNGLPROGRAMBINARYPROC           )(size_t)SDL_GL_GetProcAddress("glProgramBinary");
+	glProgramParameteri =        (PFNGLPROGRAMPARAMETERIPROC       )(size_t)SDL_GL_GetProcAddress("glProgramParameteri");
+	if (!glGetProgramBinary || !glProgramBinary || !glProgramParameteri) glGetProgramBinary = NULL, glProgramBinary = NULL;
+#endif
+#ifdef ZL_VIDEO_GL_ASYNC_READBACK
+	glFenceSync =                (PFNGLFENCESYNCPROC               )(size_t)SDL_GL_GetProcAddress("glFenceSync");
+	glClientWaitSync =           (PFNGLCLIENTWAITSYNCPROC          )(size_t)SDL_GL_GetProcAddress("glClientWaitSync");
+	glDeleteSync =               (PFNGLDELETESYNCPROC              )(size_t)SDL_GL_GetProcAddress("glDeleteSync");
+	glGetBufferSubData =         (PFNGLGETBUFFERSUBDATAPROC        )(size_t)SDL_GL_GetProcAddress("glGetBufferSubData");
+	if (!glFenceSync || !glClientWaitSync || !glDeleteSync || !glGetBufferSubData) glFenceSync = NULL;
+#endif
+#ifdef ZL_VIDEO_GL_INSTANCING
+	glDrawElementsInstanced =    (PFNGLDRAWELEMENTSINSTANCEDPROC   )(size_t)SDL_GL_GetProcAddress("glDrawElementsInstanced");
+	if (!glDrawElementsInstanced) glDrawElementsInstanced = (PFNGLDRAWELEMENTSINSTANCEDPROC)(size_t)SDL_GL_GetProcAddress("glDrawElementsInstancedARB");
+#ifndef ZL_VIDEO_OPENGL_CORE
+	if (!SDL_GL_ExtensionSupported("GL_ARB_draw_instanced")) glDrawElementsInstanced = NULL; //shaders without a version header need the extension for gl_InstanceIDARB
+#endif
+#endif
 }
 
 #ifdef ZL_REQUIRE_INIT3DGLEXTENSIONENTRIES
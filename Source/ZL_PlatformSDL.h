@@ -24,6 +24,12 @@
 
 #include <SDL_opengl.h>
 
+#ifndef __MACOSX__
+#define ZL_VIDEO_GL_PROGRAM_BINARY
+#define ZL_VIDEO_GL_ASYNC_READBACK
+#define ZL_VIDEO_GL_INSTANCING
+#endif
+
 #ifdef __cplusplus
 
 //GLSL namespace
@@ -94,6 +100,7 @@ extern PFNGLBLENDFUNCSEPARATEPROC        glBlendFuncSeparate;
 #ifndef GL_ATI_blend_equation_separate //On linux some OpenGL 2 functions are already defined in the OS GL.h, avoid redefinition
 extern PFNGLBLENDCOLORPROC               glBlendColor;
 extern PFNGLBLENDEQUATIONPROC            glBlendEquation;
+extern PFNGLCOMPRESSEDTEXIMAGE2DPROC     glCompressedTexImage2D;
 #endif
 #ifndef ZL_DISABLE_DISPLAY3D
 #define ZL_REQUIRE_INIT3DGLEXTENSIONENTRIES
@@ -135,5 +142,19 @@ extern PFNGLBUFFERSUBDATAPROC            glBufferSubData;
 extern PFNGLGENVERTEXARRAYSPROC          glGenVertexArrays;
 extern PFNGLBINDVERTEXARRAYPROC          glBindVertexArray;
 extern PFNGLDELETEVERTEXARRAYSPROC       glDeleteVertexArrays;
+#ifdef ZL_VIDEO_GL_PROGRAM_BINARY //these are NULL if not supported by the driver
+extern PFNGLGETPROGRAMBINARYPROC         glGetProgramBinary;
+extern PFNGLPROGRAMBINARYPROC            glProgramBinary;
+extern PFNGLPROGRAMPARAMETERIPROC        glProgramParameteri;
+#endif
+#ifdef ZL_VIDEO_GL_ASYNC_READBACK //these are NULL if fence sync objects are not supported by the driver (OpenGL 3.2 or ARB_sync)
+extern PFNGLFENCESYNCPROC                glFenceSync;
+extern PFNGLCLIENTWAITSYNCPROC           glClientWaitSync;
+extern PFNGLDELETESYNCPROC               glDeleteSync;
+extern PFNGLGETBUFFERSUBDATAPROC         glGetBufferSubData;
+#endif
+#ifdef ZL_VIDEO_GL_INSTANCING //NULL if instanced drawing is not supported by the driver (OpenGL 3.1 or ARB_draw_instanced)
+extern PFNGLDRAWELEMENTSINSTANCEDPROC    glDrawElementsInstanced;
+#endif
 #endif //__cplusplus
 #endif //__ZL_PLATFORM_SDL__
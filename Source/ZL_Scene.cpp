@@ -23,8 +23,13 @@
 #include "ZL_Application.h"
 #include "ZL_Display_Impl.h"
 #include "ZL_Display.h"
+#include "ZL_Surface.h"
+#include "ZL_Font.h"
+#include "ZL_Texture_Impl.h"
 #include <assert.h>
 #include <map>
+#include <vector>
+#include <algorithm>
 
 static ZL_Scene *pCurrentScene, *pSceneTransitionFrom, *pSceneTransitionTo;
 static int TransitionTicksTotal, TransitionTicksLeft;
@@ -198,3 +203,360 @@ ZL_Scene* ZL_SceneManager::GetCurrent()
 {
 	return pCurrentScene;
 }
+
+struct ZL_SceneNode_Impl : ZL_Impl
+{
+	enum eType { GROUP, SPRITE, TEXT, RECT, ELLIPSE };
+	enum { DIRTY_TRANSFORM = 1, DIRTY_CHILD = 2 };
+	struct DrawItem { ZL_SceneNode_Impl* Node; int Layer; unsigned int Order; };
+	struct DrawCache { std::vector<DrawItem> Items; ZL_SceneNode_Impl* Root; unsigned int ChangeCount; }; //all drawable nodes in draw order, independent of the view
+
+	eType Type;
+	ZL_SceneNode_Impl* Parent;
+	std::vector<ZL_SceneNode_Impl*> Children;
+	ZL_Vector Pos, Scale;
+	scalar Rot, RotSin, RotCos;
+	ZL_Color Color, WorldColor, ShapeBorder, ShapeFill;
+	int Layer;
+	bool Visible, HasBounds;
+	unsigned char Dirty;
+	scalar World[6]; //affine world transform (x axis, y axis, translation)
+	ZL_Rectf LocalBox, WorldBounds;
+	GLscalar SpriteQuad[8]; //local sprite corners with the draw origin and rotation of the surface applied
+	unsigned int ChangeCount; //only used on root nodes, increased on every modification in the tree to invalidate cached draw lists
+	ZL_Surface Surface;
+	ZL_TextBuffer TextBuffer;
+	DrawCache* Cache;
+
+	ZL_SceneNode_Impl(eType Type) : Type(Type), Parent(NULL), Pos(0, 0), Scale(1, 1), Rot(0), RotSin(0), RotCos(1), Color(ZL_Color::White), WorldColor(ZL_Color::White), Layer(0), Visible(true), HasBounds(false), Dirty(DIRTY_TRANSFORM), ChangeCount(0), Cache(NULL) { }
+
+	~ZL_SceneNode_Impl()
+	{
+		for (std::vector<ZL_SceneNode_Impl*>::iterator it = Children.begin(); it != Children.end(); ++it) { (*it)->Parent = NULL; (*it)->DelRef(); }
+		if (Cache) delete Cache;
+	}
+
+	static ZL_Vector GetOriginOffset(ZL_Origin::Type orDraw, scalar hw, scalar hh)
+	{
+		if (orDraw >= ZL_Origin::_CUSTOM_START) return ZL_Vector(-hw * (ZL_Origin::FromCustomGetX(orDraw)*s(2)-s(1)), hh * (ZL_Origin::FromCustomGetY(orDraw)*s(2)-s(1)));
+		return ZL_Vector(((orDraw & ZL_Origin::_MASK_LEFT) ? hw : ((orDraw & ZL_Origin::_MASK_RIGHT) ? -hw : 0)), ((orDraw & ZL_Origin::_MASK_TOP) ? -hh : ((orDraw & ZL_Origin::_MASK_BOTTOM) ? hh : 0)));
+	}
+
+	void CalcLocalBox()
+	{
+		ZL_Vector c, e;
+		if (Type == SPRITE)
+		{
+			ZL_Surface_Impl* srf = ZL_ImplFromOwner<ZL_Surface_Impl>(Surface);
+			srf->CalcQuad(0, 0, srf->fRotate, srf->fHCW, srf->fHCH, srf->fRSin, srf->fRCos, SpriteQuad);
+			LocalBox = ZL_Rectf(SpriteQuad[0], SpriteQuad[1], SpriteQuad[0], SpriteQuad[1]);
+			for (int i = 2; i != 8; i += 2) LocalBox.Expand(ZL_Vector(SpriteQuad[i], SpriteQuad[i+1]));
+			return;
+		}
+		else if (Type == TEXT)
+		{
+			e = TextBuffer.GetDimensions() * s(.5);
+			c = GetOriginOffset(TextBuffer.GetDrawOrigin(), e.x, e.y);
+		}
+		else if (Type == GROUP) return;
+		else e = LocalBox.Extents();
+		LocalBox = ZL_Rectf(c, e); //corners can be swapped for flipped surfaces, bounds get sorted in Update
+	}
+
+	inline ZL_Vector ToWorld(scalar x, scalar y) const { return ZL_Vector(World[0]*x + World[2]*y + World[4], World[1]*x + World[3]*y + World[5]); }
+
+	void MarkChanged()
+	{
+		Dirty |= DIRTY_TRANSFORM;
+		ZL_SceneNode_Impl* n = this;
+		for (; n->Parent; n = n->Parent) n->Parent->Dirty |= DIRTY_CHILD;
+		n->ChangeCount++;
+	}
+
+	ZL_SceneNode_Impl* GetRoot() { ZL_SceneNode_Impl* n = this; while (n->Parent) n = n->Parent; return n; }
+
+	void Update(bool ParentChanged)
+	{
+		const bool Changed = (ParentChanged || (Dirty & DIRTY_TRANSFORM));
+		if (Changed)
+		{
+			const scalar a = RotCos*Scale.x, b = RotSin*Scale.x, c = -RotSin*Scale.y, d = RotCos*Scale.y;
+			if (Parent)
+			{
+				const scalar* p = Parent->World;
+				World[0] = p[0]*a + p[2]*b; World[1] = p[1]*a + p[3]*b;
+				World[2] = p[0]*c + p[2]*d; World[3] = p[1]*c + p[3]*d;
+				World[4] = p[0]*Pos.x + p[2]*Pos.y + p[4]; World[5] = p[1]*Pos.x + p[3]*Pos.y + p[5];
+				WorldColor = Parent->WorldColor * Color;
+			}
+			else { World[0] = a; World[1] = b; World[2] = c; World[3] = d; World[4] = Pos.x; World[5] = Pos.y; WorldColor = Color; }
+		}
+		if (!Changed && !(Dirty & DIRTY_CHILD)) return;
+		HasBounds = false;
+		if (Type != GROUP)
+		{
+			ZL_Vector p = ToWorld(LocalBox.left, LocalBox.low);
+			WorldBounds = ZL_Rectf(p, 0, 0);
+			WorldBounds.Expand(ToWorld(LocalBox.right, LocalBox.low));
+			WorldBounds.Expand(ToWorld(LocalBox.left, LocalBox.high));
+			WorldBounds.Expand(ToWorld(LocalBox.right, LocalBox.high));
+			HasBounds = true;
+		}
+		for (std::vector<ZL_SceneNode_Impl*>::iterator it = Children.begin(); it != Children.end(); ++it)
+		{
+			ZL_SceneNode_Impl* child = *it;
+			if (Changed || child->Dirty) child->Update(Changed);
+			if (!child->Visible || !child->HasBounds) continue;
+			if (!HasBounds) { WorldBounds = child->WorldBounds; HasBounds = true; continue; }
+			WorldBounds.Expand(child->WorldBounds.LowLeft());
+			WorldBounds.Expand(child->WorldBounds.HighRight());
+		}
+		Dirty = 0;
+	}
+
+	void Collect(std::vector<DrawItem>& Items)
+	{
+		if (!Visible || !HasBounds) return;
+		if (Type != GROUP)
+		{
+			DrawItem di = { this, Layer, (unsigned int)Items.size() };
+			Items.push_back(di);
+		}
+		for (std::vector<ZL_SceneNode_Impl*>::iterator it = Children.begin(); it != Children.end(); ++it) (*it)->Collect(Items);
+	}
+
+	//Keep the tree order within a layer so overlapping nodes are drawn in painter's order
+	static bool SortDrawItems(const DrawItem& a, const DrawItem& b)
+	{
+		if (a.Layer != b.Layer) return (a.Layer < b.Layer);
+		return (a.Order < b.Order);
+	}
+
+	void DrawTransformed(bool push)
+	{
+		if (push)
+		{
+			scalar sw = ssqrt(World[0]*World[0] + World[1]*World[1]), sh = ssqrt(World[2]*World[2] + World[3]*World[3]);
+			if (World[0]*World[3] - World[1]*World[2] < 0) sh = -sh;
+			ZL_Display::PushMatrix();
+			ZL_Display::Translate(World[4], World[5]);
+			if (World[1] || World[0] < 0) ZL_Display::Rotate(World[0]/sw, World[1]/sw);
+			ZL_Display::Scale(sw, sh);
+		}
+		else ZL_Display::PopMatrix();
+	}
+
+	void Draw()
+	{
+		GetRoot()->Update(false);
+		if (!Visible || !HasBounds) return;
+
+		const ZL_Rectf View = ZL_Display::GetVisibleWorldRect();
+		ZL_SceneNode_Impl* Root = GetRoot();
+		if (!Cache) { Cache = new DrawCache(); Cache->Root = NULL; }
+		if (Cache->Root != Root || Cache->ChangeCount != Root->ChangeCount)
+		{
+			Cache->Items.clear();
+			Collect(Cache->Items);
+			std::sort(Cache->Items.begin(), Cache->Items.end(), SortDrawItems);
+			Cache->Root = Root;
+			Cache->ChangeCount = Root->ChangeCount;
+		}
+
+		//Consecutive sprites sharing a texture are merged into one draw call, nodes outside of the view are skipped
+		static std::vector<GLscalar> Verts, TexCoords, Colors;
+		ZL_Texture_Impl* BatchTex = NULL;
+		for (std::vector<DrawItem>::iterator it = Cache->Items.begin();; ++it)
+		{
+			if (it != Cache->Items.end() && !View.Overlaps(it->Node->WorldBounds)) continue;
+			ZL_SceneNode_Impl* n = (it == Cache->Items.end() ? NULL : it->Node);
+			ZL_Surface_Impl* srf = (n && n->Type == SPRITE ? ZL_ImplFromOwner<ZL_Surface_Impl>(n->Surface) : NULL);
+			if (BatchTex && (!srf || srf->tex != BatchTex))
+			{
+				glBindTexture(GL_TEXTURE_2D, BatchTex->Use());
+				ZLGL_ENABLE_TEXTURE();
+				ZLGL_COLORARRAY_ENABLE();
+				ZLGL_VERTEXTPOINTER(2, GL_SCALAR, 0, &Verts[0]);
+				ZLGL_COLORARRAY_POINTER(4, GL_SCALAR, 0, &Colors[0]);
+				ZLGL_TEXCOORDPOINTER(2, GL_SCALAR, 0, &TexCoords[0]);
+				glDrawArraysUnbuffered(GL_TRIANGLES, 0, (GLsizei)(Verts.size()/2));
+				ZLGL_COLORARRAY_DISABLE();
+				Verts.clear(); TexCoords.clear(); Colors.clear();
+				BatchTex = NULL;
+			}
+			if (!n) break;
+			switch (n->Type)
+			{
+				case SPRITE:
+				{
+					BatchTex = srf->tex;
+					const GLscalar* lq = n->SpriteQuad;
+					const ZL_Vector q[4] = { n->ToWorld(lq[0], lq[1]), n->ToWorld(lq[2], lq[3]), n->ToWorld(lq[4], lq[5]), n->ToWorld(lq[6], lq[7]) };
+					const ZL_Color col = srf->color * n->WorldColor * ZL_Color(1, 1, 1, srf->fOpacity);
+					static const int Tris[6] = { 0, 1, 2, 1, 2, 3 };
+					for (int i = 0; i != 6; i++)
+					{
+						Verts.push_back(q[Tris[i]].x); Verts.push_back(q[Tris[i]].y);
+						TexCoords.push_back(srf->TexCoordBox[Tris[i]*2]); TexCoords.push_back(srf->TexCoordBox[Tris[i]*2+1]);
+						Colors.push_back(col.r); Colors.push_back(col.g); Colors.push_back(col.b); Colors.push_back(col.a);
+					}
+					break;
+				}
+				case TEXT:
+					n->DrawTransformed(true);
+					n->TextBuffer.Draw(0, 0, n->TextBuffer.GetColor() * n->WorldColor);
+					n->DrawTransformed(false);
+					break;
+				case RECT:
+				{
+					const ZL_Rectf& lb = n->LocalBox;
+					ZL_Display::DrawQuad(n->ToWorld(lb.left, lb.low), n->ToWorld(lb.right, lb.low), n->ToWorld(lb.right, lb.high), n->ToWorld(lb.left, lb.high), n->ShapeBorder * n->WorldColor, n->ShapeFill * n->WorldColor);
+					break;
+				}
+				case ELLIPSE:
+					n->DrawTransformed(true);
+					ZL_Display::DrawEllipse(0, 0, n->LocalBox.right, n->LocalBox.high, n->ShapeBorder * n->WorldColor, n->ShapeFill * n->WorldColor);
+					n->DrawTransformed(false);
+					break;
+				default: break;
+			}
+		}
+	}
+};
+
+ZL_IMPL_OWNER_DEFAULT_IMPLEMENTATIONS(ZL_SceneNode)
+
+ZL_SceneNode ZL_SceneNode::Group()
+{
+	ZL_SceneNode n;
+	n.impl = new ZL_SceneNode_Impl(ZL_SceneNode_Impl::GROUP);
+	return n;
+}
+
+ZL_SceneNode ZL_SceneNode::Sprite(const ZL_Surface& surface)
+{
+	ZL_SceneNode n;
+	if (!surface) return n;
+	n.impl = new ZL_SceneNode_Impl(ZL_SceneNode_Impl::SPRITE);
+	n.impl->Surface = surface;
+	n.impl->CalcLocalBox();
+	return n;
+}
+
+ZL_SceneNode ZL_SceneNode::Text(const ZL_TextBuffer& text_buffer)
+{
+	ZL_SceneNode n;
+	if (!text_buffer) return n;
+	n.impl = new ZL_SceneNode_Impl(ZL_SceneNode_Impl::TEXT);
+	n.impl->TextBuffer = text_buffer;
+	n.impl->CalcLocalBox();
+	return n;
+}
+
+ZL_SceneNode ZL_SceneNode::Rect(scalar width, scalar height, const ZL_Color &color_border, const ZL_Color &color_fill)
+{
+	ZL_SceneNode n;
+	n.impl = new ZL_SceneNode_Impl(ZL_SceneNode_Impl::RECT);
+	n.impl->LocalBox = ZL_Rectf(-width*s(.5), -height*s(.5), width*s(.5), height*s(.5));
+	n.impl->ShapeBorder = color_border;
+	n.impl->ShapeFill = color_fill;
+	return n;
+}
+
+ZL_SceneNode ZL_SceneNode::Ellipse(scalar radius_x, scalar radius_y, const ZL_Color &color_border, const ZL_Color &color_fill)
+{
+	ZL_SceneNode n;
+	n.impl = new ZL_SceneNode_Impl(ZL_SceneNode_Impl::ELLIPSE);
+	n.impl->LocalBox = ZL_Rectf(-radius_x, -radius_y, radius_x, radius_y);
+	n.impl->ShapeBorder = color_border;
+	n.impl->ShapeFill = color_fill;
+	return n;
+}
+
+ZL_SceneNode& ZL_SceneNode::AddChild(const ZL_SceneNode& child)
+{
+	ZL_SceneNode_Impl* c = child.impl;
+	if (!impl || !c || c == impl || c->Parent == impl) return *this;
+	for (ZL_SceneNode_Impl* p = impl->Parent; p; p = p->Parent) if (p == c) return *this; //can't add an ancestor as a child
+	c->AddRef();
+	if (c->Parent) ZL_SceneNode(child).RemoveFromParent();
+	impl->Children.push_back(c);
+	c->Parent = impl;
+	c->MarkChanged();
+	return *this;
+}
+
+ZL_SceneNode& ZL_SceneNode::RemoveChild(const ZL_SceneNode& child)
+{
+	if (impl && child.impl && child.impl->Parent == impl) ZL_SceneNode(child).RemoveFromParent();
+	return *this;
+}
+
+ZL_SceneNode& ZL_SceneNode::RemoveAllChildren()
+{
+	if (!impl || impl->Children.empty()) return *this;
+	for (std::vector<ZL_SceneNode_Impl*>::iterator it = impl->Children.begin(); it != impl->Children.end(); ++it) { (*it)->Parent = NULL; (*it)->MarkChanged(); (*it)->DelRef(); }
+	impl->Children.clear();
+	impl->MarkChanged();
+	return *this;
+}
+
+void ZL_SceneNode::RemoveFromParent()
+{
+	if (!impl || !impl->Parent) return;
+	ZL_SceneNode_Impl* p = impl->Parent;
+	p->Children.erase(std::find(p->Children.begin(), p->Children.end(), impl));
+	p->MarkChanged();
+	impl->Parent = NULL;
+	impl->MarkChanged();
+	impl->DelRef();
+}
+
+ZL_SceneNode ZL_SceneNode::GetParent() const { return ZL_ImplMakeOwner<ZL_SceneNode>((impl ? impl->Parent : NULL), true); }
+size_t ZL_SceneNode::GetChildCount() const { return (impl ? impl->Children.size() : 0); }
+ZL_SceneNode ZL_SceneNode::GetChild(size_t index) const { return ZL_ImplMakeOwner<ZL_SceneNode>((impl && index < impl->Children.size() ? impl->Children[index] : NULL), true); }
+
+ZL_SceneNode& ZL_SceneNode::SetPosition(const ZL_Vector& pos)           { if (impl && impl->Pos != pos) { impl->Pos = pos; impl->MarkChanged(); } return *this; }
+ZL_SceneNode& ZL_SceneNode::SetPosition(scalar x, scalar y)             { return SetPosition(ZL_Vector(x, y)); }
+ZL_SceneNode& ZL_SceneNode::SetRotateDeg(scalar rotate_deg)             { return SetRotate(rotate_deg*PIOVER180); }
+ZL_SceneNode& ZL_SceneNode::SetScale(scalar scale)                      { return SetScale(scale, scale); }
+ZL_SceneNode& ZL_SceneNode::SetScale(scalar scalew, scalar scaleh)      { if (impl && (impl->Scale.x != scalew || impl->Scale.y != scaleh)) { impl->Scale = ZL_Vector(scalew, scaleh); impl->MarkChanged(); } return *this; }
+ZL_SceneNode& ZL_SceneNode::SetColor(const ZL_Color &color)             { if (impl && impl->Color != color) { impl->Color = color; impl->MarkChanged(); } return *this; }
+ZL_SceneNode& ZL_SceneNode::SetVisible(bool visible)                    { if (impl && impl->Visible != visible) { impl->Visible = visible; impl->MarkChanged(); } return *this; }
+ZL_SceneNode& ZL_SceneNode::SetLayer(int layer)                         { if (impl && impl->Layer != layer) { impl->Layer = layer; impl->GetRoot()->ChangeCount++; } return *this; }
+ZL_SceneNode& ZL_SceneNode::Invalidate()                                { if (impl) { impl->CalcLocalBox(); impl->MarkChanged(); } return *this; }
+ZL_Vector ZL_SceneNode::GetPosition() const { return (impl ? impl->Pos : ZL_Vector()); }
+scalar ZL_SceneNode::GetRotate() const { return (impl ? impl->Rot : 0); }
+ZL_Vector ZL_SceneNode::GetScale() const { return (impl ? impl->Scale : ZL_Vector()); }
+ZL_Color ZL_SceneNode::GetColor() const { return (impl ? impl->Color : ZL_Color::White); }
+bool ZL_SceneNode::IsVisible() const { return (impl && impl->Visible); }
+int ZL_SceneNode::GetLayer() const { return (impl ? impl->Layer : 0); }
+
+ZL_SceneNode& ZL_SceneNode::SetRotate(scalar rotate_rad)
+{
+	if (!impl || impl->Rot == rotate_rad) return *this;
+	impl->Rot = rotate_rad;
+	impl->RotSin = ssin(rotate_rad);
+	impl->RotCos = scos(rotate_rad);
+	impl->MarkChanged();
+	return *this;
+}
+
+ZL_Vector ZL_SceneNode::GetWorldPosition() const
+{
+	if (!impl) return ZL_Vector();
+	impl->GetRoot()->Update(false);
+	return ZL_Vector(impl->World[4], impl->World[5]);
+}
+
+ZL_Rectf ZL_SceneNode::GetWorldBounds() const
+{
+	if (!impl) return ZL_Rectf();
+	impl->GetRoot()->Update(false);
+	return (impl->HasBounds ? impl->WorldBounds : ZL_Rectf(impl->World[4], impl->World[5], impl->World[4], impl->World[5]));
+}
+
+void ZL_SceneNode::Draw() const
+{
+	if (impl) impl->Draw();
+}
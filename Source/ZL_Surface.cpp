@@ -23,6 +23,7 @@
 #include "ZL_Texture_Impl.h"
 #include "ZL_Application.h"
 #include <vector>
+#include <algorithm>
 #include <string.h>
 #include <assert.h>
 
@@ -62,7 +63,7 @@ struct ZL_Surface_BatchRenderContext
 	void Draw()
 	{
 		assert(vertices_start);
-		glBindTexture(GL_TEXTURE_2D, srf->tex->gltexid);
+		glBindTexture(GL_TEXTURE_2D, srf->tex->Use());
 		ZLGL_ENABLE_TEXTURE();
 		if (colors_start) ZLGL_COLORARRAY_ENABLE();
 		else ZLGL_COLORA(srf->color, srf->fOpacity);
@@ -110,17 +111,18 @@ ZL_Surface_Impl::ZL_Surface_Impl(ZL_Texture_Impl* tex, bool add_ref)
 	if (add_ref) tex->AddRef();
 	if (!tex->gltexid) { tex->DelRef(); tex = NULL; return; }
 	CalcUnclippedTexCoordBoxAndContentSize();
+	ZL_SurfaceAsyncTrack(this, true);
 }
 ZL_Surface_Impl::ZL_Surface_Impl(const ZL_Surface_Impl* src)
 {
 	memcpy((void*)this, (void*)src, sizeof(ZL_Surface_Impl));
 	if (pBatchRender) pBatchRender = NULL;
-	if (tex) tex->AddRef();
+	if (tex) { tex->AddRef(); ZL_SurfaceAsyncTrack(this, true); }
 }
 
 ZL_Surface_Impl::~ZL_Surface_Impl()
 {
-	if (tex) tex->DelRef();
+	if (tex) { ZL_SurfaceAsyncTrack(this, false); tex->DelRef(); }
 	if (pBatchRender) delete pBatchRender;
 }
 
@@ -143,6 +145,30 @@ void ZL_Surface_Impl::CalcUnclippedTexCoordBoxAndContentSize()
 	fHCH = tex->h * fScaleH / 2;
 }
 
+void ZL_Surface_Impl::CalcClippedTexCoordBoxAndContentSize()
+{
+	const scalar *clip = ClipArea;
+	if (ClipInPixels)
+	{
+		const int divisor = (tex->filtermag == GL_NEAREST ? 12 : 2);
+		TexCoordBox[0] = TexCoordBox[4] =        s(clip[0]*divisor+1) / (tex->wTex*divisor);
+		TexCoordBox[1] = TexCoordBox[3] = s(1) - s(clip[3]*divisor-1) / (tex->hTex*divisor);
+		TexCoordBox[2] = TexCoordBox[6] =        s(clip[2]*divisor-1) / (tex->wTex*divisor);
+		TexCoordBox[5] = TexCoordBox[7] = s(1) - s(clip[1]*divisor+1) / (tex->hTex*divisor);
+		fHCW = fScaleW * sabs(clip[2] - clip[0]) * s(.5);
+		fHCH = fScaleH * sabs(clip[3] - clip[1]) * s(.5);
+	}
+	else
+	{
+		TexCoordBox[0] = TexCoordBox[4] = (tex->wTex > tex->w ? clip[0] * tex->w / tex->wTex : clip[0]);
+		TexCoordBox[1] = TexCoordBox[3] = (tex->hTex > tex->h ? clip[1] * tex->h / tex->hTex : clip[1]);
+		TexCoordBox[2] = TexCoordBox[6] = (tex->wTex > tex->w ? clip[2] * tex->w / tex->wTex : clip[2]);
+		TexCoordBox[5] = TexCoordBox[7] = (tex->hTex > tex->h ? clip[3] * tex->h / tex->hTex : clip[3]);
+		fHCW = fScaleW * tex->w * sabs(clip[2] - clip[0]) * s(.5);
+		fHCH = fScaleH * tex->w * sabs(clip[3] - clip[1]) * s(.5);
+	}
+}
+
 void ZL_Surface_Impl::CalcRotation(const scalar rotate)
 {
 	if (fRotate == rotate) return;
@@ -156,7 +182,7 @@ inline void ZL_Surface_Impl::DrawOrBatch(const ZL_Color &color, const GLscalar v
 	if (pBatchRender && pBatchRender->vertices_start) pBatchRender->Add(VerticesBox, texcoordbox, &color);
 	else
 	{
-		glBindTexture(GL_TEXTURE_2D, tex->gltexid);
+		glBindTexture(GL_TEXTURE_2D, tex->Use());
 		ZLGL_ENABLE_TEXTURE();
 		ZLGL_COLORA(color, fOpacity);
 		ZLGL_TEXCOORDPOINTER(2, GL_SCALAR, 0, texcoordbox);
@@ -165,7 +191,7 @@ inline void ZL_Surface_Impl::DrawOrBatch(const ZL_Color &color, const GLscalar v
 	}
 }
 
-void ZL_Surface_Impl::Draw(scalar x, scalar y, const scalar rotate, const scalar hcw, const scalar hch, scalar rsin, scalar rcos, const ZL_Color &color)
+void ZL_Surface_Impl::CalcQuad(scalar x, scalar y, const scalar rotate, const scalar hcw, const scalar hch, scalar rsin, scalar rcos, GLscalar* Quad) const
 {
 	switch (orDraw)
 	{
@@ -184,7 +210,7 @@ void ZL_Surface_Impl::Draw(scalar x, scalar y, const scalar rotate, const scalar
 	}
 	if (rotate == 0)
 	{
-		DrawOrBatch(color, x-hcw , y-hch , x+hcw , y-hch ,  x-hcw , y+hch, x+hcw , y+hch, TexCoordBox);
+		Quad[0] = x-hcw; Quad[1] = y-hch; Quad[2] = x+hcw; Quad[3] = y-hch; Quad[4] = x-hcw; Quad[5] = y+hch; Quad[6] = x+hcw; Quad[7] = y+hch;
 	}
 	else
 	{
@@ -206,10 +232,17 @@ void ZL_Surface_Impl::Draw(scalar x, scalar y, const scalar rotate, const scalar
 				x+=(+hcw-cosW)*rcos-sinH*rsin;
 				y+=(-hch+cosH)*rsin-sinW*rcos;
 		}
-		DrawOrBatch(color, x-cosW+sinH, y-sinW-cosH, x+cosW+sinH, y+sinW-cosH, x-cosW-sinH, y-sinW+cosH, x+cosW-sinH, y+sinW+cosH, TexCoordBox);
+		Quad[0] = x-cosW+sinH; Quad[1] = y-sinW-cosH; Quad[2] = x+cosW+sinH; Quad[3] = y+sinW-cosH; Quad[4] = x-cosW-sinH; Quad[5] = y-sinW+cosH; Quad[6] = x+cosW-sinH; Quad[7] = y+sinW+cosH;
 	}
 }
 
+void ZL_Surface_Impl::Draw(scalar x, scalar y, const scalar rotate, const scalar hcw, const scalar hch, scalar rsin, scalar rcos, const ZL_Color &color)
+{
+	GLscalar q[8];
+	CalcQuad(x, y, rotate, hcw, hch, rsin, rcos, q);
+	DrawOrBatch(color, q[0], q[1], q[2], q[3], q[4], q[5], q[6], q[7], TexCoordBox);
+}
+
 void ZL_Surface_Impl::DrawTo(const scalar x1, const scalar y1, const scalar x2, const scalar y2, scalar scalew, scalar scaleh, const ZL_Color &color)
 {
 	if (tex->wraps == GL_REPEAT/* || tex->wraps == GL_MIRRORED_REPEAT (not available on GLES)*/)
@@ -260,6 +293,53 @@ ZL_Surface ZL_Surface::Clone() const
 	return ret;
 }
 
+ZL_Surface ZL_Surface::LoadAsync(const ZL_FileLink& file)
+{
+	ZL_Surface ret;
+	if ((ret.impl = ZL_SurfaceLoadAsync(file)) && !ret.impl->tex) { delete ret.impl; ret.impl = NULL; }
+	return ret;
+}
+
+bool ZL_Surface::IsLoading() const
+{
+	return (impl && ZL_SurfaceAsyncSignal(impl) != NULL);
+}
+
+bool ZL_Surface::HasLoadFailed() const
+{
+	return (impl && impl->tex->LoadFailed);
+}
+
+ZL_Signal_v3<const unsigned char*, int, int>& ZL_Surface::ReadPixelsAsync() const
+{
+	static ZL_Signal_v3<const unsigned char*, int, int> sigNeverCalled; //for empty surfaces
+	return (impl ? impl->tex->ReadPixelsAsync() : sigNeverCalled);
+}
+
+ZL_Signal_v1<const ZL_Surface&>& ZL_Surface::sigLoaded()
+{
+	static ZL_Signal_v1<const ZL_Surface&> sigNeverCalled; //for surfaces that are not loading
+	ZL_Signal_v1<const ZL_Surface&>* sig = (impl ? ZL_SurfaceAsyncSignal(impl) : NULL);
+	return (sig ? *sig : sigNeverCalled);
+}
+
+void ZL_Surface::SetAsyncUploadBudget(ticks_t MaxTicksPerFrame, size_t MaxBytesPerFrame)
+{
+	ZL_SurfaceAsyncSetBudget(MaxTicksPerFrame, MaxBytesPerFrame);
+}
+
+void ZL_Surface::SetTextureMemoryBudget(size_t MaxBytes, unsigned int MinUnusedFrames, bool AsyncReload)
+{
+	ZL_Texture_Impl::SetMemoryBudget(MaxBytes, MinUnusedFrames, AsyncReload);
+}
+
+ZL_Surface::TextureMemoryStats ZL_Surface::GetTextureMemoryStats()
+{
+	TextureMemoryStats res;
+	ZL_Texture_Impl::GetMemoryStats(&res.ResidentBytes, &res.BudgetBytes, &res.EvictedTextures, &res.Evictions, &res.Reloads);
+	return res;
+}
+
 int ZL_Surface::GetWidth() const { return impl ? impl->tex->wRep : 0; }
 int ZL_Surface::GetHeight() const { return impl ? impl->tex->hRep : 0; }
 ZL_Vector ZL_Surface::GetSize() const { return impl ? ZL_Vector(s(impl->tex->wRep), s(impl->tex->hRep)) : ZL_Vector(); }
@@ -303,13 +383,9 @@ ZL_Surface& ZL_Surface::SetClipping(ZL_Rect clip)
 {
 	if (!impl) return *this;
 	impl->hasClipping = true;
-	const int divisor = (impl->tex->filtermag == GL_NEAREST ? 12 : 2);
-	impl->TexCoordBox[0] = impl->TexCoordBox[4] =        s(clip.left  *divisor+1) / (impl->tex->wTex*divisor);
-	impl->TexCoordBox[1] = impl->TexCoordBox[3] = s(1) - s(clip.bottom*divisor-1) / (impl->tex->hTex*divisor);
-	impl->TexCoordBox[2] = impl->TexCoordBox[6] =        s(clip.right *divisor-1) / (impl->tex->wTex*divisor);
-	impl->TexCoordBox[5] = impl->TexCoordBox[7] = s(1) - s(clip.top   *divisor+1) / (impl->tex->hTex*divisor);
-	impl->fHCW = impl->fScaleW * sabs(s(clip.Width()))  * s(.5);
-	impl->fHCH = impl->fScaleH * sabs(s(clip.Height())) * s(.5);
+	impl->ClipInPixels = true;
+	impl->ClipArea[0] = s(clip.left); impl->ClipArea[1] = s(clip.top); impl->ClipArea[2] = s(clip.right); impl->ClipArea[3] = s(clip.bottom);
+	impl->CalcClippedTexCoordBoxAndContentSize();
 	return *this;
 }
 
@@ -318,12 +394,9 @@ ZL_Surface& ZL_Surface::SetClipping(ZL_Rectf clip)
 	if (!impl) return *this;
 	if (IsTextureRepeatMode()) SetTextureRepeatMode(false);
 	impl->hasClipping = true;
-	impl->TexCoordBox[0] = impl->TexCoordBox[4] = (impl->tex->wTex > impl->tex->w ? clip.left  * impl->tex->w / impl->tex->wTex : clip.left);
-	impl->TexCoordBox[1] = impl->TexCoordBox[3] = (impl->tex->hTex > impl->tex->h ? clip.low   * impl->tex->h / impl->tex->hTex : clip.low);
-	impl->TexCoordBox[2] = impl->TexCoordBox[6] = (impl->tex->wTex > impl->tex->w ? clip.right * impl->tex->w / impl->tex->wTex : clip.right);
-	impl->TexCoordBox[5] = impl->TexCoordBox[7] = (impl->tex->hTex > impl->tex->h ? clip.high  * impl->tex->h / impl->tex->hTex : clip.high);
-	impl->fHCW = impl->fScaleW * impl->tex->w * sabs(clip.Width())  * s(.5);
-	impl->fHCH = impl->fScaleH * impl->tex->w * sabs(clip.Height()) * s(.5);
+	impl->ClipInPixels = false;
+	impl->ClipArea[0] = clip.left; impl->ClipArea[1] = clip.low; impl->ClipArea[2] = clip.right; impl->ClipArea[3] = clip.high;
+	impl->CalcClippedTexCoordBoxAndContentSize();
 	return *this;
 }
 
@@ -344,6 +417,7 @@ ZL_Surface& ZL_Surface::SetTilesetIndex(int Index)
 	GLscalar* tcb = impl->TexCoordBox;
 	scalar left =        s(w * (Index % cols) *divisor+1) / (impl->tex->wTex*divisor); if (left != tcb[0]) { scalar tcw = tcb[2] - tcb[0]; tcb[2] = tcb[6] = (tcb[0] = tcb[4] = left) + tcw; }
 	scalar top  = s(1) - s(h * (Index / cols) *divisor+1) / (impl->tex->hTex*divisor); if (top  != tcb[5]) { scalar tch = tcb[5] - tcb[1]; tcb[1] = tcb[3] = (tcb[5] = tcb[7] = top ) - tch; }
+	impl->SetTileClipArea(w * (Index % cols), h * (Index / cols), w, h);
 	return *this;
 }
 
@@ -356,6 +430,7 @@ ZL_Surface& ZL_Surface::SetTilesetIndex(int IndexCol, int IndexRow)
 	GLscalar* tcb = impl->TexCoordBox;
 	scalar left =        s(w * IndexCol *divisor+1) / (impl->tex->wTex*divisor); if (left != tcb[0]) { scalar tcw = tcb[2] - tcb[0]; tcb[2] = tcb[6] = (tcb[0] = tcb[4] = left) + tcw; }
 	scalar top  = s(1) - s(h * IndexRow *divisor+1) / (impl->tex->hTex*divisor); if (top  != tcb[5]) { scalar tch = tcb[5] - tcb[1]; tcb[1] = tcb[3] = (tcb[5] = tcb[7] = top ) - tch; }
+	impl->SetTileClipArea(w * IndexCol, h * IndexRow, w, h);
 	return *this;
 }
 
@@ -416,7 +491,7 @@ void ZL_Surface::RenderToBegin(bool clear, bool set2DOrtho)
 	if (!impl || !impl->tex || !impl->tex->pFrameBuffer) return;
 	impl->tex->FrameBufferBegin(clear);
 	if (set2DOrtho) ZL_Display::PushOrtho(0, s(impl->tex->wRep), 0, s(impl->tex->hRep));
-	impl->tex->pFrameBuffer->flags = (set2DOrtho ? 1 : 0);
+	impl->tex->pFrameBuffer->flags = (set2DOrtho ? 1 : 0); //also resets contents lost flag
 }
 
 void ZL_Surface::RenderToEnd()
@@ -566,7 +641,7 @@ void ZL_Surface::DrawBox(const scalar* VerticesBox, const scalar* TexCoordBox, c
 {
 	if (!impl) return;
 	if (impl->pBatchRender && impl->pBatchRender->vertices_start) { impl->pBatchRender->Add(VerticesBox, TexCoordBox, &color); return; }
-	glBindTexture(GL_TEXTURE_2D, impl->tex->gltexid);
+	glBindTexture(GL_TEXTURE_2D, impl->tex->Use());
 	ZLGL_ENABLE_TEXTURE();
 	ZLGL_COLOR(color);
 	ZLGL_TEXCOORDPOINTER(2, GL_SCALAR, 0, TexCoordBox);
@@ -577,7 +652,8 @@ void ZL_Surface::DrawBox(const scalar* VerticesBox, const scalar* TexCoordBox, c
 void ZL_Surface::SetPixels(const unsigned char* pixels, int sub_x, int sub_y, int sub_width, int sub_height, int BytesPerPixel)
 {
 	static const GLenum fmts[] = { GL_RGBA, GL_LUMINANCE, GL_LUMINANCE_ALPHA, GL_RGB, GL_RGBA };
-	glBindTexture(GL_TEXTURE_2D, impl->tex->gltexid);
+	glBindTexture(GL_TEXTURE_2D, impl->tex->Use());
+	impl->tex->Pinned = true; //modified contents can't be reloaded from the file, never evict this texture
 	glTexSubImage2D(GL_TEXTURE_2D, 0, sub_x, sub_y, sub_width, sub_height, (BytesPerPixel < 5 ? fmts[BytesPerPixel] : GL_RGBA), GL_UNSIGNED_BYTE, pixels);
 }
 
@@ -590,6 +666,416 @@ unsigned char* ZL_Surface::GetPixelsFromFile(const ZL_FileLink& ImgFile, int* pO
 	return bmp.pixels;
 }
 
+void ZL_Surface::SetMipmapGeneration(MipmapFilter Filter, bool GammaCorrect)
+{
+	ZL_Texture_Impl::SetMipmapGeneration(Filter, GammaCorrect);
+}
+
+bool ZL_Surface::SaveMipmappedKTX(const ZL_FileLink& ImgFile, const char* OutKTXFile, MipmapFilter Filter, bool GammaCorrect)
+{
+	return ZL_Texture_Impl::SaveMipmappedKTX(ImgFile, OutKTXFile, Filter, GammaCorrect);
+}
+
+const char* ZL_Surface::SelectSupportedFile(const char*const* Files, int Count)
+{
+	const char* Fallback = NULL;
+	for (int i = 0; i != Count; i++)
+	{
+		int Support = ZL_Texture_Impl::GetFileFormatSupport(Files[i]);
+		if (Support == 2) return Files[i];
+		if (Support == 1 && !Fallback) Fallback = Files[i];
+	}
+	return Fallback;
+}
+
+struct ZL_TileMap_Impl : ZL_Impl
+{
+	struct AnimQuad { GLsizei Quad; int Anim, Frame; };
+	struct Chunk
+	{
+		std::vector<GLscalar> Vertices, TexCoords; //2 triangles (6 vertices of 2 values) per non-empty tile
+		std::vector<AnimQuad> AnimQuads;
+		bool Dirty;
+		Chunk() : Dirty(true) { }
+	};
+	struct TileAnim
+	{
+		int TileIndex, Frame;
+		ticks_t FrameDuration;
+		GLscalar BaseTexCoords[4];
+		std::vector<int> FrameTiles;
+		std::vector<GLscalar> TexCoordOffsets; //offset from the base tile to the tile of each frame
+	};
+
+	ZL_Texture_Impl *tex;
+	int TilesetCols, TilesetRows, MapWidth, MapHeight, NumLayers, ChunkSize, ChunkCols, ChunkRows;
+	int TexW, TexH, TexWTex, TexHTex; //texture size the chunk texture coordinates were built for
+	scalar TileW, TileH;
+	std::vector<int> Tiles;
+	std::vector<Chunk> Chunks;
+	std::vector<TileAnim> Anims;
+
+	ZL_TileMap_Impl(ZL_Texture_Impl* tex, int TilesetCols, int TilesetRows, int MapWidth, int MapHeight, int NumLayers, int ChunkSize)
+		: tex(tex), TilesetCols(TilesetCols), TilesetRows(TilesetRows), MapWidth(MapWidth), MapHeight(MapHeight), NumLayers(NumLayers), ChunkSize(ChunkSize)
+	{
+		tex->AddRef();
+		TexW = tex->w; TexH = tex->h; TexWTex = tex->wTex; TexHTex = tex->hTex;
+		ChunkCols = (MapWidth + ChunkSize - 1) / ChunkSize;
+		ChunkRows = (MapHeight + ChunkSize - 1) / ChunkSize;
+		TileW = s(tex->w / TilesetCols);
+		TileH = s(tex->h / TilesetRows);
+		Tiles.resize(NumLayers * MapWidth * MapHeight, -1);
+		Chunks.resize(NumLayers * ChunkCols * ChunkRows);
+	}
+
+	~ZL_TileMap_Impl()
+	{
+		tex->DelRef();
+	}
+
+	inline int& GetTile(int x, int y, int Layer) { return Tiles[(Layer * MapHeight + y) * MapWidth + x]; }
+	inline Chunk& GetChunk(int cx, int cy, int Layer) { return Chunks[(Layer * ChunkRows + cy) * ChunkCols + cx]; }
+	inline bool IsValid(int x, int y, int Layer) { return (x >= 0 && y >= 0 && Layer >= 0 && x < MapWidth && y < MapHeight && Layer < NumLayers); }
+	void MarkAllDirty() { for (std::vector<Chunk>::iterator it = Chunks.begin(); it != Chunks.end(); ++it) it->Dirty = true; }
+
+	//A tileset loaded with ZL_Surface::LoadAsync can change its texture size when the image gets uploaded
+	void CheckTextureSize()
+	{
+		if (tex->w == TexW && tex->h == TexH && tex->wTex == TexWTex && tex->hTex == TexHTex) return;
+		TexW = tex->w; TexH = tex->h; TexWTex = tex->wTex; TexHTex = tex->hTex;
+		for (std::vector<TileAnim>::iterator it = Anims.begin(); it != Anims.end(); ++it) CalcAnimOffsets(*it);
+		MarkAllDirty();
+	}
+
+	void CalcAnimOffsets(TileAnim& a)
+	{
+		const int cols = TilesetCols, w = tex->w / cols, h = tex->h / TilesetRows;
+		a.TexCoordOffsets.resize(a.FrameTiles.size() * 2);
+		for (size_t i = 0; i != a.FrameTiles.size(); i++)
+		{
+			a.TexCoordOffsets[i*2+0] =  s(w * (a.FrameTiles[i] % cols - a.TileIndex % cols)) / s(tex->wTex);
+			a.TexCoordOffsets[i*2+1] = -s(h * (a.FrameTiles[i] / cols - a.TileIndex / cols)) / s(tex->hTex);
+		}
+	}
+
+	void GetTileTexCoords(int TileIndex, GLscalar* tcr)
+	{
+		//same inset as ZL_Surface::SetClipping to avoid bleeding in of neighboring tiles
+		const int divisor = (tex->filtermag == GL_NEAREST ? 12 : 2);
+		const int w = tex->w / TilesetCols, h = tex->h / TilesetRows, left = w * (TileIndex % TilesetCols), top = h * (TileIndex / TilesetCols);
+		tcr[0] =        s(left    *divisor+1) / (tex->wTex*divisor);
+		tcr[1] = s(1) - s((top+h) *divisor-1) / (tex->hTex*divisor);
+		tcr[2] =        s((left+w)*divisor-1) / (tex->wTex*divisor);
+		tcr[3] = s(1) - s(top     *divisor+1) / (tex->hTex*divisor);
+	}
+
+	static inline void SetQuad(GLscalar* p, GLscalar x1, GLscalar y1, GLscalar x2, GLscalar y2)
+	{
+		p[0] = p[4] = p[8]  = x1; p[1] = p[3] = p[7]  = y1;
+		p[2] = p[6] = p[10] = x2; p[5] = p[9] = p[11] = y2;
+	}
+
+	void RebuildChunk(Chunk& c, int cx, int cy, int Layer)
+	{
+		c.Vertices.clear();
+		c.TexCoords.clear();
+		c.AnimQuads.clear();
+		int xEnd = ZL_Math::Min((cx+1) * ChunkSize, MapWidth), yEnd = ZL_Math::Min((cy+1) * ChunkSize, MapHeight);
+		for (int y = cy * ChunkSize; y < yEnd; y++)
+			for (int x = cx * ChunkSize; x < xEnd; x++)
+			{
+				int TileIndex = GetTile(x, y, Layer);
+				if (TileIndex < 0) continue;
+				GLscalar tcr[4];
+				GetTileTexCoords(TileIndex, tcr);
+				size_t Quad = c.Vertices.size() / 12;
+				c.Vertices.resize(c.Vertices.size() + 12);
+				c.TexCoords.resize(c.TexCoords.size() + 12);
+				SetQuad(&c.Vertices[Quad*12], TileW * x, TileH * y, TileW * (x+1), TileH * (y+1));
+				SetQuad(&c.TexCoords[Quad*12], tcr[0], tcr[1], tcr[2], tcr[3]);
+				for (size_t a = 0; a != Anims.size(); a++)
+					if (Anims[a].TileIndex == TileIndex) { AnimQuad aq = { (GLsizei)Quad, (int)a, -1 }; c.AnimQuads.push_back(aq); break; }
+			}
+		c.Dirty = false;
+	}
+
+	void UpdateAnimations()
+	{
+		for (std::vector<TileAnim>::iterator it = Anims.begin(); it != Anims.end(); ++it)
+		{
+			it->Frame = (int)((ZLTICKS / it->FrameDuration) % (ticks_t)(it->TexCoordOffsets.size() / 2));
+			GetTileTexCoords(it->TileIndex, it->BaseTexCoords);
+		}
+	}
+
+	void DrawLayer(int Layer, scalar x, scalar y, const ZL_Color &color)
+	{
+		const ZL_Rectf View = ZL_Display::GetVisibleWorldRect() - ZL_Vector(x, y);
+		const scalar ChunkW = TileW * ChunkSize, ChunkH = TileH * ChunkSize;
+		const scalar fx1 = sfloor(View.left / ChunkW), fy1 = sfloor(View.low / ChunkH);
+		if (fx1 >= ChunkCols || fy1 >= ChunkRows) return; //view is entirely right of or above the map
+		int cx1 = (int)ZL_Math::Clamp(fx1, s(0), s(ChunkCols-1)), cx2 = (int)ZL_Math::Clamp(sfloor(View.right / ChunkW), s(-1), s(ChunkCols-1));
+		int cy1 = (int)ZL_Math::Clamp(fy1, s(0), s(ChunkRows-1)), cy2 = (int)ZL_Math::Clamp(sfloor(View.high  / ChunkH), s(-1), s(ChunkRows-1));
+		if (cx1 > cx2 || cy1 > cy2) return;
+
+		glBindTexture(GL_TEXTURE_2D, tex->Use());
+		ZLGL_ENABLE_TEXTURE();
+		ZLGL_COLOR(color);
+		if (x || y) { GLPUSHMATRIX(); GLTRANSLATE(x, y); }
+		for (int cy = cy1; cy <= cy2; cy++)
+			for (int cx = cx1; cx <= cx2; cx++)
+			{
+				Chunk& c = GetChunk(cx, cy, Layer);
+				if (c.Dirty) RebuildChunk(c, cx, cy, Layer);
+				if (c.Vertices.empty()) continue;
+				for (std::vector<AnimQuad>::iterator it = c.AnimQuads.begin(); it != c.AnimQuads.end(); ++it)
+				{
+					const TileAnim& a = Anims[it->Anim];
+					if (it->Frame == a.Frame) continue;
+					const GLscalar *bt = a.BaseTexCoords, *ofs = &a.TexCoordOffsets[a.Frame*2];
+					SetQuad(&c.TexCoords[it->Quad*12], bt[0]+ofs[0], bt[1]+ofs[1], bt[2]+ofs[0], bt[3]+ofs[1]);
+					it->Frame = a.Frame;
+				}
+				ZLGL_VERTEXTPOINTER(2, GL_SCALAR, 0, &c.Vertices[0]);
+				ZLGL_TEXCOORDPOINTER(2, GL_SCALAR, 0, &c.TexCoords[0]);
+				glDrawArraysUnbuffered(GL_TRIANGLES, 0, (GLsizei)(c.Vertices.size() / 2));
+			}
+		if (x || y) GLPOPMATRIX();
+	}
+};
+
+ZL_IMPL_OWNER_DEFAULT_IMPLEMENTATIONS(ZL_TileMap)
+
+ZL_TileMap::ZL_TileMap(const ZL_Surface& Tileset, int ImageNumTileCols, int ImageNumTileRows, int MapWidth, int MapHeight, int NumLayers, int ChunkSize) : impl(NULL)
+{
+	ZL_Surface_Impl* srf = ZL_ImplFromOwner<ZL_Surface_Impl>(Tileset);
+	if (!srf || ImageNumTileCols <= 0 || ImageNumTileRows <= 0 || MapWidth <= 0 || MapHeight <= 0 || NumLayers <= 0 || ChunkSize <= 0) return;
+	impl = new ZL_TileMap_Impl(srf->tex, ImageNumTileCols, ImageNumTileRows, MapWidth, MapHeight, NumLayers, ChunkSize);
+}
+
+int ZL_TileMap::GetMapWidth() const { return (impl ? impl->MapWidth : 0); }
+int ZL_TileMap::GetMapHeight() const { return (impl ? impl->MapHeight : 0); }
+int ZL_TileMap::GetNumLayers() const { return (impl ? impl->NumLayers : 0); }
+ZL_Vector ZL_TileMap::GetTileSize() const { return (impl ? ZL_Vector(impl->TileW, impl->TileH) : ZL_Vector()); }
+ZL_Vector ZL_TileMap::GetSize() const { return (impl ? ZL_Vector(impl->TileW * impl->MapWidth, impl->TileH * impl->MapHeight) : ZL_Vector()); }
+
+ZL_TileMap& ZL_TileMap::SetTileSize(scalar TileWidth, scalar TileHeight)
+{
+	if (!impl || (impl->TileW == TileWidth && impl->TileH == TileHeight)) return *this;
+	impl->TileW = TileWidth;
+	impl->TileH = TileHeight;
+	impl->MarkAllDirty();
+	return *this;
+}
+
+int ZL_TileMap::GetTile(int x, int y, int Layer) const
+{
+	return (impl && impl->IsValid(x, y, Layer) ? impl->GetTile(x, y, Layer) : -1);
+}
+
+ZL_TileMap& ZL_TileMap::SetTile(int x, int y, int TileIndex, int Layer)
+{
+	if (!impl || !impl->IsValid(x, y, Layer)) return *this;
+	int& Tile = impl->GetTile(x, y, Layer);
+	if (TileIndex < 0) TileIndex = -1;
+	if (Tile == TileIndex) return *this;
+	Tile = TileIndex;
+	impl->GetChunk(x / impl->ChunkSize, y / impl->ChunkSize, Layer).Dirty = true;
+	return *this;
+}
+
+ZL_TileMap& ZL_TileMap::SetTiles(const int* TileIndices, int Layer)
+{
+	if (!impl || Layer < 0 || Layer >= impl->NumLayers) return *this;
+	for (int y = impl->MapHeight - 1; y >= 0; y--)
+		for (int x = 0; x < impl->MapWidth; x++, TileIndices++)
+			impl->GetTile(x, y, Layer) = (*TileIndices < 0 ? -1 : *TileIndices);
+	for (int i = 0, n = impl->ChunkCols * impl->ChunkRows; i != n; i++) impl->GetChunk(i % impl->ChunkCols, i / impl->ChunkCols, Layer).Dirty = true;
+	return *this;
+}
+
+ZL_TileMap& ZL_TileMap::Fill(int TileIndex, int Layer)
+{
+	if (!impl || Layer < 0 || Layer >= impl->NumLayers) return *this;
+	std::fill(&impl->GetTile(0, 0, Layer), &impl->GetTile(0, 0, Layer) + impl->MapWidth * impl->MapHeight, (TileIndex < 0 ? -1 : TileIndex));
+	for (int i = 0, n = impl->ChunkCols * impl->ChunkRows; i != n; i++) impl->GetChunk(i % impl->ChunkCols, i / impl->ChunkCols, Layer).Dirty = true;
+	return *this;
+}
+
+ZL_TileMap& ZL_TileMap::SetTileAnimation(int TileIndex, const int* FrameTileIndices, int NumFrames, ticks_t FrameDuration)
+{
+	if (!impl || TileIndex < 0 || NumFrames <= 0) return *this;
+	std::vector<ZL_TileMap_Impl::TileAnim>::iterator it;
+	for (it = impl->Anims.begin(); it != impl->Anims.end(); ++it) if (it->TileIndex == TileIndex) break;
+	if (it == impl->Anims.end()) it = impl->Anims.insert(it, ZL_TileMap_Impl::TileAnim());
+	it->TileIndex = TileIndex;
+	it->Frame = 0;
+	it->FrameDuration = (FrameDuration ? FrameDuration : 1);
+	it->FrameTiles.assign(FrameTileIndices, FrameTileIndices + NumFrames);
+	impl->CalcAnimOffsets(*it);
+	impl->MarkAllDirty();
+	return *this;
+}
+
+ZL_TileMap& ZL_TileMap::ClearTileAnimation(int TileIndex)
+{
+	if (!impl) return *this;
+	for (std::vector<ZL_TileMap_Impl::TileAnim>::iterator it = impl->Anims.begin(); it != impl->Anims.end(); ++it)
+		if (it->TileIndex == TileIndex) { impl->Anims.erase(it); impl->MarkAllDirty(); break; }
+	return *this;
+}
+
+void ZL_TileMap::Draw(scalar x, scalar y, const ZL_Color &color) const
+{
+	if (!impl) return;
+	impl->CheckTextureSize();
+	impl->UpdateAnimations();
+	for (int Layer = 0; Layer != impl->NumLayers; Layer++) impl->DrawLayer(Layer, x, y, color);
+}
+
+void ZL_TileMap::DrawLayer(int Layer, scalar x, scalar y, const ZL_Color &color) const
+{
+	if (!impl || Layer < 0 || Layer >= impl->NumLayers) return;
+	impl->CheckTextureSize();
+	impl->UpdateAnimations();
+	impl->DrawLayer(Layer, x, y, color);
+}
+
+struct ZL_CachedLayer_Impl : ZL_Impl
+{
+	struct Dependency { const void* Data; std::vector<unsigned char> Copy; };
+	ZL_Rectf Area, DirtyArea;
+	scalar ResolutionScale;
+	bool UseAlpha, DirtyFull, DirtyPartial;
+	ZL_Surface Surface;
+	ZL_Signal_v1<const ZL_Rectf&> sigRedraw;
+	std::vector<Dependency> Dependencies;
+
+	ZL_CachedLayer_Impl(const ZL_Rectf& Area, bool UseAlpha, scalar ResolutionScale) : Area(Area), ResolutionScale(ResolutionScale), UseAlpha(UseAlpha), DirtyFull(true), DirtyPartial(false) { }
+
+	void CheckDependencies()
+	{
+		for (std::vector<Dependency>::iterator it = Dependencies.begin(); it != Dependencies.end(); ++it)
+		{
+			if (!memcmp(it->Data, &it->Copy[0], it->Copy.size())) continue;
+			memcpy(&it->Copy[0], it->Data, it->Copy.size());
+			DirtyFull = true;
+		}
+	}
+
+	void Redraw()
+	{
+		if (Area.right <= Area.left || Area.high <= Area.low) return;
+		scalar w = Area.Width() * ResolutionScale, h = Area.Height() * ResolutionScale;
+		if (ResolutionScale <= 0)
+		{
+			ZL_Vector a = ZL_Display::WorldToScreen(Area.left, Area.low), b = ZL_Display::WorldToScreen(Area.right, Area.high);
+			w = sabs(b.x - a.x); h = sabs(b.y - a.y);
+		}
+		int pw = ZL_Math::Max((int)sceil(w), 1), ph = ZL_Math::Max((int)sceil(h), 1);
+		ZL_Texture_Impl* tex = (Surface ? ZL_ImplFromOwner<ZL_Surface_Impl>(Surface)->tex : NULL);
+		if (!tex || tex->wRep != pw || tex->hRep != ph)
+		{
+			Surface = ZL_Surface(pw, ph, UseAlpha);
+			if (!Surface) return;
+			tex = ZL_ImplFromOwner<ZL_Surface_Impl>(Surface)->tex;
+			DirtyFull = true;
+		}
+		if (tex->pFrameBuffer->flags & 2) DirtyFull = true; //contents were lost with the context
+		if (!DirtyFull && !DirtyPartial) return;
+
+		ZL_Rectf RedrawArea = Area;
+		bool UseScissor = (!DirtyFull && !DirtyArea.Contains(Area));
+		if (UseScissor)
+		{
+			if (!DirtyArea.Overlaps(Area)) { DirtyPartial = false; return; }
+			int x1 = (int)sfloor((DirtyArea.left  - Area.left) * pw / Area.Width()),  y1 = (int)sfloor((DirtyArea.low  - Area.low) * ph / Area.Height());
+			int x2 = (int)sceil( (DirtyArea.right - Area.left) * pw / Area.Width()),  y2 = (int)sceil( (DirtyArea.high - Area.low) * ph / Area.Height());
+			x1 = ZL_Math::Max(x1, 0); y1 = ZL_Math::Max(y1, 0); x2 = ZL_Math::Min(x2, pw); y2 = ZL_Math::Min(y2, ph);
+			RedrawArea = ZL_Rectf(Area.left + x1 * Area.Width() / pw, Area.low + y1 * Area.Height() / ph, Area.left + x2 * Area.Width() / pw, Area.low + y2 * Area.Height() / ph);
+			Surface.RenderToBegin(false, false);
+			glScissor(x1, y1, x2 - x1, y2 - y1);
+			glEnable(GL_SCISSOR_TEST);
+		}
+		else Surface.RenderToBegin(false, false);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		ZL_Display::PushOrtho(Area.left, Area.right, Area.low, Area.high);
+		sigRedraw.call(RedrawArea);
+		ZL_Display::PopOrtho();
+		if (UseScissor) glDisable(GL_SCISSOR_TEST);
+		Surface.RenderToEnd();
+		DirtyFull = DirtyPartial = false;
+	}
+};
+
+ZL_IMPL_OWNER_DEFAULT_IMPLEMENTATIONS(ZL_CachedLayer)
+
+ZL_CachedLayer::ZL_CachedLayer(const ZL_Rectf& area, bool use_alpha, scalar resolution_scale) : impl(new ZL_CachedLayer_Impl(area, use_alpha, resolution_scale)) { }
+
+ZL_Signal_v1<const ZL_Rectf&>& ZL_CachedLayer::sigRedraw()
+{
+	static ZL_Signal_v1<const ZL_Rectf&> sigNeverCalled; //for empty layer handles
+	return (impl ? impl->sigRedraw : sigNeverCalled);
+}
+
+ZL_Rectf ZL_CachedLayer::GetArea() const { return (impl ? impl->Area : ZL_Rectf()); }
+bool ZL_CachedLayer::IsInvalidated() const { return (impl && (impl->DirtyFull || impl->DirtyPartial)); }
+ZL_Surface ZL_CachedLayer::GetSurface() const { return (impl ? impl->Surface : ZL_Surface()); }
+
+ZL_CachedLayer& ZL_CachedLayer::SetArea(const ZL_Rectf& area)
+{
+	if (!impl || impl->Area == area) return *this;
+	impl->Area = area;
+	impl->DirtyFull = true;
+	return *this;
+}
+
+ZL_CachedLayer& ZL_CachedLayer::Invalidate()
+{
+	if (impl) impl->DirtyFull = true;
+	return *this;
+}
+
+ZL_CachedLayer& ZL_CachedLayer::Invalidate(const ZL_Rectf& dirty_area)
+{
+	if (!impl || impl->DirtyFull) return *this;
+	if (!impl->DirtyPartial) { impl->DirtyArea = dirty_area; impl->DirtyPartial = true; }
+	else { impl->DirtyArea.Expand(dirty_area.LowLeft()); impl->DirtyArea.Expand(dirty_area.HighRight()); }
+	return *this;
+}
+
+ZL_CachedLayer& ZL_CachedLayer::TrackDependency(const void* data, size_t size)
+{
+	if (!impl || !data || !size) return *this;
+	UntrackDependency(data);
+	impl->Dependencies.push_back(ZL_CachedLayer_Impl::Dependency());
+	impl->Dependencies.back().Data = data;
+	impl->Dependencies.back().Copy.assign((const unsigned char*)data, (const unsigned char*)data + size);
+	return *this;
+}
+
+ZL_CachedLayer& ZL_CachedLayer::UntrackDependency(const void* data)
+{
+	if (!impl) return *this;
+	for (std::vector<ZL_CachedLayer_Impl::Dependency>::iterator it = impl->Dependencies.begin(); it != impl->Dependencies.end(); ++it)
+		if (it->Data == data) { impl->Dependencies.erase(it); break; }
+	return *this;
+}
+
+void ZL_CachedLayer::Draw() const
+{
+	Draw(ZL_Color::White);
+}
+
+void ZL_CachedLayer::Draw(const ZL_Color &color) const
+{
+	if (!impl) return;
+	impl->CheckDependencies();
+	impl->Redraw();
+	if (impl->Surface) impl->Surface.DrawTo(impl->Area, color);
+}
+
 unsigned ZL_Surface_GetGLFrameBuffer(ZL_Surface* srf)
 {
 	return (*((ZL_Surface_Impl**)srf))->tex->pFrameBuffer->glFB;
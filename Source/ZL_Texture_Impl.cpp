@@ -21,8 +21,22 @@
 
 #include "ZL_Texture_Impl.h"
 #include <map>
+#include <algorithm>
 #include <assert.h>
 #include "stb/stb_image.h"
+#include "ZL_Surface.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ZL_TEXTURE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ZL_TEXTURE_NEON
+#endif
+#ifndef GL_NEAREST_MIPMAP_NEAREST
+#define GL_NEAREST_MIPMAP_NEAREST 0x2700
+#define GL_LINEAR_MIPMAP_LINEAR   0x2703
+#endif
 
 static int  zlrwops_read(void *user, char *data, int size) { return (int)ZL_RWread((ZL_RWops*)user, data, 1, size); }
 static void zlrwops_skip(void *user, int n) { ZL_RWseektell((ZL_RWops*)user, n, RW_SEEK_CUR); }
@@ -32,6 +46,22 @@ static const stbi_io_callbacks stbi_zlrwops_callbacks = { zlrwops_read, zlrwops_
 static std::map<ZL_FileLink, ZL_Texture_Impl*>* pLoadedTextures = NULL;
 static ZL_TextureFrameBuffer *pActiveFrameBuffer = NULL;
 
+//Texture memory budget, textures loaded from files that are unused for a while get evicted (least recently used first) when resident bytes exceed the budget
+static size_t TextureResidentBytes = 0, TextureBudgetMaxBytes = 0;
+static unsigned int TextureBudgetMinUnusedFrames = 60, TextureEvictions = 0, TextureReloads = 0;
+static bool TextureBudgetAsyncReload = false;
+
+static void SetTextureBytes(ZL_Texture_Impl* t, size_t bytes)
+{
+	TextureResidentBytes += bytes - t->GPUBytes;
+	t->GPUBytes = bytes;
+}
+
+static int GetFormatBytesPerPixel(GLenum format)
+{
+	return (format == GL_RGBA ? 4 : (format == GL_RGB ? 3 : (format == GL_LUMINANCE_ALPHA ? 2 : 1)));
+}
+
 #ifdef ZL_VIDEO_WEAKCONTEXT
 static std::vector<ZL_Texture_Impl*> *pLoadedFrameBufferTextures = NULL;
 #endif
@@ -66,29 +96,698 @@ static bool OGL_ProbeTexture(GLint w, GLint h, GLint maxSize, GLint, GLenum)
 #define OGL_ProbeTexture(a,b,c,d,e) true
 #endif
 
+static void FlipBitmapRows(ZL_BitmapSurface* surface)
+{
+	size_t pitch = surface->w * surface->BytesPerPixel;
+	unsigned char StackTempRow[1024], *TempRow = (pitch > 1024 ? (unsigned char*)malloc(pitch) : StackTempRow);
+	for (unsigned char *rowTop = surface->pixels, *rowTopEnd = rowTop + (surface->h/2)*pitch, *rowBottom = rowTop + (surface->h-1)*pitch; rowTop != rowTopEnd; rowTop += pitch, rowBottom -= pitch)
+	{
+		memcpy(TempRow, rowTop, pitch);
+		memcpy(rowTop, rowBottom, pitch);
+		memcpy(rowBottom, TempRow, pitch);
+	}
+	if (pitch > 1024) free(TempRow);
+}
+
+//Mipmap chains generated on the CPU with alpha weighted filtering (color channels are premultiplied while filtering), optionally in linear color space
+static int MipmapGenFilter = ZL_Surface::MIPMAP_NONE;
+static bool MipmapGenGammaCorrect = false;
+static unsigned int MipmapReciprocal[256];
+static float MipmapKaiserWeights[8], MipmapSRGBToLinear[256];
+static unsigned char MipmapLinearToSRGB[4096];
+
+static float MipmapKaiserBessel0(float x)
+{
+	float sum = 1, term = 1;
+	for (int k = 1; k != 20; k++) { term *= (x * 0.5f / k) * (x * 0.5f / k); sum += term; }
+	return sum;
+}
+
+//Fill the lookup tables on the main thread before any loader thread can use them
+static void MipmapInitTables()
+{
+	if (MipmapReciprocal[1]) return;
+	for (unsigned int a = 1; a != 256; a++) MipmapReciprocal[a] = (255 * 65536 + a / 2) / a;
+	float sum = 0, weights[8];
+	for (int k = 0; k != 8; k++)
+	{
+		//Kaiser window (alpha 4) over 8 source pixels applied to a sinc with half the sampling rate
+		float d = k - 3.5f, x = d * 0.5f * PI, t = d / 4.0f;
+		weights[k] = (ssin(x) / x) * MipmapKaiserBessel0(4.0f * ssqrt(1.0f - t * t)) / MipmapKaiserBessel0(4.0f);
+		sum += weights[k];
+	}
+	for (int k = 0; k != 8; k++) MipmapKaiserWeights[k] = weights[k] / sum;
+	for (int i = 0; i != 256; i++) { float c = i / 255.0f; MipmapSRGBToLinear[i] = (c <= 0.04045f ? c / 12.92f : spow((c + 0.055f) / 1.055f, 2.4f)); }
+	for (int i = 0; i != 4096; i++) { float c = i / 4095.0f; MipmapLinearToSRGB[i] = (unsigned char)(255.0f * (c <= 0.0031308f ? c * 12.92f : 1.055f * spow(c, 1.0f / 2.4f) - 0.055f) + 0.5f); }
+}
+
+static bool CanHaveMipmaps(int w, int h)
+{
+	#if defined(ZL_VIDEO_DIRECT3D)
+	(void)w; (void)h;
+	return false;
+	#elif defined(ZL_VIDEO_OPENGL_ES1) || defined(ZL_VIDEO_OPENGL_ES2)
+	return (w > 1 || h > 1) && OGL_IsPOT(w) && OGL_IsPOT(h); //GLES only supports mipmaps on power of two textures
+	#else
+	return (w > 1 || h > 1);
+	#endif
+}
+
+static GLint MinFilterWithMipmaps(GLint filtermin, int mipLevels)
+{
+	if (!mipLevels) return filtermin;
+	return (filtermin == GL_NEAREST ? GL_NEAREST_MIPMAP_NEAREST : (filtermin == GL_LINEAR ? GL_LINEAR_MIPMAP_LINEAR : filtermin));
+}
+
+static void MipmapPremultiply(const unsigned char* src, unsigned char* dst, size_t numpixels)
+{
+	size_t i = 0;
+	#if defined(ZL_TEXTURE_SSE2)
+	const __m128i zero = _mm_setzero_si128(), rgbmask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1), alpha255 = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0), round = _mm_set1_epi16(128);
+	for (; i + 4 <= numpixels; i += 4)
+	{
+		__m128i px = _mm_loadu_si128((const __m128i*)(src + i*4)), res[2];
+		for (int h = 0; h != 2; h++)
+		{
+			__m128i c = (h ? _mm_unpackhi_epi8(px, zero) : _mm_unpacklo_epi8(px, zero));
+			__m128i a = _mm_or_si128(_mm_and_si128(_mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0xFF), 0xFF), rgbmask), alpha255);
+			__m128i t = _mm_add_epi16(_mm_mullo_epi16(c, a), round);
+			res[h] = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+		}
+		_mm_storeu_si128((__m128i*)(dst + i*4), _mm_packus_epi16(res[0], res[1]));
+	}
+	#elif defined(ZL_TEXTURE_NEON)
+	for (; i + 16 <= numpixels; i += 16)
+	{
+		uint8x16x4_t px = vld4q_u8(src + i*4);
+		for (int c = 0; c != 3; c++)
+		{
+			uint16x8_t lo = vaddq_u16(vmull_u8(vget_low_u8(px.val[c]), vget_low_u8(px.val[3])), vdupq_n_u16(128));
+			uint16x8_t hi = vaddq_u16(vmull_u8(vget_high_u8(px.val[c]), vget_high_u8(px.val[3])), vdupq_n_u16(128));
+			px.val[c] = vcombine_u8(vshrn_n_u16(vsraq_n_u16(lo, lo, 8), 8), vshrn_n_u16(vsraq_n_u16(hi, hi, 8), 8));
+		}
+		vst4q_u8(dst + i*4, px);
+	}
+	#endif
+	for (; i != numpixels; i++)
+	{
+		const unsigned char* s = src + i*4; unsigned char* d = dst + i*4;
+		for (int c = 0; c != 3; c++) { unsigned int t = s[c] * s[3] + 128; d[c] = (unsigned char)((t + (t >> 8)) >> 8); }
+		d[3] = s[3];
+	}
+}
+
+//Halves a 4 bytes per pixel image with a 2x2 box filter (for odd sizes the last row/column is skipped)
+static void MipmapBoxHalve(const unsigned char* src, int sw, int sh, unsigned char* dst, int dw, int dh)
+{
+	for (int y = 0; y != dh; y++)
+	{
+		const unsigned char *r0 = src + (size_t)(y*2) * sw * 4, *r1 = (sh > 1 ? r0 + sw * 4 : r0);
+		unsigned char* d = dst + (size_t)y * dw * 4;
+		int x = 0;
+		if (sw > 1)
+		{
+			#if defined(ZL_TEXTURE_SSE2)
+			const __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+			for (; x + 4 <= dw; x += 4)
+			{
+				__m128i out[2];
+				for (int h = 0; h != 2; h++)
+				{
+					__m128i a = _mm_loadu_si128((const __m128i*)(r0 + (x*2+h*4)*4)), b = _mm_loadu_si128((const __m128i*)(r1 + (x*2+h*4)*4));
+					__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)), s1 = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+					s0 = _mm_add_epi16(s0, _mm_srli_si128(s0, 8));
+					s1 = _mm_add_epi16(s1, _mm_srli_si128(s1, 8));
+					out[h] = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(s0, s1), two), 2);
+				}
+				_mm_storeu_si128((__m128i*)(d + x*4), _mm_packus_epi16(out[0], out[1]));
+			}
+			#elif defined(ZL_TEXTURE_NEON)
+			for (; x + 8 <= dw; x += 8)
+			{
+				uint8x16x4_t a = vld4q_u8(r0 + x*8), b = vld4q_u8(r1 + x*8);
+				uint8x8x4_t out;
+				for (int c = 0; c != 4; c++) out.val[c] = vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(a.val[c]), b.val[c]), 2);
+				vst4_u8(d + x*4, out);
+			}
+			#endif
+		}
+		for (; x != dw; x++)
+		{
+			const unsigned char *a = r0 + x*8, *b = r1 + x*8;
+			int next = (sw > 1 ? 4 : 0);
+			for (int c = 0; c != 4; c++) d[x*4+c] = (unsigned char)((a[c] + a[next+c] + b[c] + b[next+c] + 2) >> 2);
+		}
+	}
+}
+
+static void MipmapUnpremultiply(const unsigned char* src, unsigned char* dst, size_t numpixels)
+{
+	for (const unsigned char* srcEnd = src + numpixels * 4; src != srcEnd; src += 4, dst += 4)
+	{
+		unsigned int r = MipmapReciprocal[src[3]];
+		for (int c = 0; c != 3; c++) { unsigned int v = (src[c] * r + 32768) >> 16; dst[c] = (unsigned char)(v > 255 ? 255 : v); }
+		dst[3] = src[3];
+	}
+}
+
+//Halves an image (each channel a float) in one direction with a box or Kaiser windowed sinc filter
+//stride is the distance between pixels along the filtered direction, srcline/dstline the distance between the count lines being filtered
+static void MipmapFloatHalve(const float* src, int slen, float* dst, int dlen, int count, size_t stride, size_t srcline, size_t dstline, int nch, bool kaiser)
+{
+	static const float BoxWeights[2] = { 0.5f, 0.5f };
+	const float* weights = (kaiser ? MipmapKaiserWeights : BoxWeights);
+	int taps = (kaiser ? 8 : 2), first = (kaiser ? -3 : 0);
+	for (int n = 0; n != count; n++)
+	{
+		const float* s = src + n * srcline;
+		float* d = dst + n * dstline;
+		for (int i = 0; i != dlen; i++)
+		{
+			float* out = d + i * stride;
+			for (int c = 0; c != nch; c++) out[c] = 0;
+			if (slen == 1) { for (int c = 0; c != nch; c++) out[c] = s[c]; continue; }
+			for (int k = 0; k != taps; k++)
+			{
+				int si = i*2 + first + k;
+				const float* in = s + (si < 0 ? 0 : (si >= slen ? slen - 1 : si)) * stride;
+				for (int c = 0; c != nch; c++) out[c] += in[c] * weights[k];
+			}
+		}
+	}
+}
+
+//Returns a malloc'd buffer with all mipmap levels after the base level (packed without row alignment) and the number of these levels
+static unsigned char* GenerateMipChain(const unsigned char* pixels, int w, int h, int bpp, int filter, bool GammaCorrect, int* out_levels)
+{
+	int levels = 0;
+	size_t total = 0;
+	for (int lw = w, lh = h; lw > 1 || lh > 1; levels++) { lw = ZL_Math::Max(lw >> 1, 1); lh = ZL_Math::Max(lh >> 1, 1); total += (size_t)lw * lh * bpp; }
+	*out_levels = levels;
+	if (!levels || filter == ZL_Surface::MIPMAP_NONE) { *out_levels = 0; return NULL; }
+	unsigned char* chain = (unsigned char*)malloc(total);
+
+	if (filter == ZL_Surface::MIPMAP_BOX && !GammaCorrect && bpp == 4)
+	{
+		//Fast path with SIMD kernels working on 8-bit premultiplied colors
+		unsigned char *premul = (unsigned char*)malloc((size_t)w * h * 4), *half = (unsigned char*)malloc((size_t)ZL_Math::Max(w >> 1, 1) * ZL_Math::Max(h >> 1, 1) * 4), *out = chain;
+		MipmapPremultiply(pixels, premul, (size_t)w * h);
+		for (int lw = w, lh = h; lw > 1 || lh > 1;)
+		{
+			int dw = ZL_Math::Max(lw >> 1, 1), dh = ZL_Math::Max(lh >> 1, 1);
+			MipmapBoxHalve(premul, lw, lh, half, dw, dh);
+			MipmapUnpremultiply(half, out, (size_t)dw * dh);
+			out += (size_t)dw * dh * 4;
+			unsigned char* tmp = premul; premul = half; half = tmp;
+			lw = dw; lh = dh;
+		}
+		free(premul);
+		free(half);
+		return chain;
+	}
+
+	//Generic path working on float channels, needed for the Kaiser filter and for filtering in linear color space
+	int ach = ((bpp == 2 || bpp == 4) ? bpp - 1 : -1), colors = (ach < 0 ? bpp : bpp - 1);
+	float *img = (float*)malloc((size_t)w * h * bpp * sizeof(float)), *tmp = (float*)malloc((size_t)ZL_Math::Max(w >> 1, 1) * h * bpp * sizeof(float));
+	for (size_t i = 0, iEnd = (size_t)w * h; i != iEnd; i++)
+	{
+		const unsigned char* p = pixels + i * bpp;
+		float* f = img + i * bpp, a = (ach < 0 ? 1.0f : p[ach] / 255.0f);
+		for (int c = 0; c != colors; c++) f[c] = (GammaCorrect ? MipmapSRGBToLinear[p[c]] : p[c] / 255.0f) * a;
+		if (ach >= 0) f[ach] = a;
+	}
+	unsigned char* out = chain;
+	bool kaiser = (filter == ZL_Surface::MIPMAP_KAISER);
+	for (int lw = w, lh = h; lw > 1 || lh > 1;)
+	{
+		int dw = ZL_Math::Max(lw >> 1, 1), dh = ZL_Math::Max(lh >> 1, 1);
+		MipmapFloatHalve(img, lw, tmp, dw, lh, bpp, (size_t)lw * bpp, (size_t)dw * bpp, bpp, kaiser); //horizontal pass
+		MipmapFloatHalve(tmp, lh, img, dh, dw, (size_t)dw * bpp, bpp, bpp, bpp, kaiser); //vertical pass
+		for (size_t i = 0, iEnd = (size_t)dw * dh; i != iEnd; i++, out += bpp)
+		{
+			const float* f = img + i * bpp;
+			float a = (ach < 0 ? 1.0f : f[ach]);
+			for (int c = 0; c != colors; c++)
+			{
+				float v = (a > 0 ? f[c] / a : 0);
+				v = (v < 0 ? 0 : (v > 1 ? 1 : v));
+				out[c] = (GammaCorrect ? MipmapLinearToSRGB[(int)(v * 4095.0f + 0.5f)] : (unsigned char)(v * 255.0f + 0.5f));
+			}
+			if (ach >= 0) out[ach] = (unsigned char)((a < 0 ? 0 : (a > 1 ? 1 : a)) * 255.0f + 0.5f);
+		}
+		lw = dw; lh = dh;
+	}
+	free(img);
+	free(tmp);
+	return chain;
+}
+
+//KTX and KTX2 containers with GPU compressed texture data, uploaded as is when the GPU supports the format and otherwise decoded to RGBA in software
+#ifndef GL_NUM_COMPRESSED_TEXTURE_FORMATS
+#define GL_NUM_COMPRESSED_TEXTURE_FORMATS 0x86A2
+#define GL_COMPRESSED_TEXTURE_FORMATS     0x86A3
+#endif
+enum eKTXCodec { KTX_UNSUPPORTED, KTX_RGBA8, KTX_ETC1, KTX_ETC2_RGB, KTX_ETC2_RGBA, KTX_BC1, KTX_BC1A, KTX_BC2, KTX_BC3, KTX_ASTC };
+struct ZL_KTXFormat { GLenum glInternalFormat, glUploadFormat; unsigned int vkFormat; eKTXCodec Codec; unsigned char BlockW, BlockH, BlockBytes; };
+static const ZL_KTXFormat KTXFormats[] = {
+	{ 0x8058, 0x1908,  37, KTX_RGBA8,     1, 1,  4 }, //RGBA8 (uncompressed, i.e. with a mipmap chain from ZL_Surface::SaveMipmappedKTX)
+	{ 0x8C43, 0x1908,  43, KTX_RGBA8,     1, 1,  4 }, //SRGB8_ALPHA8
+	{ 0x1908, 0x1908,   0, KTX_RGBA8,     1, 1,  4 }, //RGBA
+	{ 0x8D64, 0x8D64,   0, KTX_ETC1,      4, 4,  8 }, //ETC1_RGB8_OES
+	{ 0x9274, 0x9274, 147, KTX_ETC2_RGB,  4, 4,  8 }, //COMPRESSED_RGB8_ETC2
+	{ 0x9275, 0x9274, 148, KTX_ETC2_RGB,  4, 4,  8 }, //COMPRESSED_SRGB8_ETC2
+	{ 0x9278, 0x9278, 151, KTX_ETC2_RGBA, 4, 4, 16 }, //COMPRESSED_RGBA8_ETC2_EAC
+	{ 0x9279, 0x9278, 152, KTX_ETC2_RGBA, 4, 4, 16 }, //COMPRESSED_SRGB8_ALPHA8_ETC2_EAC
+	{ 0x83F0, 0x83F0, 131, KTX_BC1,       4, 4,  8 }, //COMPRESSED_RGB_S3TC_DXT1
+	{ 0x8C4C, 0x83F0, 132, KTX_BC1,       4, 4,  8 }, //COMPRESSED_SRGB_S3TC_DXT1
+	{ 0x83F1, 0x83F1, 133, KTX_BC1A,      4, 4,  8 }, //COMPRESSED_RGBA_S3TC_DXT1
+	{ 0x8C4D, 0x83F1, 134, KTX_BC1A,      4, 4,  8 }, //COMPRESSED_SRGB_ALPHA_S3TC_DXT1
+	{ 0x83F2, 0x83F2, 135, KTX_BC2,       4, 4, 16 }, //COMPRESSED_RGBA_S3TC_DXT3
+	{ 0x8C4E, 0x83F2, 136, KTX_BC2,       4, 4, 16 }, //COMPRESSED_SRGB_ALPHA_S3TC_DXT3
+	{ 0x83F3, 0x83F3, 137, KTX_BC3,       4, 4, 16 }, //COMPRESSED_RGBA_S3TC_DXT5
+	{ 0x8C4F, 0x83F3, 138, KTX_BC3,       4, 4, 16 }, //COMPRESSED_SRGB_ALPHA_S3TC_DXT5
+};
+static const unsigned char KTXASTCBlockSizes[14][2] = { {4,4},{5,4},{5,5},{6,5},{6,6},{8,5},{8,6},{8,8},{10,5},{10,6},{10,8},{10,10},{12,10},{12,12} };
+
+struct ZL_KTXImage
+{
+	ZL_KTXFormat Format;
+	int w, h, Levels;
+	bool BottomUp; //true if the first row is the bottom row like OpenGL expects it (KTXorientation 'ru')
+	const unsigned char* LevelData[16];
+	size_t LevelSize[16];
+};
+
+static bool IsKTXIdentifier(const unsigned char* id)
+{
+	static const unsigned char KTX1[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+	return (!memcmp(id, KTX1, 4) && (!memcmp(id+4, KTX1+4, 2) || !memcmp(id+4, "20", 2)) && !memcmp(id+6, KTX1+6, 6));
+}
+
+static unsigned int KTXRead32(const unsigned char* p, bool BigEndian = false)
+{
+	return (BigEndian ? ((unsigned int)p[0]<<24)|(p[1]<<16)|(p[2]<<8)|p[3] : ((unsigned int)p[3]<<24)|(p[2]<<16)|(p[1]<<8)|p[0]);
+}
+
+static bool GetKTXFormat(ZL_KTXFormat* out, const unsigned char* data, size_t size)
+{
+	if (size < 48 || !IsKTXIdentifier(data)) return false;
+	bool IsKTX2 = (data[5] == '2'), BigEndian = (!IsKTX2 && KTXRead32(data+12) == 0x01020304);
+	unsigned int vkFormat = (IsKTX2 ? KTXRead32(data+12) : 0), glInternalFormat = (IsKTX2 ? 0 : KTXRead32(data+28, BigEndian));
+	for (const ZL_KTXFormat *f = KTXFormats, *fEnd = f + COUNT_OF(KTXFormats); f != fEnd; f++)
+		if (IsKTX2 ? (f->vkFormat && f->vkFormat == vkFormat) : f->glInternalFormat == glInternalFormat)
+		{
+			*out = *f;
+			if (f->Codec == KTX_RGBA8 && !IsKTX2 && KTXRead32(data+16, BigEndian) != 0x1401) break; //uncompressed only with GL_UNSIGNED_BYTE
+			return true;
+		}
+	for (unsigned int i = 0; i != 14; i++)
+	{
+		//ASTC formats are ordered the same way in GL (RGBA at 0x93B0, SRGB at 0x93D0) and Vulkan (alternating UNORM and SRGB from 157)
+		if (IsKTX2 ? (vkFormat != 157+i*2 && vkFormat != 158+i*2) : (glInternalFormat != 0x93B0+i && glInternalFormat != 0x93D0+i)) continue;
+		ZL_KTXFormat astc = { 0x93B0+i, 0x93B0+i, 157+i*2, KTX_ASTC, KTXASTCBlockSizes[i][0], KTXASTCBlockSizes[i][1], 16 };
+		*out = astc;
+		return true;
+	}
+	out->Codec = KTX_UNSUPPORTED;
+	out->glInternalFormat = (IsKTX2 ? vkFormat : glInternalFormat);
+	return true;
+}
+
+static bool ParseKTX(ZL_KTXImage* ktx, const unsigned char* data, size_t size, const char* filename)
+{
+	if (!GetKTXFormat(&ktx->Format, data, size) || size < (data[5] == '2' ? 80u : 64u)) { ZL_LOG1("TEXTURE", "Cannot load image file: %s (invalid KTX header)", filename); return false; }
+	if (ktx->Format.Codec == KTX_UNSUPPORTED) { ZL_LOG2("TEXTURE", "Cannot load image file: %s (unsupported KTX texture format 0x%x)", filename, ktx->Format.glInternalFormat); return false; }
+	bool IsKTX2 = (data[5] == '2'), BigEndian = (!IsKTX2 && KTXRead32(data+12) == 0x01020304);
+	const unsigned char *kv, *kvEnd, *end = data + size;
+	if (IsKTX2)
+	{
+		ktx->w = KTXRead32(data+20), ktx->h = KTXRead32(data+24), ktx->Levels = KTXRead32(data+40);
+		if (KTXRead32(data+28) > 1 || KTXRead32(data+32) > 1 || KTXRead32(data+36) != 1) { ZL_LOG1("TEXTURE", "Cannot load image file: %s (only plain 2D KTX2 textures are supported)", filename); return false; }
+		if (KTXRead32(data+44)) { ZL_LOG1("TEXTURE", "Cannot load image file: %s (supercompressed KTX2 textures are not supported)", filename); return false; }
+		if (ktx->Levels < 1) ktx->Levels = 1;
+		if (ktx->Levels > 16 || (size_t)(80 + ktx->Levels * 24) > size) { ZL_LOG1("TEXTURE", "Cannot load image file: %s (invalid KTX2 level index)", filename); return false; }
+		for (int i = 0; i != ktx->Levels; i++)
+		{
+			const unsigned char* lvl = data + 80 + i * 24;
+			size_t ofs = KTXRead32(lvl), len = KTXRead32(lvl+8);
+			if (KTXRead32(lvl+4) || KTXRead32(lvl+12) || ofs > size || len > size - ofs) { ZL_LOG1("TEXTURE", "Cannot load image file: %s (truncated KTX2 file)", filename); return false; }
+			ktx->LevelData[i] = data + ofs;
+			ktx->LevelSize[i] = len;
+		}
+		size_t kvOfs = KTXRead32(data+56), kvLen = KTXRead32(data+60);
+		if (kvOfs > size || kvLen > size - kvOfs) kvOfs = kvLen = 0;
+		kv = data + kvOfs, kvEnd = kv + kvLen;
+	}
+	else
+	{
+		if (!BigEndian && KTXRead32(data+12) != 0x04030201) { ZL_LOG1("TEXTURE", "Cannot load image file: %s (invalid KTX endianness)", filename); return false; }
+		ktx->w = KTXRead32(data+36, BigEndian), ktx->h = KTXRead32(data+40, BigEndian), ktx->Levels = KTXRead32(data+56, BigEndian);
+		if (KTXRead32(data+44, BigEndian) > 1 || KTXRead32(data+48, BigEndian) > 1 || KTXRead32(data+52, BigEndian) != 1) { ZL_LOG1("TEXTURE", "Cannot load image file: %s (only plain 2D KTX textures are supported)", filename); return false; }
+		if (ktx->Levels < 1) ktx->Levels = 1;
+		if (ktx->Levels > 16) ktx->Levels = 16;
+		size_t kvLen = KTXRead32(data+60, BigEndian);
+		if (kvLen > size - 64) { ZL_LOG1("TEXTURE", "Cannot load image file: %s (truncated KTX file)", filename); return false; }
+		kv = data + 64, kvEnd = kv + kvLen;
+		const unsigned char* p = kvEnd;
+		for (int i = 0; i != ktx->Levels; i++)
+		{
+			size_t len = 0;
+			if (end - p < 4 || (len = KTXRead32(p, BigEndian)) > (size_t)(end - p - 4)) { ZL_LOG1("TEXTURE", "Cannot load image file: %s (truncated KTX file)", filename); return false; }
+			ktx->LevelData[i] = p + 4;
+			ktx->LevelSize[i] = len;
+			p += 4 + ((len + 3) & ~3);
+		}
+	}
+	if (ktx->w < 1 || ktx->h < 1) { ZL_LOG1("TEXTURE", "Cannot load image file: %s (invalid KTX image size)", filename); return false; }
+
+	ktx->BottomUp = false;
+	for (size_t kvSize; kv + 4 <= kvEnd; kv += 4 + ((kvSize + 3) & ~3))
+	{
+		kvSize = KTXRead32(kv, BigEndian);
+		if (kvSize > (size_t)(kvEnd - kv - 4)) break;
+		if (kvSize > 15 && !memcmp(kv + 4, "KTXorientation", 15)) ktx->BottomUp = (memchr(kv + 4 + 15, 'u', kvSize - 15) != NULL); //'ru' in KTX2 or 'S=r,T=u' in KTX1
+	}
+
+	for (int i = 0; i != ktx->Levels; i++)
+	{
+		int lw = ZL_Math::Max(ktx->w >> i, 1), lh = ZL_Math::Max(ktx->h >> i, 1);
+		size_t need = (size_t)((lw + ktx->Format.BlockW - 1) / ktx->Format.BlockW) * ((lh + ktx->Format.BlockH - 1) / ktx->Format.BlockH) * ktx->Format.BlockBytes;
+		if (ktx->LevelSize[i] < need) { if (i) { ktx->Levels = i; break; } ZL_LOG1("TEXTURE", "Cannot load image file: %s (KTX image data too small)", filename); return false; }
+	}
+	return true;
+}
+
+static bool ReadKTXFile(ZL_File_Impl* fileimpl, std::vector<unsigned char>& out)
+{
+	unsigned char id[12];
+	size_t n = ZL_RWread(fileimpl->src, id, 1, 12);
+	if (n != 12 || !IsKTXIdentifier(id)) { ZL_RWseektell(fileimpl->src, -(ptrdiff_t)n, RW_SEEK_CUR); return false; }
+	size_t size = ZL_RWsize(fileimpl->src);
+	if (size < 12) size = 12;
+	out.resize(size);
+	memcpy(&out[0], id, 12);
+	out.resize(12 + ZL_RWread(fileimpl->src, &out[12], 1, size - 12));
+	return true;
+}
+
+static unsigned char KTXClamp(int v) { return (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v)); }
+
+//Decodes an ETC1 or ETC2 RGB block into 4x4 RGBA pixels (row by row)
+static void DecodeETCBlock(const unsigned char* b, unsigned char* out, bool etc2)
+{
+	static const int Modifiers[8][2] = { {2,8},{5,17},{9,29},{13,42},{18,60},{24,80},{33,106},{47,183} };
+	static const int Distances[8] = { 3,6,11,16,23,32,41,64 };
+	unsigned int hi = KTXRead32(b, true), lo = KTXRead32(b+4, true);
+	#define ETC_BITS(v, from, count) (int)(((v) >> (from)) & ((1u << (count)) - 1))
+	int c[4][3], x, y, i, k;
+	if (hi & 2)
+	{
+		int r = ETC_BITS(hi,27,5), g = ETC_BITS(hi,19,5), bl = ETC_BITS(hi,11,5);
+		int r2 = r + ((ETC_BITS(hi,24,3) ^ 4) - 4), g2 = g + ((ETC_BITS(hi,16,3) ^ 4) - 4), b2 = bl + ((ETC_BITS(hi,8,3) ^ 4) - 4);
+		if (etc2 && (r2 < 0 || r2 > 31 || g2 < 0 || g2 > 31))
+		{
+			int d, c1[3], c2[3];
+			if (r2 < 0 || r2 > 31)
+			{
+				//T mode
+				c1[0] = ((ETC_BITS(hi,27,2) << 2) | ETC_BITS(hi,24,2)) * 17, c1[1] = ETC_BITS(hi,20,4) * 17, c1[2] = ETC_BITS(hi,16,4) * 17;
+				c2[0] = ETC_BITS(hi,12,4) * 17, c2[1] = ETC_BITS(hi,8,4) * 17, c2[2] = ETC_BITS(hi,4,4) * 17;
+				d = Distances[(ETC_BITS(hi,2,2) << 1) | ETC_BITS(hi,0,1)];
+				for (k = 0; k != 3; k++) { c[0][k] = c1[k]; c[1][k] = c2[k] + d; c[2][k] = c2[k]; c[3][k] = c2[k] - d; }
+			}
+			else
+			{
+				//H mode
+				c1[0] = ETC_BITS(hi,27,4), c1[1] = (ETC_BITS(hi,24,3) << 1) | ETC_BITS(hi,20,1), c1[2] = (ETC_BITS(hi,19,1) << 3) | ETC_BITS(hi,15,3);
+				c2[0] = ETC_BITS(hi,11,4), c2[1] = ETC_BITS(hi,7,4), c2[2] = ETC_BITS(hi,3,4);
+				d = Distances[(ETC_BITS(hi,2,1) << 2) | (ETC_BITS(hi,0,1) << 1) | (((c1[0]<<8)|(c1[1]<<4)|c1[2]) >= ((c2[0]<<8)|(c2[1]<<4)|c2[2]) ? 1 : 0)];
+				for (k = 0; k != 3; k++) { c[0][k] = c1[k]*17 + d; c[1][k] = c1[k]*17 - d; c[2][k] = c2[k]*17 + d; c[3][k] = c2[k]*17 - d; }
+			}
+			for (y = 0; y != 4; y++) for (x = 0; x != 4; x++)
+			{
+				i = x*4+y;
+				int* p = c[(ETC_BITS(lo,i+16,1) << 1) | ETC_BITS(lo,i,1)];
+				unsigned char* o = out + (y*4+x)*4;
+				o[0] = KTXClamp(p[0]), o[1] = KTXClamp(p[1]), o[2] = KTXClamp(p[2]), o[3] = 255;
+			}
+			return;
+		}
+		if (etc2 && (b2 < 0 || b2 > 31))
+		{
+			//Planar mode
+			int o[3], h[3], v[3];
+			o[0] = ETC_BITS(hi,25,6), o[1] = (ETC_BITS(hi,24,1) << 6) | ETC_BITS(hi,17,6), o[2] = (ETC_BITS(hi,16,1) << 5) | (ETC_BITS(hi,11,2) << 3) | ETC_BITS(hi,7,3);
+			h[0] = (ETC_BITS(hi,2,5) << 1) | ETC_BITS(hi,0,1), h[1] = ETC_BITS(lo,25,7), h[2] = ETC_BITS(lo,19,6);
+			v[0] = ETC_BITS(lo,13,6), v[1] = ETC_BITS(lo,6,7), v[2] = ETC_BITS(lo,0,6);
+			o[0] = (o[0] << 2) | (o[0] >> 4), o[1] = (o[1] << 1) | (o[1] >> 6), o[2] = (o[2] << 2) | (o[2] >> 4);
+			h[0] = (h[0] << 2) | (h[0] >> 4), h[1] = (h[1] << 1) | (h[1] >> 6), h[2] = (h[2] << 2) | (h[2] >> 4);
+			v[0] = (v[0] << 2) | (v[0] >> 4), v[1] = (v[1] << 1) | (v[1] >> 6), v[2] = (v[2] << 2) | (v[2] >> 4);
+			for (y = 0; y != 4; y++) for (x = 0; x != 4; x++)
+			{
+				unsigned char* p = out + (y*4+x)*4;
+				for (k = 0; k != 3; k++) p[k] = KTXClamp((x * (h[k] - o[k]) + y * (v[k] - o[k]) + 4 * o[k] + 2) >> 2);
+				p[3] = 255;
+			}
+			return;
+		}
+		c[0][0] = (r << 3) | (r >> 2), c[0][1] = (g << 3) | (g >> 2), c[0][2] = (bl << 3) | (bl >> 2);
+		c[1][0] = (r2 << 3) | (r2 >> 2), c[1][1] = (g2 << 3) | (g2 >> 2), c[1][2] = (b2 << 3) | (b2 >> 2);
+	}
+	else
+	{
+		c[0][0] = ETC_BITS(hi,28,4) * 17, c[0][1] = ETC_BITS(hi,20,4) * 17, c[0][2] = ETC_BITS(hi,12,4) * 17;
+		c[1][0] = ETC_BITS(hi,24,4) * 17, c[1][1] = ETC_BITS(hi,16,4) * 17, c[1][2] = ETC_BITS(hi,8,4) * 17;
+	}
+	const int *mods[2] = { Modifiers[ETC_BITS(hi,5,3)], Modifiers[ETC_BITS(hi,2,3)] };
+	for (y = 0; y != 4; y++) for (x = 0; x != 4; x++)
+	{
+		i = x*4+y;
+		int sub = ((hi & 1) ? (y >= 2) : (x >= 2)), idx = (ETC_BITS(lo,i+16,1) << 1) | ETC_BITS(lo,i,1), m = mods[sub][idx & 1] * ((idx & 2) ? -1 : 1);
+		unsigned char* p = out + (y*4+x)*4;
+		p[0] = KTXClamp(c[sub][0] + m), p[1] = KTXClamp(c[sub][1] + m), p[2] = KTXClamp(c[sub][2] + m), p[3] = 255;
+	}
+	#undef ETC_BITS
+}
+
+//Decodes an EAC block into the alpha channel of 4x4 RGBA pixels
+static void DecodeEACAlphaBlock(const unsigned char* b, unsigned char* out)
+{
+	static const signed char Tables[16][8] = {
+		{-3,-6,-9,-15,2,5,8,14}, {-3,-7,-10,-13,2,6,9,12}, {-2,-5,-8,-13,1,4,7,12}, {-2,-4,-6,-13,1,3,5,12},
+		{-3,-6,-8,-12,2,5,7,11}, {-3,-7,-9,-11,2,6,8,10}, {-4,-7,-8,-11,3,6,7,10}, {-3,-5,-8,-11,2,4,7,10},
+		{-2,-6,-8,-10,1,5,7,9}, {-2,-5,-8,-10,1,4,7,9}, {-2,-4,-8,-10,1,3,7,9}, {-2,-5,-7,-10,1,4,6,9},
+		{-3,-4,-7,-10,2,3,6,9}, {-1,-2,-3,-10,0,1,2,9}, {-4,-6,-8,-9,3,5,7,8}, {-3,-5,-7,-9,2,4,6,8} };
+	int base = b[0], mul = b[1] >> 4;
+	const signed char* table = Tables[b[1] & 15];
+	unsigned long long bits = ((unsigned long long)KTXRead32(b, true) << 32) | KTXRead32(b+4, true);
+	for (int i = 0; i != 16; i++)
+		out[((i&3)*4+(i>>2))*4+3] = KTXClamp(base + table[(bits >> (45 - i*3)) & 7] * mul);
+}
+
+//Decodes the color part of a BC1/BC2/BC3 block into 4x4 RGBA pixels
+static void DecodeBC1Block(const unsigned char* b, unsigned char* out, bool FourColors, bool Alpha1Bit)
+{
+	unsigned int c0 = b[0] | (b[1] << 8), c1 = b[2] | (b[3] << 8);
+	unsigned char pal[4][4];
+	pal[0][0] = (unsigned char)(((c0 >> 11) << 3) | (c0 >> 13)), pal[0][1] = (unsigned char)((((c0 >> 5) & 63) << 2) | ((c0 >> 9) & 3)), pal[0][2] = (unsigned char)(((c0 & 31) << 3) | ((c0 >> 2) & 7));
+	pal[1][0] = (unsigned char)(((c1 >> 11) << 3) | (c1 >> 13)), pal[1][1] = (unsigned char)((((c1 >> 5) & 63) << 2) | ((c1 >> 9) & 3)), pal[1][2] = (unsigned char)(((c1 & 31) << 3) | ((c1 >> 2) & 7));
+	pal[0][3] = pal[1][3] = pal[2][3] = pal[3][3] = 255;
+	for (int k = 0; k != 3; k++)
+	{
+		if (c0 > c1 || FourColors) { pal[2][k] = (unsigned char)((2*pal[0][k] + pal[1][k]) / 3); pal[3][k] = (unsigned char)((pal[0][k] + 2*pal[1][k]) / 3); }
+		else { pal[2][k] = (unsigned char)((pal[0][k] + pal[1][k]) / 2); pal[3][k] = 0; }
+	}
+	if (c0 <= c1 && !FourColors && Alpha1Bit) pal[3][3] = 0;
+	for (int i = 0; i != 16; i++)
+		memcpy(out + i*4, pal[(b[4 + (i>>2)] >> ((i&3)*2)) & 3], 4);
+}
+
+static void DecodeBC3AlphaBlock(const unsigned char* b, unsigned char* out)
+{
+	int a[8] = { b[0], b[1] };
+	for (int i = 1; i != 7; i++) a[i+1] = (a[0] > a[1] ? ((7-i)*a[0] + i*a[1]) / 7 : (i < 5 ? ((5-i)*a[0] + i*a[1]) / 5 : (i == 5 ? 0 : 255)));
+	unsigned long long bits = ((unsigned long long)KTXRead32(b+4) << 16) | (b[3] << 8) | b[2];
+	for (int i = 0; i != 16; i++) out[i*4+3] = (unsigned char)a[(bits >> (i*3)) & 7];
+}
+
+//Decodes the first mip level into an RGBA bitmap with the top row first
+static bool DecodeKTXImage(const ZL_KTXImage* ktx, ZL_BitmapSurface* surface, const char* filename)
+{
+	const ZL_KTXFormat& f = ktx->Format;
+	if (f.Codec == KTX_ASTC) { ZL_LOG1("TEXTURE", "Cannot load image file: %s (ASTC is not supported by the GPU and has no software decoder)", filename); return false; }
+	surface->w = ktx->w;
+	surface->h = ktx->h;
+	surface->BytesPerPixel = 4;
+	surface->pixels = (unsigned char*)malloc(ktx->w * ktx->h * 4);
+	if (f.Codec == KTX_RGBA8)
+	{
+		for (int y = 0; y != ktx->h; y++)
+			memcpy(surface->pixels + (ktx->BottomUp ? ktx->h - 1 - y : y) * ktx->w * 4, ktx->LevelData[0] + y * ktx->w * 4, ktx->w * 4);
+		return true;
+	}
+	const unsigned char* b = ktx->LevelData[0];
+	unsigned char block[16*4];
+	for (int by = 0; by < ktx->h; by += 4)
+	{
+		for (int bx = 0; bx < ktx->w; bx += 4, b += f.BlockBytes)
+		{
+			switch (f.Codec)
+			{
+				case KTX_ETC1:      DecodeETCBlock(b, block, false); break;
+				case KTX_ETC2_RGB:  DecodeETCBlock(b, block, true); break;
+				case KTX_ETC2_RGBA: DecodeETCBlock(b+8, block, true); DecodeEACAlphaBlock(b, block); break;
+				case KTX_BC1:       DecodeBC1Block(b, block, false, false); break;
+				case KTX_BC1A:      DecodeBC1Block(b, block, false, true); break;
+				case KTX_BC2:       DecodeBC1Block(b+8, block, true, false); for (int i = 0; i != 16; i++) block[i*4+3] = (unsigned char)(((b[i>>1] >> ((i&1)*4)) & 15) * 17); break;
+				case KTX_BC3:       DecodeBC1Block(b+8, block, true, false); DecodeBC3AlphaBlock(b, block); break;
+				default: break;
+			}
+			for (int y = 0, yEnd = ZL_Math::Min(4, ktx->h - by); y != yEnd; y++)
+			{
+				int row = (ktx->BottomUp ? ktx->h - 1 - by - y : by + y);
+				memcpy(surface->pixels + (row * ktx->w + bx) * 4, block + y*16, ZL_Math::Min(4, ktx->w - bx) * 4);
+			}
+		}
+	}
+	return true;
+}
+
+//Reverses the rows of BC1/BC2/BC3 blocks to turn a top row first image into OpenGL bottom row first order
+static bool FlipBCLevel(const ZL_KTXImage* ktx, unsigned char* data, int lw, int lh)
+{
+	if (lh > 4 && (lh & 3)) return false;
+	int BlocksX = (lw + 3) / 4, BlocksY = (lh + 3) / 4, n = ZL_Math::Min(lh, 4), pitch = BlocksX * ktx->Format.BlockBytes;
+	for (unsigned char *blk = data, *blkEnd = data + BlocksY * pitch; blk != blkEnd; blk += ktx->Format.BlockBytes)
+	{
+		unsigned char *c = blk + ktx->Format.BlockBytes - 8 + 4, t;
+		for (int r = 0; r < n/2; r++) { t = c[r]; c[r] = c[n-1-r]; c[n-1-r] = t; }
+		if (ktx->Format.Codec == KTX_BC2)
+			for (int r = 0; r < n/2; r++) for (int k = 0; k != 2; k++) { t = blk[r*2+k]; blk[r*2+k] = blk[(n-1-r)*2+k]; blk[(n-1-r)*2+k] = t; }
+		if (ktx->Format.Codec == KTX_BC3)
+		{
+			unsigned long long bits = ((unsigned long long)KTXRead32(blk+4) << 16) | (blk[3] << 8) | blk[2], flipped = bits;
+			for (int r = 0; r != n; r++) flipped = (flipped & ~(0xFFFull << ((n-1-r)*12))) | (((bits >> (r*12)) & 0xFFF) << ((n-1-r)*12));
+			for (int k = 0; k != 6; k++) blk[2+k] = (unsigned char)(flipped >> (k*8));
+		}
+	}
+	std::vector<unsigned char> row(pitch);
+	for (int by = 0; by < BlocksY/2; by++)
+	{
+		memcpy(&row[0], data + by * pitch, pitch);
+		memcpy(data + by * pitch, data + (BlocksY-1-by) * pitch, pitch);
+		memcpy(data + (BlocksY-1-by) * pitch, &row[0], pitch);
+	}
+	return true;
+}
+
+static bool IsCompressedFormatSupportedByGPU(GLenum glFormat)
+{
+	#if defined(ZL_VIDEO_DIRECT3D)
+	(void)glFormat;
+	return false;
+	#else
+	static std::vector<GLint> SupportedFormats;
+	static bool Queried = false;
+	if (!Queried)
+	{
+		GLint num = 0;
+		glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &num);
+		if (num > 0) { SupportedFormats.resize(num); glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, &SupportedFormats[0]); }
+		Queried = true;
+	}
+	for (std::vector<GLint>::iterator it = SupportedFormats.begin(); it != SupportedFormats.end(); ++it)
+		if ((GLenum)*it == glFormat) return true;
+	return false;
+	#endif
+}
+
+//Uploads the data with all its mip levels directly to the GPU, returns false if the format needs to be decoded in software
+static bool UploadKTXIntoTexture(ZL_Texture_Impl* t, const ZL_KTXImage* ktx, const char* filename)
+{
+	#if defined(ZL_VIDEO_DIRECT3D)
+	(void)t; (void)ktx; (void)filename;
+	return false;
+	#else
+	const ZL_KTXFormat& f = ktx->Format;
+	bool Uncompressed = (f.Codec == KTX_RGBA8);
+	if (!Uncompressed && !IsCompressedFormatSupportedByGPU(f.glUploadFormat)) return false;
+	bool FlipBlocks = (!ktx->BottomUp && (f.Codec == KTX_BC1 || f.Codec == KTX_BC1A || f.Codec == KTX_BC2 || f.Codec == KTX_BC3 || Uncompressed));
+	if (!ktx->BottomUp && (!FlipBlocks || (!Uncompressed && ktx->h > 4 && (ktx->h & 3))))
+	{
+		if (f.Codec == KTX_ASTC) { ZL_LOG1("TEXTURE", "Cannot load image file: %s (ASTC textures need to be stored with KTXorientation 'ru' with the first row at the bottom)", filename); return false; }
+		ZL_LOG1("TEXTURE", "Decoding compressed texture from file %s in software due to its row order - Image should be stored with KTXorientation 'ru' to be uploaded directly", filename);
+		return false;
+	}
+
+	GLint maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	int first = 0;
+	while (first + 1 < ktx->Levels && ((ktx->w >> first) > maxSize || (ktx->h >> first) > maxSize)) first++;
+	int w = ZL_Math::Max(ktx->w >> first, 1), h = ZL_Math::Max(ktx->h >> first, 1), levels = 0;
+	if (w > maxSize || h > maxSize || (Uncompressed && !OGL_ProbeTexture(w, h, maxSize, 4, GL_RGBA))) return false;
+
+	glGenTextures(1, &t->gltexid);
+	glBindTexture(GL_TEXTURE_2D, t->gltexid);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, t->filtermag);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	std::vector<unsigned char> flipped;
+	size_t bytes = 0;
+	for (int i = first; i != ktx->Levels; i++)
+	{
+		int lw = ZL_Math::Max(ktx->w >> i, 1), lh = ZL_Math::Max(ktx->h >> i, 1);
+		size_t size = (size_t)((lw + f.BlockW - 1) / f.BlockW) * ((lh + f.BlockH - 1) / f.BlockH) * f.BlockBytes;
+		const unsigned char* data = ktx->LevelData[i];
+		if (FlipBlocks)
+		{
+			flipped.assign(data, data + size);
+			if (Uncompressed) { ZL_BitmapSurface lvl = { 4, lw, lh, &flipped[0] }; FlipBitmapRows(&lvl); }
+			else if (!FlipBCLevel(ktx, &flipped[0], lw, lh)) break; //stop at the first mip level that can't be flipped
+			data = &flipped[0];
+		}
+		if (Uncompressed)
+		{
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glTexImage2D(GL_TEXTURE_2D, i - first, GL_RGBA, lw, lh, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		}
+		else glCompressedTexImage2D(GL_TEXTURE_2D, i - first, f.glUploadFormat, lw, lh, 0, (GLsizei)size, data);
+		bytes += size;
+		levels++;
+	}
+	int FullChainLevels = 1;
+	for (int lw = w, lh = h; lw > 1 || lh > 1; FullChainLevels++) { lw = ZL_Math::Max(lw >> 1, 1); lh = ZL_Math::Max(lh >> 1, 1); }
+	t->mipLevels = (levels == FullChainLevels && CanHaveMipmaps(w, h) ? levels - 1 : 0); //mipmaps are only used with a complete chain
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, MinFilterWithMipmaps(t->filtermin, t->mipLevels));
+	t->format = GL_RGBA;
+	t->w = t->wTex = t->wRep = w;
+	t->h = t->hTex = t->hRep = h;
+	SetTextureBytes(t, bytes);
+	return true;
+	#endif
+}
+
 static bool LoadBitmapData(ZL_BitmapSurface* surface, ZL_File_Impl* fileimpl, int RequestBytesPerPixel = 0)
 {
+	std::vector<unsigned char> ktxdata;
+	if (ReadKTXFile(fileimpl, ktxdata))
+	{
+		ZL_KTXImage ktx;
+		if (RequestBytesPerPixel && RequestBytesPerPixel != 4) { ZL_LOG2("TEXTURE", "Cannot load image file: %s (compressed textures can only be decoded to 4 bytes per pixel, not %d)", fileimpl->filename.c_str(), RequestBytesPerPixel); return false; }
+		return (ParseKTX(&ktx, &ktxdata[0], ktxdata.size(), fileimpl->filename.c_str()) && DecodeKTXImage(&ktx, surface, fileimpl->filename.c_str()));
+	}
 	surface->pixels = stbi_load_from_callbacks(&stbi_zlrwops_callbacks, fileimpl->src, &surface->w, &surface->h, &surface->BytesPerPixel, RequestBytesPerPixel);
 	if (!surface->pixels || !surface->w || !surface->h) { ZL_LOG2("TEXTURE", "Cannot load image file: %s (err: %s)", fileimpl->filename.c_str(), stbi_failure_reason()); return false; }
 	//ZL_LOG4("SURFACE", "Loaded bitmap: %s - x: %d - y: %d - bpp: %d", fileimpl->filename.c_str(), surface->w, surface->h, surface->BytesPerPixel);
 	return true;
 }
 
-static bool PrepareSurfaceData(ZL_Texture_Impl* t, ZL_BitmapSurface* surface, const char* filename)
+static bool PrepareSurfaceData(ZL_Texture_Impl* t, ZL_BitmapSurface* surface, const char* filename, bool flip = true)
 {
+	if (flip) FlipBitmapRows(surface);
 	int w = surface->w, h = surface->h, BytesPerPixel = surface->BytesPerPixel;
 	unsigned char* pixels = surface->pixels;
 
-	size_t pitch = w * BytesPerPixel;
-	unsigned char StackTempRow[1024], *TempRow = (pitch > 1024 ? (unsigned char*)malloc(pitch) : StackTempRow);
-	for (unsigned char *rowTop = pixels, *rowTopEnd = rowTop + (h/2)*pitch, *rowBottom = rowTop + (h-1)*pitch; rowTop != rowTopEnd; rowTop += pitch, rowBottom -= pitch)
-	{
-		memcpy(TempRow, rowTop, pitch);
-		memcpy(rowTop, rowBottom, pitch);
-		memcpy(rowBottom, TempRow, pitch);
-	}
-	if (pitch > 1024) free(TempRow);
-
 	int wTex = t->wRep = w;
 	int hTex = t->hRep = h;
 
@@ -189,11 +888,12 @@ static bool LoadSurfaceDataFromFile(ZL_Texture_Impl* t, const ZL_File& file, ZL_
 	return true;
 }
 
-static void LoadBitmapIntoTexture(ZL_Texture_Impl* t, ZL_BitmapSurface* surface)
+static void LoadBitmapIntoTexture(ZL_Texture_Impl* t, ZL_BitmapSurface* surface, const unsigned char* MipChain = NULL, int MipLevels = 0)
 {
+	t->mipLevels = (MipChain ? MipLevels : 0);
 	glGenTextures(1, &t->gltexid);
 	glBindTexture(GL_TEXTURE_2D, t->gltexid);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, t->filtermin);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, MinFilterWithMipmaps(t->filtermin, t->mipLevels));
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, t->filtermag);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -205,14 +905,51 @@ static void LoadBitmapIntoTexture(ZL_Texture_Impl* t, ZL_BitmapSurface* surface)
 	}
 	else
 		glTexImage2D(GL_TEXTURE_2D, 0, t->format, t->wTex, t->hTex, 0, t->format, GL_UNSIGNED_BYTE, surface->pixels);
+	size_t bytes = (size_t)t->wTex * t->hTex * surface->BytesPerPixel;
+	for (int i = 1, lw = t->wTex, lh = t->hTex; i <= t->mipLevels; i++)
+	{
+		lw = ZL_Math::Max(lw >> 1, 1), lh = ZL_Math::Max(lh >> 1, 1);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, (!(lw&7) ? 8 : (!(lw&3) ? 4 : (!(lw&1) ? 2 : 1))));
+		glTexImage2D(GL_TEXTURE_2D, i, t->format, lw, lh, 0, t->format, GL_UNSIGNED_BYTE, MipChain);
+		MipChain += (size_t)lw * lh * surface->BytesPerPixel;
+		bytes += (size_t)lw * lh * surface->BytesPerPixel;
+	}
+	SetTextureBytes(t, bytes);
+}
+
+//Generate the mipmap chain for a prepared surface if enabled and if the texture has no padding
+static unsigned char* GenerateMipChainForTexture(ZL_Texture_Impl* t, ZL_BitmapSurface* surface, int* out_levels)
+{
+	*out_levels = 0;
+	if (MipmapGenFilter == ZL_Surface::MIPMAP_NONE || t->w != t->wTex || t->h != t->hTex || !CanHaveMipmaps(t->wTex, t->hTex)) return NULL;
+	return GenerateMipChain(surface->pixels, surface->w, surface->h, surface->BytesPerPixel, MipmapGenFilter, MipmapGenGammaCorrect, out_levels);
+}
+
+static bool LoadKTXIntoTexture(ZL_Texture_Impl* t, const unsigned char* data, size_t size, const char* filename)
+{
+	ZL_KTXImage ktx;
+	if (!ParseKTX(&ktx, data, size, filename)) return false;
+	if (UploadKTXIntoTexture(t, &ktx, filename)) return true;
+	ZL_BitmapSurface surface;
+	if (!DecodeKTXImage(&ktx, &surface, filename)) return false;
+	bool res = PrepareSurfaceData(t, &surface, filename);
+	if (res) LoadBitmapIntoTexture(t, &surface);
+	free(surface.pixels);
+	return res;
 }
 
 static bool LoadFileIntoTexture(ZL_Texture_Impl* t, const ZL_File& file, ZL_BitmapSurface* out_surface = NULL)
 {
+	ZL_File_Impl* fileimpl = ZL_ImplFromOwner<ZL_File_Impl>(file);
+	std::vector<unsigned char> ktxdata;
+	if (!out_surface && fileimpl && ReadKTXFile(fileimpl, ktxdata)) return LoadKTXIntoTexture(t, &ktxdata[0], ktxdata.size(), fileimpl->filename.c_str());
 	ZL_BitmapSurface tmpSurface;
 	ZL_BitmapSurface* surface = (out_surface ? out_surface : &tmpSurface);
 	if (!LoadSurfaceDataFromFile(t, file, surface)) return false;
-	LoadBitmapIntoTexture(t, surface);
+	int MipLevels;
+	unsigned char* MipChain = GenerateMipChainForTexture(t, surface, &MipLevels);
+	LoadBitmapIntoTexture(t, surface, MipChain, MipLevels);
+	if (MipChain) free(MipChain);
 	if (!out_surface) free(surface->pixels);
 	return true;
 }
@@ -239,6 +976,7 @@ static void SetupFrameBuffer(ZL_Texture_Impl* t, int width, int height)
 	glBindFramebuffer(GL_FRAMEBUFFER, t->pFrameBuffer->glFB);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, t->gltexid, 0);
 	glBindFramebuffer(GL_FRAMEBUFFER, active_framebuffer);
+	SetTextureBytes(t, (size_t)t->w * t->h * GetFormatBytesPerPixel(t->format));
 }
 
 ZL_Texture_Impl* ZL_Texture_Impl::CreateFromBitmap(const unsigned char* pixels, int width, int height, int BytesPerPixel)
@@ -260,6 +998,7 @@ ZL_Texture_Impl* ZL_Texture_Impl::LoadTextureRef(const ZL_FileLink& file, ZL_Bit
 	if (it != pLoadedTextures->end())
 	{
 		it->second->AddRef();
+		it->second->Touch();
 		if (out_surface) LoadSurfaceDataFromFile(it->second, file.Open(), out_surface);
 		return it->second;
 	}
@@ -288,7 +1027,7 @@ ZL_Texture_Impl* ZL_Texture_Impl::GenerateTexture(int width, int height, bool us
 	return t;
 }
 
-ZL_Texture_Impl::ZL_Texture_Impl() : gltexid(0), wraps(GL_CLAMP_TO_EDGE), wrapt(GL_CLAMP_TO_EDGE), filtermin(GL_LINEAR), filtermag(GL_LINEAR), pFrameBuffer(NULL)
+ZL_Texture_Impl::ZL_Texture_Impl() : gltexid(0), wraps(GL_CLAMP_TO_EDGE), wrapt(GL_CLAMP_TO_EDGE), filtermin(GL_LINEAR), filtermag(GL_LINEAR), mipLevels(0), pFrameBuffer(NULL), GPUBytes(0), LastUsedFrame(ZL_Application::FrameCount), Evicted(false), Pinned(false), LoadFailed(false)
 {
 }
 
@@ -308,12 +1047,13 @@ ZL_Texture_Impl::~ZL_Texture_Impl()
 		delete pFrameBuffer;
 	}
 	if (gltexid) glDeleteTextures(1, &gltexid);
+	SetTextureBytes(this, 0);
 }
 
 void ZL_Texture_Impl::SetTextureFilter(GLint newfiltermin, GLint newfiltermag)
 {
 	glBindTexture(GL_TEXTURE_2D, gltexid);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filtermin = newfiltermin);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, MinFilterWithMipmaps(filtermin = newfiltermin, mipLevels));
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filtermag = newfiltermag);
 }
 
@@ -381,6 +1121,7 @@ void ZL_Texture_Impl::SetTextureWrap(GLint newwraps, GLint newwrapt)
 		ZLGLSL::_TEXTURE_PROGRAM_ACTIVATE();
 		glVertexAttrib4(ZLGLSL::ATTR_COLOR, 1, 1, 1, 1);
 		glUniformMatrix4v(ZLGLSL::UNI_MVP, 1, GL_FALSE, matrix);
+		ZLGLSL::MatrixDirty = false; //draw with the custom matrix
 		ZLGL_VERTEXTPOINTER(2, GL_SCALAR, 0, fullbox);
 		ZLGL_TEXCOORDPOINTER(2, GL_SCALAR, 0, fullbox);
 		glDrawArraysUnbuffered(GL_TRIANGLE_STRIP, 0, 4);
@@ -395,8 +1136,9 @@ void ZL_Texture_Impl::SetTextureWrap(GLint newwraps, GLint newwrapt)
 		glBindFramebuffer(GL_FRAMEBUFFER, active_framebuffer);
 		glDeleteFramebuffers(1, &glfb);
 		glDeleteTextures(1, &gltexid);
-		gltexid = gltexidfill; w = wTex; h = hTex;
+		gltexid = gltexidfill; w = wTex; h = hTex; mipLevels = 0;
 		if (pFrameBuffer) { pFrameBuffer->viewport[2] = wTex; pFrameBuffer->viewport[3] = hTex; }
+		SetTextureBytes(this, (size_t)wTex * hTex * GetFormatBytesPerPixel(format));
 	}
 	#endif
 	glBindTexture(GL_TEXTURE_2D, gltexid);
@@ -462,11 +1204,539 @@ ZL_BitmapSurface ZL_Texture_Impl::LoadBitmapSurface(const ZL_File& file, int Req
 	return res;
 }
 
+void ZL_Texture_Impl::SetMipmapGeneration(int Filter, bool GammaCorrect)
+{
+	if (Filter != ZL_Surface::MIPMAP_NONE) MipmapInitTables();
+	MipmapGenFilter = Filter;
+	MipmapGenGammaCorrect = GammaCorrect;
+}
+
+static void KTXWrite32(std::vector<unsigned char>& out, unsigned int v)
+{
+	unsigned char b[4] = { (unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24) };
+	out.insert(out.end(), b, b + 4);
+}
+
+bool ZL_Texture_Impl::SaveMipmappedKTX(const ZL_FileLink& ImgFile, const char* OutKTXFile, int Filter, bool GammaCorrect)
+{
+	ZL_BitmapSurface bmp = LoadBitmapSurface(ImgFile.Open(), 4);
+	if (!bmp.pixels) return false;
+	FlipBitmapRows(&bmp); //store with the bottom row first so it can be uploaded as is
+	MipmapInitTables();
+	int MipLevels;
+	unsigned char* MipChain = GenerateMipChain(bmp.pixels, bmp.w, bmp.h, 4, Filter, GammaCorrect, &MipLevels);
+
+	static const unsigned char Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+	static const char Orientation[] = "KTXorientation\0S=r,T=u"; //with the terminating zero this is 23 bytes, padded to 24
+	std::vector<unsigned char> out(Identifier, Identifier + 12);
+	unsigned int Header[13] = { 0x04030201, 0x1401, 1, 0x1908, 0x8058, 0x1908, (unsigned int)bmp.w, (unsigned int)bmp.h, 0, 0, 1, (unsigned int)(1 + MipLevels), 4 + 24 };
+	for (int i = 0; i != 13; i++) KTXWrite32(out, Header[i]);
+	KTXWrite32(out, sizeof(Orientation));
+	out.insert(out.end(), Orientation, Orientation + sizeof(Orientation));
+	out.push_back(0);
+	const unsigned char* lvl = bmp.pixels;
+	for (int i = 0, lw = bmp.w, lh = bmp.h; i <= MipLevels; i++, lw = ZL_Math::Max(lw >> 1, 1), lh = ZL_Math::Max(lh >> 1, 1))
+	{
+		KTXWrite32(out, (unsigned int)(lw * lh * 4));
+		out.insert(out.end(), lvl, lvl + lw * lh * 4);
+		lvl = (i ? lvl + lw * lh * 4 : MipChain);
+	}
+	free(bmp.pixels);
+	if (MipChain) free(MipChain);
+	return (ZL_File(OutKTXFile, "wb").SetContents(&out[0], out.size()) == out.size());
+}
+
+int ZL_Texture_Impl::GetFileFormatSupport(const ZL_FileLink& file)
+{
+	unsigned char header[64];
+	size_t size = file.Open().GetContents(header, sizeof(header));
+	if (!size) return 0;
+	ZL_KTXFormat f;
+	if (!GetKTXFormat(&f, header, size)) return 1;
+	if (f.Codec == KTX_UNSUPPORTED) return 0;
+	if (IsCompressedFormatSupportedByGPU(f.glUploadFormat)) return 2;
+	return (f.Codec == KTX_ASTC ? 0 : 1);
+}
+
+struct ZL_TextureAsyncLoad
+{
+	enum eState { QUEUED, DECODED, FAILED, UPLOADED } State;
+	ZL_Texture_Impl* tex;
+	ZL_FileLink file;
+	std::vector<unsigned char> FileData;
+	ZL_BitmapSurface Bitmap;
+	int MipFilter, MipLevels;
+	bool MipGammaCorrect;
+	unsigned char* MipChain;
+	struct Waiter { ZL_Surface_Impl* srf; ZL_Signal_v1<const ZL_Surface&> sigLoaded; };
+	std::vector<Waiter*> Waiters;
+	std::vector<ZL_Surface_Impl*> Surfaces; //all surfaces (not referenced) drawing the texture while it is pending, including clones and synchronously created ones
+};
+static std::vector<ZL_TextureAsyncLoad*>* pAsyncLoads = NULL;
+static ZL_MutexHandle AsyncLoadsMutex;
+static ticks_t AsyncUploadMaxTicks = 4;
+static size_t AsyncUploadMaxBytes = 4*1024*1024;
+
+static void AsyncDecode(void* p)
+{
+	//Runs on a worker thread, only decoding, flipping and generating mipmaps without any GL calls
+	ZL_TextureAsyncLoad* l = (ZL_TextureAsyncLoad*)p;
+	ZL_BitmapSurface bitmap;
+	bitmap.pixels = stbi_load_from_memory(&l->FileData[0], (int)l->FileData.size(), &bitmap.w, &bitmap.h, &bitmap.BytesPerPixel, 0);
+	if (bitmap.pixels) FlipBitmapRows(&bitmap);
+	int MipLevels = 0;
+	unsigned char* MipChain = (bitmap.pixels && CanHaveMipmaps(bitmap.w, bitmap.h) ? GenerateMipChain(bitmap.pixels, bitmap.w, bitmap.h, bitmap.BytesPerPixel, l->MipFilter, l->MipGammaCorrect, &MipLevels) : NULL);
+	ZL_MutexLock(AsyncLoadsMutex);
+	l->Bitmap = bitmap;
+	l->MipChain = MipChain;
+	l->MipLevels = MipLevels;
+	l->State = (bitmap.pixels ? ZL_TextureAsyncLoad::DECODED : ZL_TextureAsyncLoad::FAILED);
+	ZL_MutexUnlock(AsyncLoadsMutex);
+}
+
+static void AsyncUploadKeepAlive()
+{
+	if (pAsyncLoads->empty()) return;
+	ticks_t start = ZL_GetTicks();
+	size_t bytes = 0;
+	for (size_t i = 0; i < pAsyncLoads->size();)
+	{
+		ZL_TextureAsyncLoad* l = (*pAsyncLoads)[i];
+		ZL_MutexLock(AsyncLoadsMutex);
+		ZL_TextureAsyncLoad::eState State = l->State;
+		ZL_MutexUnlock(AsyncLoadsMutex);
+		if (State == ZL_TextureAsyncLoad::QUEUED) { i++; continue; }
+		if (bytes && (bytes >= AsyncUploadMaxBytes || ZL_GetTicks() - start >= AsyncUploadMaxTicks)) break; //upload at least one texture per frame
+		pAsyncLoads->erase(pAsyncLoads->begin() + i);
+
+		ZL_Texture_Impl* t = l->tex;
+		ZL_BitmapSurface decoded = l->Bitmap; //size and format before it gets prepared for the GPU
+		if (State == ZL_TextureAsyncLoad::UPLOADED) { }
+		else if (State == ZL_TextureAsyncLoad::DECODED && PrepareSurfaceData(t, &l->Bitmap, l->file.Name().c_str(), false))
+		{
+			//The mipmap chain is only valid if preparing the surface did not change its size or format
+			if (l->MipChain && (t->w != t->wTex || t->h != t->hTex || t->w != decoded.w || t->h != decoded.h || l->Bitmap.BytesPerPixel != decoded.BytesPerPixel)) { free(l->MipChain); l->MipChain = NULL; }
+			glDeleteTextures(1, &t->gltexid);
+			LoadBitmapIntoTexture(t, &l->Bitmap, l->MipChain, l->MipLevels);
+			t->SetTextureWrap(t->wraps, t->wrapt);
+			bytes += (size_t)t->wTex * t->hTex * l->Bitmap.BytesPerPixel * (l->MipChain ? 4 : 3) / 3;
+			t->LoadFailed = false;
+		}
+		else { ZL_LOG1("TEXTURE", "Cannot load image file: %s (keeping placeholder texture)", l->file.Name().c_str()); t->LoadFailed = true; }
+		if (l->Bitmap.pixels) free(l->Bitmap.pixels);
+		if (l->MipChain) free(l->MipChain);
+
+		//Preparing the data can change the texture size (power of two or size limit) so texture coordinates based on the placeholder need updating
+		for (std::vector<ZL_Surface_Impl*>::iterator it = l->Surfaces.begin(); it != l->Surfaces.end(); ++it)
+			if ((*it)->hasClipping) (*it)->CalcClippedTexCoordBoxAndContentSize();
+			else (*it)->CalcUnclippedTexCoordBoxAndContentSize();
+
+		for (std::vector<ZL_TextureAsyncLoad::Waiter*>::iterator it = l->Waiters.begin(); it != l->Waiters.end(); ++it)
+		{
+			ZL_Surface_Impl* srf = (*it)->srf;
+			(*it)->sigLoaded.call(ZL_ImplMakeOwner<ZL_Surface>(srf, true));
+			srf->DelRef();
+			delete *it;
+		}
+		t->DelRef();
+		delete l;
+	}
+}
+
+static void InitAsyncLoads()
+{
+	if (pAsyncLoads) return;
+	pAsyncLoads = new std::vector<ZL_TextureAsyncLoad*>();
+	ZL_MutexInit(AsyncLoadsMutex);
+	ZL_Application::sigKeepAlive.connect(&AsyncUploadKeepAlive);
+}
+
+//Give the texture a transparent 1x1 placeholder which is drawn until the decoded image gets uploaded
+static void SetupPlaceholderTexture(ZL_Texture_Impl* t)
+{
+	static const unsigned char Transparent[4] = { 0, 0, 0, 0 };
+	glGenTextures(1, &t->gltexid);
+	glBindTexture(GL_TEXTURE_2D, t->gltexid);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, t->filtermin);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, t->filtermag);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, Transparent);
+	t->mipLevels = 0;
+	SetTextureBytes(t, 4);
+}
+
+static ZL_TextureAsyncLoad* QueueAsyncLoad(ZL_Texture_Impl* t, const ZL_FileLink& file, std::vector<unsigned char>& FileData, bool IsKTX)
+{
+	ZL_TextureAsyncLoad* l = new ZL_TextureAsyncLoad();
+	l->State = (IsKTX ? ZL_TextureAsyncLoad::UPLOADED : ZL_TextureAsyncLoad::QUEUED);
+	l->tex = t;
+	l->file = file;
+	l->FileData.swap(FileData);
+	l->Bitmap.pixels = NULL;
+	l->MipFilter = MipmapGenFilter;
+	l->MipGammaCorrect = MipmapGenGammaCorrect;
+	l->MipChain = NULL;
+	l->MipLevels = 0;
+	t->AddRef(); //keep texture until upload
+	pAsyncLoads->push_back(l);
+	if (!IsKTX) ZL_JobQueue(AsyncDecode, l);
+	return l;
+}
+
+static bool IsAsyncLoading(ZL_Texture_Impl* t)
+{
+	if (pAsyncLoads)
+		for (std::vector<ZL_TextureAsyncLoad*>::iterator it = pAsyncLoads->begin(); it != pAsyncLoads->end(); ++it)
+			if ((*it)->tex == t) return true;
+	return false;
+}
+
+ZL_Surface_Impl* ZL_SurfaceLoadAsync(const ZL_FileLink& file)
+{
+	InitAsyncLoads();
+	if (!pLoadedTextures) pLoadedTextures = new std::map<ZL_FileLink, ZL_Texture_Impl*>();
+
+	ZL_TextureAsyncLoad* l = NULL;
+	ZL_Texture_Impl* t;
+	std::map<ZL_FileLink, ZL_Texture_Impl*>::iterator itTex = pLoadedTextures->find(file);
+	if (itTex != pLoadedTextures->end())
+	{
+		t = itTex->second;
+		t->AddRef();
+		t->Touch(); //reload if evicted by the texture memory budget
+		for (std::vector<ZL_TextureAsyncLoad*>::iterator it = pAsyncLoads->begin(); it != pAsyncLoads->end(); ++it)
+			if ((*it)->tex == t) { l = *it; break; }
+	}
+	else
+	{
+		//Read the file and its image header on the main thread so the surface gets its final size right away
+		std::vector<unsigned char> FileData;
+		int w, h, BytesPerPixel;
+		bool IsKTX = (file.Open().GetContents(FileData) >= 12 && IsKTXIdentifier(&FileData[0]));
+		if (!IsKTX && (FileData.empty() || !stbi_info_from_memory(&FileData[0], (int)FileData.size(), &w, &h, &BytesPerPixel)))
+		{
+			ZL_LOG2("TEXTURE", "Cannot load image file: %s (err: %s)", file.Name().c_str(), stbi_failure_reason());
+			return NULL;
+		}
+
+		t = new ZL_Texture_Impl();
+		if (IsKTX)
+		{
+			//Compressed textures need no decoding, upload right away and only delay the loaded signal to the next frame
+			if (!LoadKTXIntoTexture(t, &FileData[0], FileData.size(), file.Name().c_str())) { t->DelRef(); return NULL; }
+			FileData.clear();
+		}
+		else
+		{
+			t->format = GL_RGBA;
+			t->w = t->wTex = t->wRep = w;
+			t->h = t->hTex = t->hRep = h;
+			SetupPlaceholderTexture(t);
+		}
+		pLoadedTextures->operator[](file) = t;
+		l = QueueAsyncLoad(t, file, FileData, IsKTX);
+	}
+
+	ZL_Surface_Impl* srf = new ZL_Surface_Impl(t, false);
+	if (l)
+	{
+		ZL_TextureAsyncLoad::Waiter* w = new ZL_TextureAsyncLoad::Waiter();
+		w->srf = srf;
+		srf->AddRef(); //keep surface until upload
+		l->Waiters.push_back(w);
+	}
+	return srf;
+}
+
+ZL_Signal_v1<const ZL_Surface&>* ZL_SurfaceAsyncSignal(ZL_Surface_Impl* srf)
+{
+	if (pAsyncLoads)
+		for (std::vector<ZL_TextureAsyncLoad*>::iterator it = pAsyncLoads->begin(); it != pAsyncLoads->end(); ++it)
+			for (std::vector<ZL_TextureAsyncLoad::Waiter*>::iterator itw = (*it)->Waiters.begin(); itw != (*it)->Waiters.end(); ++itw)
+				if ((*itw)->srf == srf) return &(*itw)->sigLoaded;
+	return NULL;
+}
+
+void ZL_SurfaceAsyncTrack(ZL_Surface_Impl* srf, bool Track)
+{
+	if (!pAsyncLoads || pAsyncLoads->empty()) return;
+	for (std::vector<ZL_TextureAsyncLoad*>::iterator it = pAsyncLoads->begin(); it != pAsyncLoads->end(); ++it)
+	{
+		if ((*it)->tex != srf->tex) continue;
+		std::vector<ZL_Surface_Impl*>& s = (*it)->Surfaces;
+		if (Track) s.push_back(srf);
+		else s.erase(std::remove(s.begin(), s.end(), srf), s.end());
+		return;
+	}
+}
+
+void ZL_SurfaceAsyncSetBudget(ticks_t MaxTicksPerFrame, size_t MaxBytesPerFrame)
+{
+	AsyncUploadMaxTicks = MaxTicksPerFrame;
+	AsyncUploadMaxBytes = MaxBytesPerFrame;
+}
+
+bool ZL_Texture_Impl::Reload()
+{
+	//Called by Touch on an evicted texture, the metadata (size, format, filter and wrap modes) stayed and only the GL texture needs to be recreated
+	Evicted = false;
+	TextureReloads++;
+	std::map<ZL_FileLink, ZL_Texture_Impl*>::iterator it;
+	for (it = pLoadedTextures->begin(); it != pLoadedTextures->end(); ++it)
+		if (it->second == this) break;
+	if (it == pLoadedTextures->end()) return false;
+	if (TextureBudgetAsyncReload)
+	{
+		//Decode in the background while drawing a transparent placeholder, compressed textures need no decoding and get reloaded right away
+		std::vector<unsigned char> FileData;
+		if (it->first.Open().GetContents(FileData) >= 12 && !IsKTXIdentifier(&FileData[0]))
+		{
+			InitAsyncLoads();
+			SetupPlaceholderTexture(this);
+			QueueAsyncLoad(this, it->first, FileData, false);
+			return true;
+		}
+	}
+	if (!LoadFileIntoTexture(this, it->first.Open())) return false;
+	SetTextureWrap(wraps, wrapt);
+	return true;
+}
+
+static bool SortByLastUsedFrame(ZL_Texture_Impl* a, ZL_Texture_Impl* b) { return a->LastUsedFrame < b->LastUsedFrame; }
+
+static void TextureBudgetKeepAlive()
+{
+	if (!TextureBudgetMaxBytes || TextureResidentBytes <= TextureBudgetMaxBytes || !pLoadedTextures) return;
+	std::vector<ZL_Texture_Impl*> Candidates;
+	for (std::map<ZL_FileLink, ZL_Texture_Impl*>::iterator it = pLoadedTextures->begin(); it != pLoadedTextures->end(); ++it)
+	{
+		ZL_Texture_Impl* t = it->second;
+		if (!t->gltexid || t->Pinned || t->pFrameBuffer || ZL_Application::FrameCount - t->LastUsedFrame <= TextureBudgetMinUnusedFrames || IsAsyncLoading(t)) continue;
+		Candidates.push_back(t);
+	}
+	std::sort(Candidates.begin(), Candidates.end(), SortByLastUsedFrame);
+	for (std::vector<ZL_Texture_Impl*>::iterator it = Candidates.begin(); it != Candidates.end() && TextureResidentBytes > TextureBudgetMaxBytes; ++it)
+	{
+		ZL_Texture_Impl* t = *it;
+		glDeleteTextures(1, &t->gltexid);
+		t->gltexid = 0;
+		t->Evicted = true;
+		SetTextureBytes(t, 0);
+		TextureEvictions++;
+	}
+}
+
+void ZL_Texture_Impl::SetMemoryBudget(size_t MaxBytes, unsigned int MinUnusedFrames, bool AsyncReload)
+{
+	static bool KeepAliveConnected = false;
+	if (!KeepAliveConnected) { ZL_Application::sigKeepAlive.connect(&TextureBudgetKeepAlive); KeepAliveConnected = true; }
+	TextureBudgetMaxBytes = MaxBytes;
+	TextureBudgetMinUnusedFrames = MinUnusedFrames;
+	TextureBudgetAsyncReload = AsyncReload;
+}
+
+void ZL_Texture_Impl::GetMemoryStats(size_t* ResidentBytes, size_t* BudgetBytes, unsigned int* EvictedTextures, unsigned int* Evictions, unsigned int* Reloads)
+{
+	*ResidentBytes = TextureResidentBytes;
+	*BudgetBytes = TextureBudgetMaxBytes;
+	*EvictedTextures = 0;
+	if (pLoadedTextures)
+		for (std::map<ZL_FileLink, ZL_Texture_Impl*>::iterator it = pLoadedTextures->begin(); it != pLoadedTextures->end(); ++it)
+			if (it->second->Evicted) (*EvictedTextures)++;
+	*Evictions = TextureEvictions;
+	*Reloads = TextureReloads;
+}
+
+struct ZL_TextureReadback
+{
+	int w, h;
+	unsigned char* pixels;
+	#ifdef ZL_VIDEO_GL_ASYNC_READBACK
+	GLuint pbo;
+	GLsync fence;
+	#endif
+	void (*funcDone)(ZL_TextureReadback* r); //can take ownership of pixels by setting it to NULL
+	ZL_String OutFile;
+	ZL_Signal_v3<const unsigned char*, int, int> sigDone;
+};
+static std::vector<ZL_TextureReadback*>* pReadbacks = NULL, *pScreenReadbacks = NULL; //started and waiting for the end of the frame
+static ZL_String FrameCapturePrefix;
+static unsigned int FrameCaptureEveryNth = 0, FrameCaptureCounter = 0, FrameCaptureIndex = 0;
+
+static void ReadbackKeepAlive();
+
+static ZL_TextureReadback* ReadbackNew()
+{
+	ZL_TextureReadback* r = new ZL_TextureReadback();
+	r->w = r->h = 0; r->pixels = NULL; r->funcDone = NULL;
+	return r;
+}
+
+static ZL_TextureReadback* ReadbackStart(GLuint glFB, int x, int y, int w, int h, bool Queue, ZL_TextureReadback* r = ReadbackNew())
+{
+	r->w = w; r->h = h;
+	glBindFramebuffer(GL_FRAMEBUFFER, glFB);
+	#ifdef ZL_VIDEO_GL_ASYNC_READBACK
+	r->pbo = 0; r->fence = NULL;
+	if (glFenceSync)
+	{
+		//read into a pixel buffer object which returns immediately, the copy to client memory happens after the fence signals
+		glGenBuffers(1, &r->pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)w * h * 4, NULL, GL_STREAM_READ);
+		glReadPixels(x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		r->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	else
+	#endif
+	{
+		//glReadPixels on OpenGLES is limited to RGBA reads only!
+		r->pixels = (unsigned char*)malloc(w * h * 4);
+		glReadPixels(x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, r->pixels);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, active_framebuffer);
+	if (Queue)
+	{
+		if (!pReadbacks) { pReadbacks = new std::vector<ZL_TextureReadback*>(); ZL_Application::sigKeepAlive.connect(&ReadbackKeepAlive); }
+		pReadbacks->push_back(r);
+	}
+	return r;
+}
+
+static bool ReadbackPoll(ZL_TextureReadback* r, bool Wait)
+{
+	#ifdef ZL_VIDEO_GL_ASYNC_READBACK
+	if (r->fence)
+	{
+		GLenum res = glClientWaitSync(r->fence, GL_SYNC_FLUSH_COMMANDS_BIT, (Wait ? (GLuint64)1000000000 : 0));
+		if (res == GL_TIMEOUT_EXPIRED && !Wait) return false;
+		glDeleteSync(r->fence);
+		r->fence = NULL;
+		r->pixels = (unsigned char*)malloc(r->w * r->h * 4);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, r->pbo);
+		glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)r->w * r->h * 4, r->pixels);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glDeleteBuffers(1, &r->pbo);
+		r->pbo = 0;
+	}
+	#else
+	(void)Wait;
+	#endif
+	return true;
+}
+
+static void ReadbackKeepAlive()
+{
+	for (std::vector<ZL_TextureReadback*>::iterator it = pReadbacks->begin(); it != pReadbacks->end();)
+	{
+		ZL_TextureReadback* r = *it;
+		if (!ReadbackPoll(r, false)) { ++it; continue; }
+		it = pReadbacks->erase(it);
+		r->sigDone.call(r->pixels, r->w, r->h);
+		if (r->funcDone) r->funcDone(r);
+		if (r->pixels) free(r->pixels);
+		delete r;
+	}
+}
+
+static void ReadbackWriteTGA(void* p)
+{
+	ZL_TextureReadback* r = (ZL_TextureReadback*)p;
+	unsigned char hdr[18] = { 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, (unsigned char)(r->w & 0xFF), (unsigned char)(r->w >> 8), (unsigned char)(r->h & 0xFF), (unsigned char)(r->h >> 8), 32, 8 };
+	size_t size = (size_t)r->w * r->h * 4;
+	unsigned char* tga = (unsigned char*)malloc(18 + size);
+	memcpy(tga, hdr, 18);
+	//uncompressed TGA is stored BGRA with the bottom row first which matches the row order of glReadPixels
+	for (unsigned char *s = r->pixels, *sEnd = s + size, *d = tga + 18; s != sEnd; s += 4, d += 4) { d[0] = s[2]; d[1] = s[1]; d[2] = s[0]; d[3] = s[3]; }
+	ZL_File(r->OutFile.c_str(), "wb").SetContents(tga, 18 + size);
+	free(tga);
+	free(r->pixels);
+	delete r;
+}
+
+static void ReadbackDoneWriteTGA(ZL_TextureReadback* r)
+{
+	if (!r->pixels) return;
+	ZL_TextureReadback* job = ReadbackNew();
+	job->w = r->w; job->h = r->h; job->pixels = r->pixels; job->OutFile = r->OutFile;
+	r->pixels = NULL;
+	ZL_JobQueue(ReadbackWriteTGA, job);
+}
+
+static void FrameCaptureAfterFrame()
+{
+	if (pScreenReadbacks)
+	{
+		for (std::vector<ZL_TextureReadback*>::iterator it = pScreenReadbacks->begin(); it != pScreenReadbacks->end(); ++it)
+			ReadbackStart(window_framebuffer, window_viewport[0], window_viewport[1], window_viewport[2], window_viewport[3], true, *it);
+		pScreenReadbacks->clear();
+	}
+	if (FrameCaptureEveryNth && ++FrameCaptureCounter >= FrameCaptureEveryNth)
+	{
+		FrameCaptureCounter = 0;
+		ZL_TextureReadback* r = ReadbackStart(window_framebuffer, window_viewport[0], window_viewport[1], window_viewport[2], window_viewport[3], true);
+		r->OutFile = ZL_String::format("%s%05u.tga", FrameCapturePrefix.c_str(), FrameCaptureIndex++);
+		r->funcDone = ReadbackDoneWriteTGA;
+	}
+}
+
+ZL_Signal_v3<const unsigned char*, int, int>& ZL_Texture_Impl::ReadPixelsAsync()
+{
+	GLuint glFB = 0;
+	if (pFrameBuffer) glFB = pFrameBuffer->glFB;
+	else
+	{
+		//attach the texture to a temporary framebuffer to be able to read from it
+		glGenFramebuffers(1, &glFB);
+		glBindFramebuffer(GL_FRAMEBUFFER, glFB);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, Use(), 0);
+	}
+	ZL_TextureReadback* r = ReadbackStart(glFB, 0, 0, wRep, hRep, true);
+	if (!pFrameBuffer) glDeleteFramebuffers(1, &glFB);
+	return r->sigDone;
+}
+
+static ZL_TextureReadback* QueueScreenReadback()
+{
+	//the read gets started after the current frame has been drawn completely
+	if (!pScreenReadbacks) pScreenReadbacks = new std::vector<ZL_TextureReadback*>();
+	ZL_TextureReadback* r = ReadbackNew();
+	pScreenReadbacks->push_back(r);
+	funcFrameCapture = FrameCaptureAfterFrame;
+	return r;
+}
+
+ZL_Signal_v3<const unsigned char*, int, int>& ZL_Texture_Impl::ReadScreenPixelsAsync()
+{
+	return QueueScreenReadback()->sigDone;
+}
+
+void ZL_Texture_Impl::SaveScreenshot(const char* OutTGAFile)
+{
+	ZL_TextureReadback* r = QueueScreenReadback();
+	r->OutFile = OutTGAFile;
+	r->funcDone = ReadbackDoneWriteTGA;
+}
+
+void ZL_Texture_Impl::SetFrameCapture(const char* PathPrefix, unsigned int EveryNthFrame)
+{
+	FrameCapturePrefix = (PathPrefix ? PathPrefix : "");
+	FrameCaptureEveryNth = (PathPrefix && EveryNthFrame ? EveryNthFrame : 0);
+	FrameCaptureCounter = FrameCaptureEveryNth - 1; //capture starts with the next frame
+	FrameCaptureIndex = 0;
+	funcFrameCapture = FrameCaptureAfterFrame;
+}
+
 #ifdef ZL_VIDEO_WEAKCONTEXT
 #ifndef ZL_VIDEO_USE_GLSL
 bool CheckTexturesIfContextLost()
 {
-	return (pLoadedTextures && pLoadedTextures->size() && !glIsTexture(pLoadedTextures->begin()->second->gltexid));
+	if (pLoadedTextures)
+		for (std::map<ZL_FileLink, ZL_Texture_Impl*>::iterator it = pLoadedTextures->begin(); it != pLoadedTextures->end(); ++it)
+			if (it->second->gltexid) return !glIsTexture(it->second->gltexid);
+	return false;
 }
 #endif
 void RecreateAllTexturesOnContextLost()
@@ -477,6 +1747,7 @@ void RecreateAllTexturesOnContextLost()
 		ZL_LOG1("TEXTURE", "RecreateAllTexturesIfContextLost with %d textures to reload", pLoadedTextures->size());
 		for (std::map<ZL_FileLink, ZL_Texture_Impl*>::iterator it = pLoadedTextures->begin(); it != pLoadedTextures->end(); ++it)
 		{
+			if (it->second->Evicted) continue; //stays evicted until drawn again
 			ZL_LOG2("TEXTURE", "   Reload Tex ID: %d (%s)", it->second->gltexid, it->first.Name().c_str());
 			if (!LoadFileIntoTexture(it->second, it->first.Open())) continue;
 			it->second->SetTextureWrap(it->second->wraps, it->second->wrapt);
@@ -488,6 +1759,7 @@ void RecreateAllTexturesOnContextLost()
 		for (std::vector<ZL_Texture_Impl*>::iterator it = pLoadedFrameBufferTextures->begin(); it != pLoadedFrameBufferTextures->end(); ++it)
 		{
 			ZL_LOG4("TEXTURE", "   Reload Framebuffer Tex ID: %d (size: %d x %d - has buffer: %d)", (*it)->gltexid, (*it)->wRep, (*it)->hRep, ((*it)->pFrameBuffer->pStorePixelData != NULL));
+			if (!(*it)->pFrameBuffer->pStorePixelData) (*it)->pFrameBuffer->flags |= 2; //contents were not stored before the context got lost
 			SetupFrameBuffer(*it, (*it)->wRep, (*it)->hRep);
 			(*it)->SetTextureWrap((*it)->wraps, (*it)->wrapt);
 		}
@@ -497,15 +1769,21 @@ void StoreAllFrameBufferTexturesOnDeactivate()
 {
 	if (!pLoadedFrameBufferTextures) return;
 	ZL_LOG1("TEXTURE", "StoreAllFrameBufferTexturesOnDeactivate with %d framebuffer textures to store", pLoadedFrameBufferTextures->size());
-	for (std::vector<ZL_Texture_Impl*>::iterator it = pLoadedFrameBufferTextures->begin(); it != pLoadedFrameBufferTextures->end(); ++it)
+	//start all reads first so the GPU can process them together, then wait for each one
+	std::vector<ZL_TextureReadback*> reads(pLoadedFrameBufferTextures->size(), (ZL_TextureReadback*)NULL);
+	for (size_t i = 0; i != reads.size(); i++)
 	{
-		ZL_LOG4("TEXTURE", "Storing framebuffer textures with size %d x %d x %d bpp (has already: %d)", (*it)->wRep, (*it)->hRep, ((*it)->format == GL_RGBA ? 4 : 3), ((*it)->pFrameBuffer->pStorePixelData != NULL));
-		if ((*it)->pFrameBuffer->pStorePixelData) continue;
-		//glReadPixels on OpenGLES is limited to RGBA reads only!
-		(*it)->pFrameBuffer->pStorePixelData = malloc((*it)->wRep * (*it)->hRep * 4);
-		(*it)->FrameBufferBegin(false);
-		glReadPixels(0, 0, (*it)->wRep, (*it)->hRep, GL_RGBA, GL_UNSIGNED_BYTE, (*it)->pFrameBuffer->pStorePixelData);
-		(*it)->FrameBufferEnd();
+		ZL_Texture_Impl* t = (*pLoadedFrameBufferTextures)[i];
+		ZL_LOG4("TEXTURE", "Storing framebuffer textures with size %d x %d x %d bpp (has already: %d)", t->wRep, t->hRep, (t->format == GL_RGBA ? 4 : 3), (t->pFrameBuffer->pStorePixelData != NULL));
+		if (!t->pFrameBuffer->pStorePixelData) reads[i] = ReadbackStart(t->pFrameBuffer->glFB, 0, 0, t->wRep, t->hRep, false);
+	}
+	for (size_t i = 0; i != reads.size(); i++)
+	{
+		if (!reads[i]) continue;
+		std::vector<ZL_Texture_Impl*>::iterator it = pLoadedFrameBufferTextures->begin() + i;
+		ReadbackPoll(reads[i], true);
+		(*it)->pFrameBuffer->pStorePixelData = reads[i]->pixels;
+		delete reads[i];
 		if ((*it)->format == GL_RGB)
 		{
 			//realign RGBA to RGB
@@ -33,7 +33,7 @@ struct ZL_TextureFrameBuffer
 {
 	GLuint glFB;
 	int viewport[4];
-	unsigned char flags;
+	unsigned char flags; //1 = RenderToBegin with set2DOrtho, 2 = contents lost with the context
 	ZL_TextureFrameBuffer* pPrevFrameBuffer;
 	#ifdef ZL_VIDEO_WEAKCONTEXT
 	void *pStorePixelData;
@@ -54,7 +54,17 @@ struct ZL_Texture_Impl : ZL_Impl
 	int wTex, hTex; // The actual size of the OpenGL texture (it might differ, power of two etc.)
 	int wRep, hRep; // The size for GL_REPEAT wrap mode before the texture was resized to conform to power of two textures
 	GLint wraps, wrapt, filtermin, filtermag;
+	int mipLevels;  // The number of mipmap levels after the base level (0 if no mipmaps)
 	ZL_TextureFrameBuffer *pFrameBuffer;
+	size_t GPUBytes;            // Estimated video memory used by the texture including all mipmap levels
+	unsigned int LastUsedFrame; // Value of ZL_Application::FrameCount when it was last bound for drawing
+	bool Evicted, Pinned;       // Evicted by the texture memory budget (no GL texture until reloaded), pinned if contents were modified and can't be reloaded from the file
+	bool LoadFailed;            // Decoding of an asynchronously loaded image failed and the transparent placeholder stays
+
+	//Mark as used in this frame and reload if it was evicted, Touch returns true if the GL texture name changed
+	inline bool Touch() { LastUsedFrame = ZL_Application::FrameCount; return (Evicted && Reload()); }
+	inline GLuint Use() { Touch(); return gltexid; }
+	bool Reload();
 
 	static ZL_Texture_Impl* CreateFromBitmap(const unsigned char* pixels, int width, int height, int BytesPerPixel);
 	static ZL_Texture_Impl* LoadTextureRef(const ZL_FileLink& file, ZL_BitmapSurface* out_surface = NULL);
@@ -67,10 +77,22 @@ struct ZL_Texture_Impl : ZL_Impl
 	void FrameBufferEnd();
 
 	static ZL_BitmapSurface LoadBitmapSurface(const ZL_File& file, int RequestBytesPerPixel = 0);
+	static int GetFileFormatSupport(const ZL_FileLink& file); //0 = can't be loaded, 1 = gets decoded on the CPU, 2 = compressed format directly supported by the GPU
+	static void SetMipmapGeneration(int Filter, bool GammaCorrect);
+	static bool SaveMipmappedKTX(const ZL_FileLink& ImgFile, const char* OutKTXFile, int Filter, bool GammaCorrect);
+	static void SetMemoryBudget(size_t MaxBytes, unsigned int MinUnusedFrames, bool AsyncReload);
+	static void GetMemoryStats(size_t* ResidentBytes, size_t* BudgetBytes, unsigned int* EvictedTextures, unsigned int* Evictions, unsigned int* Reloads);
+
+	//Pixel readback through pixel buffer objects polled with fences where supported, the signal is called in a later frame with RGBA pixels (bottom row first)
+	ZL_Signal_v3<const unsigned char*, int, int>& ReadPixelsAsync();
+	static ZL_Signal_v3<const unsigned char*, int, int>& ReadScreenPixelsAsync();
+	static void SaveScreenshot(const char* OutTGAFile);
+	static void SetFrameCapture(const char* PathPrefix, unsigned int EveryNthFrame);
 
 private:
 	ZL_Texture_Impl();
 	~ZL_Texture_Impl();
+	friend struct ZL_Surface_Impl* ZL_SurfaceLoadAsync(const ZL_FileLink& file);
 };
 
 struct ZL_Surface_BatchRenderContext;
@@ -85,6 +107,7 @@ struct ZL_Surface_Impl : ZL_Impl
 	ZL_Origin::Type orDraw, orRotate;
 	ZL_Color color;
 	GLscalar TexCoordBox[8];
+	scalar ClipArea[4]; bool ClipInPixels; //clipping as set (left, top, right, bottom in pixels or left, low, right, high relative) to recalculate it when the texture size changes
 	ZL_Surface_Impl(ZL_Texture_Impl* tex, bool add_ref = true);
 	ZL_Surface_Impl(const ZL_Surface_Impl* src);
 	~ZL_Surface_Impl();
@@ -92,10 +115,19 @@ struct ZL_Surface_Impl : ZL_Impl
 	inline scalar GetHCH(const scalar scaleh) { return (fScaleH == scaleh ? fHCH : (fScaleH == -scaleh ? -fHCH : (hasClipping ? fHCH*scaleh/fScaleH : tex->h*scaleh*s(.5)))); }
 	void CalcContentSizes(const scalar scalew, const scalar scaleh);
 	void CalcUnclippedTexCoordBoxAndContentSize();
+	void CalcClippedTexCoordBoxAndContentSize();
+	inline void SetTileClipArea(int left, int top, int w, int h) { ClipInPixels = true; ClipArea[0] = s(left); ClipArea[1] = s(top); ClipArea[2] = s(left + w); ClipArea[3] = s(top + h); }
 	void CalcRotation(const scalar rotate);
+	void CalcQuad(scalar x, scalar y, const scalar rotate, const scalar hcw, const scalar hch, scalar rsin, scalar rcos, GLscalar* Quad) const; //corners in triangle strip order after applying draw origin and rotation
 	void Draw(scalar x, scalar y, const scalar rotate, const scalar hcw, const scalar hch, const scalar rsin, const scalar rcos, const ZL_Color &color);
 	void DrawTo(const scalar x1, const scalar y1, const scalar x2, const scalar y2, scalar scalew, scalar scaleh, const ZL_Color &color);
 	inline void DrawOrBatch(const ZL_Color &color, const GLscalar v1x, const GLscalar v1y, const GLscalar v2x, const GLscalar v2y, const GLscalar v3x, const GLscalar v3y, const GLscalar v4x, const GLscalar v4y, const GLscalar* texcoordbox);
 };
 
+//Asynchronous surface loading, decoding on worker threads and uploading on the main thread within a per frame budget
+ZL_Surface_Impl* ZL_SurfaceLoadAsync(const ZL_FileLink& file);
+ZL_Signal_v1<const struct ZL_Surface&>* ZL_SurfaceAsyncSignal(ZL_Surface_Impl* srf);
+void ZL_SurfaceAsyncTrack(ZL_Surface_Impl* srf, bool Track); //surfaces on a pending texture get their texture coordinates updated after the upload
+void ZL_SurfaceAsyncSetBudget(ticks_t MaxTicksPerFrame, size_t MaxBytesPerFrame);
+
 #endif //__ZL_TEXTURE_IMPL__
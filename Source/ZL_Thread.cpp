@@ -81,3 +81,46 @@ void ZL_Thread::Sleep(int ms)
 {
 	ZL_Delay(ms);
 }
+
+#ifndef __WEBAPP__
+#define ZL_JOBS_MAX_WORKERS 3
+struct ZL_JobWorker { ZL_ThreadHandle hthread; bool running, started; };
+struct ZL_Job { void (*func)(void*); void* data; };
+static std::vector<ZL_Job>* ZL_JobsQueued;
+static ZL_JobWorker ZL_JobsWorkers[ZL_JOBS_MAX_WORKERS];
+static ZL_MutexHandle ZL_JobsMutex;
+
+static void* ZL_JobsWorkerRun(void* p)
+{
+	for (ZL_Job job;;)
+	{
+		ZL_MutexLock(ZL_JobsMutex);
+		if (ZL_JobsQueued->empty()) { ((ZL_JobWorker*)p)->running = false; ZL_MutexUnlock(ZL_JobsMutex); return (void*)1; } //exit thread when idle, it gets restarted by ZL_JobQueue
+		job = ZL_JobsQueued->front();
+		ZL_JobsQueued->erase(ZL_JobsQueued->begin());
+		ZL_MutexUnlock(ZL_JobsMutex);
+		job.func(job.data);
+	}
+}
+
+void ZL_JobQueue(void (*func)(void*), void* data)
+{
+	if (!ZL_JobsQueued) { ZL_JobsQueued = new std::vector<ZL_Job>(); ZL_MutexInit(ZL_JobsMutex); }
+	ZL_Job job = { func, data };
+	ZL_JobWorker* start = NULL;
+	ZL_MutexLock(ZL_JobsMutex);
+	ZL_JobsQueued->push_back(job);
+	for (ZL_JobWorker* w = ZL_JobsWorkers; w != ZL_JobsWorkers + ZL_JOBS_MAX_WORKERS; w++)
+		if (!w->running) { start = w; start->running = true; break; }
+	ZL_MutexUnlock(ZL_JobsMutex);
+	if (!start) return;
+	if (start->started) { int status; ZL_WaitThread(start->hthread, &status); } //clean up the exited thread
+	start->started = true;
+	start->hthread = ZL_CreateThread(ZL_JobsWorkerRun, start);
+}
+#else
+void ZL_JobQueue(void (*func)(void*), void* data)
+{
+	func(data);
+}
+#endif
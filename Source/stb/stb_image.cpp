@@ -1,5 +1,11 @@
 #include "stb_image.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STBI_ZL_SSE2_TARGET //SSE2 is part of the target instruction set, no need for a runtime check
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(_MSC_VER) && !defined(STBI_NEON)
+#define STBI_NEON
+#elif !defined(STBI_NEON)
 #define STBI_NO_SIMD
+#endif
 #define STB_IMAGE_NO_FLIP_VERTICALLY_ON_LOAD
 #define STB_IMAGE_IMPLEMENTATION
 
@@ -366,11 +372,16 @@ typedef unsigned char validate_uint32[sizeof(stbi__uint32)==4 ? 1 : -1];
 #define STBI_NO_SIMD
 #endif
 
-#if !defined(STBI_NO_SIMD) && defined(STBI__X86_TARGET)
+#if !defined(STBI_NO_SIMD) && (defined(STBI__X86_TARGET) || defined(STBI__X64_TARGET))
 #define STBI_SSE2
 #include <emmintrin.h>
 
-#ifdef _MSC_VER
+#if defined(_MSC_VER) && defined(STBI_ZL_SSE2_TARGET)
+
+#define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
+static int stbi__sse2_available() { return 1; }
+
+#elif defined(_MSC_VER)
 
 #if _MSC_VER >= 1400  // not VC6
 #include <intrin.h> // __cpuid
@@ -405,7 +416,9 @@ static int stbi__sse2_available()
 
 static int stbi__sse2_available()
 {
-#if defined(__GNUC__) && (__GNUC__ * 100 + __GNUC_MINOR__) >= 408 // GCC 4.8 or later
+#if defined(STBI_ZL_SSE2_TARGET)
+   return 1;
+#elif defined(__GNUC__) && (__GNUC__ * 100 + __GNUC_MINOR__) >= 408 // GCC 4.8 or later
    // GCC 4.8+ has a nice way to do this
    return __builtin_cpu_supports("sse2");
 #else
@@ -3149,7 +3162,7 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 #ifndef STBI_NO_ZLIB
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
-#define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
+#define STBI__ZFAST_BITS  10 // accelerate all cases in default tables and most codes of dynamic tables
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 
 // zlib-style huffman encoding
@@ -3372,6 +3385,12 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
          if (dist == 1) { // run of one byte; common in images.
             stbi_uc v = *p;
             if (len) { do *zout++ = v; while (--len); }
+         } else if (dist >= 8 && a->zout_end - zout >= len + 8) {
+            // copy 8 bytes at a time, source never overlaps the chunk being written and
+            // the overshoot past len stays in the buffer and is overwritten by later output
+            char *zend = zout + len;
+            do { memcpy(zout, p, 8); zout += 8; p += 8; } while (zout < zend);
+            zout = zend;
          } else {
             if (len) { do *zout++ = *p++; while (--len); }
          }
@@ -3667,6 +3686,88 @@ static int stbi__paeth(int a, int b, int c)
    return c;
 }
 
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+// SIMD row unfilters for 8-bit images. Up has no dependency between bytes and runs 16 bytes
+// at a time. Sub, Avg and Paeth depend on the pixel to the left, so they reconstruct one whole
+// 3 or 4 byte pixel per step with its components widened to 16-bit lanes (same as libpng).
+#ifdef STBI_SSE2
+typedef __m128i stbi__pngpx;
+static stbi__pngpx stbi__pngpx_zero() { return _mm_setzero_si128(); }
+static stbi__pngpx stbi__pngpx_load(stbi_uc const *p, int n) { stbi__uint32 v = 0; memcpy(&v, p, n); return _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)v), _mm_setzero_si128()); }
+static void stbi__pngpx_store(stbi_uc *p, stbi__pngpx v, int n) { stbi__uint32 r = (stbi__uint32)_mm_cvtsi128_si32(_mm_packus_epi16(v, v)); memcpy(p, &r, n); }
+static stbi__pngpx stbi__pngpx_add(stbi__pngpx a, stbi__pngpx b) { return _mm_and_si128(_mm_add_epi16(a, b), _mm_set1_epi16(0xff)); }
+static stbi__pngpx stbi__pngpx_avg(stbi__pngpx a, stbi__pngpx b) { return _mm_srli_epi16(_mm_add_epi16(a, b), 1); }
+static stbi__pngpx stbi__pngpx_paeth(stbi__pngpx a, stbi__pngpx b, stbi__pngpx c)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i p = _mm_sub_epi16(b, c), q = _mm_sub_epi16(a, c), r = _mm_add_epi16(p, q);
+   __m128i pa = _mm_max_epi16(p, _mm_sub_epi16(zero, p)); // |(a+b-c)-a|
+   __m128i pb = _mm_max_epi16(q, _mm_sub_epi16(zero, q)); // |(a+b-c)-b|
+   __m128i pc = _mm_max_epi16(r, _mm_sub_epi16(zero, r)); // |(a+b-c)-c|
+   __m128i not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+   __m128i not_b = _mm_cmpgt_epi16(pb, pc);
+   __m128i bc = _mm_or_si128(_mm_and_si128(not_b, c), _mm_andnot_si128(not_b, b));
+   return _mm_or_si128(_mm_and_si128(not_a, bc), _mm_andnot_si128(not_a, a));
+}
+static void stbi__pngpx_up16(stbi_uc *cur, stbi_uc const *raw, stbi_uc const *prior)
+{
+   _mm_storeu_si128((__m128i *) cur, _mm_add_epi8(_mm_loadu_si128((__m128i const *) raw), _mm_loadu_si128((__m128i const *) prior)));
+}
+#else
+typedef int16x8_t stbi__pngpx;
+static stbi__pngpx stbi__pngpx_zero() { return vdupq_n_s16(0); }
+static stbi__pngpx stbi__pngpx_load(stbi_uc const *p, int n) { stbi__uint32 v = 0; memcpy(&v, p, n); return vreinterpretq_s16_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(v)))); }
+static void stbi__pngpx_store(stbi_uc *p, stbi__pngpx v, int n) { stbi__uint32 r = vget_lane_u32(vreinterpret_u32_u8(vmovn_u16(vreinterpretq_u16_s16(v))), 0); memcpy(p, &r, n); }
+static stbi__pngpx stbi__pngpx_add(stbi__pngpx a, stbi__pngpx b) { return vandq_s16(vaddq_s16(a, b), vdupq_n_s16(0xff)); }
+static stbi__pngpx stbi__pngpx_avg(stbi__pngpx a, stbi__pngpx b) { return vshrq_n_s16(vaddq_s16(a, b), 1); }
+static stbi__pngpx stbi__pngpx_paeth(stbi__pngpx a, stbi__pngpx b, stbi__pngpx c)
+{
+   int16x8_t p = vsubq_s16(b, c), q = vsubq_s16(a, c);
+   int16x8_t pa = vabsq_s16(p), pb = vabsq_s16(q), pc = vabsq_s16(vaddq_s16(p, q));
+   uint16x8_t not_a = vorrq_u16(vcgtq_s16(pa, pb), vcgtq_s16(pa, pc));
+   uint16x8_t not_b = vcgtq_s16(pb, pc);
+   return vbslq_s16(not_a, vbslq_s16(not_b, c, b), a);
+}
+static void stbi__pngpx_up16(stbi_uc *cur, stbi_uc const *raw, stbi_uc const *prior)
+{
+   vst1q_u8(cur, vaddq_u8(vld1q_u8(raw), vld1q_u8(prior)));
+}
+#endif
+
+// unfilter a complete row (not the first one) with Up (any n) or Sub, Avg or Paeth (n is 3 or 4)
+static void stbi__unfilter_row_simd(int filter, stbi_uc *cur, stbi_uc const *raw, stbi_uc const *prior, int n, stbi__uint32 width)
+{
+   stbi__uint32 i, k = 0, nk = width * n;
+   stbi__pngpx a = stbi__pngpx_zero(), b, c = stbi__pngpx_zero();
+   switch (filter) {
+      case STBI__F_up:
+         for (; k + 16 <= nk; k += 16) stbi__pngpx_up16(cur+k, raw+k, prior+k);
+         for (; k < nk; ++k) cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+         break;
+      case STBI__F_sub:
+         for (i=0; i < width; ++i, raw += n, cur += n) {
+            a = stbi__pngpx_add(stbi__pngpx_load(raw, n), a);
+            stbi__pngpx_store(cur, a, n);
+         }
+         break;
+      case STBI__F_avg:
+         for (i=0; i < width; ++i, raw += n, cur += n, prior += n) {
+            a = stbi__pngpx_add(stbi__pngpx_load(raw, n), stbi__pngpx_avg(a, stbi__pngpx_load(prior, n)));
+            stbi__pngpx_store(cur, a, n);
+         }
+         break;
+      case STBI__F_paeth:
+         for (i=0; i < width; ++i, raw += n, cur += n, prior += n) {
+            b = stbi__pngpx_load(prior, n);
+            a = stbi__pngpx_add(stbi__pngpx_load(raw, n), stbi__pngpx_paeth(a, b, c));
+            c = b;
+            stbi__pngpx_store(cur, a, n);
+         }
+         break;
+   }
+}
+#endif
+
 static stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
 // create the png data from post-deflated data
@@ -3677,6 +3778,11 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    stbi__uint32 img_len, img_width_bytes;
    int k;
    int img_n = s->img_n; // copy it into a local for later
+   #ifdef STBI_SSE2
+   int simd = (depth == 8 && img_n == out_n && stbi__sse2_available());
+   #elif defined(STBI_NEON)
+   int simd = (depth == 8 && img_n == out_n);
+   #endif
 
    STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
    a->out = (stbi_uc *) stbi__malloc(x * y * out_n); // extra bytes to write off the end into
@@ -3709,6 +3815,14 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       // if first row, use special filter that doesn't sample previous row
       if (j == 0) filter = first_row_filter[filter];
 
+      #if defined(STBI_SSE2) || defined(STBI_NEON)
+      if (simd && (filter == STBI__F_up || (img_n >= 3 && filter >= STBI__F_sub && filter <= STBI__F_paeth))) {
+         stbi__unfilter_row_simd(filter, cur, raw, prior, img_n, x);
+         raw += x*img_n;
+         continue;
+      }
+      #endif
+
       // handle first byte explicitly
       for (k=0; k < filter_bytes; ++k) {
          switch (filter) {